@@ -0,0 +1,815 @@
+// $Id$
+
+/**
+ * @file Benchmark harness for the PZX tools.
+ *
+ * Times the individual conversion stages in-process and reports the
+ * throughput of each of them as JSON.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "pzx.h"
+#include "tzx.h"
+#include "csw.h"
+#include "wav.h"
+
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+/**
+ * Global options.
+ */
+namespace {
+
+/**
+ * Default number of times each stage is repeated.
+ */
+const uint default_repeat_count = 5 ;
+
+/**
+ * Number of times each stage is repeated.
+ */
+uint option_repeat_count = default_repeat_count ;
+
+/**
+ * Sample rate used for WAV encoding.
+ */
+uint option_sample_rate = 44100 ;
+
+/**
+ * Maximum number of pulses in sequence used when packing pulses.
+ */
+const uint pack_sequence_limit = 2 ;
+
+} ;
+
+/**
+ * Timing results of single stage.
+ */
+struct Stage {
+
+    /**
+     * Name of the stage.
+     */
+    const char * name ;
+
+    /**
+     * Amount of bytes processed by the stage per run.
+     */
+    uquad byte_count ;
+
+    /**
+     * Amount of pulses processed by the stage per run.
+     */
+    uquad pulse_count ;
+
+    /**
+     * Duration of each run, in seconds.
+     */
+    std::vector< double > times ;
+
+    Stage( const char * const stage_name )
+        : name( stage_name )
+        , byte_count( 0 )
+        , pulse_count( 0 )
+    {
+    }
+} ;
+
+/**
+ * Span of pulses which come from the same PZX block.
+ */
+struct Span {
+
+    /**
+     * Index of the first pulse of the span.
+     */
+    uint start ;
+
+    /**
+     * Number of pulses in the span.
+     */
+    uint count ;
+
+    /**
+     * Level of the first pulse of the span.
+     */
+    bool level ;
+
+    /**
+     * Set if all pulses of the span fit in 16 bits, so they may be packed.
+     */
+    bool packable ;
+} ;
+
+/**
+ * Get current time in seconds.
+ */
+double get_time( void )
+{
+    timespec now ;
+    clock_gettime( CLOCK_MONOTONIC, &now ) ;
+    return now.tv_sec + now.tv_nsec * 1e-9 ;
+}
+
+/**
+ * Fetch value of specified type from given data block.
+ */
+template< typename Type >
+Type fetch( const byte * & data, uint & data_size )
+{
+    hope( data ) ;
+
+    if ( sizeof( Type ) > data_size ) {
+        fail( "incomplete block detected" ) ;
+    }
+
+    const Type value = little_endian( * reinterpret_cast< const Type * >( data ) ) ;
+
+    data += sizeof( Type ) ;
+    data_size -= sizeof( Type ) ;
+
+    return value ;
+}
+
+/**
+ * Skip given amount of bytes in given data block.
+ */
+void skip( const uint amount, const byte * & data, uint & data_size )
+{
+    hope( data ) ;
+
+    if ( amount > data_size ) {
+        fail( "incomplete block detected" ) ;
+    }
+
+    data += amount ;
+    data_size -= amount ;
+}
+
+/**
+ * Macros for convenient fetching of values from current block.
+ */
+//@{
+#define GET1()  fetch< u8 >( data, data_size )
+#define GET2()  fetch< u16 >( data, data_size )
+#define GET4()  fetch< u32 >( data, data_size )
+#define SKIP(n) skip( n, data, data_size )
+//@}
+
+/**
+ * Pulse stream collected from a PZX file.
+ */
+class PulseStream {
+
+    Buffer pulses ;
+    std::vector< Span > spans ;
+
+public:
+
+    PulseStream( void )
+        : pulses( 1024 * 1024 )
+    {
+    }
+
+    void clear( void )
+    {
+        pulses.clear() ;
+        spans.clear() ;
+    }
+
+    /**
+     * Start new span of pulses with given initial level.
+     */
+    void start_span( const bool initial_level )
+    {
+        Span span ;
+        span.start = get_pulse_count() ;
+        span.count = 0 ;
+        span.level = initial_level ;
+        span.packable = true ;
+        spans.push_back( span ) ;
+    }
+
+    /**
+     * Append pulse of given duration to current span.
+     */
+    inline void add_pulse( const uint duration )
+    {
+        pulses.write< u32 >( duration ) ;
+        Span & span = spans.back() ;
+        span.count++ ;
+        if ( duration > 0xFFFF ) {
+            span.packable = false ;
+        }
+    }
+
+    inline const u32 * get_pulses( void ) const
+    {
+        return pulses.get_typed_data< u32 >() ;
+    }
+
+    inline uint get_pulse_count( void ) const
+    {
+        return pulses.get_data_size() / sizeof( u32 ) ;
+    }
+
+    inline const std::vector< Span > & get_spans( void ) const
+    {
+        return spans ;
+    }
+} ;
+
+/**
+ * Collect pulses of given DATA block.
+ */
+void parse_data_block( PulseStream & stream, const byte * data, uint data_size )
+{
+    uint bit_count = GET4() ;
+    const uint tail_cycles = GET2() ;
+    const uint pulse_count_0 = GET1() ;
+    const uint pulse_count_1 = GET1() ;
+
+    const bool level = ( ( bit_count >> 31 ) != 0 ) ;
+
+    bit_count &= 0x7FFFFFFF ;
+
+    word sequence_0[ 256 ] ;
+    for ( uint i = 0 ; i < pulse_count_0 ; i++ ) {
+        sequence_0[ i ] = GET2() ;
+    }
+
+    word sequence_1[ 256 ] ;
+    for ( uint i = 0 ; i < pulse_count_1 ; i++ ) {
+        sequence_1[ i ] = GET2() ;
+    }
+
+    if ( data_size != ( ( bit_count + 7 ) / 8 ) ) {
+        fail( "bit count %u does not match the actual data size %u", bit_count, data_size ) ;
+    }
+
+    stream.start_span( level ) ;
+
+    for ( uint i = 0 ; i < bit_count ; i++ ) {
+        if ( ( data[ i / 8 ] << ( i % 8 ) ) & 0x80 ) {
+            for ( uint j = 0 ; j < pulse_count_1 ; j++ ) {
+                stream.add_pulse( sequence_1[ j ] ) ;
+            }
+        }
+        else {
+            for ( uint j = 0 ; j < pulse_count_0 ; j++ ) {
+                stream.add_pulse( sequence_0[ j ] ) ;
+            }
+        }
+    }
+
+    if ( tail_cycles > 0 ) {
+        stream.add_pulse( tail_cycles ) ;
+    }
+}
+
+/**
+ * Collect pulses of given PULS block.
+ */
+void parse_pulse_block( PulseStream & stream, const byte * data, uint data_size )
+{
+    stream.start_span( false ) ;
+
+    while ( data_size > 0 ) {
+        uint count = 1 ;
+        uint duration = GET2() ;
+        if ( duration > 0x8000 ) {
+            count = duration & 0x7FFF ;
+            duration = GET2() ;
+        }
+        if ( duration >= 0x8000 ) {
+            duration &= 0x7FFF ;
+            duration <<= 16 ;
+            duration |= GET2() ;
+        }
+        while ( count-- > 0 ) {
+            stream.add_pulse( duration ) ;
+        }
+    }
+}
+
+/**
+ * Collect pulses of entire PZX file stored in given memory block.
+ */
+void parse_pzx( PulseStream & stream, const byte * const start, const byte * const end )
+{
+    stream.clear() ;
+
+    const byte * block = start ;
+
+    while ( block < end ) {
+
+        const byte * data = block ;
+        uint data_size = uint( end - block ) ;
+
+        const uint tag = native_endian( GET4() ) ;
+        const uint size = GET4() ;
+
+        if ( size > data_size ) {
+            fail( "incomplete block detected" ) ;
+        }
+
+        data_size = size ;
+        block = data + size ;
+
+        switch ( tag ) {
+            case PZX_PULSES: {
+                parse_pulse_block( stream, data, data_size ) ;
+                break ;
+            }
+            case PZX_DATA: {
+                parse_data_block( stream, data, data_size ) ;
+                break ;
+            }
+            case PZX_PAUSE: {
+                const uint duration = GET4() ;
+                stream.start_span( ( duration >> 31 ) != 0 ) ;
+                stream.add_pulse( duration & 0x7FFFFFFF ) ;
+                break ;
+            }
+        }
+    }
+}
+
+/**
+ * Convert given TAP file to equivalent TZX file made of standard speed blocks.
+ */
+void convert_tap( Buffer & tape, const byte * data, uint data_size )
+{
+    tape.write( "ZXTape!\x1a", 8 ) ;
+    tape.write< u8 >( TZX_MAJOR ) ;
+    tape.write< u8 >( TZX_MINOR ) ;
+
+    while ( data_size > 0 ) {
+        const uint size = GET2() ;
+        const byte * const block = data ;
+        SKIP( size ) ;
+        tape.write< u8 >( TZX_NORMAL_BLOCK ) ;
+        tape.write_little< u16 >( 1000 ) ;
+        tape.write_little< u16 >( size ) ;
+        tape.write( block, size ) ;
+    }
+}
+
+/**
+ * Open the null device, used for output we don't care about.
+ */
+FILE * open_null_file( void )
+{
+    FILE * const file = fopen( "/dev/null", "wb" ) ;
+    if ( file == NULL ) {
+        fail( "unable to open null device" ) ;
+    }
+    return file ;
+}
+
+/**
+ * Render given memory tape of given type to PZX stored in given buffer.
+ */
+void render_tape( Buffer & output, const char * const type, const Buffer & tape )
+{
+    char * memory ;
+    size_t memory_size ;
+
+    FILE * const file = open_memstream( &memory, &memory_size ) ;
+    if ( file == NULL ) {
+        fail( "unable to open memory stream" ) ;
+    }
+
+    pzx_open( file ) ;
+
+    if ( std::strcmp( type, "csw" ) == 0 ) {
+        csw_render( tape.get_data(), tape.get_data_size() ) ;
+    }
+    else {
+        tzx_render( tape.get_data(), tape.get_data_end() ) ;
+    }
+
+    pzx_close() ;
+
+    if ( fclose( file ) != 0 ) {
+        fail( "error writing to memory stream" ) ;
+    }
+
+    output.clear() ;
+    output.write( memory, memory_size ) ;
+
+    std::free( memory ) ;
+}
+
+/**
+ * Pack pulses of given stream back to PZX written to given file.
+ */
+void pack_pulses( FILE * const file, const PulseStream & stream, const Buffer & words )
+{
+    pzx_open( file ) ;
+
+    const u32 * const pulses = stream.get_pulses() ;
+    const word * const packed_pulses = words.get_typed_data< word >() ;
+
+    const std::vector< Span > & spans = stream.get_spans() ;
+
+    for ( uint i = 0 ; i < spans.size() ; i++ ) {
+
+        const Span & span = spans[ i ] ;
+
+        if ( span.packable && span.count > 1 ) {
+            const word * const p = packed_pulses + span.start ;
+            if ( ! pzx_pack( p, span.count, span.level, pack_sequence_limit, 2, 0 ) ) {
+                pzx_pulses( p, span.count, span.level, 0 ) ;
+            }
+            continue ;
+        }
+
+        bool level = span.level ;
+        for ( uint j = 0 ; j < span.count ; j++ ) {
+            pzx_out( pulses[ span.start + j ], level ) ;
+            level = ! level ;
+        }
+    }
+
+    pzx_close() ;
+}
+
+/**
+ * Encode all pulses of given stream to WAV sample buffer.
+ */
+void encode_pulses( const PulseStream & stream )
+{
+    const u32 * const pulses = stream.get_pulses() ;
+
+    const std::vector< Span > & spans = stream.get_spans() ;
+
+    for ( uint i = 0 ; i < spans.size() ; i++ ) {
+        const Span & span = spans[ i ] ;
+        bool level = span.level ;
+        for ( uint j = 0 ; j < span.count ; j++ ) {
+            wav_out( pulses[ span.start + j ], level ) ;
+            level = ! level ;
+        }
+    }
+}
+
+/**
+ * Count the non-zero pulses of given stream.
+ */
+uquad count_pulses( const PulseStream & stream )
+{
+    const u32 * const pulses = stream.get_pulses() ;
+    const uint pulse_count = stream.get_pulse_count() ;
+
+    uquad count = 0 ;
+    for ( uint i = 0 ; i < pulse_count ; i++ ) {
+        count += ( pulses[ i ] > 0 ) ;
+    }
+    return count ;
+}
+
+/**
+ * Guess type of given tape file.
+ */
+const char * get_tape_type( const char * const name, const Buffer & tape )
+{
+    const uint size = tape.get_data_size() ;
+    const char * const data = reinterpret_cast< const char * >( tape.get_data() ) ;
+
+    if ( size >= 8 && std::memcmp( data, "ZXTape!\x1a", 8 ) == 0 ) {
+        return "tzx" ;
+    }
+    if ( size >= 23 && std::memcmp( data, "Compressed Square Wave\x1a", 23 ) == 0 ) {
+        return "csw" ;
+    }
+    if ( size >= 4 && std::memcmp( data, "PZXT", 4 ) == 0 ) {
+        return "pzx" ;
+    }
+
+    const uint length = std::strlen( name ) ;
+    if ( length >= 4 && std::strcmp( name + length - 4, ".tap" ) == 0 ) {
+        return "tap" ;
+    }
+
+    return NULL ;
+}
+
+/**
+ * Print statistics of given stage as JSON.
+ */
+void print_stage( FILE * const file, const Stage & stage, const bool last )
+{
+    const uint count = stage.times.size() ;
+
+    double sum = 0 ;
+    double min = 0 ;
+    double max = 0 ;
+
+    for ( uint i = 0 ; i < count ; i++ ) {
+        const double time = stage.times[ i ] ;
+        sum += time ;
+        if ( i == 0 || time < min ) {
+            min = time ;
+        }
+        if ( i == 0 || time > max ) {
+            max = time ;
+        }
+    }
+
+    const double mean = ( count > 0 ? sum / count : 0 ) ;
+
+    double variance = 0 ;
+    for ( uint i = 0 ; i < count ; i++ ) {
+        const double delta = stage.times[ i ] - mean ;
+        variance += delta * delta ;
+    }
+    if ( count > 1 ) {
+        variance /= ( count - 1 ) ;
+    }
+
+    const double megabytes_per_second = ( mean > 0 ? stage.byte_count / mean / 1e6 : 0 ) ;
+    const double pulses_per_second = ( mean > 0 ? stage.pulse_count / mean : 0 ) ;
+
+    fprintf( file, "        {\n" ) ;
+    fprintf( file, "          \"stage\": \"%s\",\n", stage.name ) ;
+    fprintf( file, "          \"bytes\": %llu,\n", stage.byte_count ) ;
+    fprintf( file, "          \"pulses\": %llu,\n", stage.pulse_count ) ;
+    fprintf( file, "          \"runs\": %u,\n", count ) ;
+    fprintf( file, "          \"mean\": %.6f,\n", mean ) ;
+    fprintf( file, "          \"min\": %.6f,\n", min ) ;
+    fprintf( file, "          \"max\": %.6f,\n", max ) ;
+    fprintf( file, "          \"variance\": %.9f,\n", variance ) ;
+    fprintf( file, "          \"stddev\": %.6f,\n", std::sqrt( variance ) ) ;
+    fprintf( file, "          \"mb_per_second\": %.3f,\n", megabytes_per_second ) ;
+    fprintf( file, "          \"pulses_per_second\": %.0f\n", pulses_per_second ) ;
+    fprintf( file, "        }%s\n", ( last ? "" : "," ) ) ;
+}
+
+/**
+ * Benchmark all stages of processing of given tape file, printing the results as JSON.
+ */
+void benchmark_file( FILE * const output_file, const char * const name, const bool last )
+{
+    Stage read_stage( "read" ) ;
+    Stage render_stage( "render" ) ;
+    Stage parse_stage( "parse" ) ;
+    Stage pack_stage( "pack" ) ;
+    Stage encode_stage( "encode" ) ;
+    Stage write_stage( "write" ) ;
+
+    Buffer tape ;
+    Buffer pzx ;
+    Buffer words ;
+    PulseStream stream ;
+
+    FILE * const null_file = open_null_file() ;
+
+    const char * type = NULL ;
+
+    for ( uint run = 0 ; run < option_repeat_count ; run++ ) {
+
+        // Read the entire file in.
+
+        double start = get_time() ;
+
+        FILE * const input_file = fopen( name, "rb" ) ;
+        if ( input_file == NULL ) {
+            fail( "unable to open input file %s", name ) ;
+        }
+
+        tape.clear() ;
+        if ( ! tape.read( input_file ) ) {
+            fail( "error reading input file %s", name ) ;
+        }
+
+        fclose( input_file ) ;
+
+        read_stage.times.push_back( get_time() - start ) ;
+        read_stage.byte_count = tape.get_data_size() ;
+
+        // Find out what it is. TAP files are rendered as equivalent TZX files.
+
+        if ( type == NULL ) {
+            type = get_tape_type( name, tape ) ;
+            if ( type == NULL ) {
+                fail( "unrecognized file type of %s", name ) ;
+            }
+        }
+
+        if ( std::strcmp( type, "tap" ) == 0 ) {
+            Buffer buffer ;
+            convert_tap( buffer, tape.get_data(), tape.get_data_size() ) ;
+            tape.clear() ;
+            tape.write( buffer.get_data(), buffer.get_data_size() ) ;
+        }
+
+        // Render it to PZX, unless it is PZX already.
+
+        if ( std::strcmp( type, "pzx" ) == 0 ) {
+            pzx.clear() ;
+            pzx.write( tape.get_data(), tape.get_data_size() ) ;
+        }
+        else {
+            start = get_time() ;
+            render_tape( pzx, type, tape ) ;
+            render_stage.times.push_back( get_time() - start ) ;
+            render_stage.byte_count = tape.get_data_size() ;
+        }
+
+        // Parse the PZX into the pulse stream.
+
+        start = get_time() ;
+        parse_pzx( stream, pzx.get_data(), pzx.get_data_end() ) ;
+        parse_stage.times.push_back( get_time() - start ) ;
+        parse_stage.byte_count = pzx.get_data_size() ;
+
+        // Prepare the 16 bit pulses for packing, outside of the timed section.
+
+        words.clear() ;
+        const u32 * const pulses = stream.get_pulses() ;
+        for ( uint i = 0 ; i < stream.get_pulse_count() ; i++ ) {
+            words.write< word >( word( pulses[ i ] ) ) ;
+        }
+
+        // Pack the pulses back to PZX.
+
+        start = get_time() ;
+        pack_pulses( null_file, stream, words ) ;
+        pack_stage.times.push_back( get_time() - start ) ;
+        pack_stage.byte_count = pzx.get_data_size() ;
+
+        // Encode the pulses as WAV samples. The WAV goes to a real temporary
+        // file, so the write stage includes the actual I/O cost.
+
+        FILE * const wav_file = tmpfile() ;
+        if ( wav_file == NULL ) {
+            fail( "unable to create temporary file" ) ;
+        }
+
+        start = get_time() ;
+        wav_open( wav_file, option_sample_rate, 3500000 ) ;
+        encode_pulses( stream ) ;
+        encode_stage.times.push_back( get_time() - start ) ;
+
+        // And finally write the WAV file out.
+
+        start = get_time() ;
+        wav_close() ;
+        if ( fflush( wav_file ) != 0 ) {
+            fail( "error writing to temporary file" ) ;
+        }
+        write_stage.times.push_back( get_time() - start ) ;
+
+        fclose( wav_file ) ;
+    }
+
+    fclose( null_file ) ;
+
+    // Fill in the pulse counts.
+
+    const uquad pulse_count = count_pulses( stream ) ;
+
+    render_stage.pulse_count = pulse_count ;
+    parse_stage.pulse_count = pulse_count ;
+    pack_stage.pulse_count = pulse_count ;
+    encode_stage.pulse_count = pulse_count ;
+    write_stage.pulse_count = pulse_count ;
+
+    // The WAV file has one byte per sample, plus the header.
+
+    uquad duration = 0 ;
+    for ( uint i = 0 ; i < stream.get_pulse_count() ; i++ ) {
+        duration += stream.get_pulses()[ i ] ;
+    }
+    write_stage.byte_count = 44 + duration * option_sample_rate / 3500000 ;
+    encode_stage.byte_count = write_stage.byte_count ;
+
+    // Print the results.
+
+    Stage * const stages[] = { &read_stage, &render_stage, &parse_stage, &pack_stage, &encode_stage, &write_stage } ;
+    const uint stage_count = sizeof( stages ) / sizeof( stages[ 0 ] ) ;
+
+    fprintf( output_file, "    {\n" ) ;
+    fprintf( output_file, "      \"file\": \"%s\",\n", name ) ;
+    fprintf( output_file, "      \"type\": \"%s\",\n", type ) ;
+    fprintf( output_file, "      \"size\": %llu,\n", read_stage.byte_count ) ;
+    fprintf( output_file, "      \"pzx_size\": %llu,\n", uquad( pzx.get_data_size() ) ) ;
+    fprintf( output_file, "      \"pulses\": %llu,\n", pulse_count ) ;
+    fprintf( output_file, "      \"stages\": [\n" ) ;
+
+    uint printed_count = 0 ;
+    uint used_count = 0 ;
+    for ( uint i = 0 ; i < stage_count ; i++ ) {
+        used_count += ( stages[ i ]->times.empty() ? 0 : 1 ) ;
+    }
+    for ( uint i = 0 ; i < stage_count ; i++ ) {
+        if ( stages[ i ]->times.empty() ) {
+            continue ;
+        }
+        print_stage( output_file, *stages[ i ], ++printed_count == used_count ) ;
+    }
+
+    fprintf( output_file, "      ]\n" ) ;
+    fprintf( output_file, "    }%s\n", ( last ? "" : "," ) ) ;
+}
+
+/**
+ * Benchmark processing of given tape files.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    // Parse the command line.
+
+    std::vector< const char * > input_names ;
+    const char * output_name = NULL ;
+
+    for ( int i = 1 ; i < argc ; i++ ) {
+        if ( argv[ i ][ 0 ] != '-' ) {
+            input_names.push_back( argv[ i ] ) ;
+            continue ;
+        }
+        switch ( argv[ i ][ 1 ] ) {
+            case 'o': {
+                if ( output_name ) {
+                    fail( "multiple output file names specified" ) ;
+                }
+                output_name = argv[ ++i ] ;
+                break ;
+            }
+            case 'r': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing repeat count" ) ;
+                }
+                option_repeat_count = uint( atoi( arg ) ) ;
+                if ( option_repeat_count == 0 ) {
+                    fail( "invalid repeat count %s", arg ) ;
+                }
+                break ;
+            }
+            case 's': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing sample rate" ) ;
+                }
+                option_sample_rate = uint( atoi( arg ) ) ;
+                if ( option_sample_rate == 0 ) {
+                    fail( "invalid sample rate %s", arg ) ;
+                }
+                break ;
+            }
+            default: {
+                fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
+
+                // Fall through.
+            }
+            case 'h': {
+                fprintf( stderr, "usage: pzxbench [-r n] [-s n] [-o output_file] input_file...\n" ) ;
+                fprintf( stderr, "-o f   write JSON report to given file instead of standard output\n" ) ;
+                fprintf( stderr, "-r n   repeat each stage given number of times (default %u)\n", default_repeat_count ) ;
+                fprintf( stderr, "-s n   use given sample rate for WAV encoding (default 44100)\n" ) ;
+                return EXIT_FAILURE ;
+            }
+        }
+    }
+
+    if ( input_names.empty() ) {
+        fail( "no input files specified" ) ;
+    }
+
+    // Open the output file.
+
+    FILE * const output_file = ( output_name ? fopen( output_name, "w" ) : stdout ) ;
+    if ( output_file == NULL ) {
+        fail( "unable to open output file" ) ;
+    }
+
+    // Benchmark all files.
+
+    fprintf( output_file, "{\n" ) ;
+    fprintf( output_file, "  \"repeat_count\": %u,\n", option_repeat_count ) ;
+    fprintf( output_file, "  \"sample_rate\": %u,\n", option_sample_rate ) ;
+    fprintf( output_file, "  \"files\": [\n" ) ;
+
+    for ( uint i = 0 ; i < input_names.size() ; i++ ) {
+        benchmark_file( output_file, input_names[ i ], i + 1 == input_names.size() ) ;
+        fflush( output_file ) ;
+    }
+
+    fprintf( output_file, "  ]\n" ) ;
+    fprintf( output_file, "}\n" ) ;
+
+    if ( ferror( output_file ) != 0 || fclose( output_file ) != 0 ) {
+        fail( "error while closing the output file" ) ;
+    }
+
+    return EXIT_SUCCESS ;
+}
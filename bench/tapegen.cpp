@@ -0,0 +1,783 @@
+// $Id$
+
+/**
+ * @file Synthetic tape file generator.
+ *
+ * Generates deterministic TZX, CSW, TAP, PZX and PZX text files of
+ * configurable size, for benchmarking and regression testing of the tools.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#ifndef NO_ZLIB
+#include <zlib.h>
+#endif
+
+#include "pzx.h"
+#include "tap.h"
+#include "tzx.h"
+
+#include <cstring>
+
+/**
+ * Global options and state.
+ */
+namespace {
+
+/**
+ * Kinds of files which may be generated.
+ */
+enum Type {
+    TYPE_TZX,
+    TYPE_CSW1,
+    TYPE_CSW2,
+    TYPE_TAP,
+    TYPE_PZX,
+    TYPE_TXT
+} ;
+
+/**
+ * Type of the file to generate.
+ */
+Type option_type = TYPE_TZX ;
+
+/**
+ * Approximate amount of data bytes to store, in kilobytes.
+ */
+uint option_size = 64 ;
+
+/**
+ * Seed of the pseudo random number generator.
+ */
+uint option_seed = 1 ;
+
+/**
+ * Current state of the pseudo random number generator.
+ */
+uint random_state ;
+
+/**
+ * Sample rate used for sampled data.
+ */
+const uint sample_rate = 44100 ;
+
+} ;
+
+/**
+ * Get next pseudo random number.
+ *
+ * We use our own generator so the output is the same on all platforms.
+ */
+uint random_number( void )
+{
+    random_state = random_state * 1103515245 + 12345 ;
+    return ( random_state >> 16 ) & 0x7FFF ;
+}
+
+/**
+ * Get pseudo random number in <0,limit) range.
+ */
+uint random_number( const uint limit )
+{
+    hope( limit > 0 ) ;
+    return ( ( random_number() << 15 ) | random_number() ) % limit ;
+}
+
+/**
+ * Fill given buffer with given amount of pseudo random bytes.
+ */
+void random_bytes( Buffer & buffer, const uint size )
+{
+    for ( uint i = 0 ; i < size ; i++ ) {
+        buffer.write< u8 >( random_number( 256 ) ) ;
+    }
+}
+
+/**
+ * Create standard ROM loader block with given flag and given amount of random payload.
+ *
+ * The block includes the flag byte and the checksum.
+ */
+void make_block( Buffer & buffer, const uint flag, const uint size )
+{
+    buffer.clear() ;
+    buffer.write< u8 >( flag ) ;
+
+    if ( flag == 0 && size == 17 ) {
+        buffer.write< u8 >( 3 ) ;
+        buffer.write( "benchmark ", 10 ) ;
+        buffer.write_little< u16 >( 0x1000 ) ;
+        buffer.write_little< u16 >( 0x8000 ) ;
+        buffer.write_little< u16 >( 0x8000 ) ;
+    }
+    else {
+        random_bytes( buffer, size ) ;
+    }
+
+    uint checksum = 0 ;
+    for ( uint i = 0 ; i < buffer.get_data_size() ; i++ ) {
+        checksum ^= buffer.get_data()[ i ] ;
+    }
+    buffer.write< u8 >( checksum ) ;
+}
+
+/**
+ * Append given amount of pulses of given duration, expressed in samples, as CSW RLE data to given buffer.
+ */
+void csw_pulses( Buffer & buffer, const uint count, const uint duration )
+{
+    const uint samples = ( ( duration * sample_rate + 1750000 ) / 3500000 ) ;
+
+    for ( uint i = 0 ; i < count ; i++ ) {
+        if ( samples > 0 && samples < 256 ) {
+            buffer.write< u8 >( samples ) ;
+        }
+        else {
+            buffer.write< u8 >( 0 ) ;
+            buffer.write_little< u32 >( samples ) ;
+        }
+    }
+}
+
+/**
+ * Append given data block as CSW RLE data to given buffer, returning the number of pulses stored.
+ */
+uint csw_block( Buffer & buffer, const byte * const data, const uint size )
+{
+    uint pulse_count = 0 ;
+
+    const uint leader_count = ( data[ 0 ] < 128 ? LONG_LEADER_COUNT : SHORT_LEADER_COUNT ) ;
+
+    csw_pulses( buffer, leader_count, LEADER_CYCLES ) ;
+    csw_pulses( buffer, 1, SYNC_1_CYCLES ) ;
+    csw_pulses( buffer, 1, SYNC_2_CYCLES ) ;
+    pulse_count += leader_count + 2 ;
+
+    for ( uint i = 0 ; i < size ; i++ ) {
+        for ( uint mask = 0x80 ; mask > 0 ; mask >>= 1 ) {
+            csw_pulses( buffer, 2, ( data[ i ] & mask ) ? BIT_1_CYCLES : BIT_0_CYCLES ) ;
+            pulse_count += 2 ;
+        }
+    }
+
+    // Finish with a pause, making sure the pulse count remains even.
+
+    csw_pulses( buffer, 1, TAIL_CYCLES ) ;
+    csw_pulses( buffer, 1, 500 * MILLISECOND_CYCLES ) ;
+    pulse_count += 2 ;
+
+    return pulse_count ;
+}
+
+/**
+ * Compress given buffer using zlib.
+ */
+void compress_buffer( Buffer & output, const Buffer & input )
+{
+#ifdef NO_ZLIB
+    fail( "zlib support is not compiled in" ) ;
+#else
+    uLongf size = compressBound( input.get_data_size() ) ;
+
+    Buffer buffer( size ) ;
+
+    if ( compress2( buffer.get_data(), &size, input.get_data(), input.get_data_size(), 9 ) != Z_OK ) {
+        fail( "error compressing data" ) ;
+    }
+
+    output.write( buffer.get_data(), size ) ;
+#endif
+}
+
+/**
+ * Append TZX block with given ID and given body to given buffer.
+ */
+void tzx_block( Buffer & tape, const uint id, const Buffer & body )
+{
+    tape.write< u8 >( id ) ;
+    tape.write( body.get_data(), body.get_data_size() ) ;
+}
+
+/**
+ * Append 24 bit little endian value to given buffer.
+ */
+void write_u24( Buffer & buffer, const uint value )
+{
+    buffer.write_little< u16 >( value & 0xFFFF ) ;
+    buffer.write< u8 >( value >> 16 ) ;
+}
+
+/**
+ * Generate TZX file, using every block type.
+ */
+void generate_tzx( Buffer & tape )
+{
+    tape.write( "ZXTape!\x1a", 8 ) ;
+    tape.write< u8 >( TZX_MAJOR ) ;
+    tape.write< u8 >( TZX_MINOR ) ;
+
+    Buffer body ;
+    Buffer data ;
+    Buffer csw ;
+
+    // Archive info.
+
+    body.write_little< u16 >( 1 + 2 + 9 + 2 + 9 ) ;
+    body.write< u8 >( 2 ) ;
+    body.write< u8 >( 0x00 ) ;
+    body.write< u8 >( 9 ) ;
+    body.write( "Benchmark", 9 ) ;
+    body.write< u8 >( 0x02 ) ;
+    body.write< u8 >( 9 ) ;
+    body.write( "Generator", 9 ) ;
+    tzx_block( tape, TZX_ARCHIVE_INFO, body ) ;
+
+    // Hardware info, custom info and messages, which are ignored.
+
+    body.clear() ;
+    body.write< u8 >( 1 ) ;
+    body.write< u8 >( 0 ) ;
+    body.write< u8 >( 0 ) ;
+    body.write< u8 >( 1 ) ;
+    tzx_block( tape, TZX_HARDWARE_INFO, body ) ;
+
+    body.clear() ;
+    body.write( "Benchmark info      ", 16 ) ;
+    body.write_little< u32 >( 4 ) ;
+    body.write( "data", 4 ) ;
+    tzx_block( tape, TZX_CUSTOM_INFO, body ) ;
+
+    body.clear() ;
+    body.write< u8 >( 1 ) ;
+    body.write< u8 >( 5 ) ;
+    body.write( "Hello", 5 ) ;
+    tzx_block( tape, TZX_MESSAGE, body ) ;
+
+    // Now keep generating rounds of all the data blocks until we reach the requested size.
+
+    const uint limit = option_size * 1024 ;
+    uint size = 0 ;
+
+    for ( uint round = 0 ; size < limit ; round++ ) {
+
+        const uint payload = 256 + random_number( 4096 ) ;
+        size += 4 * payload ;
+
+        // Group with standard header and data block.
+
+        body.clear() ;
+        body.write< u8 >( 5 ) ;
+        body.write( "Round", 5 ) ;
+        tzx_block( tape, TZX_GROUP_BEGIN, body ) ;
+
+        make_block( data, 0x00, 17 ) ;
+        body.clear() ;
+        body.write_little< u16 >( 1000 ) ;
+        body.write_little< u16 >( data.get_data_size() ) ;
+        body.write( data.get_data(), data.get_data_size() ) ;
+        tzx_block( tape, TZX_NORMAL_BLOCK, body ) ;
+
+        make_block( data, 0xFF, payload ) ;
+        body.clear() ;
+        body.write_little< u16 >( 1000 ) ;
+        body.write_little< u16 >( data.get_data_size() ) ;
+        body.write( data.get_data(), data.get_data_size() ) ;
+        tzx_block( tape, TZX_NORMAL_BLOCK, body ) ;
+
+        body.clear() ;
+        tzx_block( tape, TZX_GROUP_END, body ) ;
+
+        // Text description.
+
+        body.clear() ;
+        body.write< u8 >( 5 ) ;
+        body.write( "Turbo", 5 ) ;
+        tzx_block( tape, TZX_TEXT_INFO, body ) ;
+
+        // Turbo block.
+
+        make_block( data, 0xFF, payload ) ;
+        body.clear() ;
+        body.write_little< u16 >( 1800 ) ;
+        body.write_little< u16 >( 500 ) ;
+        body.write_little< u16 >( 600 ) ;
+        body.write_little< u16 >( 400 ) ;
+        body.write_little< u16 >( 800 ) ;
+        body.write_little< u16 >( 2000 ) ;
+        body.write< u8 >( 8 - ( round & 3 ) ) ;
+        body.write_little< u16 >( 500 ) ;
+        write_u24( body, data.get_data_size() ) ;
+        body.write( data.get_data(), data.get_data_size() ) ;
+        tzx_block( tape, TZX_TURBO_BLOCK, body ) ;
+
+        // Pure tone, pulse sequence and pure data.
+
+        body.clear() ;
+        body.write_little< u16 >( LEADER_CYCLES ) ;
+        body.write_little< u16 >( 1000 + round ) ;
+        tzx_block( tape, TZX_PURE_TONE, body ) ;
+
+        body.clear() ;
+        body.write< u8 >( 2 ) ;
+        body.write_little< u16 >( SYNC_1_CYCLES ) ;
+        body.write_little< u16 >( SYNC_2_CYCLES ) ;
+        tzx_block( tape, TZX_PULSE_SEQUENCE, body ) ;
+
+        make_block( data, 0xFF, payload ) ;
+        body.clear() ;
+        body.write_little< u16 >( BIT_0_CYCLES ) ;
+        body.write_little< u16 >( BIT_1_CYCLES ) ;
+        body.write< u8 >( 8 ) ;
+        body.write_little< u16 >( 0 ) ;
+        write_u24( body, data.get_data_size() ) ;
+        body.write( data.get_data(), data.get_data_size() ) ;
+        tzx_block( tape, TZX_DATA_BLOCK, body ) ;
+
+        // Set level followed by pause.
+
+        body.clear() ;
+        body.write_little< u32 >( 1 ) ;
+        body.write< u8 >( 1 ) ;
+        tzx_block( tape, TZX_SET_LEVEL, body ) ;
+
+        body.clear() ;
+        body.write_little< u16 >( 100 ) ;
+        tzx_block( tape, TZX_PAUSE, body ) ;
+
+        // Direct recording.
+
+        body.clear() ;
+        body.write_little< u16 >( 79 ) ;
+        body.write_little< u16 >( 100 ) ;
+        body.write< u8 >( 8 ) ;
+        write_u24( body, payload / 4 ) ;
+        for ( uint i = 0 ; i < payload / 4 ; i++ ) {
+            const uint bits = random_number( 256 ) ;
+            body.write< u8 >( ( bits & 0x80 ) ? 0xFF : bits & 0x0F ) ;
+        }
+        tzx_block( tape, TZX_SAMPLES, body ) ;
+
+        // CSW recordings, using both kinds of compression.
+
+        for ( uint compression = 1 ; compression <= 2 ; compression++ ) {
+
+            make_block( data, 0xFF, payload / 4 ) ;
+            csw.clear() ;
+            const uint pulse_count = csw_block( csw, data.get_data(), data.get_data_size() ) ;
+
+            Buffer packed ;
+            if ( compression == 2 ) {
+                compress_buffer( packed, csw ) ;
+            }
+            else {
+                packed.write( csw.get_data(), csw.get_data_size() ) ;
+            }
+
+            body.clear() ;
+            body.write_little< u32 >( 10 + packed.get_data_size() ) ;
+            body.write_little< u16 >( 0 ) ;
+            write_u24( body, sample_rate ) ;
+            body.write< u8 >( compression ) ;
+            body.write_little< u32 >( pulse_count ) ;
+            body.write( packed.get_data(), packed.get_data_size() ) ;
+            tzx_block( tape, TZX_CSW, body ) ;
+        }
+
+        // Generalized data block with pilot and data, using 2 pulse symbols for data.
+
+        make_block( data, 0xFF, payload ) ;
+        body.clear() ;
+        body.write_little< u32 >( 0 ) ;
+        body.write_little< u16 >( 1000 ) ;
+        body.write_little< u32 >( 2 ) ;
+        body.write< u8 >( 2 ) ;
+        body.write< u8 >( 2 ) ;
+        body.write_little< u32 >( 8 * data.get_data_size() ) ;
+        body.write< u8 >( 2 ) ;
+        body.write< u8 >( 2 ) ;
+        body.write< u8 >( 0 ) ;
+        body.write_little< u16 >( LEADER_CYCLES ) ;
+        body.write_little< u16 >( 0 ) ;
+        body.write< u8 >( 0 ) ;
+        body.write_little< u16 >( SYNC_1_CYCLES ) ;
+        body.write_little< u16 >( SYNC_2_CYCLES ) ;
+        body.write< u8 >( 0 ) ;
+        body.write_little< u16 >( LONG_LEADER_COUNT ) ;
+        body.write< u8 >( 1 ) ;
+        body.write_little< u16 >( 1 ) ;
+        body.write< u8 >( 0 ) ;
+        body.write_little< u16 >( BIT_0_CYCLES ) ;
+        body.write_little< u16 >( BIT_0_CYCLES ) ;
+        body.write< u8 >( 0 ) ;
+        body.write_little< u16 >( BIT_1_CYCLES ) ;
+        body.write_little< u16 >( BIT_1_CYCLES ) ;
+        body.write( data.get_data(), data.get_data_size() ) ;
+        const uint gdb_size = body.get_data_size() - 4 ;
+        body.get_data()[ 0 ] = gdb_size & 0xFF ;
+        body.get_data()[ 1 ] = ( gdb_size >> 8 ) & 0xFF ;
+        body.get_data()[ 2 ] = ( gdb_size >> 16 ) & 0xFF ;
+        body.get_data()[ 3 ] = ( gdb_size >> 24 ) ;
+        tzx_block( tape, TZX_GDB, body ) ;
+
+        // Loop with pure tone.
+
+        body.clear() ;
+        body.write_little< u16 >( 3 ) ;
+        tzx_block( tape, TZX_LOOP_BEGIN, body ) ;
+
+        body.clear() ;
+        body.write_little< u16 >( 1000 ) ;
+        body.write_little< u16 >( 100 ) ;
+        tzx_block( tape, TZX_PURE_TONE, body ) ;
+
+        body.clear() ;
+        tzx_block( tape, TZX_LOOP_END, body ) ;
+
+        // Jump over a subroutine, which is then called twice.
+
+        body.clear() ;
+        body.write_little< u16 >( 3 ) ;
+        tzx_block( tape, TZX_JUMP, body ) ;
+
+        body.clear() ;
+        body.write_little< u16 >( 1500 ) ;
+        body.write_little< u16 >( 51 ) ;
+        tzx_block( tape, TZX_PURE_TONE, body ) ;
+
+        body.clear() ;
+        tzx_block( tape, TZX_RETURN, body ) ;
+
+        body.clear() ;
+        body.write_little< u16 >( 2 ) ;
+        body.write_little< u16 >( u16( -2 ) ) ;
+        body.write_little< u16 >( u16( -2 ) ) ;
+        tzx_block( tape, TZX_CALL_SEQUENCE, body ) ;
+
+        // Glue and stop the tape in 48K mode occasionally, starting with the first round.
+
+        if ( ( round & 7 ) == 0 ) {
+            body.clear() ;
+            body.write( "XTape!\x1a", 7 ) ;
+            body.write< u8 >( TZX_MAJOR ) ;
+            body.write< u8 >( TZX_MINOR ) ;
+            tzx_block( tape, TZX_GLUE, body ) ;
+
+            body.clear() ;
+            body.write_little< u32 >( 0 ) ;
+            tzx_block( tape, TZX_STOP_IF_48K, body ) ;
+        }
+    }
+
+    // Stop the tape at the end.
+
+    body.clear() ;
+    body.write_little< u16 >( 0 ) ;
+    tzx_block( tape, TZX_PAUSE, body ) ;
+}
+
+/**
+ * Generate CSW file of given major version.
+ */
+void generate_csw( Buffer & tape, const uint major )
+{
+    Buffer rle ;
+    Buffer data ;
+
+    // Generate the pulses first.
+
+    const uint limit = option_size * 1024 ;
+    uint pulse_count = 0 ;
+
+    for ( uint size = 0 ; size < limit ; ) {
+        const uint payload = 256 + random_number( 4096 ) ;
+        make_block( data, 0x00, 17 ) ;
+        pulse_count += csw_block( rle, data.get_data(), data.get_data_size() ) ;
+        make_block( data, 0xFF, payload ) ;
+        pulse_count += csw_block( rle, data.get_data(), data.get_data_size() ) ;
+        size += payload ;
+    }
+
+    // Now create the header.
+
+    tape.write( "Compressed Square Wave\x1a", 23 ) ;
+    tape.write< u8 >( major ) ;
+
+    if ( major == 1 ) {
+        tape.write< u8 >( 1 ) ;
+        tape.write_little< u16 >( sample_rate ) ;
+        tape.write< u8 >( 1 ) ;
+        tape.write< u8 >( 0 ) ;
+        tape.write< u8 >( 0 ) ;
+        tape.write< u8 >( 0 ) ;
+        tape.write< u8 >( 0 ) ;
+        tape.write( rle.get_data(), rle.get_data_size() ) ;
+        return ;
+    }
+
+    tape.write< u8 >( 0 ) ;
+    tape.write_little< u32 >( sample_rate ) ;
+    tape.write_little< u32 >( pulse_count ) ;
+    tape.write< u8 >( 2 ) ;
+    tape.write< u8 >( 0 ) ;
+    tape.write< u8 >( 0 ) ;
+    tape.write( "tapegen         ", 16 ) ;
+    compress_buffer( tape, rle ) ;
+}
+
+/**
+ * Generate TAP file.
+ */
+void generate_tap( Buffer & tape )
+{
+    Buffer data ;
+
+    const uint limit = option_size * 1024 ;
+
+    for ( uint size = 0 ; size < limit ; ) {
+        const uint payload = 256 + random_number( 16384 ) ;
+
+        make_block( data, 0x00, 17 ) ;
+        tape.write_little< u16 >( data.get_data_size() ) ;
+        tape.write( data.get_data(), data.get_data_size() ) ;
+
+        make_block( data, 0xFF, payload ) ;
+        tape.write_little< u16 >( data.get_data_size() ) ;
+        tape.write( data.get_data(), data.get_data_size() ) ;
+
+        size += payload ;
+    }
+}
+
+/**
+ * Generate PZX file to given output file.
+ */
+void generate_pzx( FILE * const output_file )
+{
+    pzx_open( output_file ) ;
+
+    pzx_info( "Benchmark" ) ;
+    pzx_info( "Author" ) ;
+    pzx_info( "tapegen" ) ;
+
+    static const word sequence_0[] = { BIT_0_CYCLES, BIT_0_CYCLES } ;
+    static const word sequence_1[] = { BIT_1_CYCLES, BIT_1_CYCLES } ;
+
+    Buffer data ;
+
+    const uint limit = option_size * 1024 ;
+
+    for ( uint round = 0, size = 0 ; size < limit ; round++ ) {
+
+        const uint payload = 256 + random_number( 16384 ) ;
+
+        pzx_browse( "Block" ) ;
+
+        for ( uint i = 0 ; i < 2 ; i++ ) {
+            make_block( data, i ? 0xFF : 0x00, i ? payload : 17 ) ;
+            pzx_store( i ? SHORT_LEADER_COUNT : LONG_LEADER_COUNT, LEADER_CYCLES ) ;
+            pzx_store( 1, SYNC_1_CYCLES ) ;
+            pzx_store( 1, SYNC_2_CYCLES ) ;
+            pzx_data( data.get_data(), 8 * data.get_data_size(), true, 2, 2, sequence_0, sequence_1, TAIL_CYCLES ) ;
+            pzx_pause( 1000 * MILLISECOND_CYCLES, false ) ;
+        }
+
+        // Some irregular pulses as well.
+
+        for ( uint i = 0 ; i < payload ; i++ ) {
+            pzx_out( 200 + random_number( 3000 ), ( i & 1 ) != 0 ) ;
+        }
+
+        if ( ( round & 7 ) == 0 ) {
+            pzx_stop( 1 ) ;
+        }
+
+        size += payload ;
+    }
+
+    pzx_stop( 0 ) ;
+
+    pzx_close() ;
+}
+
+/**
+ * Generate PZX text dump to given output file.
+ */
+void generate_txt( FILE * const output_file )
+{
+    fprintf( output_file, "PZX 1.0\n" ) ;
+    fprintf( output_file, "INFO \"Benchmark\"\n" ) ;
+
+    Buffer data ;
+
+    const uint limit = option_size * 1024 ;
+
+    for ( uint size = 0 ; size < limit ; ) {
+
+        const uint payload = 256 + random_number( 16384 ) ;
+
+        fprintf( output_file, "\nPULSES\nPULSE %u %u\nPULSE %u\nPULSE %u\n", LEADER_CYCLES, SHORT_LEADER_COUNT, SYNC_1_CYCLES, SYNC_2_CYCLES ) ;
+
+        make_block( data, 0xFF, payload ) ;
+
+        fprintf( output_file, "\nDATA 1\nSIZE %u\nTAIL %u\n", uint( data.get_data_size() ), TAIL_CYCLES ) ;
+        fprintf( output_file, "BIT0 %u %u\nBIT1 %u %u\n", BIT_0_CYCLES, BIT_0_CYCLES, BIT_1_CYCLES, BIT_1_CYCLES ) ;
+
+        for ( uint i = 0 ; i < data.get_data_size() ; i++ ) {
+            if ( ( i & 31 ) == 0 ) {
+                fprintf( output_file, ( i ? "\nBODY " : "BODY " ) ) ;
+            }
+            fprintf( output_file, "%02X", data.get_data()[ i ] ) ;
+        }
+
+        fprintf( output_file, "\n\nPAUSE %u\n", 1000 * MILLISECOND_CYCLES ) ;
+
+        fprintf( output_file, "\nPULSES\n" ) ;
+
+        for ( uint i = 0 ; i < payload ; i++ ) {
+            fprintf( output_file, "PULSE %u\n", 200 + random_number( 3000 ) ) ;
+        }
+
+        size += payload ;
+    }
+}
+
+/**
+ * Generate synthetic tape file.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    // Make sure the standard output is in binary mode.
+
+    set_binary_mode( stdout ) ;
+
+    // Parse the command line.
+
+    const char * output_name = NULL ;
+
+    for ( int i = 1 ; i < argc ; i++ ) {
+        if ( argv[ i ][ 0 ] != '-' ) {
+            fail( "unexpected argument %s", argv[ i ] ) ;
+        }
+        switch ( argv[ i ][ 1 ] ) {
+            case 'o': {
+                if ( output_name ) {
+                    fail( "multiple output file names specified" ) ;
+                }
+                output_name = argv[ ++i ] ;
+                break ;
+            }
+            case 't': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing file type" ) ;
+                }
+                if ( std::strcmp( arg, "tzx" ) == 0 ) {
+                    option_type = TYPE_TZX ;
+                }
+                else if ( std::strcmp( arg, "csw1" ) == 0 ) {
+                    option_type = TYPE_CSW1 ;
+                }
+                else if ( std::strcmp( arg, "csw" ) == 0 || std::strcmp( arg, "csw2" ) == 0 ) {
+                    option_type = TYPE_CSW2 ;
+                }
+                else if ( std::strcmp( arg, "tap" ) == 0 ) {
+                    option_type = TYPE_TAP ;
+                }
+                else if ( std::strcmp( arg, "pzx" ) == 0 ) {
+                    option_type = TYPE_PZX ;
+                }
+                else if ( std::strcmp( arg, "txt" ) == 0 ) {
+                    option_type = TYPE_TXT ;
+                }
+                else {
+                    fail( "invalid file type %s", arg ) ;
+                }
+                break ;
+            }
+            case 'k': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing size" ) ;
+                }
+                option_size = uint( atoi( arg ) ) ;
+                break ;
+            }
+            case 's': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing seed" ) ;
+                }
+                option_seed = uint( atoi( arg ) ) ;
+                break ;
+            }
+            default: {
+                fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
+
+                // Fall through.
+            }
+            case 'h': {
+                fprintf( stderr, "usage: tapegen [-t type] [-k size] [-s seed] [-o output_file]\n" ) ;
+                fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
+                fprintf( stderr, "-t s   generate tzx, csw1, csw2, tap, pzx or txt file (default tzx)\n" ) ;
+                fprintf( stderr, "-k n   store approximately given amount of data, in kilobytes (default 64)\n" ) ;
+                fprintf( stderr, "-s n   use given seed for the pseudo random data (default 1)\n" ) ;
+                return EXIT_FAILURE ;
+            }
+        }
+    }
+
+    random_state = option_seed ;
+
+    // Open the output file.
+
+    const bool text_output = ( option_type == TYPE_TXT ) ;
+
+    FILE * const output_file = ( output_name ? fopen( output_name, text_output ? "w" : "wb" ) : stdout ) ;
+    if ( output_file == NULL ) {
+        fail( "unable to open output file" ) ;
+    }
+
+    // Generate the file.
+
+    Buffer tape ;
+
+    switch ( option_type ) {
+        case TYPE_TZX: {
+            generate_tzx( tape ) ;
+            break ;
+        }
+        case TYPE_CSW1: {
+            generate_csw( tape, 1 ) ;
+            break ;
+        }
+        case TYPE_CSW2: {
+            generate_csw( tape, 2 ) ;
+            break ;
+        }
+        case TYPE_TAP: {
+            generate_tap( tape ) ;
+            break ;
+        }
+        case TYPE_PZX: {
+            generate_pzx( output_file ) ;
+            break ;
+        }
+        case TYPE_TXT: {
+            generate_txt( output_file ) ;
+            break ;
+        }
+    }
+
+    if ( tape.is_not_empty() && std::fwrite( tape.get_data(), 1, tape.get_data_size(), output_file ) != tape.get_data_size() ) {
+        fail( "error writing to file" ) ;
+    }
+
+    if ( ferror( output_file ) != 0 || fclose( output_file ) != 0 ) {
+        fail( "error while closing the output file" ) ;
+    }
+
+    return EXIT_SUCCESS ;
+}
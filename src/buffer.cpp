@@ -0,0 +1,112 @@
+// $Id$
+
+/**
+ * @file Pool of Buffer storage.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "buffer.h"
+
+namespace {
+
+/**
+ * Number of size classes which are pooled, and how many free blocks of each
+ * size class may be kept around at most.
+ */
+//@{
+const uint POOL_CLASS_COUNT = BUFFER_POOL_LIMIT_BITS + 1 ;
+const uint POOL_DEPTH = 4 ;
+//@}
+
+/**
+ * Free blocks of each size class, together with their counts.
+ *
+ * The pool is kept per thread, so the buffers may be used by several threads
+ * at once without any locking. It is a plain structure on purpose, so it
+ * stays available even while the global buffers are being destroyed.
+ */
+struct Pool {
+    byte * blocks[ POOL_CLASS_COUNT ][ POOL_DEPTH ] ;
+    uint counts[ POOL_CLASS_COUNT ] ;
+} ;
+
+thread_local Pool pool ;
+
+/**
+ * Get size class of block of given size, or POOL_CLASS_COUNT if such block
+ * is not pooled.
+ */
+uint buffer_pool_class( const size_t size )
+{
+    if ( size > BUFFER_POOL_LIMIT || ( size & ( size - 1 ) ) != 0 ) {
+        return POOL_CLASS_COUNT ;
+    }
+
+    uint size_class = 0 ;
+    while ( ( size_t( 1 ) << size_class ) < size ) {
+        size_class++ ;
+    }
+    return size_class ;
+}
+
+} ;
+
+/**
+ * Get block of given size, either from the pool or freshly allocated.
+ */
+byte * buffer_pool_allocate( const size_t size )
+{
+    stats_add( STATS_BUFFER_ALLOCATIONS ) ;
+
+    const uint size_class = buffer_pool_class( size ) ;
+
+    if ( size_class < POOL_CLASS_COUNT && pool.counts[ size_class ] > 0 ) {
+        stats_add( STATS_BUFFER_POOL_HITS ) ;
+        return pool.blocks[ size_class ][ --pool.counts[ size_class ] ] ;
+    }
+
+    byte * const block = static_cast< byte * >( std::malloc( size ) ) ;
+
+    if ( block == NULL ) {
+        fault( "out of memory" ) ;
+    }
+
+    return block ;
+}
+
+/**
+ * Return block of given size to the pool, or free it if the pool is full.
+ */
+void buffer_pool_release( byte * const block, const size_t size )
+{
+    if ( block == NULL ) {
+        return ;
+    }
+
+    const uint size_class = buffer_pool_class( size ) ;
+
+    if ( size_class < POOL_CLASS_COUNT && pool.counts[ size_class ] < POOL_DEPTH ) {
+        pool.blocks[ size_class ][ pool.counts[ size_class ]++ ] = block ;
+        return ;
+    }
+
+    std::free( block ) ;
+}
+
+/**
+ * Free all blocks kept in the pool of the current thread.
+ *
+ * Meant to be used at file boundaries when processing many files in a row,
+ * and by threads which use buffers before they terminate.
+ */
+void buffer_pool_trim( void )
+{
+    for ( uint i = 0 ; i < POOL_CLASS_COUNT ; i++ ) {
+        while ( pool.counts[ i ] > 0 ) {
+            std::free( pool.blocks[ i ][ --pool.counts[ i ] ] ) ;
+        }
+    }
+}
@@ -23,43 +23,161 @@
 #include "endian.h"
 #endif
 
+#ifndef STATS_H
+#include "stats.h"
+#endif
+
+/**
+ * Largest block size whose storage is pooled, and its base 2 logarithm.
+ */
+//@{
+const uint BUFFER_POOL_LIMIT_BITS = 24 ;
+const uint BUFFER_POOL_LIMIT = ( 1 << BUFFER_POOL_LIMIT_BITS ) ;
+//@}
+
+byte * buffer_pool_allocate( const size_t size ) ;
+void buffer_pool_release( byte * const block, const size_t size ) ;
+void buffer_pool_trim( void ) ;
+
 /**
  * Trivial class for convenient storing of arbitrary data.
+ *
+ * The storage of buffers up to BUFFER_POOL_LIMIT bytes is recycled through
+ * a per thread pool of power of two sized blocks, so the temporary buffers
+ * used for each block do not keep allocating and freeing memory over and
+ * over again.
+ *
+ * When BUFFER_TRACKING is defined, each buffer also remembers the place in
+ * the source where it was created, and its allocations are accounted for
+ * that call site in the statistics report.
  */
 class Buffer {
 
     byte * buffer ;
-    uint buffer_size ;
-    uint bytes_used ;
+    size_t buffer_size ;
+    size_t bytes_used ;
+
+#ifdef BUFFER_TRACKING
+    StatsBufferSite * const site ;
+#endif
 
 public:
 
-    Buffer( const uint size = 65536 )
+#ifdef BUFFER_TRACKING
+    Buffer(
+        const size_t size = 65536,
+        const char * const file = __builtin_FILE(),
+        const uint line = __builtin_LINE()
+    )
+        : buffer( NULL )
+        , buffer_size( 0 )
+        , bytes_used( 0 )
+        , site( stats_buffer_site( file, line ) )
+    {
+        site->instances++ ;
+        reallocate( size ) ;
+    }
+#else
+    Buffer( const size_t size = 65536 )
         : buffer( NULL )
         , buffer_size( 0 )
         , bytes_used( 0 )
     {
         reallocate( size ) ;
     }
+#endif
 
     ~Buffer()
     {
-        std::free( buffer ) ;
+        buffer_pool_release( buffer, buffer_size ) ;
+        stats_release( buffer_size ) ;
+#ifdef BUFFER_TRACKING
+        stats_release( site, buffer_size ) ;
+#endif
     }
 
 private:
 
-    void reallocate( const uint new_size )
+    void reallocate( size_t new_size )
     {
-        buffer = static_cast< byte * >( std::realloc( buffer, new_size ) ) ;
+        hope( new_size > buffer_size ) ;
+
+        size_t bytes_copied = 0 ;
+
+        if ( new_size <= BUFFER_POOL_LIMIT ) {
+
+            // Round the size up to the nearest pooled size class, and move
+            // the content into the new block. Note that only the bytes used
+            // need to be copied.
+
+            size_t block_size = 1 ;
+            while ( block_size < new_size ) {
+                block_size <<= 1 ;
+            }
+            new_size = block_size ;
+
+            byte * const new_buffer = buffer_pool_allocate( new_size ) ;
 
-        if ( buffer == NULL || new_size <= buffer_size ) {
-            fail( "out of memory" ) ;
+            if ( buffer ) {
+                std::memcpy( new_buffer, buffer, bytes_used ) ;
+                buffer_pool_release( buffer, buffer_size ) ;
+                bytes_copied = bytes_used ;
+            }
+
+            buffer = new_buffer ;
         }
+        else {
+
+            // Huge blocks are not pooled, so let realloc grow them in place if it can.
+            // Note that realloc copies the whole old block if it has to move it.
+
+            const size_t old_address = reinterpret_cast< size_t >( buffer ) ;
+
+            buffer = static_cast< byte * >( std::realloc( buffer, new_size ) ) ;
+
+            if ( buffer == NULL ) {
+                fault( "out of memory" ) ;
+            }
+
+            if ( reinterpret_cast< size_t >( buffer ) != old_address ) {
+                bytes_copied = buffer_size ;
+            }
+        }
+
+        if ( buffer_size > 0 ) {
+            stats_add( STATS_BUFFER_GROWTHS ) ;
+#ifdef BUFFER_TRACKING
+            site->growths++ ;
+#endif
+        }
+
+        stats_allocate( new_size - buffer_size, bytes_copied ) ;
+#ifdef BUFFER_TRACKING
+        stats_allocate( site, new_size - buffer_size, bytes_copied ) ;
+#endif
 
         buffer_size = new_size ;
     }
 
+    /**
+     * Grow the buffer so there is room for at least given amount of additional bytes.
+     *
+     * Rather than letting the size wrap around, fail if it can't be doubled anymore.
+     */
+    void make_room( const size_t size )
+    {
+        size_t new_size = buffer_size ;
+
+        while ( size > new_size - bytes_used ) {
+            if ( new_size > size_t( -1 ) / 2 ) {
+                fault( "out of memory" ) ;
+            }
+            new_size *= 2 ;
+        }
+
+        reallocate( new_size ) ;
+    }
+
 public:
 
     inline void clear( void )
@@ -67,6 +185,15 @@ public:
         bytes_used = 0 ;
     }
 
+    void discard( const size_t size )
+    {
+        hope( size <= bytes_used ) ;
+
+        bytes_used -= size ;
+
+        std::memmove( buffer, buffer + size, bytes_used ) ;
+    }
+
 public:
 
     bool read( FILE * const file )
@@ -75,8 +202,8 @@ public:
 
         for ( ; ; ) {
 
-            const uint bytes_free = buffer_size - bytes_used ;
-            const uint bytes_read = std::fread( buffer + bytes_used, 1, bytes_free, file ) ;
+            const size_t bytes_free = buffer_size - bytes_used ;
+            const size_t bytes_read = std::fread( buffer + bytes_used, 1, bytes_free, file ) ;
 
             bytes_used += bytes_read ;
 
@@ -84,7 +211,7 @@ public:
                 return ( std::ferror( file ) == 0 ) ;
             }
 
-            reallocate( 2 * buffer_size ) ;
+            make_room( 1 ) ;
         }
     }
 
@@ -92,23 +219,42 @@ public:
     {
         hope( file ) ;
 
+        bytes_used = 0 ;
+
         if ( size > buffer_size ) {
             reallocate( size ) ;
         }
 
-        bytes_used = std::fread( buffer, 1, size, file ) ;
+        const uint bytes_read = std::fread( buffer, 1, size, file ) ;
+
+        bytes_used = bytes_read ;
+
+        return ( std::ferror( file ) ? ~0 : bytes_read ) ;
+    }
+
+    uint append( FILE * const file, const uint size )
+    {
+        hope( file ) ;
+
+        if ( size > buffer_size - bytes_used ) {
+            make_room( size ) ;
+        }
+
+        const uint bytes_read = std::fread( buffer + bytes_used, 1, size, file ) ;
+
+        bytes_used += bytes_read ;
 
-        return ( std::ferror( file ) ? ~0 : bytes_used ) ;
+        return ( std::ferror( file ) ? ~0 : bytes_read ) ;
     }
 
 public:
 
-    inline void write( const void * const data, const uint size )
+    inline void write( const void * const data, const size_t size )
     {
         hope( data || size == 0 ) ;
 
-        while ( size > buffer_size - bytes_used ) {
-            reallocate( 2 * buffer_size ) ;
+        if ( size > buffer_size - bytes_used ) {
+            make_room( size ) ;
         }
 
         std::memcpy( buffer + bytes_used, data, size ) ;
@@ -152,7 +298,7 @@ public:
         return buffer + bytes_used ;
     }
 
-    inline uint get_data_size( void ) const
+    inline size_t get_data_size( void ) const
     {
         return bytes_used ;
     }
@@ -0,0 +1,167 @@
+// $Id$
+
+/**
+ * @file Raw file data copying.
+ *
+ * Copies the data between files without looking at them, letting the kernel
+ * do the copying directly whenever possible, so even huge files are copied
+ * at disk speed. Whenever that is not possible, like when reading from pipe,
+ * the data are copied the usual way instead.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "copy.h"
+#include "debug.h"
+#include "stats.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#endif
+
+namespace {
+
+/**
+ * Size of the chunks used when the data are copied the usual way.
+ */
+const uint chunk_size = 65536 ;
+
+/**
+ * Buffer used when the data are copied the usual way.
+ */
+byte chunk[ chunk_size ] ;
+
+#ifdef __linux__
+
+/**
+ * Let the kernel copy given amount of bytes from given input file to given
+ * output file, returning the amount of bytes it has actually copied.
+ */
+uquad copy_directly( FILE * const output_file, FILE * const input_file, const uquad size )
+{
+    // Find out where in the input file we are. This fails unless the input is seekable.
+
+    const off_t start = ftello( input_file ) ;
+    if ( start < 0 ) {
+        return 0 ;
+    }
+
+    // Make sure everything written so far reaches the output file first.
+
+    if ( fflush( output_file ) != 0 ) {
+        fault( "error writing to file" ) ;
+    }
+
+    const int input = fileno( input_file ) ;
+    const int output = fileno( output_file ) ;
+
+    // Try copy_file_range first, which may avoid copying anything at all,
+    // then sendfile, which works for output to pipes as well.
+
+    off_t offset = start ;
+    uquad left = size ;
+
+    bool use_copy_file_range = true ;
+
+    while ( left > 0 ) {
+
+        const size_t amount = size_t( left > 0x40000000 ? 0x40000000 : left ) ;
+
+        ssize_t result = -1 ;
+
+        if ( use_copy_file_range ) {
+            result = copy_file_range( input, &offset, output, NULL, amount, 0 ) ;
+            if ( result < 0 ) {
+                use_copy_file_range = false ;
+                continue ;
+            }
+        }
+        else {
+            result = sendfile( output, input, &offset, amount ) ;
+        }
+
+        if ( result <= 0 ) {
+            break ;
+        }
+
+        left -= result ;
+    }
+
+    // Continue reading the input file after the copied data.
+
+    if ( fseeko( input_file, offset, SEEK_SET ) != 0 ) {
+        fault( "error reading input file" ) ;
+    }
+
+    return ( size - left ) ;
+}
+
+#endif // __linux__
+
+}
+
+/**
+ * Copy given amount of bytes from given input file to given output file.
+ */
+void copy_data( FILE * const output_file, FILE * const input_file, uquad size )
+{
+    hope( output_file ) ;
+    hope( input_file ) ;
+
+    stats_add( STATS_BYTES_IN, size ) ;
+    stats_add( STATS_BYTES_OUT, size ) ;
+
+    const StatsPhase phase = stats_enter( STATS_WRITE ) ;
+
+#ifdef __linux__
+    size -= copy_directly( output_file, input_file, size ) ;
+#endif
+
+    while ( size > 0 ) {
+
+        const uint amount = uint( size > chunk_size ? chunk_size : size ) ;
+
+        if ( fread( chunk, 1, amount, input_file ) != amount ) {
+            fault( "error reading input file" ) ;
+        }
+        if ( fwrite( chunk, 1, amount, output_file ) != amount ) {
+            fault( "error writing to file" ) ;
+        }
+
+        size -= amount ;
+    }
+
+    stats_leave( phase ) ;
+}
+
+/**
+ * Skip given amount of bytes of given input file.
+ */
+void skip_data( FILE * const input_file, uquad size )
+{
+    hope( input_file ) ;
+
+    stats_add( STATS_BYTES_IN, size ) ;
+
+    // Seek if possible, otherwise read the data.
+
+    if ( size <= 0x7FFFFFFF && fseek( input_file, long( size ), SEEK_CUR ) == 0 ) {
+        return ;
+    }
+
+    while ( size > 0 ) {
+
+        const uint amount = uint( size > chunk_size ? chunk_size : size ) ;
+
+        if ( fread( chunk, 1, amount, input_file ) != amount ) {
+            fault( "error reading input file" ) ;
+        }
+
+        size -= amount ;
+    }
+}
@@ -0,0 +1,25 @@
+// $Id$
+
+/**
+ * @file Raw file data copying.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#ifndef COPY_H
+#define COPY_H 1
+
+#include <cstdio>
+
+#ifndef TYPES_H
+#include "types.h"
+#endif
+
+// Interface.
+
+void copy_data( FILE * const output_file, FILE * const input_file, uquad size ) ;
+void skip_data( FILE * const input_file, uquad size ) ;
+
+#endif // COPY_H
@@ -14,6 +14,18 @@
 
 #include "csw.h"
 #include "pzx.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /**
  * Macros for fetching little endian data from data block.
@@ -25,56 +37,400 @@
 #define GET4(o)     (data[o]+(data[(o)+1]<<8)+(data[(o)+2]<<16)+(data[(o)+3]<<24))
 //@}
 
+namespace {
+
 /**
- * Render CSW encoded pulses to the output stream.
+ * Cache of unpacked CSW blocks.
+ *
+ * TZX loops and call sequences may render the same compressed CSW block
+ * many times, so we keep the unpacked data of recently used blocks around
+ * to avoid inflating them over and over again. The blocks are identified
+ * by their position in memory, so the cache has to be cleared whenever
+ * the memory holding the source data is about to be released.
+ */
+//@{
+
+struct CacheEntry {
+    const byte * data ;
+    size_t size ;
+    uint last_use ;
+    Buffer * buffer ;
+} ;
+
+const uint cache_entry_count = 16 ;
+
+CacheEntry cache[ cache_entry_count ] ;
+
+size_t cache_limit = 16 * 1024 * 1024 ;
+size_t cache_size ;
+uint cache_clock ;
+
+//@}
+
+/**
+ * Guard marking the cache as being in use for its lifetime.
+ *
+ * The cache is not locked, as the conversion core is not reentrant anyway.
+ * It is used only by the thread rendering the blocks, never by the threads
+ * encoding the CSW parts, and the cached buffers are used by the caller
+ * after the lookup returns. The debug builds make sure it stays that way.
+ */
+struct CacheGuard {
+#ifdef DEBUG
+    static std::atomic< bool > busy ;
+#endif
+
+    CacheGuard()
+    {
+#ifdef DEBUG
+        hope( ! busy.exchange( true ) ) ;
+#endif
+    }
+
+    ~CacheGuard()
+    {
+#ifdef DEBUG
+        busy = false ;
+#endif
+    }
+} ;
+
+#ifdef DEBUG
+std::atomic< bool > CacheGuard::busy ;
+#endif
+
+/**
+ * Number of threads used for rendering large CSW blocks.
+ */
+uint thread_count = 1 ;
+
+/**
+ * Minimum size of the part of CSW data rendered by each thread.
+ */
+const size_t part_size_limit = 16 * 1024 ;
+
+/**
+ * Part of CSW data rendered by one thread.
  */
-uint csw_render_block( bool & level, const uint sample_rate, const byte * const data, const uint size )
+struct CswPart {
+    const byte * start ;
+    const byte * end ;
+    bool level ;
+    PzxPulses pulses ;
+    std::exception_ptr failure ;
+} ;
+
+/**
+ * Durations of pulses of single byte sample counts in 3.5MHz T cycles, for
+ * the sample rate they were computed for.
+ */
+struct CswTiming {
+    uint sample_rate ;
+    uint durations[ 256 ] ;
+} ;
+
+CswTiming timing ;
+
+/**
+ * Number of pulses converted at once before passing them to the PZX stream.
+ */
+const uint batch_size = 256 ;
+
+/**
+ * Release given cache entry.
+ */
+void csw_release_entry( CacheEntry & entry )
+{
+    hope( entry.buffer ) ;
+    hope( cache_size >= entry.buffer->get_data_size() ) ;
+
+    cache_size -= entry.buffer->get_data_size() ;
+
+    delete entry.buffer ;
+
+    entry.data = NULL ;
+    entry.size = 0 ;
+    entry.last_use = 0 ;
+    entry.buffer = NULL ;
+}
+
+/**
+ * Release the least recently used cache entry, if there is any.
+ */
+bool csw_release_oldest_entry( void )
+{
+    CacheEntry * oldest = NULL ;
+
+    for ( uint i = 0 ; i < cache_entry_count ; i++ ) {
+        CacheEntry & entry = cache[ i ] ;
+        if ( entry.buffer && ( oldest == NULL || entry.last_use < oldest->last_use ) ) {
+            oldest = &entry ;
+        }
+    }
+
+    if ( oldest == NULL ) {
+        return false ;
+    }
+
+    csw_release_entry( *oldest ) ;
+    return true ;
+}
+
+/**
+ * Get cached unpacked data of given CSW block, or NULL if it is not cached.
+ */
+const Buffer * csw_get_cached_block( const byte * const data, const size_t size )
+{
+    for ( uint i = 0 ; i < cache_entry_count ; i++ ) {
+        CacheEntry & entry = cache[ i ] ;
+        if ( entry.buffer && entry.data == data && entry.size == size ) {
+            entry.last_use = ++cache_clock ;
+            return entry.buffer ;
+        }
+    }
+    return NULL ;
+}
+
+/**
+ * Store unpacked data of given CSW block in the cache.
+ *
+ * @note The cache takes the ownership of the buffer, and may release it right away.
+ */
+void csw_cache_block( const byte * const data, const size_t size, Buffer * const buffer )
+{
+    hope( buffer ) ;
+
+    // Don't bother with blocks which would never fit.
+
+    const size_t buffer_size = buffer->get_data_size() ;
+
+    if ( buffer_size > cache_limit ) {
+        delete buffer ;
+        return ;
+    }
+
+    // Make room for the new block, evicting the least recently used blocks as necessary.
+
+    while ( cache_size + buffer_size > cache_limit ) {
+        csw_release_oldest_entry() ;
+    }
+
+    CacheEntry * slot = NULL ;
+
+    while ( slot == NULL ) {
+        for ( uint i = 0 ; i < cache_entry_count ; i++ ) {
+            if ( cache[ i ].buffer == NULL ) {
+                slot = &cache[ i ] ;
+                break ;
+            }
+        }
+        if ( slot == NULL ) {
+            csw_release_oldest_entry() ;
+        }
+    }
+
+    // Now remember the block.
+
+    slot->data = data ;
+    slot->size = size ;
+    slot->last_use = ++cache_clock ;
+    slot->buffer = buffer ;
+
+    cache_size += buffer_size ;
+}
+
+}
+
+/**
+ * Set the maximum amount of unpacked CSW data kept in the cache.
+ *
+ * @note Zero limit disables the caching entirely.
+ */
+void csw_set_cache_limit( const uint limit )
+{
+    const CacheGuard guard ;
+
+    cache_limit = limit ;
+
+    while ( cache_size > cache_limit ) {
+        csw_release_oldest_entry() ;
+    }
+}
+
+/**
+ * Release all cached CSW data.
+ */
+void csw_clear_cache( void )
+{
+    const CacheGuard guard ;
+
+    while ( csw_release_oldest_entry() ) {
+    }
+
+    hope( cache_size == 0 ) ;
+
+    cache_clock = 0 ;
+}
+
+/**
+ * Set the number of threads used for rendering large CSW blocks.
+ */
+void csw_set_thread_count( const uint count )
+{
+    thread_count = ( count > 0 ? count : 1 ) ;
+}
+
+namespace {
+
+/**
+ * Get the conversion table for given sample rate, computing it if necessary.
+ *
+ * The table is built by adding the duration of single sample over and over
+ * again. The fraction of T cycle this duration consists of is accumulated
+ * separately and carried over to the following entries once it makes up
+ * entire T cycle, so the error doesn't build up and each entry is the same
+ * as if it was computed by the division itself.
+ */
+const CswTiming & csw_prepare_timing( const uint sample_rate )
 {
     hope( sample_rate > 0 ) ;
-    hope( data || size == 0 ) ;
 
-    const byte * p = data ;
-    const byte * const end = data + size ;
+    if ( timing.sample_rate != sample_rate ) {
+
+        const uint step = 3500000 / sample_rate ;
+        const uint fraction = 3500000 % sample_rate ;
 
-    // Iterate over all pulses.
+        uint duration = 0 ;
+        uquad remainder = 0 ;
 
-    uint pulse_count = 0 ;
+        for ( uint i = 0 ; i < 256 ; i++ ) {
+            timing.durations[ i ] = duration ;
+            duration += step ;
+            remainder += fraction ;
+            if ( remainder >= sample_rate ) {
+                remainder -= sample_rate ;
+                duration++ ;
+            }
+        }
+
+        timing.sample_rate = sample_rate ;
+    }
+
+    return timing ;
+}
+
+/**
+ * Convert given sample count to duration in 3.5MHz T cycles.
+ *
+ * Note that by rounding down we lose up to almost 1 T for every
+ * pulse, but it's precise enough for our purposes.
+ */
+inline uquad csw_duration( const uint sample_count, const uint sample_rate )
+{
+    return ( ( 3500000ull * sample_count ) / sample_rate ) ;
+}
+
+/**
+ * Find the first zero byte escaping 32 bit sample count in given CSW data,
+ * returning the end of the data in case there is none.
+ */
+const byte * csw_find_escape( const byte * p, const byte * const end )
+{
+#ifdef __SSE2__
+
+    // Compare sixteen bytes at once, stopping at the first group where any
+    // of them is zero.
+
+    const __m128i zero = _mm_setzero_si128() ;
+
+    for ( ; end - p >= 16 ; p += 16 ) {
+        const __m128i values = _mm_loadu_si128( reinterpret_cast< const __m128i * >( p ) ) ;
+        const uint mask = _mm_movemask_epi8( _mm_cmpeq_epi8( values, zero ) ) ;
+        if ( mask != 0 ) {
+            return p + __builtin_ctz( mask ) ;
+        }
+    }
+
+#endif
+
+    while ( p < end && *p != 0 ) {
+        p++ ;
+    }
+
+    return p ;
+}
+
+/**
+ * Render CSW encoded pulses either to the output stream, or to given
+ * separately encoded pulses if there are any.
+ *
+ * Returns the number of pulses rendered.
+ */
+uquad csw_decode(
+    PzxPulses * const pulses,
+    const CswTiming & timing,
+    bool & level,
+    const byte * p,
+    const byte * const end
+)
+{
+    uquad durations[ batch_size ] ;
+
+    uquad pulse_count = 0 ;
 
     while ( p < end ) {
 
-        // Fetch the pulse duration encoded as number of samples.
+        // Convert the single byte sample counts up to the next escape in
+        // bulk, looking their durations up in the table.
 
-        uint sample_count = *p++ ;
+        const byte * const escape = csw_find_escape( p, end ) ;
 
-        // In case it is 0, fetch the 32 bit sample count.
+        while ( p < escape ) {
 
-        if ( sample_count == 0 ) {
+            const uint count = uint( std::min< size_t >( escape - p, batch_size ) ) ;
 
-            if ( end - p < 4 ) {
-                warn( "premature end of CSW data detected" ) ;
-                break ;
+            for ( uint i = 0 ; i < count ; i++ ) {
+                durations[ i ] = timing.durations[ p[ i ] ] ;
             }
 
-            sample_count = *p++ ;
-            sample_count += *p++ << 8 ;
-            sample_count += *p++ << 16 ;
-            sample_count += *p++ << 24 ;
+            if ( pulses ) {
+                pzx_encode( *pulses, durations, count, level ) ;
+            }
+            else {
+                pzx_out( durations, count, level ) ;
+            }
+
+            if ( ( count & 1 ) != 0 ) {
+                level = ! level ;
+            }
+
+            p += count ;
+            pulse_count += count ;
         }
 
-        // Now output the pulse, converting the sample count to duration in 3.5MHz T cycles first.
-        //
-        // Note that by rounding down we lose up to almost 1 T for every
-        // pulse, but it's precise enough for our purposes.
+        if ( p == end ) {
+            break ;
+        }
 
-        uquad duration = ( ( 3500000ull * sample_count ) / sample_rate ) ;
-        const uint limit = 0xFFFFFFFF ;
+        // The zero byte is followed by the 32 bit sample count.
 
-        while ( duration > limit ) {
-            pzx_out( limit, level ) ;
-            duration -= limit ;
+        if ( end - p < 5 ) {
+            warn( "premature end of CSW data detected" ) ;
+            break ;
         }
 
-        pzx_out( uint( duration ), level ) ;
+        const uint sample_count = p[ 1 ] | ( p[ 2 ] << 8 ) | ( p[ 3 ] << 16 ) | ( uint( p[ 4 ] ) << 24 ) ;
+
+        p += 5 ;
+
+        const uquad duration = csw_duration( sample_count, timing.sample_rate ) ;
+
+        if ( pulses ) {
+            pzx_encode( *pulses, duration, level ) ;
+        }
+        else {
+            pzx_out( &duration, 1, level ) ;
+        }
 
         level = ! level ;
 
@@ -84,10 +440,156 @@ uint csw_render_block( bool & level, const uint sample_rate, const byte * const
     return pulse_count ;
 }
 
+/**
+ * Encode the CSW encoded pulses of given part, separately from the output stream.
+ *
+ * @note This runs in its own thread, so it must not touch anything shared.
+ */
+void csw_encode_part( CswPart & part, const CswTiming & timing )
+{
+    try {
+        bool level = part.level ;
+
+        csw_decode( &part.pulses, timing, level, part.start, part.end ) ;
+
+        pzx_encode_finish( part.pulses ) ;
+    }
+    catch ( ... ) {
+        part.failure = std::current_exception() ;
+    }
+}
+
+/**
+ * Encode given part in a thread of its own, releasing the pooled buffer
+ * storage of the thread before it terminates.
+ */
+void csw_encode_thread( CswPart & part, const CswTiming & timing )
+{
+    csw_encode_part( part, timing ) ;
+    buffer_pool_trim() ;
+}
+
+/**
+ * Render CSW encoded pulses to the output stream, using multiple threads.
+ *
+ * The data is split into parts, each encoded by its own thread, and the
+ * encoded parts are then appended to the output stream in order.
+ */
+uquad csw_render_parallel( bool & level, const CswTiming & timing, const byte * const data, const size_t size )
+{
+    const size_t part_count = std::min< size_t >( thread_count, size / part_size_limit ) ;
+    const size_t part_size = size / part_count ;
+
+    std::vector< CswPart > parts( part_count ) ;
+
+    // Find the part boundaries. Each pulse takes single byte, unless that
+    // byte is zero, in which case the pulse spans the following 32 bit sample
+    // count as well. So hop from one zero byte to another until each boundary
+    // is reached, counting the pulses on the way, so the initial level of
+    // each part is known as well.
+
+    const byte * p = data ;
+    const byte * end = data + size ;
+
+    uquad pulse_count = 0 ;
+
+    for ( size_t i = 0 ; i < part_count ; i++ ) {
+
+        CswPart & part = parts[ i ] ;
+
+        part.start = p ;
+        part.level = ( level != ( ( pulse_count & 1 ) != 0 ) ) ;
+
+        const byte * const boundary = ( i + 1 < part_count ? std::min( data + ( i + 1 ) * part_size, end ) : end ) ;
+
+        while ( p < boundary ) {
+
+            const byte * const escape = csw_find_escape( p, boundary ) ;
+
+            pulse_count += escape - p ;
+            p = escape ;
+
+            if ( p == boundary ) {
+                break ;
+            }
+
+            if ( end - escape < 5 ) {
+                warn( "premature end of CSW data detected" ) ;
+                end = escape ;
+                break ;
+            }
+
+            pulse_count++ ;
+            p += 5 ;
+        }
+
+        part.end = p ;
+    }
+
+    // Now encode the parts, each in its own thread, except the first one
+    // which is encoded by this thread.
+
+    std::vector< std::thread > threads ;
+
+    try {
+        for ( size_t i = 1 ; i < part_count ; i++ ) {
+            threads.push_back( std::thread( csw_encode_thread, std::ref( parts[ i ] ), std::cref( timing ) ) ) ;
+        }
+    }
+    catch ( ... ) {
+        for ( size_t i = 0 ; i < threads.size() ; i++ ) {
+            threads[ i ].join() ;
+        }
+        throw ;
+    }
+
+    csw_encode_part( parts[ 0 ], timing ) ;
+
+    for ( size_t i = 0 ; i < threads.size() ; i++ ) {
+        threads[ i ].join() ;
+    }
+
+    // Finally append the encoded parts to the output stream in order.
+
+    for ( size_t i = 0 ; i < part_count ; i++ ) {
+        if ( parts[ i ].failure ) {
+            std::rethrow_exception( parts[ i ].failure ) ;
+        }
+        pzx_out( parts[ i ].pulses ) ;
+    }
+
+    if ( ( pulse_count & 1 ) != 0 ) {
+        level = ! level ;
+    }
+
+    return pulse_count ;
+}
+
+}
+
+/**
+ * Render CSW encoded pulses to the output stream.
+ */
+uquad csw_render_block( bool & level, const uint sample_rate, const byte * const data, const size_t size )
+{
+    hope( sample_rate > 0 ) ;
+    hope( data || size == 0 ) ;
+
+    const CswTiming & timing = csw_prepare_timing( sample_rate ) ;
+
+    // Split large blocks among multiple threads if permitted.
+
+    if ( thread_count > 1 && size >= 2 * part_size_limit ) {
+        return csw_render_parallel( level, timing, data, size ) ;
+    }
+
+    return csw_decode( NULL, timing, level, data, data + size ) ;
+}
+
 /**
  * Unpack given CSW block to given buffer.
  */
-void csw_unpack_block( Buffer & buffer, const byte * const data, const uint size )
+void csw_unpack_block( Buffer & buffer, const byte * const data, const size_t size )
 {
     hope( data || size == 0 ) ;
 
@@ -95,24 +597,37 @@ void csw_unpack_block( Buffer & buffer, const byte * const data, const uint size
         return ;
     }
 
+    const StatsPhase phase = stats_enter( STATS_PARSE ) ;
+
 #ifdef NO_ZLIB
 
     warn( "zlib support si not compiled in, so CSW Z-RLE compression is not supported" ) ;
+    stats_leave( phase ) ;
     return ;
 
 #else // NO_ZLIB
 
-    // Initialize the zlib stream stucture.
+    // Initialize the zlib stream stucture. As zlib can't handle more than
+    // 4GB at once, the input is fed to it in smaller pieces.
+
+    const uint piece_limit = 0x40000000 ;
+
+    const byte * input = data ;
+    size_t input_left = size ;
 
     z_stream stream ;
     stream.zalloc = Z_NULL ;
     stream.zfree = Z_NULL ;
     stream.opaque = NULL ;
-    stream.next_in = const_cast< byte * >( data ) ;
-    stream.avail_in = size ;
+    stream.next_in = const_cast< byte * >( input ) ;
+    stream.avail_in = uint( input_left > piece_limit ? piece_limit : input_left ) ;
+
+    input += stream.avail_in ;
+    input_left -= stream.avail_in ;
 
     if ( inflateInit( &stream ) != Z_OK ) {
         warn( "error initializing zlib decompressor for CSW block: %s", stream.msg ? stream.msg : "unknown error" ) ;
+        stats_leave( phase ) ;
         return ;
     }
 
@@ -129,6 +644,13 @@ void csw_unpack_block( Buffer & buffer, const byte * const data, const uint size
         stream.next_out = chunk ;
         stream.avail_out = chunk_size ;
 
+        if ( stream.avail_in == 0 && input_left > 0 ) {
+            stream.next_in = const_cast< byte * >( input ) ;
+            stream.avail_in = uint( input_left > piece_limit ? piece_limit : input_left ) ;
+            input += stream.avail_in ;
+            input_left -= stream.avail_in ;
+        }
+
         result = inflate( &stream, Z_NO_FLUSH ) ;
 
         if ( result != Z_OK && result != Z_STREAM_END ) {
@@ -136,7 +658,16 @@ void csw_unpack_block( Buffer & buffer, const byte * const data, const uint size
             break ;
         }
 
-        buffer.write( chunk, chunk_size - stream.avail_out ) ;
+        // Make sure the decompressor is released in case the buffer can't grow anymore.
+
+        try {
+            buffer.write( chunk, chunk_size - stream.avail_out ) ;
+        }
+        catch ( ... ) {
+            inflateEnd( &stream ) ;
+            stats_leave( phase ) ;
+            throw ;
+        }
 
     } while ( result != Z_STREAM_END ) ;
 
@@ -144,6 +675,8 @@ void csw_unpack_block( Buffer & buffer, const byte * const data, const uint size
 
     inflateEnd( &stream ) ;
 
+    stats_leave( phase ) ;
+
 #endif // NO_ZLIB
 
 }
@@ -151,7 +684,7 @@ void csw_unpack_block( Buffer & buffer, const byte * const data, const uint size
 /**
  * Render CSW encoded pulses to the output stream.
  */
-uint csw_render_block( bool & level, const uint compression, const uint sample_rate, const byte * const data, const uint size )
+uquad csw_render_block( bool & level, const uint compression, const uint sample_rate, const byte * const data, const size_t size )
 {
     // Process the data depending on the compression.
 
@@ -160,9 +693,33 @@ uint csw_render_block( bool & level, const uint compression, const uint sample_r
             return csw_render_block( level, sample_rate, data, size ) ;
         }
         case 2: {
-            Buffer buffer ;
-            csw_unpack_block( buffer, data, size ) ;
-            return csw_render_block( level, sample_rate, buffer.get_data(), buffer.get_data_size() ) ;
+
+            // Use the cached data if this block was unpacked before.
+
+            const CacheGuard guard ;
+
+            const Buffer * const cached_buffer = csw_get_cached_block( data, size ) ;
+
+            if ( cached_buffer ) {
+                return csw_render_block( level, sample_rate, cached_buffer->get_data(), cached_buffer->get_data_size() ) ;
+            }
+
+            // Otherwise unpack it and keep it around in case it is needed again.
+
+            Buffer * const buffer = new Buffer ;
+            uquad pulse_count ;
+
+            try {
+                csw_unpack_block( *buffer, data, size ) ;
+                pulse_count = csw_render_block( level, sample_rate, buffer->get_data(), buffer->get_data_size() ) ;
+            }
+            catch ( ... ) {
+                delete buffer ;
+                throw ;
+            }
+
+            csw_cache_block( data, size, buffer ) ;
+            return pulse_count ;
         }
         default: {
             warn( "unsupported CSW compression 0x%02x scheme", compression ) ;
@@ -174,7 +731,7 @@ uint csw_render_block( bool & level, const uint compression, const uint sample_r
 /**
  * Render given CSW file to the PZX output stream.
  */
-void csw_render( const byte * const data, const uint size )
+void csw_render( const byte * const data, const size_t size )
 {
     hope( data ) ;
     hope( size >= 0x20 ) ;
@@ -197,12 +754,12 @@ void csw_render( const byte * const data, const uint size )
             break ;
         }
         default: {
-            fail( "unsupported CSW major version %u.%02u - stopping", major, minor ) ;
+            fault( "unsupported CSW major version %u.%02u - stopping", major, minor ) ;
         }
     }
 
     if ( header_size > size ) {
-        fail( "CSW header is incomplete" ) ;
+        fault( "CSW header is incomplete" ) ;
     }
 
     if ( minor > supported_minor ) {
@@ -235,17 +792,17 @@ void csw_render( const byte * const data, const uint size )
     // Verify sample rate.
 
     if ( sample_rate == 0 ) {
-        fail( "invalid CSW sample rate %u", sample_rate ) ;
+        fault( "invalid CSW sample rate %u", sample_rate ) ;
     }
 
     // Prepare data block.
 
     if ( data_offset > size ) {
-        fail( "CSW file is incomplete" ) ;
+        fault( "CSW file is incomplete" ) ;
     }
 
     const byte * const block = data + data_offset ;
-    const uint block_size = size - data_offset ;
+    const size_t block_size = size - data_offset ;
 
     // Prepare initial level.
 
@@ -253,14 +810,24 @@ void csw_render( const byte * const data, const uint size )
 
     // Process the data depending on the compression.
 
-    const uint pulse_count = csw_render_block( level, compression, sample_rate, block, block_size ) ;
+    stats_count_block( true, "CSW" ) ;
+
+    const StatsPhase phase = stats_enter( STATS_RENDER ) ;
+
+    const uquad pulse_count = csw_render_block( level, compression, sample_rate, block, block_size ) ;
+
+    stats_leave( phase ) ;
+
+    // The file is rendered only once, so there is no point in keeping its data cached.
+
+    csw_clear_cache() ;
 
-    // Verify the pulse count matched.
+    // Verify the pulse count matched. Note that the advertised count has only 32 bits.
 
     if ( major == 2 ) {
         const uint expected_pulse_count = GET4(0x1D) ;
-        if ( pulse_count != expected_pulse_count ) {
-            warn( "real CSW pulse count %u doesn't match the advertised pulse count %u", pulse_count, expected_pulse_count ) ;
+        if ( uint( pulse_count ) != expected_pulse_count ) {
+            warn( "real CSW pulse count %llu doesn't match the advertised pulse count %u", pulse_count, expected_pulse_count ) ;
         }
     }
 }
@@ -17,11 +17,16 @@
 
 // Interface.
 
-uint csw_render_block( bool & level, const uint sample_rate, const byte * const data, const uint size ) ;
-void csw_unpack_block( Buffer & buffer, const byte * const data, const uint size ) ;
+uquad csw_render_block( bool & level, const uint sample_rate, const byte * const data, const size_t size ) ;
+void csw_unpack_block( Buffer & buffer, const byte * const data, const size_t size ) ;
 
-uint csw_render_block( bool & level, const uint compression, const uint sample_rate, const byte * const data, const uint size ) ;
+uquad csw_render_block( bool & level, const uint compression, const uint sample_rate, const byte * const data, const size_t size ) ;
 
-void csw_render( const byte * const data, const uint size ) ;
+void csw_set_cache_limit( const uint limit ) ;
+void csw_clear_cache( void ) ;
+
+void csw_set_thread_count( const uint count ) ;
+
+void csw_render( const byte * const data, const size_t size ) ;
 
 #endif // CSW_H
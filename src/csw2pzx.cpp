@@ -10,12 +10,14 @@
 
 #include "pzx.h"
 #include "csw.h"
+#include "stats.h"
+
+#include <thread>
 
 /**
  * Convert given CSW file to PZX file.
  */
-extern "C"
-int main( int argc, char * * argv )
+int convert( int argc, char * * argv )
 {
     // Make sure the standard I/O is in binary mode.
 
@@ -35,6 +37,9 @@ int main( int argc, char * * argv )
             input_name = argv[ i ] ;
             continue ;
         }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
         switch ( argv[ i ][ 1 ] ) {
             case 'o': {
                 if ( output_name ) {
@@ -43,14 +48,28 @@ int main( int argc, char * * argv )
                 output_name = argv[ ++i ] ;
                 break ;
             }
+            case 'j': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing thread count" ) ;
+                }
+                uint thread_count = uint( atoi( arg ) ) ;
+                if ( thread_count == 0 ) {
+                    thread_count = std::thread::hardware_concurrency() ;
+                }
+                csw_set_thread_count( thread_count ) ;
+                break ;
+            }
             default: {
                 fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
 
                 // Fall through.
             }
             case 'h': {
-                fprintf( stderr, "usage: csw2pzx [-o output_file] [input_file]\n" ) ;
+                fprintf( stderr, "usage: csw2pzx [-j n] [-o output_file] [input_file]\n" ) ;
                 fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
+                fprintf( stderr, "-j n   render large blocks using given number of threads, 0 for one per CPU\n" ) ;
+                stats_usage() ;
                 return EXIT_FAILURE ;
             }
         }
@@ -65,12 +84,17 @@ int main( int argc, char * * argv )
 
     Buffer buffer( 256 * 1024 ) ;
 
+    const StatsPhase phase = stats_enter( STATS_READ ) ;
+
     if ( ! buffer.read( input_file ) ) {
         fail( "error reading input file" ) ;
     }
 
     fclose( input_file ) ;
 
+    stats_leave( phase ) ;
+    stats_add( STATS_BYTES_IN, buffer.get_data_size() ) ;
+
     // Make sure it is the CSW file.
 
     if ( buffer.get_data_size() < 32 || std::memcmp( buffer.get_data(), "Compressed Square Wave\x1a", 23 ) != 0 ) {
@@ -100,5 +124,23 @@ int main( int argc, char * * argv )
         fail( "error while closing the output file" ) ;
     }
 
+    // Report the statistics, if requested.
+
+    stats_report( "csw2pzx" ) ;
+
     return EXIT_SUCCESS ;
 }
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
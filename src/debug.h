@@ -17,6 +17,35 @@
 
 #include <cstdlib>
 #include <cstdio>
+#include <cstdarg>
+
+/**
+ * Exception thrown by the conversion core when it can't continue.
+ *
+ * The core reports its errors with fault() rather than fail(), so it never
+ * terminates the process itself. That is left to the main functions of the
+ * tools, which may use fail() freely.
+ */
+class Failure {
+
+    char message[ 256 ] ;
+
+public:
+
+    Failure( const char * const format, ... )
+    {
+        va_list args ;
+        va_start( args, format ) ;
+        std::vsnprintf( message, sizeof( message ), format, args ) ;
+        va_end( args ) ;
+    }
+
+    const char * what( void ) const
+    {
+        return message ;
+    }
+
+} ;
 
 // Just a lightweight version of some of the stuff I am used to.
 
@@ -27,6 +56,7 @@
 #endif
 
 #define fail(f,...)     (std::fprintf(stderr,"error: " f "\n",##__VA_ARGS__),std::exit(EXIT_FAILURE))
+#define fault(f,...)    (std::fprintf(stderr,"error: " f "\n",##__VA_ARGS__),throw Failure(f,##__VA_ARGS__))
 #define warn(f,...)     (std::fprintf(stderr,"warning: " f "\n",##__VA_ARGS__))
 #define inform(f,...)   (std::fprintf(stderr,"info: " f "\n",##__VA_ARGS__))
 
@@ -67,6 +67,21 @@ inline s32 swapped_endian( const s32 value )
     return static_cast< s32 >( swapped_endian( static_cast< u32 >( value ) ) ) ;
 }
 
+template<>
+inline u64 swapped_endian( const u64 value )
+{
+    return (
+        ( u64( swapped_endian( static_cast< u32 >( value ) ) ) << 32 ) |
+        swapped_endian( static_cast< u32 >( value >> 32 ) )
+    ) ;
+}
+
+template<>
+inline s64 swapped_endian( const s64 value )
+{
+    return static_cast< s64 >( swapped_endian( static_cast< u64 >( value ) ) ) ;
+}
+
 //@}
 
 /**
@@ -0,0 +1,1209 @@
+// $Id$
+
+/**
+ * @file PZX library C interface for reading and playing PZX files.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "libpzx.h"
+#include "pzx.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+/**
+ * State of the PZX block reader.
+ */
+struct libpzx_reader {
+    const byte * data ;
+    size_t size ;
+} ;
+
+/**
+ * State of the PZX pulse iterator.
+ */
+struct libpzx_pulses {
+
+    /**
+     * Reader providing the blocks.
+     */
+    libpzx_reader reader ;
+
+    /**
+     * Tag of the block being expanded, zero if none, and its remaining data.
+     */
+    //@{
+    uint tag ;
+    const byte * data ;
+    uint data_size ;
+    //@}
+
+    /**
+     * Level of the next pulse.
+     */
+    bool level ;
+
+    /**
+     * Remaining repeat count and duration of current pulse of PULS block.
+     */
+    //@{
+    uint pulse_count ;
+    uint pulse_duration ;
+    //@}
+
+    /**
+     * Remaining bits, pulse sequences and tail of current DATA block, as well as
+     * remaining pulses of the sequence of the current bit. The sequences are
+     * kept little endian.
+     */
+    //@{
+    uint bit_count ;
+    uint bit_index ;
+    uint tail_cycles ;
+    uint pulse_count_0 ;
+    uint pulse_count_1 ;
+    const byte * sequence_0 ;
+    const byte * sequence_1 ;
+    const byte * sequence ;
+    uint sequence_count ;
+    //@}
+} ;
+
+/**
+ * Entry of the index used by the player to find given tape position quickly.
+ *
+ * There is an entry for the start of each block, as well as additional entries
+ * within long PULS and DATA blocks, so seeking never has to go through too
+ * many pulses.
+ */
+struct libpzx_player_entry {
+
+    /**
+     * Offset of the block within the file.
+     */
+    size_t offset ;
+
+    /**
+     * Offset within PULS block data or bit index within DATA block where the
+     * entry starts, and the level of the pulse there.
+     */
+    //@{
+    uint skip ;
+    bool level ;
+    //@}
+
+    /**
+     * Tape positions where the entry starts and ends, in T cycles.
+     */
+    //@{
+    uquad start ;
+    uquad end ;
+    //@}
+} ;
+
+/**
+ * State of the PZX player.
+ */
+struct libpzx_player {
+
+    /**
+     * The PZX file being played.
+     */
+    //@{
+    const byte * data ;
+    size_t size ;
+    //@}
+
+    /**
+     * Index of the file ordered by tape position, and index of the entry
+     * where each block starts.
+     */
+    //@{
+    std::vector< libpzx_player_entry > entries ;
+    std::vector< size_t > blocks ;
+    //@}
+
+    /**
+     * Indices of the entries of the STOP blocks which stop the tape, and
+     * index of the first of them the playback has not stopped at yet.
+     *
+     * Such entries are empty, so the seeking would skip them, which is why
+     * the jumps ahead have to stop at them explicitly. Note that looking
+     * back doesn't make the tape stop again at the STOP blocks it already
+     * stopped at, only the explicit seeking does.
+     */
+    //@{
+    std::vector< size_t > stops ;
+    size_t next_stop ;
+    //@}
+
+    /**
+     * Pulse iterator serving as the playback cursor.
+     */
+    libpzx_pulses pulses ;
+
+    /**
+     * Index entry containing the current pulse.
+     */
+    size_t entry ;
+
+    /**
+     * Tape positions where the current pulse starts and ends, and its level.
+     */
+    //@{
+    uquad pulse_start ;
+    uquad pulse_end ;
+    int level ;
+    //@}
+
+    /**
+     * Difference between the time used by the caller and the tape position.
+     */
+    squad time_offset ;
+
+    /**
+     * Set when the tape stopped at STOP block or reached its end.
+     */
+    //@{
+    bool stopped ;
+    bool ended ;
+    //@}
+
+    /**
+     * Set when STOP blocks intended for 48k machines should be honored.
+     */
+    bool machine_48k ;
+} ;
+
+namespace {
+
+/**
+ * Message describing the last error.
+ */
+char error_message[ 256 ] = "" ;
+
+/**
+ * Remember given error message and return error code.
+ */
+int reject( const char * const message )
+{
+    hope( message ) ;
+
+    std::snprintf( error_message, sizeof( error_message ), "%s", message ) ;
+
+    return LIBPZX_ERROR ;
+}
+
+/**
+ * Read little endian value of specified type from given data.
+ */
+template< typename Type >
+Type peek( const byte * const data )
+{
+    Type value ;
+    std::memcpy( &value, data, sizeof( value ) ) ;
+    return little_endian( value ) ;
+}
+
+/**
+ * Start expanding given block with given tag by given pulse iterator.
+ *
+ * Returns LIBPZX_OK with pulse of given duration and level in case the block
+ * consists of single pulse, LIBPZX_END in case the pulses should be taken
+ * from the iterator state, or the code to be returned otherwise.
+ */
+int start_block( libpzx_pulses * const pulses, const libpzx_block & block, uint32_t & duration, int & level )
+{
+    hope( pulses ) ;
+
+    const byte * const data = block.data ;
+    const uint size = block.size ;
+
+    switch ( block.tag ) {
+        case LIBPZX_BLOCK_PULSES: {
+            pulses->tag = block.tag ;
+            pulses->data = data ;
+            pulses->data_size = size ;
+            pulses->level = false ;
+            pulses->pulse_count = 0 ;
+            return LIBPZX_END ;
+        }
+        case LIBPZX_BLOCK_DATA: {
+            if ( size < 8 ) {
+                return reject( "incomplete block detected" ) ;
+            }
+
+            const uint bits = peek< u32 >( data ) ;
+            const uint bit_count = ( bits & 0x7FFFFFFF ) ;
+            const uint pulse_count_0 = data[ 6 ] ;
+            const uint pulse_count_1 = data[ 7 ] ;
+            const uint sequence_size = 2 * ( pulse_count_0 + pulse_count_1 ) ;
+
+            if ( size < 8 + sequence_size ) {
+                return reject( "incomplete block detected" ) ;
+            }
+            if ( size - 8 - sequence_size != ( bit_count + 7 ) / 8 ) {
+                return reject( "bit count does not match the actual data size" ) ;
+            }
+
+            pulses->tag = block.tag ;
+            pulses->data = data + 8 + sequence_size ;
+            pulses->data_size = size - 8 - sequence_size ;
+            pulses->level = ( ( bits >> 31 ) != 0 ) ;
+            pulses->bit_count = bit_count ;
+            pulses->bit_index = 0 ;
+            pulses->tail_cycles = peek< u16 >( data + 4 ) ;
+            pulses->pulse_count_0 = pulse_count_0 ;
+            pulses->pulse_count_1 = pulse_count_1 ;
+            pulses->sequence_0 = data + 8 ;
+            pulses->sequence_1 = data + 8 + 2 * pulse_count_0 ;
+            pulses->sequence_count = 0 ;
+            return LIBPZX_END ;
+        }
+        case LIBPZX_BLOCK_PAUSE: {
+            if ( size < 4 ) {
+                return reject( "incomplete block detected" ) ;
+            }
+            const uint value = peek< u32 >( data ) ;
+            duration = ( value & 0x7FFFFFFF ) ;
+            level = ( value >> 31 ) ;
+            return LIBPZX_OK ;
+        }
+        case LIBPZX_BLOCK_STOP: {
+            if ( size < 2 ) {
+                return reject( "incomplete block detected" ) ;
+            }
+            duration = 0 ;
+            level = peek< u16 >( data ) ;
+            return LIBPZX_STOP ;
+        }
+    }
+
+    // Other blocks don't contain any pulses.
+
+    duration = 0 ;
+    return LIBPZX_OK ;
+}
+
+/**
+ * Fetch next pulse of the block being expanded by given pulse iterator.
+ *
+ * Returns LIBPZX_OK with the pulse, LIBPZX_END at the end of the block,
+ * or LIBPZX_ERROR in case the block is malformed.
+ */
+int next_pulse( libpzx_pulses * const pulses, uint32_t & duration, int & level )
+{
+    hope( pulses ) ;
+
+    if ( pulses->tag == LIBPZX_BLOCK_PULSES ) {
+
+        // Fetch the next pulse repeat count and duration if necessary.
+
+        if ( pulses->pulse_count == 0 ) {
+
+            if ( pulses->data_size == 0 ) {
+                return LIBPZX_END ;
+            }
+
+            if ( pulses->data_size < 2 ) {
+                return reject( "incomplete block detected" ) ;
+            }
+
+            uint count = 1 ;
+            uint value = peek< u16 >( pulses->data ) ;
+            pulses->data += 2 ;
+            pulses->data_size -= 2 ;
+
+            if ( value > 0x8000 ) {
+                if ( pulses->data_size < 2 ) {
+                    return reject( "incomplete block detected" ) ;
+                }
+                count = value & 0x7FFF ;
+                value = peek< u16 >( pulses->data ) ;
+                pulses->data += 2 ;
+                pulses->data_size -= 2 ;
+            }
+            if ( value >= 0x8000 ) {
+                if ( pulses->data_size < 2 ) {
+                    return reject( "incomplete block detected" ) ;
+                }
+                value &= 0x7FFF ;
+                value <<= 16 ;
+                value |= peek< u16 >( pulses->data ) ;
+                pulses->data += 2 ;
+                pulses->data_size -= 2 ;
+            }
+
+            pulses->pulse_count = count ;
+            pulses->pulse_duration = value ;
+        }
+
+        pulses->pulse_count-- ;
+        duration = pulses->pulse_duration ;
+        level = pulses->level ;
+        pulses->level = ! pulses->level ;
+        return LIBPZX_OK ;
+    }
+
+    hope( pulses->tag == LIBPZX_BLOCK_DATA ) ;
+
+    // Choose the sequence for next bit if necessary.
+
+    if ( pulses->sequence_count == 0 ) {
+
+        // Once all bits are done, output the optional tail pulse.
+
+        if ( pulses->bit_index >= pulses->bit_count ) {
+            if ( pulses->tail_cycles == 0 ) {
+                return LIBPZX_END ;
+            }
+            duration = pulses->tail_cycles ;
+            level = pulses->level ;
+            pulses->tail_cycles = 0 ;
+            return LIBPZX_OK ;
+        }
+
+        const uint index = pulses->bit_index++ ;
+        const bool bit = ( ( pulses->data[ index / 8 ] << ( index % 8 ) ) & 0x80 ) != 0 ;
+
+        pulses->sequence = ( bit ? pulses->sequence_1 : pulses->sequence_0 ) ;
+        pulses->sequence_count = ( bit ? pulses->pulse_count_1 : pulses->pulse_count_0 ) ;
+
+        // Bits with empty sequences produce nothing.
+
+        if ( pulses->sequence_count == 0 ) {
+            duration = 0 ;
+            level = pulses->level ;
+            return LIBPZX_OK ;
+        }
+    }
+
+    duration = peek< u16 >( pulses->sequence ) ;
+    level = pulses->level ;
+    pulses->sequence += 2 ;
+    pulses->sequence_count-- ;
+    pulses->level = ! pulses->level ;
+    return LIBPZX_OK ;
+}
+
+}
+
+/**
+ * Get version of the library interface.
+ */
+int libpzx_version( void )
+{
+    return LIBPZX_VERSION ;
+}
+
+/**
+ * Get message describing the last error.
+ */
+const char * libpzx_error( void )
+{
+    return error_message ;
+}
+
+/**
+ * Release memory allocated by the library.
+ */
+void libpzx_free( void * const data )
+{
+    std::free( data ) ;
+}
+
+/**
+ * Remember given error message on behalf of the writer, returning error code.
+ */
+int libpzx_reject( const char * const message )
+{
+    return reject( message ) ;
+}
+
+/**
+ * Remember message describing the exception being handled, returning error code.
+ *
+ * Meant to be called from catch handlers only, so no exception ever escapes
+ * through the C interface.
+ */
+int libpzx_reject_exception( void )
+{
+    try {
+        throw ;
+    }
+    catch ( const Failure & failure ) {
+        return reject( failure.what() ) ;
+    }
+    catch ( const std::bad_alloc & ) {
+        return reject( "out of memory" ) ;
+    }
+    catch ( ... ) {
+        return reject( "unexpected error" ) ;
+    }
+}
+
+/**
+ * Create new block reader of given PZX file in memory.
+ */
+libpzx_reader * libpzx_reader_open( const void * const data, const size_t size )
+{
+    const byte * const bytes = static_cast< const byte * >( data ) ;
+
+    if ( bytes == NULL || size < 8 || peek< u32 >( bytes ) != LIBPZX_BLOCK_HEADER ) {
+        reject( "input is not a PZX file" ) ;
+        return NULL ;
+    }
+
+    libpzx_reader * const reader = new ( std::nothrow ) libpzx_reader ;
+    if ( reader == NULL ) {
+        reject( "out of memory" ) ;
+        return NULL ;
+    }
+
+    reader->data = bytes ;
+    reader->size = size ;
+    return reader ;
+}
+
+/**
+ * Fetch next block of given reader.
+ */
+int libpzx_reader_next( libpzx_reader * const reader, libpzx_block * const block )
+{
+    if ( reader == NULL || block == NULL ) {
+        return reject( "invalid arguments" ) ;
+    }
+
+    if ( reader->size == 0 ) {
+        return LIBPZX_END ;
+    }
+
+    if ( reader->size < 8 ) {
+        return reject( "error reading block header" ) ;
+    }
+
+    const uint tag = peek< u32 >( reader->data ) ;
+    const uint size = peek< u32 >( reader->data + 4 ) ;
+
+    if ( size > reader->size - 8 ) {
+        return reject( "error reading block data" ) ;
+    }
+
+    // Refuse to continue with files we don't understand.
+
+    if ( tag == LIBPZX_BLOCK_HEADER && size >= 2 && reader->data[ 8 ] != PZX_MAJOR ) {
+        return reject( "unsupported PZX major version" ) ;
+    }
+
+    block->tag = tag ;
+    block->size = size ;
+    block->data = reader->data + 8 ;
+
+    reader->data += 8 + size ;
+    reader->size -= 8 + size ;
+
+    return LIBPZX_OK ;
+}
+
+/**
+ * Release given block reader.
+ */
+void libpzx_reader_close( libpzx_reader * const reader )
+{
+    delete reader ;
+}
+
+/**
+ * Create new pulse iterator of given PZX file in memory.
+ */
+libpzx_pulses * libpzx_pulses_open( const void * const data, const size_t size )
+{
+    libpzx_reader * const reader = libpzx_reader_open( data, size ) ;
+    if ( reader == NULL ) {
+        return NULL ;
+    }
+
+    libpzx_pulses * const pulses = new ( std::nothrow ) libpzx_pulses ;
+
+    if ( pulses ) {
+        pulses->reader = *reader ;
+        pulses->tag = 0 ;
+    }
+    else {
+        reject( "out of memory" ) ;
+    }
+
+    libpzx_reader_close( reader ) ;
+
+    return pulses ;
+}
+
+/**
+ * Fetch next pulse of given pulse iterator.
+ */
+int libpzx_pulses_next( libpzx_pulses * const pulses, uint32_t * const duration, int * const level )
+{
+    if ( pulses == NULL || duration == NULL || level == NULL ) {
+        return reject( "invalid arguments" ) ;
+    }
+
+    for ( ; ; ) {
+
+        int result ;
+
+        // Continue with the current block, if there is any,
+        // otherwise start with the next one.
+
+        if ( pulses->tag != 0 ) {
+            result = next_pulse( pulses, *duration, *level ) ;
+            if ( result == LIBPZX_END ) {
+                pulses->tag = 0 ;
+                continue ;
+            }
+        }
+        else {
+            libpzx_block block ;
+            result = libpzx_reader_next( &pulses->reader, &block ) ;
+            if ( result != LIBPZX_OK ) {
+                return result ;
+            }
+            result = start_block( pulses, block, *duration, *level ) ;
+            if ( result == LIBPZX_END ) {
+                continue ;
+            }
+        }
+
+        // Skip the zero pulses, which are not real pulses.
+
+        if ( result == LIBPZX_OK && *duration == 0 ) {
+            continue ;
+        }
+
+        return result ;
+    }
+}
+
+/**
+ * Release given pulse iterator.
+ */
+void libpzx_pulses_close( libpzx_pulses * const pulses )
+{
+    delete pulses ;
+}
+
+namespace {
+
+/**
+ * Number of pulses after which the player index gets a new entry within PULS and DATA blocks.
+ */
+const uint index_pulse_step = 1024 ;
+
+/**
+ * Add new entry to the index of given player.
+ */
+void add_entry( libpzx_player * const player, const size_t offset, const uint skip, const bool level, const uquad position )
+{
+    hope( player ) ;
+
+    if ( ! player->entries.empty() ) {
+        player->entries.back().end = position ;
+    }
+
+    libpzx_player_entry entry ;
+    entry.offset = offset ;
+    entry.skip = skip ;
+    entry.level = level ;
+    entry.start = position ;
+    entry.end = position ;
+    player->entries.push_back( entry ) ;
+}
+
+/**
+ * Count the bits set among given amount of bits starting at given byte.
+ */
+uint count_bits( const byte * data, uint bit_count )
+{
+    hope( data || bit_count == 0 ) ;
+
+    uint count = 0 ;
+
+    for ( ; bit_count >= 8 ; bit_count -= 8 ) {
+        count += __builtin_popcount( *data++ ) ;
+    }
+    if ( bit_count > 0 ) {
+        count += __builtin_popcount( *data >> ( 8 - bit_count ) ) ;
+    }
+
+    return count ;
+}
+
+/**
+ * Add index entries for given block of given player, advancing given tape position past it.
+ */
+int index_block( libpzx_player * const player, const libpzx_block & block, uquad & position )
+{
+    hope( player ) ;
+
+    const size_t offset = ( block.data - 8 ) - player->data ;
+
+    const byte * data = block.data ;
+    uint size = block.size ;
+
+    player->blocks.push_back( player->entries.size() ) ;
+
+    switch ( block.tag ) {
+        case LIBPZX_BLOCK_PULSES: {
+
+            add_entry( player, offset, 0, false, position ) ;
+
+            bool level = false ;
+            uint pulse_count = 0 ;
+
+            while ( size > 0 ) {
+
+                if ( pulse_count >= index_pulse_step ) {
+                    add_entry( player, offset, block.size - size, level, position ) ;
+                    pulse_count = 0 ;
+                }
+
+                if ( size < 2 ) {
+                    return reject( "incomplete block detected" ) ;
+                }
+
+                uint count = 1 ;
+                uint value = peek< u16 >( data ) ;
+                data += 2 ;
+                size -= 2 ;
+
+                if ( value > 0x8000 ) {
+                    if ( size < 2 ) {
+                        return reject( "incomplete block detected" ) ;
+                    }
+                    count = value & 0x7FFF ;
+                    value = peek< u16 >( data ) ;
+                    data += 2 ;
+                    size -= 2 ;
+                }
+                if ( value >= 0x8000 ) {
+                    if ( size < 2 ) {
+                        return reject( "incomplete block detected" ) ;
+                    }
+                    value = ( ( value & 0x7FFF ) << 16 ) | peek< u16 >( data ) ;
+                    data += 2 ;
+                    size -= 2 ;
+                }
+
+                position += uquad( count ) * value ;
+                pulse_count += count ;
+                level ^= ( count & 1 ) ;
+            }
+            break ;
+        }
+        case LIBPZX_BLOCK_DATA: {
+            if ( size < 8 ) {
+                return reject( "incomplete block detected" ) ;
+            }
+
+            const uint bits = peek< u32 >( data ) ;
+            const uint bit_count = ( bits & 0x7FFFFFFF ) ;
+            const uint tail_cycles = peek< u16 >( data + 4 ) ;
+            const uint pulse_count_0 = data[ 6 ] ;
+            const uint pulse_count_1 = data[ 7 ] ;
+            const uint sequence_size = 2 * ( pulse_count_0 + pulse_count_1 ) ;
+
+            if ( size < 8 + sequence_size || size - 8 - sequence_size != ( bit_count + 7 ) / 8 ) {
+                return reject( "bit count does not match the actual data size" ) ;
+            }
+
+            // Sum the sequences, then count the bits set in each byte to know
+            // how many times each is used.
+
+            uquad duration_0 = 0 ;
+            for ( uint i = 0 ; i < pulse_count_0 ; i++ ) {
+                duration_0 += peek< u16 >( data + 8 + 2 * i ) ;
+            }
+
+            uquad duration_1 = 0 ;
+            for ( uint i = 0 ; i < pulse_count_1 ; i++ ) {
+                duration_1 += peek< u16 >( data + 8 + 2 * ( pulse_count_0 + i ) ) ;
+            }
+
+            const byte * const bit_data = data + 8 + sequence_size ;
+
+            bool level = ( ( bits >> 31 ) != 0 ) ;
+            uint pulse_count = 0 ;
+
+            add_entry( player, offset, 0, level, position ) ;
+
+            for ( uint index = 0 ; index < bit_count ; index += 8 ) {
+
+                if ( pulse_count >= index_pulse_step ) {
+                    add_entry( player, offset, index, level, position ) ;
+                    pulse_count = 0 ;
+                }
+
+                const uint step = ( bit_count - index < 8 ? bit_count - index : 8 ) ;
+                const uint bit_1_count = count_bits( bit_data + index / 8, step ) ;
+                const uint bit_0_count = step - bit_1_count ;
+                const uint count = bit_1_count * pulse_count_1 + bit_0_count * pulse_count_0 ;
+
+                position += bit_1_count * duration_1 + bit_0_count * duration_0 ;
+                pulse_count += count ;
+                level ^= ( count & 1 ) ;
+            }
+
+            position += tail_cycles ;
+            break ;
+        }
+        case LIBPZX_BLOCK_PAUSE: {
+            if ( size < 4 ) {
+                return reject( "incomplete block detected" ) ;
+            }
+            add_entry( player, offset, 0, false, position ) ;
+            position += ( peek< u32 >( data ) & 0x7FFFFFFF ) ;
+            break ;
+        }
+        case LIBPZX_BLOCK_STOP: {
+            if ( size < 2 ) {
+                return reject( "incomplete block detected" ) ;
+            }
+            if ( peek< u16 >( data ) != 1 || player->machine_48k ) {
+                player->stops.push_back( player->entries.size() ) ;
+            }
+            add_entry( player, offset, 0, false, position ) ;
+            break ;
+        }
+        default: {
+            add_entry( player, offset, 0, false, position ) ;
+            break ;
+        }
+    }
+
+    player->entries.back().end = position ;
+
+    return LIBPZX_OK ;
+}
+
+/**
+ * Position given player at the start of index entry with given index.
+ */
+void start_playing( libpzx_player * const player, const size_t index )
+{
+    hope( player ) ;
+    hope( index < player->entries.size() ) ;
+
+    const libpzx_player_entry & entry = player->entries[ index ] ;
+
+    libpzx_pulses & pulses = player->pulses ;
+
+    pulses.reader.data = player->data + entry.offset ;
+    pulses.reader.size = player->size - entry.offset ;
+    pulses.tag = 0 ;
+
+    // Entries within blocks need the block to be started first,
+    // then the iterator is moved to the appropriate place.
+
+    if ( entry.skip > 0 ) {
+
+        libpzx_block block ;
+        uint32_t duration ;
+        int level ;
+
+        libpzx_reader_next( &pulses.reader, &block ) ;
+        start_block( &pulses, block, duration, level ) ;
+
+        if ( pulses.tag == LIBPZX_BLOCK_PULSES ) {
+            pulses.data += entry.skip ;
+            pulses.data_size -= entry.skip ;
+        }
+        else {
+            hope( pulses.tag == LIBPZX_BLOCK_DATA ) ;
+            pulses.bit_index = entry.skip ;
+        }
+
+        pulses.level = entry.level ;
+    }
+
+    player->entry = index ;
+    player->pulse_start = entry.start ;
+    player->pulse_end = entry.start ;
+    player->stopped = false ;
+    player->ended = false ;
+}
+
+/**
+ * Advance given player to the next pulse.
+ */
+int advance_player( libpzx_player * const player )
+{
+    hope( player ) ;
+
+    uint32_t duration ;
+    int level ;
+
+    const int result = libpzx_pulses_next( &player->pulses, &duration, &level ) ;
+
+    switch ( result ) {
+        case LIBPZX_OK: {
+            player->pulse_start = player->pulse_end ;
+            player->pulse_end += duration ;
+            player->level = level ;
+
+            // Keep track of the index entry we are in.
+
+            const std::vector< libpzx_player_entry > & entries = player->entries ;
+            while ( player->entry + 1 < entries.size() && entries[ player->entry ].end <= player->pulse_start ) {
+                player->entry++ ;
+            }
+            break ;
+        }
+        case LIBPZX_STOP: {
+            if ( level != 1 || player->machine_48k ) {
+                player->stopped = true ;
+
+                const std::vector< size_t > & stops = player->stops ;
+                if ( player->next_stop < stops.size() && player->entries[ stops[ player->next_stop ] ].start <= player->pulse_end ) {
+                    player->next_stop++ ;
+                }
+            }
+            break ;
+        }
+        case LIBPZX_END: {
+            player->ended = true ;
+            break ;
+        }
+    }
+
+    return result ;
+}
+
+/**
+ * Position given player at given tape position.
+ */
+int seek_player( libpzx_player * const player, const uquad position )
+{
+    hope( player ) ;
+
+    // Find the first index entry which ends after given position. As such
+    // entry is not empty, it also contains the position, unless there is
+    // none. In that case play the last pulse up to the end to get its level.
+
+    const std::vector< libpzx_player_entry > & entries = player->entries ;
+
+    size_t index = 0 ;
+    size_t count = entries.size() ;
+
+    while ( count > 0 ) {
+        const size_t half = count / 2 ;
+        if ( entries[ index + half ].end <= position ) {
+            index += half + 1 ;
+            count -= half + 1 ;
+        }
+        else {
+            count = half ;
+        }
+    }
+
+    if ( index == entries.size() ) {
+        player->level = 0 ;
+        if ( entries.empty() || entries.back().end == 0 ) {
+            player->ended = true ;
+            return LIBPZX_OK ;
+        }
+        while ( entries[ index - 1 ].start == entries[ index - 1 ].end ) {
+            index-- ;
+        }
+        index-- ;
+    }
+
+    start_playing( player, index ) ;
+
+    // Now skip the pulses preceding the position.
+
+    while ( player->pulse_end <= position && ! player->ended ) {
+        if ( advance_player( player ) == LIBPZX_ERROR ) {
+            return LIBPZX_ERROR ;
+        }
+    }
+
+    player->stopped = false ;
+
+    return LIBPZX_OK ;
+}
+
+/**
+ * Jump ahead to given tape position, unless there is a STOP block on the
+ * way, in which case play up to it, so the tape stops there.
+ */
+int jump_player( libpzx_player * const player, const uquad position )
+{
+    hope( player ) ;
+
+    const std::vector< size_t > & stops = player->stops ;
+
+    if ( player->next_stop >= stops.size() ) {
+        return seek_player( player, position ) ;
+    }
+
+    const size_t stop = stops[ player->next_stop ] ;
+    const uquad stop_position = player->entries[ stop ].start ;
+
+    if ( stop_position > position ) {
+        return seek_player( player, position ) ;
+    }
+
+    // Seek to the last pulse before the STOP block, the advancing then
+    // reaches the block itself. At the very start there is no such pulse.
+
+    if ( stop_position > 0 ) {
+        return seek_player( player, stop_position - 1 ) ;
+    }
+
+    start_playing( player, stop ) ;
+    player->level = 0 ;
+
+    return LIBPZX_OK ;
+}
+
+}
+
+/**
+ * Create new player of given PZX file in memory, optionally honoring the STOP blocks meant for 48k machines.
+ *
+ * The playback starts at time zero, use libpzx_player_seek() to start it at any other time.
+ */
+libpzx_player * libpzx_player_open( const void * const data, const size_t size, const int machine_48k )
+{
+    libpzx_reader * const reader = libpzx_reader_open( data, size ) ;
+    if ( reader == NULL ) {
+        return NULL ;
+    }
+
+    libpzx_player * const player = new ( std::nothrow ) libpzx_player ;
+    if ( player == NULL ) {
+        libpzx_reader_close( reader ) ;
+        reject( "out of memory" ) ;
+        return NULL ;
+    }
+
+    player->data = static_cast< const byte * >( data ) ;
+    player->size = size ;
+    player->machine_48k = ( machine_48k != 0 ) ;
+    player->time_offset = 0 ;
+    player->level = 0 ;
+
+    // Index all the blocks.
+
+    libpzx_block block ;
+    int result ;
+    uquad position = 0 ;
+
+    try {
+        while ( ( result = libpzx_reader_next( reader, &block ) ) == LIBPZX_OK ) {
+            if ( index_block( player, block, position ) != LIBPZX_OK ) {
+                result = LIBPZX_ERROR ;
+                break ;
+            }
+        }
+    }
+    catch ( ... ) {
+        result = libpzx_reject_exception() ;
+    }
+
+    libpzx_reader_close( reader ) ;
+
+    if ( result != LIBPZX_END ) {
+        delete player ;
+        return NULL ;
+    }
+
+    // Get ready to play from the first block.
+
+    player->pulses.reader.data = player->data ;
+    player->pulses.reader.size = player->size ;
+    player->pulses.tag = 0 ;
+    player->entry = 0 ;
+    player->next_stop = 0 ;
+    player->pulse_start = 0 ;
+    player->pulse_end = 0 ;
+    player->stopped = false ;
+    player->ended = false ;
+
+    return player ;
+}
+
+/**
+ * Get the level of the tape signal at given time, as well as the time until
+ * which the level is guaranteed to stay the same.
+ *
+ * Returns LIBPZX_STOP in case the tape stopped at STOP block, until
+ * libpzx_player_continue() is used, and LIBPZX_END at the end of the tape.
+ * The level then stays the same forever.
+ *
+ * The queries are fastest when the time doesn't decrease between successive calls.
+ */
+int libpzx_player_level( libpzx_player * const player, const uint64_t time, int * const level, uint64_t * const edge_time )
+{
+    if ( player == NULL || level == NULL ) {
+        return reject( "invalid arguments" ) ;
+    }
+
+    const squad offset_time = squad( time ) - player->time_offset ;
+    const uquad position = ( offset_time > 0 ? uquad( offset_time ) : 0 ) ;
+
+    // Go back or jump far ahead using the index if necessary,
+    // otherwise just advance as far as needed.
+
+    const std::vector< libpzx_player_entry > & entries = player->entries ;
+
+    if ( position < player->pulse_start ) {
+        if ( seek_player( player, position ) != LIBPZX_OK ) {
+            return LIBPZX_ERROR ;
+        }
+    }
+    else if ( player->entry + 1 < entries.size() && position >= entries[ player->entry + 1 ].end && ! player->stopped ) {
+        if ( jump_player( player, position ) != LIBPZX_OK ) {
+            return LIBPZX_ERROR ;
+        }
+    }
+
+    while ( position >= player->pulse_end && ! player->stopped && ! player->ended ) {
+        if ( advance_player( player ) == LIBPZX_ERROR ) {
+            return LIBPZX_ERROR ;
+        }
+    }
+
+    *level = player->level ;
+
+    if ( position >= player->pulse_end ) {
+        if ( edge_time ) {
+            *edge_time = UINT64_MAX ;
+        }
+        return ( player->stopped ? LIBPZX_STOP : LIBPZX_END ) ;
+    }
+
+    if ( edge_time ) {
+        *edge_time = player->pulse_end + player->time_offset ;
+    }
+
+    return LIBPZX_OK ;
+}
+
+/**
+ * Continue playing the tape stopped at STOP block at given time.
+ */
+int libpzx_player_continue( libpzx_player * const player, const uint64_t time )
+{
+    if ( player == NULL ) {
+        return reject( "invalid arguments" ) ;
+    }
+
+    if ( player->stopped ) {
+        player->time_offset = squad( time ) - squad( player->pulse_end ) ;
+        player->stopped = false ;
+    }
+
+    return LIBPZX_OK ;
+}
+
+/**
+ * Continue playing the tape from given tape position at given time.
+ */
+int libpzx_player_seek( libpzx_player * const player, const uint64_t position, const uint64_t time )
+{
+    if ( player == NULL ) {
+        return reject( "invalid arguments" ) ;
+    }
+
+    player->time_offset = squad( time ) - squad( position ) ;
+
+    // The tape stops again at all STOP blocks after the new position.
+
+    const std::vector< size_t > & stops = player->stops ;
+
+    player->next_stop = 0 ;
+    while ( player->next_stop < stops.size() && player->entries[ stops[ player->next_stop ] ].start <= position ) {
+        player->next_stop++ ;
+    }
+
+    return seek_player( player, position ) ;
+}
+
+/**
+ * Continue playing the tape from the start of block with given index at given time.
+ */
+int libpzx_player_seek_block( libpzx_player * const player, const uint32_t index, const uint64_t time )
+{
+    if ( player == NULL || index >= player->blocks.size() ) {
+        return reject( "invalid arguments" ) ;
+    }
+
+    const size_t entry = player->blocks[ index ] ;
+
+    player->time_offset = squad( time ) - squad( player->entries[ entry ].start ) ;
+
+    // The tape stops again at all STOP blocks from the given one on.
+
+    const std::vector< size_t > & stops = player->stops ;
+    player->next_stop = std::lower_bound( stops.begin(), stops.end(), entry ) - stops.begin() ;
+
+    start_playing( player, entry ) ;
+
+    return LIBPZX_OK ;
+}
+
+/**
+ * Get total duration of the tape in T cycles.
+ */
+uint64_t libpzx_player_length( libpzx_player * const player )
+{
+    return ( player && ! player->entries.empty() ? player->entries.back().end : 0 ) ;
+}
+
+/**
+ * Get tape position played at given time, in T cycles.
+ */
+uint64_t libpzx_player_position( libpzx_player * const player, const uint64_t time )
+{
+    if ( player == NULL ) {
+        return 0 ;
+    }
+
+    const squad offset_time = squad( time ) - player->time_offset ;
+
+    return ( offset_time > 0 ? uquad( offset_time ) : 0 ) ;
+}
+
+/**
+ * Get tape position where the block with given index starts, in T cycles.
+ *
+ * Returns LIBPZX_END in case there is no such block.
+ */
+int libpzx_player_block_position( libpzx_player * const player, const uint32_t index, uint64_t * const position )
+{
+    if ( player == NULL || position == NULL ) {
+        return reject( "invalid arguments" ) ;
+    }
+
+    if ( index >= player->blocks.size() ) {
+        return LIBPZX_END ;
+    }
+
+    *position = player->entries[ player->blocks[ index ] ].start ;
+
+    return LIBPZX_OK ;
+}
+
+/**
+ * Release given player.
+ */
+void libpzx_player_close( libpzx_player * const player )
+{
+    delete player ;
+}
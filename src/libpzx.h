@@ -0,0 +1,147 @@
+// $Id$
+
+/**
+ * @file PZX library C interface.
+ *
+ * Allows emulators and other programs to read and write PZX files and to
+ * import TZX, TAP and CSW files in memory, using the same code as the PZX tools.
+ *
+ * All functions returning int return LIBPZX_OK on success and LIBPZX_ERROR
+ * on failure, in which case libpzx_error() describes what went wrong.
+ * The handles are opaque and must be released with the corresponding close
+ * function. Only one writer or import may be in progress at any time, as the
+ * conversion core is not reentrant, so use the library from one thread only.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#ifndef LIBPZX_H
+#define LIBPZX_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined( __GNUC__ )
+#define LIBPZX_API  __attribute__(( visibility( "default" ) ))
+#else
+#define LIBPZX_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Version of this interface.
+
+#define LIBPZX_VERSION  1
+
+// Status codes.
+
+#define LIBPZX_OK       0
+#define LIBPZX_END      1
+#define LIBPZX_STOP     2
+#define LIBPZX_ERROR    (-1)
+
+// PZX block tags, as stored in the file and read as little endian number.
+
+#define LIBPZX_TAG(a,b,c,d) ((uint32_t)(a)|(uint32_t)(b)<<8|(uint32_t)(c)<<16|(uint32_t)(d)<<24)
+
+#define LIBPZX_BLOCK_HEADER LIBPZX_TAG('P','Z','X','T')
+#define LIBPZX_BLOCK_PULSES LIBPZX_TAG('P','U','L','S')
+#define LIBPZX_BLOCK_DATA   LIBPZX_TAG('D','A','T','A')
+#define LIBPZX_BLOCK_PAUSE  LIBPZX_TAG('P','A','U','S')
+#define LIBPZX_BLOCK_STOP   LIBPZX_TAG('S','T','O','P')
+#define LIBPZX_BLOCK_BROWSE LIBPZX_TAG('B','R','W','S')
+
+// Opaque handles.
+
+typedef struct libpzx_writer libpzx_writer ;
+typedef struct libpzx_reader libpzx_reader ;
+typedef struct libpzx_pulses libpzx_pulses ;
+typedef struct libpzx_player libpzx_player ;
+
+/**
+ * PZX block as returned by the reader. The data point directly to the
+ * memory passed to the reader, so they are valid only as long as that memory.
+ */
+typedef struct libpzx_block {
+    uint32_t tag ;
+    uint32_t size ;
+    const uint8_t * data ;
+} libpzx_block ;
+
+// Common functions.
+
+LIBPZX_API int libpzx_version( void ) ;
+LIBPZX_API const char * libpzx_error( void ) ;
+LIBPZX_API void libpzx_free( void * data ) ;
+
+// Importers, converting entire TZX, TAP or CSW file to PZX file in newly
+// allocated memory, which the caller releases with libpzx_free().
+
+LIBPZX_API int libpzx_import_tzx( const void * data, size_t size, void * * pzx_data, size_t * pzx_size ) ;
+LIBPZX_API int libpzx_import_tap( const void * data, size_t size, uint32_t pause_ms, void * * pzx_data, size_t * pzx_size ) ;
+LIBPZX_API int libpzx_import_csw( const void * data, size_t size, void * * pzx_data, size_t * pzx_size ) ;
+
+// Writer, creating PZX file in memory. Durations are in T cycles of 3.5MHz clock.
+// The info strings should be added before any other output.
+
+LIBPZX_API libpzx_writer * libpzx_writer_open( void ) ;
+LIBPZX_API int libpzx_writer_info( libpzx_writer * writer, const char * string ) ;
+LIBPZX_API int libpzx_writer_out( libpzx_writer * writer, uint32_t duration, int level ) ;
+LIBPZX_API int libpzx_writer_pulse( libpzx_writer * writer, uint32_t duration ) ;
+LIBPZX_API int libpzx_writer_data(
+    libpzx_writer * writer,
+    const uint8_t * data,
+    uint32_t bit_count,
+    int initial_level,
+    uint32_t pulse_count_0,
+    uint32_t pulse_count_1,
+    const uint16_t * pulse_sequence_0,
+    const uint16_t * pulse_sequence_1,
+    uint32_t tail_cycles
+) ;
+LIBPZX_API int libpzx_writer_pause( libpzx_writer * writer, uint32_t duration, int level ) ;
+LIBPZX_API int libpzx_writer_stop( libpzx_writer * writer, uint32_t flags ) ;
+LIBPZX_API int libpzx_writer_browse( libpzx_writer * writer, const char * string ) ;
+LIBPZX_API int libpzx_writer_close( libpzx_writer * writer, void * * pzx_data, size_t * pzx_size ) ;
+
+// Block reader, walking blocks of PZX file in memory without copying them.
+// The next function returns LIBPZX_END after the last block.
+
+LIBPZX_API libpzx_reader * libpzx_reader_open( const void * data, size_t size ) ;
+LIBPZX_API int libpzx_reader_next( libpzx_reader * reader, libpzx_block * block ) ;
+LIBPZX_API void libpzx_reader_close( libpzx_reader * reader ) ;
+
+// Pulse iterator, expanding PULS, DATA and PAUS blocks of PZX file in memory
+// to individual pulses. The next function returns LIBPZX_STOP with zero
+// duration for each STOP block, the flags of which are passed as the level,
+// and LIBPZX_END after the last pulse. Pulses of zero duration are skipped,
+// only their effect on the level is retained.
+
+LIBPZX_API libpzx_pulses * libpzx_pulses_open( const void * data, size_t size ) ;
+LIBPZX_API int libpzx_pulses_next( libpzx_pulses * pulses, uint32_t * duration, int * level ) ;
+LIBPZX_API void libpzx_pulses_close( libpzx_pulses * pulses ) ;
+
+// Player, answering what the tape signal level is at given time, as needed by
+// emulators playing the tape. The times are in T cycles of 3.5MHz clock and
+// may use any origin, the positions are in T cycles from the start of the tape.
+// STOP blocks meant for 48k machines only are honored if machine_48k is set.
+
+LIBPZX_API libpzx_player * libpzx_player_open( const void * data, size_t size, int machine_48k ) ;
+LIBPZX_API int libpzx_player_level( libpzx_player * player, uint64_t time, int * level, uint64_t * edge_time ) ;
+LIBPZX_API int libpzx_player_continue( libpzx_player * player, uint64_t time ) ;
+LIBPZX_API int libpzx_player_seek( libpzx_player * player, uint64_t position, uint64_t time ) ;
+LIBPZX_API int libpzx_player_seek_block( libpzx_player * player, uint32_t index, uint64_t time ) ;
+LIBPZX_API uint64_t libpzx_player_length( libpzx_player * player ) ;
+LIBPZX_API uint64_t libpzx_player_position( libpzx_player * player, uint64_t time ) ;
+LIBPZX_API int libpzx_player_block_position( libpzx_player * player, uint32_t index, uint64_t * position ) ;
+LIBPZX_API void libpzx_player_close( libpzx_player * player ) ;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBPZX_H
@@ -0,0 +1,380 @@
+// $Id$
+
+/**
+ * @file PZX library C interface for writing PZX files and importing other formats.
+ *
+ * Kept apart from the rest of the library, so the tools which only read PZX
+ * files don't need to link the whole conversion core.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "libpzx.h"
+#include "pzx.h"
+#include "tzx.h"
+#include "tap.h"
+#include "csw.h"
+
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * State of the PZX writer.
+ */
+struct libpzx_writer {
+    Buffer buffer ;
+    bool failed ;
+} ;
+
+/**
+ * Remember given error message, or the message of the exception being handled, and return error code, see libpzx.cpp.
+ */
+//@{
+int libpzx_reject( const char * const message ) ;
+int libpzx_reject_exception( void ) ;
+//@}
+
+namespace {
+
+/**
+ * Writer currently in use, as the PZX output stream may serve only one at a time.
+ */
+libpzx_writer * active_writer ;
+
+/**
+ * Check that given writer may be used, returning error code if it may not.
+ */
+int check_writer( libpzx_writer * const writer )
+{
+    if ( writer == NULL || writer != active_writer ) {
+        return libpzx_reject( "invalid writer" ) ;
+    }
+    if ( writer->failed ) {
+        return libpzx_reject( "writer failed previously" ) ;
+    }
+    return LIBPZX_OK ;
+}
+
+/**
+ * Abandon all output of given writer after the conversion core failed.
+ *
+ * Meant to be called from catch handlers only, as the error message is
+ * taken from the exception being handled.
+ */
+int abandon_writer( libpzx_writer * const writer )
+{
+    hope( writer ) ;
+
+    pzx_abort() ;
+    csw_clear_cache() ;
+
+    writer->failed = true ;
+
+    return libpzx_reject_exception() ;
+}
+
+/**
+ * Macro for running given conversion core statement on behalf of given writer.
+ */
+#define WRITE(writer,statement)                                 \
+    do {                                                        \
+        if ( check_writer( writer ) != LIBPZX_OK ) {            \
+            return LIBPZX_ERROR ;                               \
+        }                                                       \
+        try {                                                   \
+            statement ;                                         \
+        }                                                       \
+        catch ( ... ) {                                         \
+            return abandon_writer( writer ) ;                   \
+        }                                                       \
+        return LIBPZX_OK ;                                      \
+    } while ( false )
+
+/**
+ * Import format of given kind from given data.
+ */
+enum Import {
+    IMPORT_TZX,
+    IMPORT_TAP,
+    IMPORT_CSW,
+} ;
+
+/**
+ * Convert given file in given format to PZX file in memory.
+ */
+int import( const Import format, const byte * const data, const size_t size, const uint pause_duration, void * * const pzx_data, size_t * const pzx_size )
+{
+    if ( ( data == NULL && size > 0 ) || pzx_data == NULL || pzx_size == NULL ) {
+        return libpzx_reject( "invalid arguments" ) ;
+    }
+
+    // Check the signature first, as the renderers expect valid files.
+
+    switch ( format ) {
+        case IMPORT_TZX: {
+            if ( size < 10 || std::memcmp( data, "ZXTape!\x1a", 8 ) != 0 ) {
+                return libpzx_reject( "input is not a TZX file" ) ;
+            }
+            break ;
+        }
+        case IMPORT_CSW: {
+            if ( size < 32 || std::memcmp( data, "Compressed Square Wave\x1a", 23 ) != 0 ) {
+                return libpzx_reject( "input is not a CSW file" ) ;
+            }
+            break ;
+        }
+        case IMPORT_TAP: {
+            break ;
+        }
+    }
+
+    // Now render the file using a writer of our own.
+
+    libpzx_writer * const writer = libpzx_writer_open() ;
+    if ( writer == NULL ) {
+        return LIBPZX_ERROR ;
+    }
+
+    try {
+        switch ( format ) {
+            case IMPORT_TZX: {
+                tzx_render( data, data + size ) ;
+                break ;
+            }
+            case IMPORT_CSW: {
+                csw_render( data, size ) ;
+                break ;
+            }
+            case IMPORT_TAP: {
+                tap_render( data, size, pause_duration ) ;
+                break ;
+            }
+        }
+    }
+    catch ( ... ) {
+        abandon_writer( writer ) ;
+        libpzx_writer_close( writer, NULL, NULL ) ;
+        return LIBPZX_ERROR ;
+    }
+
+    return libpzx_writer_close( writer, pzx_data, pzx_size ) ;
+}
+
+}
+
+/**
+ * Convert given TZX file to PZX file in memory.
+ */
+int libpzx_import_tzx( const void * const data, const size_t size, void * * const pzx_data, size_t * const pzx_size )
+{
+    return import( IMPORT_TZX, static_cast< const byte * >( data ), size, 0, pzx_data, pzx_size ) ;
+}
+
+/**
+ * Convert given TAP file to PZX file in memory, separating the blocks with pauses of given duration.
+ */
+int libpzx_import_tap( const void * const data, const size_t size, const uint32_t pause_ms, void * * const pzx_data, size_t * const pzx_size )
+{
+    if ( pause_ms > 10 * 60 * 1000 ) {
+        return libpzx_reject( "pause duration is out of range" ) ;
+    }
+    return import( IMPORT_TAP, static_cast< const byte * >( data ), size, pause_ms * MILLISECOND_CYCLES, pzx_data, pzx_size ) ;
+}
+
+/**
+ * Convert given CSW file to PZX file in memory.
+ */
+int libpzx_import_csw( const void * const data, const size_t size, void * * const pzx_data, size_t * const pzx_size )
+{
+    return import( IMPORT_CSW, static_cast< const byte * >( data ), size, 0, pzx_data, pzx_size ) ;
+}
+
+/**
+ * Create new writer, producing PZX file in memory.
+ */
+libpzx_writer * libpzx_writer_open( void )
+{
+    if ( active_writer ) {
+        libpzx_reject( "another writer is already in use" ) ;
+        return NULL ;
+    }
+
+    libpzx_writer * writer = NULL ;
+
+    try {
+        writer = new libpzx_writer ;
+    }
+    catch ( ... ) {
+        libpzx_reject_exception() ;
+        return NULL ;
+    }
+
+    writer->failed = false ;
+
+    active_writer = writer ;
+
+    try {
+        pzx_open( writer->buffer ) ;
+    }
+    catch ( ... ) {
+        abandon_writer( writer ) ;
+        libpzx_writer_close( writer, NULL, NULL ) ;
+        return NULL ;
+    }
+
+    return writer ;
+}
+
+/**
+ * Append given info string to PZX header.
+ */
+int libpzx_writer_info( libpzx_writer * const writer, const char * const string )
+{
+    if ( string == NULL ) {
+        return libpzx_reject( "invalid arguments" ) ;
+    }
+    WRITE( writer, pzx_info( string ) ) ;
+}
+
+/**
+ * Extend the output signal by given duration of given level.
+ */
+int libpzx_writer_out( libpzx_writer * const writer, const uint32_t duration, const int level )
+{
+    WRITE( writer, pzx_out( duration, level != 0 ) ) ;
+}
+
+/**
+ * Append pulse of given duration to the output, toggling the level.
+ */
+int libpzx_writer_pulse( libpzx_writer * const writer, const uint32_t duration )
+{
+    if ( duration >= 0x80000000 ) {
+        return libpzx_reject( "pulse duration is out of range" ) ;
+    }
+    WRITE( writer, pzx_pulse( duration ) ) ;
+}
+
+/**
+ * Append DATA block with given bits encoded by given pulse sequences.
+ */
+int libpzx_writer_data(
+    libpzx_writer * const writer,
+    const uint8_t * const data,
+    const uint32_t bit_count,
+    const int initial_level,
+    const uint32_t pulse_count_0,
+    const uint32_t pulse_count_1,
+    const uint16_t * const pulse_sequence_0,
+    const uint16_t * const pulse_sequence_1,
+    const uint32_t tail_cycles
+)
+{
+    if (
+        ( data == NULL && bit_count > 0 ) || bit_count >= 0x80000000 ||
+        pulse_count_0 > 0xFF || pulse_count_1 > 0xFF ||
+        ( pulse_sequence_0 == NULL && pulse_count_0 > 0 ) ||
+        ( pulse_sequence_1 == NULL && pulse_count_1 > 0 ) ||
+        tail_cycles > 0xFFFF
+    ) {
+        return libpzx_reject( "invalid arguments" ) ;
+    }
+    WRITE(
+        writer,
+        pzx_data( data, bit_count, initial_level != 0, pulse_count_0, pulse_count_1, pulse_sequence_0, pulse_sequence_1, tail_cycles )
+    ) ;
+}
+
+/**
+ * Append PAUS block of given duration and level.
+ */
+int libpzx_writer_pause( libpzx_writer * const writer, const uint32_t duration, const int level )
+{
+    if ( duration >= 0x80000000 ) {
+        return libpzx_reject( "pause duration is out of range" ) ;
+    }
+    WRITE( writer, pzx_pause( duration, level != 0 ) ) ;
+}
+
+/**
+ * Append STOP block with given flags.
+ */
+int libpzx_writer_stop( libpzx_writer * const writer, const uint32_t flags )
+{
+    if ( flags > 0xFFFF ) {
+        return libpzx_reject( "invalid arguments" ) ;
+    }
+    WRITE( writer, pzx_stop( flags ) ) ;
+}
+
+/**
+ * Append BRWS block with given string.
+ */
+int libpzx_writer_browse( libpzx_writer * const writer, const char * const string )
+{
+    if ( string == NULL ) {
+        return libpzx_reject( "invalid arguments" ) ;
+    }
+    WRITE( writer, pzx_browse( string ) ) ;
+}
+
+/**
+ * Finish the output of given writer and release it, passing the resulting
+ * PZX file to the caller, or discarding it in case @a pzx_data is NULL.
+ */
+int libpzx_writer_close( libpzx_writer * const writer, void * * const pzx_data, size_t * const pzx_size )
+{
+    if ( writer == NULL || writer != active_writer ) {
+        return libpzx_reject( "invalid writer" ) ;
+    }
+
+    // Flush the pending output, unless it is abandoned anyway.
+
+    bool ok = ! writer->failed ;
+
+    if ( ok && pzx_data ) {
+        try {
+            pzx_close() ;
+        }
+        catch ( ... ) {
+            abandon_writer( writer ) ;
+            ok = false ;
+        }
+    }
+    else {
+        pzx_abort() ;
+    }
+
+    active_writer = NULL ;
+
+    // Hand over copy of the result if requested, as the caller releases it
+    // with libpzx_free(), otherwise just discard it.
+
+    if ( pzx_data == NULL ) {
+        delete writer ;
+        return LIBPZX_OK ;
+    }
+
+    if ( ok ) {
+        const size_t size = writer->buffer.get_data_size() ;
+        void * const data = std::malloc( size ) ;
+
+        if ( data == NULL ) {
+            libpzx_reject( "out of memory" ) ;
+            ok = false ;
+        }
+        else {
+            std::memcpy( data, writer->buffer.get_data(), size ) ;
+            *pzx_data = data ;
+            if ( pzx_size ) {
+                *pzx_size = size ;
+            }
+        }
+    }
+
+    delete writer ;
+
+    return ( ok ? LIBPZX_OK : LIBPZX_ERROR ) ;
+}
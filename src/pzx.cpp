@@ -12,13 +12,17 @@
  */
 
 #include "pzx.h"
+#include "stats.h"
 
 namespace {
 
 /**
- * File currently used for output, if any.
+ * File or buffer currently used for output, if any.
  */
+//@{
 FILE * output_file ;
+Buffer * output_buffer ;
+//@}
 
 /**
  * Buffer used for PZX header.
@@ -30,6 +34,16 @@ Buffer header_buffer ;
  */
 Buffer pulse_buffer ;
 
+/**
+ * Level of the next pulse stored in current PULS block.
+ */
+bool pulse_level ;
+
+/**
+ * Size at which the PULS block is split, so its size always fits in 32 bits.
+ */
+const uint pulse_block_limit = 0xFFFFFFF0 ;
+
 /**
  * Buffer used for temporary block data.
  */
@@ -67,7 +81,7 @@ void pzx_open( FILE * file )
 
     // Remember the file.
 
-    hope( output_file == NULL ) ;
+    hope( output_file == NULL && output_buffer == NULL ) ;
     output_file = file ;
 
     // Make sure the file starts with a PZX header.
@@ -75,12 +89,27 @@ void pzx_open( FILE * file )
     pzx_header( NULL, 0 ) ;
 }
 
+/**
+ * Use given buffer for subsequent PZX output, appending the PZX file to its content.
+ */
+void pzx_open( Buffer & buffer )
+{
+    // Remember the buffer.
+
+    hope( output_file == NULL && output_buffer == NULL ) ;
+    output_buffer = &buffer ;
+
+    // Make sure the file starts with a PZX header.
+
+    pzx_header( NULL, 0 ) ;
+}
+
 /**
  * Commit any buffered PZX output to PZX output file and stop using that file.
  */
 void pzx_close( void )
 {
-    hope( output_file ) ;
+    hope( output_file || output_buffer ) ;
 
     // Flush pending output.
 
@@ -89,28 +118,66 @@ void pzx_close( void )
     // Forget about the file.
 
     output_file = NULL ;
+    output_buffer = NULL ;
+}
+
+/**
+ * Stop using the PZX output file, discarding any pending output.
+ *
+ * Used to recover after the conversion was abandoned due to a failure,
+ * so the PZX stream may be used again.
+ */
+void pzx_abort( void )
+{
+    header_buffer.clear() ;
+    pulse_buffer.clear() ;
+    data_buffer.clear() ;
+    pack_buffer.clear() ;
+
+    pulse_level = false ;
+    pulse_count = 0 ;
+    pulse_duration = 0 ;
+    last_duration = 0 ;
+    last_level = false ;
+
+    output_file = NULL ;
+    output_buffer = NULL ;
 }
 
 /**
  * Write given memory block of given size to output file.
  */
-void pzx_write( const void * const data, const uint size )
+void pzx_write( const void * const data, const size_t size )
 {
     hope( data || size == 0 ) ;
-    hope( output_file ) ;
+    hope( output_file || output_buffer ) ;
 
     // Just write everything, freaking out in case of problems.
 
-    if ( std::fwrite( data, 1, size, output_file ) != size ) {
-        fail( "error writing to file" ) ;
+    const StatsPhase phase = stats_enter( STATS_WRITE ) ;
+
+    if ( output_buffer ) {
+        output_buffer->write( data, size ) ;
+    }
+    else if ( std::fwrite( data, 1, size, output_file ) != size ) {
+        fault( "error writing to file" ) ;
     }
+
+    stats_leave( phase ) ;
+    stats_add( STATS_BYTES_OUT, size ) ;
 }
 
 /**
  * Write given memory block of given size to output file as PZX block with given tag.
  */
-void pzx_write_block( const uint tag, const void * const data, const uint size )
+void pzx_write_block( const uint tag, const void * const data, const size_t size )
 {
+    // Make sure the size fits in the block header.
+
+    if ( size > 0xFFFFFFFF ) {
+        fault( "PZX block is too large" ) ;
+    }
+
     // Prepare block header.
 
     u32 header[ 2 ] ;
@@ -121,6 +188,8 @@ void pzx_write_block( const uint tag, const void * const data, const uint size )
 
     pzx_write( header, sizeof( header ) ) ;
     pzx_write( data, size ) ;
+
+    stats_count_block( false, tag ) ;
 }
 
 /**
@@ -185,30 +254,72 @@ void pzx_info( const char * const string )
 }
 
 /**
- * Append given amount of pulses of given duration to PZX pulse block.
+ * Encode given amount of pulses of given duration as PZX pulse entry.
  *
- * @note The @a count and @a duration must fit in 15 and 31 bits, respectively.
+ * Returns the number of words of the entry.
  */
-void pzx_store( const uint count, const uint duration )
+uint pzx_encode_entry( word * const entry, const uint count, const uint duration )
 {
-    hope( count > 0 ) ;
-    hope( count < 0x8000 ) ;
-    hope( duration < 0x80000000 ) ;
+    uint size = 0 ;
 
     // Store the count if there were multiple pulses or the duration encoding requires that.
 
     if ( count > 1 || duration > 0xFFFF ) {
-        pulse_buffer.write_little< u16 >( 0x8000 | count ) ;
+        entry[ size++ ] = 0x8000 | count ;
     }
 
     // Now store the duration itself using either the short or long encoding.
 
     if ( duration < 0x8000 ) {
-        pulse_buffer.write_little< u16 >( duration ) ;
+        entry[ size++ ] = duration ;
     }
     else {
-        pulse_buffer.write_little< u16 >( 0x8000 | ( duration >> 16 ) ) ;
-        pulse_buffer.write_little< u16 >( duration & 0xFFFF ) ;
+        entry[ size++ ] = 0x8000 | ( duration >> 16 ) ;
+        entry[ size++ ] = duration & 0xFFFF ;
+    }
+
+    return size ;
+}
+
+/**
+ * Append given amount of pulses of given duration to PZX pulse block.
+ *
+ * @note The @a count and @a duration must fit in 15 and 31 bits, respectively.
+ */
+void pzx_store( const uint count, const uint duration )
+{
+    hope( count > 0 ) ;
+    hope( count < 0x8000 ) ;
+    hope( duration < 0x80000000 ) ;
+
+    stats_add( STATS_PULSES_OUT, count ) ;
+
+    // If the PULS block is about to grow too large, start a new one. As
+    // each block starts with low level, use zero pulse to preserve the
+    // level if necessary.
+
+    if ( pulse_buffer.get_data_size() >= pulse_block_limit ) {
+        const bool level = pulse_level ;
+        pzx_write_buffer( PZX_PULSES, pulse_buffer ) ;
+        pulse_level = false ;
+        if ( level ) {
+            pulse_buffer.write_little< u16 >( 0 ) ;
+            pulse_level = true ;
+        }
+    }
+
+    if ( ( count & 1 ) != 0 ) {
+        pulse_level = ! pulse_level ;
+    }
+
+    // Now store the entry itself.
+
+    word entry[ 3 ] ;
+
+    const uint entry_size = pzx_encode_entry( entry, count, duration ) ;
+
+    for ( uint i = 0 ; i < entry_size ; i++ ) {
+        pulse_buffer.write_little< u16 >( entry[ i ] ) ;
     }
 }
 
@@ -291,6 +402,307 @@ void pzx_out( const uint duration, const bool level )
     }
 }
 
+/**
+ * Append pulse of given duration and given pulse level to PZX pulse block,
+ * even if the duration doesn't fit in 32 bits.
+ */
+void pzx_out_duration( uquad duration, const bool level )
+{
+    const uint limit = 0xFFFFFFFF ;
+
+    while ( duration > limit ) {
+        pzx_out( limit, level ) ;
+        duration -= limit ;
+    }
+
+    pzx_out( uint( duration ), level ) ;
+}
+
+/**
+ * Append given pulses of alternating level, starting with given level, to PZX pulse block.
+ */
+void pzx_out( const uquad * const durations, const uint count, const bool initial_level )
+{
+    hope( durations || count == 0 ) ;
+
+    const uint limit = 0x7FFFFFFF ;
+
+    bool level = initial_level ;
+
+    for ( uint i = 0 ; i < count ; i++ ) {
+
+        const uquad duration = durations[ i ] ;
+
+        // Most of the time the level changes and the duration fits, so the
+        // previous pulse is simply complete and the new one replaces it.
+
+        if ( last_level != level && duration > 0 && duration <= limit ) {
+            pzx_pulse( last_duration ) ;
+            last_duration = uint( duration ) ;
+            last_level = level ;
+        }
+        else {
+            pzx_out_duration( duration, level ) ;
+        }
+
+        level = ! level ;
+    }
+}
+
+/**
+ * Append given amount of pulses of given duration to PZX pulse block.
+ *
+ * Same as calling pzx_pulse() given amount of times.
+ */
+void pzx_repeat( const uint duration, uquad count )
+{
+    while ( count > 0 ) {
+
+        // Store the previous pulses unless they may be extended.
+
+        if ( pulse_count > 0 && ( pulse_duration != duration || pulse_count == 0x7FFF ) ) {
+            pzx_store( pulse_count, pulse_duration ) ;
+            pulse_count = 0 ;
+        }
+
+        if ( pulse_count == 0 ) {
+            pulse_duration = duration ;
+        }
+
+        // Add as many pulses as the count limit permits.
+
+        const uint room = 0x7FFF - pulse_count ;
+        const uint added = uint( count < room ? count : room ) ;
+
+        pulse_count += added ;
+        count -= added ;
+    }
+}
+
+/**
+ * Append pulse of given duration to separately encoded pulses.
+ *
+ * Works like pzx_pulse(), except that the first run of pulses is kept aside.
+ */
+void pzx_encode_pulse( PzxPulses & pulses, const uint duration )
+{
+    // If the duration matches, just extend the current run.
+
+    if ( pulses.run_count > 0 && pulses.run_duration == duration ) {
+        pulses.run_count++ ;
+        return ;
+    }
+
+    // Otherwise the current run is complete. Keep the first one aside, and
+    // encode the others the same way pzx_pulse() and pzx_store() would.
+
+    if ( pulses.run_count > 0 ) {
+        if ( pulses.first_run_count == 0 ) {
+            pulses.first_run_duration = pulses.run_duration ;
+            pulses.first_run_count = pulses.run_count ;
+        }
+        else {
+            for ( uquad left = pulses.run_count ; left > 0 ; ) {
+
+                const uint count = uint( left > 0x7FFF ? 0x7FFF : left ) ;
+
+                word entry[ 3 ] ;
+
+                const uint entry_size = pzx_encode_entry( entry, count, pulses.run_duration ) ;
+
+                for ( uint i = 0 ; i < entry_size ; i++ ) {
+                    pulses.entries.push_back( entry[ i ] & 0xFF ) ;
+                    pulses.entries.push_back( entry[ i ] >> 8 ) ;
+                }
+
+                left -= count ;
+            }
+            pulses.entry_pulse_count += pulses.run_count ;
+        }
+    }
+
+    // Start the new run.
+
+    pulses.run_duration = duration ;
+    pulses.run_count = 1 ;
+}
+
+/**
+ * Append pulse of given duration and given pulse level to separately encoded pulses.
+ *
+ * Works like pzx_out(), except that the first pulse is kept aside.
+ */
+void pzx_encode( PzxPulses & pulses, const uquad duration, const bool level )
+{
+    // Zero duration doesn't extend anything.
+
+    if ( duration == 0 ) {
+        return ;
+    }
+
+    // As long as the level doesn't change, keep extending the current pulse.
+
+    if ( pulses.pulse_count > 0 && pulses.last_level == level ) {
+        pulses.last_duration += duration ;
+        return ;
+    }
+
+    // Otherwise the current pulse is complete. Keep the first one aside,
+    // and split the others to pulses of encodable duration the same way
+    // pzx_out() would.
+
+    if ( pulses.pulse_count == 1 ) {
+        pulses.first_level = pulses.last_level ;
+        pulses.first_duration = pulses.last_duration ;
+    }
+    else if ( pulses.pulse_count > 1 ) {
+        const uint limit = 0x7FFFFFFF ;
+        const uquad split_count = ( pulses.last_duration - 1 ) / limit ;
+
+        for ( uquad i = 0 ; i < split_count ; i++ ) {
+            pzx_encode_pulse( pulses, limit ) ;
+            pzx_encode_pulse( pulses, 0 ) ;
+        }
+
+        pzx_encode_pulse( pulses, uint( pulses.last_duration - split_count * limit ) ) ;
+    }
+
+    // Start the new pulse.
+
+    pulses.pulse_count++ ;
+    pulses.last_level = level ;
+    pulses.last_duration = duration ;
+}
+
+/**
+ * Append given pulses of alternating level, starting with given level, to separately encoded pulses.
+ */
+void pzx_encode( PzxPulses & pulses, const uquad * const durations, const uint count, const bool initial_level )
+{
+    bool level = initial_level ;
+
+    for ( uint i = 0 ; i < count ; i++ ) {
+        pzx_encode( pulses, durations[ i ], level ) ;
+        level = ! level ;
+    }
+}
+
+/**
+ * Finish separately encoded pulses, so they may be appended to PZX pulse block.
+ */
+void pzx_encode_finish( PzxPulses & pulses )
+{
+    if ( pulses.pulse_count == 1 ) {
+        pulses.first_level = pulses.last_level ;
+        pulses.first_duration = pulses.last_duration ;
+    }
+
+    // The run being accumulated is the last one, unless it is the first one as well.
+
+    if ( pulses.run_count > 0 ) {
+        if ( pulses.first_run_count == 0 ) {
+            pulses.first_run_duration = pulses.run_duration ;
+            pulses.first_run_count = pulses.run_count ;
+        }
+        else {
+            pulses.last_run_duration = pulses.run_duration ;
+            pulses.last_run_count = pulses.run_count ;
+        }
+        pulses.run_count = 0 ;
+    }
+}
+
+/**
+ * Append pulse entries encoded separately to PZX pulse block.
+ */
+void pzx_store_entries( const PzxPulses & pulses )
+{
+    const std::vector< byte > & entries = pulses.entries ;
+
+    if ( entries.empty() ) {
+        return ;
+    }
+
+    // The entries start with pulses of different duration, so the pending
+    // pulses are complete.
+
+    if ( pulse_count > 0 ) {
+        pzx_store( pulse_count, pulse_duration ) ;
+        pulse_count = 0 ;
+    }
+
+    // Unless the PULS block would have to be split, simply append the entries as they are.
+
+    if ( pulse_buffer.get_data_size() + entries.size() < pulse_block_limit ) {
+        pulse_buffer.write( &entries[ 0 ], entries.size() ) ;
+        stats_add( STATS_PULSES_OUT, pulses.entry_pulse_count ) ;
+        if ( ( pulses.entry_pulse_count & 1 ) != 0 ) {
+            pulse_level = ! pulse_level ;
+        }
+        return ;
+    }
+
+    // Otherwise store them one by one, so the block is split at the usual place.
+
+    const byte * p = &entries[ 0 ] ;
+    const byte * const end = p + entries.size() ;
+
+    while ( p < end ) {
+
+        uint count = 1 ;
+        uint duration = p[ 0 ] | ( p[ 1 ] << 8 ) ;
+        p += 2 ;
+
+        if ( duration > 0x8000 ) {
+            count = duration & 0x7FFF ;
+            duration = p[ 0 ] | ( p[ 1 ] << 8 ) ;
+            p += 2 ;
+        }
+
+        if ( duration >= 0x8000 ) {
+            duration = ( ( duration & 0x7FFF ) << 16 ) | p[ 0 ] | ( p[ 1 ] << 8 ) ;
+            p += 2 ;
+        }
+
+        pzx_store( count, duration ) ;
+    }
+}
+
+/**
+ * Append separately encoded pulses to PZX pulse block.
+ */
+void pzx_out( const PzxPulses & pulses )
+{
+    if ( pulses.pulse_count == 0 ) {
+        return ;
+    }
+
+    // The first pulse may extend the pulse being output.
+
+    pzx_out_duration( pulses.first_duration, pulses.first_level ) ;
+
+    if ( pulses.pulse_count == 1 ) {
+        return ;
+    }
+
+    // If there are more pulses, it is complete now, and so are the pulses
+    // which follow it, except the last one. The first and last run of them
+    // may merge with the neighbouring pulses of the same duration.
+
+    pzx_pulse( last_duration ) ;
+    last_duration = 0 ;
+
+    pzx_repeat( pulses.first_run_duration, pulses.first_run_count ) ;
+    pzx_store_entries( pulses ) ;
+    pzx_repeat( pulses.last_run_duration, pulses.last_run_count ) ;
+
+    // Finally start the last pulse, which may be extended by the pulses which follow.
+
+    last_level = pulses.last_level ;
+
+    pzx_out_duration( pulses.last_duration, pulses.last_level ) ;
+}
+
 /**
  * Commit any buffered header and/or pulse output to the PZX output file.
  */
@@ -321,6 +733,7 @@ void pzx_flush( void )
 
     if ( pulse_buffer.is_not_empty() ) {
         pzx_write_buffer( PZX_PULSES, pulse_buffer ) ;
+        pulse_level = false ;
     }
 }
 
@@ -370,6 +783,17 @@ void pzx_data(
 
     data_buffer.write( data, ( bit_count + 7 ) / 8 ) ;
 
+    // Count the pulses this represents, if anyone cares.
+
+    if ( stats_enabled ) {
+        uint bit_1_count = 0 ;
+        for ( uint i = 0 ; i < bit_count ; i++ ) {
+            bit_1_count += ( ( data[ i / 8 ] << ( i % 8 ) ) >> 7 ) & 1 ;
+        }
+        const uquad pulse_count = uquad( bit_1_count ) * pulse_count_1 + uquad( bit_count - bit_1_count ) * pulse_count_0 ;
+        stats_add( STATS_PULSES_OUT, pulse_count + ( tail_cycles > 0 ) ) ;
+    }
+
     // Now write the entire block to the file.
 
     pzx_write_buffer( PZX_DATA, data_buffer ) ;
@@ -543,7 +967,7 @@ bool pzx_pack(
 /**
  * Try to pack given pulses to PZX data block, guessing the pulse sequences automatically.
  */
-bool pzx_pack(
+bool pzx_guess_pack(
     const word * const pulses,
     const uint pulse_count,
     const bool initial_level,
@@ -611,6 +1035,31 @@ bool pzx_pack(
     return false ;
 }
 
+/**
+ * Try to pack given pulses to PZX data block, guessing the pulse sequences automatically.
+ *
+ * The attempt is accounted for in the statistics.
+ */
+bool pzx_pack(
+    const word * const pulses,
+    const uint pulse_count,
+    const bool initial_level,
+    const uint sequence_limit,
+    const uint sequence_order,
+    const uint tail_cycles
+)
+{
+    const StatsPhase phase = stats_enter( STATS_PACK ) ;
+
+    const bool packed = pzx_guess_pack( pulses, pulse_count, initial_level, sequence_limit, sequence_order, tail_cycles ) ;
+
+    stats_leave( phase ) ;
+    stats_add( STATS_PACK_ATTEMPTS ) ;
+    stats_add( STATS_PACK_SUCCESSES, packed ) ;
+
+    return packed ;
+}
+
 /**
  * Output given pulses to the output.
  */
@@ -647,6 +1096,8 @@ void pzx_pause( const uint duration, const bool level )
     pzx_flush() ;
     data_buffer.write_little< u32 >( ( level << 31 ) | duration ) ;
     pzx_write_buffer( PZX_PAUSE, data_buffer ) ;
+
+    stats_add( STATS_PULSES_OUT ) ;
 }
 
 /**
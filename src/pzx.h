@@ -12,6 +12,7 @@
 #define PZX_H 1
 
 #include <cstdio>
+#include <vector>
 
 #ifndef BUFFER_H
 #include "buffer.h"
@@ -31,13 +32,80 @@ const uint PZX_PAUSE    = TAG_NAME('P','A','U','S') ;
 const uint PZX_STOP     = TAG_NAME('S','T','O','P') ;
 const uint PZX_BROWSE   = TAG_NAME('B','R','W','S') ;
 
+/**
+ * Pulses encoded separately from the PZX output stream.
+ *
+ * Allows long pulse streams to be split into parts which are encoded in
+ * parallel and appended to the output stream in order afterwards. The first
+ * and last pulse of the part and the first and last run of pulses of the
+ * same duration may merge with those of the neighbouring parts, so they are
+ * kept aside and only the pulses in between are encoded right away.
+ *
+ * @note Unlike the rest of the interface, this may be used by any thread.
+ */
+struct PzxPulses {
+
+    /**
+     * Number of pulses of alternating level encountered so far.
+     */
+    uquad pulse_count ;
+
+    /**
+     * Level and duration of the first pulse and the most recent pulse.
+     */
+    //@{
+    bool first_level ;
+    uquad first_duration ;
+    bool last_level ;
+    uquad last_duration ;
+    //@}
+
+    /**
+     * Duration and count of the first run of pulses, the most recent one, and the one being accumulated.
+     */
+    //@{
+    uint first_run_duration ;
+    uquad first_run_count ;
+    uint last_run_duration ;
+    uquad last_run_count ;
+    uint run_duration ;
+    uquad run_count ;
+    //@}
+
+    /**
+     * Encoded pulse entries of the runs in between, and number of pulses they represent.
+     */
+    //@{
+    std::vector< byte > entries ;
+    uquad entry_pulse_count ;
+    //@}
+
+    PzxPulses( void )
+        : pulse_count( 0 )
+        , first_level( false )
+        , first_duration( 0 )
+        , last_level( false )
+        , last_duration( 0 )
+        , first_run_duration( 0 )
+        , first_run_count( 0 )
+        , last_run_duration( 0 )
+        , last_run_count( 0 )
+        , run_duration( 0 )
+        , run_count( 0 )
+        , entry_pulse_count( 0 )
+    {
+    }
+} ;
+
 // Interface.
 
 void pzx_open( FILE * file ) ;
+void pzx_open( Buffer & buffer ) ;
 void pzx_close( void ) ;
+void pzx_abort( void ) ;
 
-void pzx_write( const void * const data, const uint size ) ;
-void pzx_write_block( const uint tag, const void * const data, const uint size ) ;
+void pzx_write( const void * const data, const size_t size ) ;
+void pzx_write_block( const uint tag, const void * const data, const size_t size ) ;
 void pzx_write_buffer( const uint tag, Buffer & buffer ) ;
 
 void pzx_header( const void * const data, const uint size ) ;
@@ -48,6 +116,13 @@ void pzx_store( const uint count, const uint duration ) ;
 void pzx_pulse( const uint duration ) ;
 void pzx_out( const uint duration, const bool level ) ;
 
+void pzx_out( const uquad * const durations, const uint count, const bool initial_level ) ;
+
+void pzx_encode( PzxPulses & pulses, const uquad duration, const bool level ) ;
+void pzx_encode( PzxPulses & pulses, const uquad * const durations, const uint count, const bool initial_level ) ;
+void pzx_encode_finish( PzxPulses & pulses ) ;
+void pzx_out( const PzxPulses & pulses ) ;
+
 void pzx_flush( void ) ;
 
 void pzx_data(
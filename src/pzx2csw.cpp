@@ -0,0 +1,214 @@
+// $Id$
+
+/**
+ * @file PZX->CSW convertor.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "pzx.h"
+#include "wav.h"
+#include "stats.h"
+
+/**
+ * Global options.
+ */
+namespace {
+
+/**
+ * Default sample rate for CSW generation.
+ */
+const uint default_sample_rate = 44100 ;
+
+/**
+ * Sample rate used for CSW generation.
+ */
+uint option_sample_rate = 0 ;
+
+/**
+ * When set, the CSW data are compressed using the Z-RLE scheme.
+ */
+bool option_compress = false ;
+
+} ;
+
+/**
+ * Convert given PZX file to CSW file.
+ */
+int convert( int argc, char * * argv )
+{
+    // Make sure the standard I/O is in binary mode.
+
+    set_binary_mode( stdin ) ;
+    set_binary_mode( stdout ) ;
+
+    // Parse the command line.
+
+    const char * input_name = NULL ;
+    const char * output_name = NULL ;
+
+    for ( int i = 1 ; i < argc ; i++ ) {
+        if ( argv[ i ][ 0 ] != '-' ) {
+            if ( input_name ) {
+                fail( "multiple input file names specified" ) ;
+            }
+            input_name = argv[ i ] ;
+            continue ;
+        }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
+        switch ( argv[ i ][ 1 ] ) {
+            case 'o': {
+                if ( output_name ) {
+                    fail( "multiple output file names specified" ) ;
+                }
+                output_name = argv[ ++i ] ;
+                break ;
+            }
+            case 's': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing sample rate" ) ;
+                }
+                option_sample_rate = uint( atoi( arg ) ) ;
+                break ;
+            }
+            case 'z': {
+                option_compress = true ;
+                break ;
+            }
+            default: {
+                fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
+
+                // Fall through.
+            }
+            case 'h': {
+                fprintf( stderr, "usage: pzx2csw [-s n] [-z] [-o output_file] [input_file]\n" ) ;
+                fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
+                fprintf( stderr, "-s n   use given sample rate instead of default %uHz\n", default_sample_rate ) ;
+                fprintf( stderr, "-z     compress the output using the Z-RLE scheme\n" ) ;
+                stats_usage() ;
+                return EXIT_FAILURE ;
+            }
+        }
+    }
+
+    // Open the input file.
+
+    FILE * const input_file = ( input_name ? fopen( input_name, "rb" ) : stdin ) ;
+    if ( input_file == NULL ) {
+        fail( "unable to open input file" ) ;
+    }
+
+    // Read in the header.
+
+    stats_enter( STATS_READ ) ;
+
+    Buffer buffer ;
+    if ( buffer.read( input_file, 8 ) != 8 ) {
+        fail( "error reading input file" ) ;
+    }
+
+    // Make sure it is really the PZX file.
+
+    const u32 * header = buffer.get_typed_data< u32 >() ;
+
+    if ( header[ 0 ] != PZX_HEADER ) {
+        fail( "input is not a PZX file" ) ;
+    }
+
+    // Only then open the output file.
+
+    FILE * const output_file = ( output_name ? fopen( output_name, "wb" ) : stdout ) ;
+    if ( output_file == NULL ) {
+        fail( "unable to open output file" ) ;
+    }
+
+    // Bind the CSW stream to the output file. Note that it shares the
+    // rendering with the WAV stream, only the samples are stored differently.
+
+    const uint sample_rate = ( option_sample_rate > 0 ? option_sample_rate : default_sample_rate ) ;
+
+    wav_open_csw( output_file, sample_rate, option_compress ) ;
+
+    // Now keep reading the blocks and process each one in turn.
+
+    for ( ; ; ) {
+
+        // Extract the tag and size from the header.
+
+        const uint tag = native_endian( header[ 0 ] ) ;
+        const uint size = little_endian( header[ 1 ] ) ;
+
+        // Read in the block data.
+
+        if ( buffer.read( input_file, size ) != size ) {
+            fail( "error reading block data" ) ;
+        }
+
+        stats_add( STATS_BYTES_IN, 8 + size ) ;
+        stats_count_block( true, tag ) ;
+
+        // Render the block.
+
+        stats_enter( STATS_RENDER ) ;
+
+        wav_render_block( tag, buffer.get_data(), size ) ;
+
+        // Read in header of the next block, if there is any.
+
+        stats_enter( STATS_READ ) ;
+
+        const uint bytes_read = buffer.read( input_file, 8 ) ;
+        header = buffer.get_typed_data< u32 >() ;
+
+        // Stop if there is nothing more.
+
+        if ( bytes_read == 0 ) {
+            break ;
+        }
+
+        // Check for errors.
+
+        if ( bytes_read != 8 ) {
+            fail( "error reading block header" ) ;
+        }
+    }
+
+    stats_enter( STATS_OTHER ) ;
+
+    // Close the input file.
+
+    fclose( input_file ) ;
+
+    // Finally, close the CSW stream and make sure there were no errors.
+
+    wav_close() ;
+
+    if ( ferror( output_file ) != 0 || fclose( output_file ) != 0 ) {
+        fail( "error while closing the output file" ) ;
+    }
+
+    // Report the statistics, if requested.
+
+    stats_report( "pzx2csw" ) ;
+
+    return EXIT_SUCCESS ;
+}
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
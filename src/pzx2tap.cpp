@@ -0,0 +1,502 @@
+// $Id$
+
+/**
+ * @file PZX->TAP convertor.
+ *
+ * Extracts the data blocks which use the standard ROM loader timings, so
+ * they can be loaded instantly by emulators. Everything which can't be
+ * expressed in TAP is reported, so it's clear whether the TAP file is
+ * a complete replacement of the PZX file or not.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "pzx.h"
+#include "tap.h"
+#include "stats.h"
+
+/**
+ * Global options.
+ */
+namespace {
+
+/**
+ * When set, the conversion fails if anything can't be stored in TAP.
+ */
+bool option_strict ;
+
+} ;
+
+/**
+ * Conversion state.
+ */
+namespace {
+
+/**
+ * Minimum number of leader pulses the ROM loader needs to recognize the leader tone.
+ */
+const uint minimum_leader_count = 256 ;
+
+/**
+ * States of the leader detection.
+ */
+enum LeaderState {
+    LEADER_NONE,
+    LEADER_TONE,
+    LEADER_SYNC_1,
+    LEADER_SYNC_2
+} ;
+
+/**
+ * Output file.
+ */
+FILE * output_file ;
+
+/**
+ * Index of the block being processed.
+ */
+uint block_index ;
+
+/**
+ * Current state of the leader detection, and the number of pulses it has consumed so far.
+ */
+//@{
+LeaderState leader_state ;
+uquad leader_pulse_count ;
+//@}
+
+/**
+ * Number of pulses of current block which can't be stored in TAP.
+ */
+uquad lost_pulse_count ;
+
+/**
+ * Number of the data blocks stored, and the number of the blocks which couldn't be stored.
+ */
+//@{
+uint stored_count ;
+uint rejected_count ;
+//@}
+
+/**
+ * Fetch value of specified type from given data block.
+ */
+template< typename Type >
+Type fetch( const byte * & data, uint & data_size )
+{
+    hope( data ) ;
+
+    if ( sizeof( Type ) > data_size ) {
+        fail( "incomplete block detected" ) ;
+    }
+
+    const Type value = little_endian( * reinterpret_cast< const Type * >( data ) ) ;
+
+    data += sizeof( Type ) ;
+    data_size -= sizeof( Type ) ;
+
+    return value ;
+}
+
+/**
+ * Macros for convenient fetching of values from current block.
+ */
+//@{
+#define GET1()  fetch< u8 >( data, data_size )
+#define GET2()  fetch< u16 >( data, data_size )
+#define GET4()  fetch< u32 >( data, data_size )
+//@}
+
+/**
+ * Report block which can't be stored in TAP.
+ */
+void reject_block( const char * const reason )
+{
+    warn( "block %u: %s", block_index, reason ) ;
+    rejected_count++ ;
+}
+
+/**
+ * Forget the leader detected so far, accounting its pulses as lost.
+ */
+void reset_leader( void )
+{
+    lost_pulse_count += leader_pulse_count ;
+    leader_pulse_count = 0 ;
+    leader_state = LEADER_NONE ;
+}
+
+/**
+ * Feed given amount of pulses of given duration to the leader detection.
+ */
+void process_pulses( const uint count, const uint duration )
+{
+    // Pulses of zero duration don't matter to the ROM loader at all.
+
+    if ( duration == 0 ) {
+        return ;
+    }
+
+    // Otherwise look for the leader tone followed by the two sync pulses.
+
+    if ( duration == LEADER_CYCLES ) {
+        if ( leader_state != LEADER_TONE ) {
+            reset_leader() ;
+            leader_state = LEADER_TONE ;
+        }
+        leader_pulse_count += count ;
+        return ;
+    }
+
+    if ( count == 1 ) {
+        if ( duration == SYNC_1_CYCLES && leader_state == LEADER_TONE && leader_pulse_count >= minimum_leader_count ) {
+            leader_state = LEADER_SYNC_1 ;
+            leader_pulse_count++ ;
+            return ;
+        }
+        if ( duration == SYNC_2_CYCLES && leader_state == LEADER_SYNC_1 ) {
+            leader_state = LEADER_SYNC_2 ;
+            leader_pulse_count++ ;
+            return ;
+        }
+    }
+
+    reset_leader() ;
+    lost_pulse_count += count ;
+}
+
+/**
+ * Process given PULS block.
+ */
+void process_pulse_block( const byte * data, uint data_size )
+{
+    while ( data_size > 0 ) {
+
+        uint count = 1 ;
+        uint duration = GET2() ;
+        if ( duration > 0x8000 ) {
+            count = duration & 0x7FFF ;
+            duration = GET2() ;
+        }
+        if ( duration >= 0x8000 ) {
+            duration &= 0x7FFF ;
+            duration <<= 16 ;
+            duration |= GET2() ;
+        }
+
+        process_pulses( count, duration ) ;
+    }
+}
+
+/**
+ * Write given data as TAP block to the output file.
+ */
+void write_tap_block( const byte * const data, const uint size )
+{
+    hope( output_file ) ;
+
+    const StatsPhase phase = stats_enter( STATS_WRITE ) ;
+
+    const byte header[ 2 ] = { byte( size ), byte( size >> 8 ) } ;
+
+    if ( std::fwrite( header, 1, sizeof( header ), output_file ) != sizeof( header ) || std::fwrite( data, 1, size, output_file ) != size ) {
+        fail( "error writing to file" ) ;
+    }
+
+    stats_leave( phase ) ;
+    stats_add( STATS_BYTES_OUT, sizeof( header ) + size ) ;
+}
+
+/**
+ * Process given DATA block, storing it as TAP block if it uses the standard timings.
+ */
+void process_data_block( const byte * data, uint data_size )
+{
+    // The data block has to follow the leader and sync pulses.
+
+    const bool leader_seen = ( leader_state == LEADER_SYNC_2 ) ;
+
+    if ( leader_seen ) {
+        leader_pulse_count = 0 ;
+    }
+    reset_leader() ;
+
+    // Fetch the numbers.
+
+    const uint bit_count = ( GET4() & 0x7FFFFFFF ) ;
+    GET2() ;
+    const uint pulse_count_0 = GET1() ;
+    const uint pulse_count_1 = GET1() ;
+
+    // Check the bits use the standard sequences.
+
+    bool standard = ( pulse_count_0 == 2 && pulse_count_1 == 2 ) ;
+
+    if ( standard ) {
+        standard = ( GET2() == BIT_0_CYCLES && GET2() == BIT_0_CYCLES && GET2() == BIT_1_CYCLES && GET2() == BIT_1_CYCLES ) ;
+    }
+
+    if ( ! standard ) {
+        reject_block( "data block doesn't use the standard bit timings" ) ;
+        return ;
+    }
+
+    if ( ! leader_seen ) {
+        reject_block( "data block is not preceded by the standard leader and sync pulses" ) ;
+        return ;
+    }
+
+    // Make sure the data fit in TAP block.
+
+    if ( data_size != ( ( bit_count + 7 ) / 8 ) ) {
+        fail( "bit count %u does not match the actual data size %u", bit_count, data_size ) ;
+    }
+
+    if ( bit_count == 0 || bit_count % 8 != 0 ) {
+        reject_block( "data block doesn't consist of whole bytes" ) ;
+        return ;
+    }
+
+    if ( data_size > 0xFFFF ) {
+        reject_block( "data block is too long" ) ;
+        return ;
+    }
+
+    // The ROM loader would report loading error unless the checksum is valid.
+
+    uint checksum = 0 ;
+    for ( uint i = 0 ; i < data_size ; i++ ) {
+        checksum ^= data[ i ] ;
+    }
+
+    if ( checksum != 0 ) {
+        reject_block( "data block has invalid checksum" ) ;
+        return ;
+    }
+
+    // All good, store it.
+
+    write_tap_block( data, data_size ) ;
+
+    stored_count++ ;
+}
+
+/**
+ * Process given PZX block.
+ */
+void process_block( const uint tag, const byte * const data, const uint data_size )
+{
+    hope( data ) ;
+
+    lost_pulse_count = 0 ;
+
+    switch ( tag ) {
+        case PZX_PULSES: {
+            process_pulse_block( data, data_size ) ;
+            break ;
+        }
+        case PZX_DATA: {
+            process_data_block( data, data_size ) ;
+            break ;
+        }
+        case PZX_PAUSE: {
+
+            // Pauses are implied by the TAP blocks, so they are not
+            // reported themselves, but they interrupt the leader tone.
+
+            reset_leader() ;
+            break ;
+        }
+        default: {
+            break ;
+        }
+    }
+
+    // Report pulses which are not part of any standard block.
+
+    if ( lost_pulse_count > 0 ) {
+        warn( "block %u: %llu pulses are not part of any standard data block", block_index, lost_pulse_count ) ;
+        rejected_count++ ;
+    }
+}
+
+}
+
+/**
+ * Convert given PZX file to TAP file.
+ */
+int convert( int argc, char * * argv )
+{
+    // Make sure the standard I/O is in binary mode.
+
+    set_binary_mode( stdin ) ;
+    set_binary_mode( stdout ) ;
+
+    // Parse the command line.
+
+    const char * input_name = NULL ;
+    const char * output_name = NULL ;
+
+    for ( int i = 1 ; i < argc ; i++ ) {
+        if ( argv[ i ][ 0 ] != '-' ) {
+            if ( input_name ) {
+                fail( "multiple input file names specified" ) ;
+            }
+            input_name = argv[ i ] ;
+            continue ;
+        }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
+        switch ( argv[ i ][ 1 ] ) {
+            case 'o': {
+                if ( output_name ) {
+                    fail( "multiple output file names specified" ) ;
+                }
+                output_name = argv[ ++i ] ;
+                break ;
+            }
+            case 's': {
+                option_strict = true ;
+                break ;
+            }
+            default: {
+                fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
+
+                // Fall through.
+            }
+            case 'h': {
+                fprintf( stderr, "usage: pzx2tap [-s] [-o output_file] [input_file]\n" ) ;
+                fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
+                fprintf( stderr, "-s     fail unless the entire input can be stored in TAP\n" ) ;
+                stats_usage() ;
+                return EXIT_FAILURE ;
+            }
+        }
+    }
+
+    // Open the input file.
+
+    FILE * const input_file = ( input_name ? fopen( input_name, "rb" ) : stdin ) ;
+    if ( input_file == NULL ) {
+        fail( "unable to open input file" ) ;
+    }
+
+    // Read in the header.
+
+    stats_enter( STATS_READ ) ;
+
+    Buffer buffer ;
+    if ( buffer.read( input_file, 8 ) != 8 ) {
+        fail( "error reading input file" ) ;
+    }
+
+    // Make sure it is really the PZX file.
+
+    const u32 * header = buffer.get_typed_data< u32 >() ;
+
+    if ( header[ 0 ] != PZX_HEADER ) {
+        fail( "input is not a PZX file" ) ;
+    }
+
+    // Only then open the output file.
+
+    output_file = ( output_name ? fopen( output_name, "wb" ) : stdout ) ;
+    if ( output_file == NULL ) {
+        fail( "unable to open output file" ) ;
+    }
+
+    // Now keep reading the blocks and process each one in turn.
+
+    for ( ; ; block_index++ ) {
+
+        // Extract the tag and size from the header.
+
+        const uint tag = native_endian( header[ 0 ] ) ;
+        const uint size = little_endian( header[ 1 ] ) ;
+
+        // Read in the block data.
+
+        if ( buffer.read( input_file, size ) != size ) {
+            fail( "error reading block data" ) ;
+        }
+
+        stats_add( STATS_BYTES_IN, 8 + size ) ;
+        stats_count_block( true, tag ) ;
+
+        // Process the block.
+
+        stats_enter( STATS_PARSE ) ;
+
+        process_block( tag, buffer.get_data(), size ) ;
+
+        // Read in header of the next block, if there is any.
+
+        stats_enter( STATS_READ ) ;
+
+        const uint bytes_read = buffer.read( input_file, 8 ) ;
+        header = buffer.get_typed_data< u32 >() ;
+
+        // Stop if there is nothing more.
+
+        if ( bytes_read == 0 ) {
+            break ;
+        }
+
+        // Check for errors.
+
+        if ( bytes_read != 8 ) {
+            fail( "error reading block header" ) ;
+        }
+    }
+
+    stats_enter( STATS_OTHER ) ;
+
+    // Leader tone at the very end is not followed by any data.
+
+    lost_pulse_count = 0 ;
+    reset_leader() ;
+
+    if ( lost_pulse_count > 0 ) {
+        warn( "%llu pulses at the end of the tape are not part of any standard data block", lost_pulse_count ) ;
+        rejected_count++ ;
+    }
+
+    // Close the input file.
+
+    fclose( input_file ) ;
+
+    // Make sure there were no errors.
+
+    if ( ferror( output_file ) != 0 || fclose( output_file ) != 0 ) {
+        fail( "error while closing the output file" ) ;
+    }
+
+    // Summarize whether the TAP file can replace the PZX file.
+
+    if ( rejected_count > 0 ) {
+        warn( "%u data blocks stored, %u blocks can't be stored in TAP", stored_count, rejected_count ) ;
+    }
+
+    // Report the statistics, if requested.
+
+    stats_report( "pzx2tap" ) ;
+
+    return ( option_strict && rejected_count > 0 ? EXIT_FAILURE : EXIT_SUCCESS ) ;
+}
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
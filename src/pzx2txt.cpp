@@ -9,6 +9,16 @@
  */
 
 #include "pzx.h"
+#include "text.h"
+#include "stats.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 /**
  * Global options.
@@ -45,8 +55,30 @@ bool option_expand_pulses ;
  */
 bool option_annotate_pulses ;
 
+/**
+ * Number of worker threads formatting the blocks, zero if the blocks are formatted sequentially.
+ */
+uint option_thread_count ;
+
 } ;
 
+/**
+ * Exception thrown when the input is found to be invalid.
+ *
+ * Unlike fault(), the error is not reported right away, but only after the
+ * output which precedes it is written, so the dump of all the valid blocks
+ * is preserved.
+ */
+class InvalidInput : public Failure {
+public:
+    explicit InvalidInput( const Failure & failure )
+        : Failure( failure )
+    {
+    }
+} ;
+
+#define reject(f,...)   throw InvalidInput(Failure(f,##__VA_ARGS__))
+
 /**
  * Fetch value of specified type from given data block.
  */
@@ -56,7 +88,7 @@ Type fetch( const byte * & data, uint & data_size )
     hope( data ) ;
 
     if ( sizeof( Type ) > data_size ) {
-        fail( "incomplete block detected" ) ;
+        reject( "incomplete block detected" ) ;
     }
 
     const Type value = little_endian( * reinterpret_cast< const Type * >( data ) ) ;
@@ -75,7 +107,7 @@ void skip( const uint amount, const byte * & data, uint & data_size )
     hope( data ) ;
 
     if ( amount > data_size ) {
-        fail( "incomplete block detected" ) ;
+        reject( "incomplete block detected" ) ;
     }
 
     data += amount ;
@@ -95,12 +127,13 @@ void skip( const uint amount, const byte * & data, uint & data_size )
 /**
  * Dump single string to a file.
  */
-void dump_string( FILE * const output_file, const char * const prefix, const byte * const data, const uint data_size )
+void dump_string( TextOutput & output, const char * const prefix, const byte * const data, const uint data_size )
 {
     hope( prefix ) ;
     hope( data ) ;
 
-    fprintf( output_file, "%s \"", prefix ) ;
+    output.put( prefix ) ;
+    output.put( " \"", 2 ) ;
 
     for ( uint i = 0 ; i < data_size ; i++ ) {
         const byte b = data[ i ] ;
@@ -111,22 +144,23 @@ void dump_string( FILE * const output_file, const char * const prefix, const byt
             case '\\':
             case '"':
             {
-                fprintf( output_file, "\\%c", b ) ;
+                output.put( '\\' ) ;
+                output.put( char( b ) ) ;
                 continue ;
             }
             case '\n':
             {
-                fprintf( output_file, "\\n" ) ;
+                output.put( "\\n", 2 ) ;
                 continue ;
             }
             case '\r':
             {
-                fprintf( output_file, "\\r" ) ;
+                output.put( "\\r", 2 ) ;
                 continue ;
             }
             case '\t':
             {
-                fprintf( output_file, "\\t" ) ;
+                output.put( "\\t", 2 ) ;
                 continue ;
             }
         }
@@ -134,23 +168,24 @@ void dump_string( FILE * const output_file, const char * const prefix, const byt
         // Any other control characters are printed in hex.
 
         if ( b < 32 ) {
-            fprintf( output_file, "\\x%02X", b ) ;
+            output.put( "\\x", 2 ) ;
+            output.put_hex( b ) ;
             continue ;
         }
 
         // Anything else is printed verbatim. Note that this includes any characters
         // greater than 127, as the strings are supposed to be in UTF-8 encoding.
 
-        fprintf( output_file, "%c", b ) ;
+        output.put( char( b ) ) ;
     }
 
-    fprintf( output_file, "\"\n" ) ;
+    output.put( "\"\n", 2 ) ;
 }
 
 /**
  * Dump strings separated with null characters to a file.
  */
-void dump_strings( FILE * const output_file, const char * const prefix, const byte * data, uint data_size )
+void dump_strings( TextOutput & output, const char * const prefix, const byte * data, uint data_size )
 {
     hope( data ) ;
 
@@ -160,7 +195,7 @@ void dump_strings( FILE * const output_file, const char * const prefix, const by
         while ( data < end && *data != 0 ) {
             data++ ;
         }
-        dump_string( output_file, prefix, string, data - string ) ;
+        dump_string( output, prefix, string, data - string ) ;
         data++ ;
     }
 }
@@ -168,7 +203,7 @@ void dump_strings( FILE * const output_file, const char * const prefix, const by
 /**
  * Dump single data line to a file.
  */
-void dump_data_line( FILE * const output_file, const byte * const data, const uint data_size, const bool dump_ascii = false )
+void dump_data_line( TextOutput & output, const byte * const data, const uint data_size, const bool dump_ascii = false )
 {
     hope( data ) ;
 
@@ -176,25 +211,31 @@ void dump_data_line( FILE * const output_file, const byte * const data, const ui
         return ;
     }
 
-    fprintf( output_file, "BODY " ) ;
+    output.put( "BODY ", 5 ) ;
 
-    for ( uint i = 0 ; i < data_size ; i++ ) {
-        const byte b = data[ i ] ;
-        if ( dump_ascii && b > 32 && b < 127 ) {
-            fprintf( output_file, ".%c", b ) ;
-        }
-        else {
-            fprintf( output_file, "%02X", b ) ;
+    if ( dump_ascii ) {
+        for ( uint i = 0 ; i < data_size ; i++ ) {
+            const byte b = data[ i ] ;
+            if ( b > 32 && b < 127 ) {
+                output.put( '.' ) ;
+                output.put( char( b ) ) ;
+            }
+            else {
+                output.put_hex( b ) ;
+            }
         }
     }
+    else {
+        output.put_hex( data, data_size ) ;
+    }
 
-    fprintf( output_file, "\n" ) ;
+    output.put( '\n' ) ;
 }
 
 /**
  * Dump data block to a file.
  */
-void dump_data( FILE * const output_file, const byte * data, uint data_size, const bool dump_ascii = false )
+void dump_data( TextOutput & output, const byte * data, uint data_size, const bool dump_ascii = false )
 {
     hope( data ) ;
 
@@ -204,18 +245,18 @@ void dump_data( FILE * const output_file, const byte * data, uint data_size, con
 
     const uint limit = 32 ;
     while ( data_size > limit ) {
-        dump_data_line( output_file, data, limit, dump_ascii ) ;
+        dump_data_line( output, data, limit, dump_ascii ) ;
         data += limit ;
         data_size -= limit ;
     }
-    dump_data_line( output_file, data, data_size, dump_ascii ) ;
+    dump_data_line( output, data, data_size, dump_ascii ) ;
 }
 
 /**
  * Dump given amount of pulses of given duration to a file, toggling level as appropriate.
  */
 void dump_pulses(
-    FILE * const output_file,
+    TextOutput & output,
     bool & level,
     const uint duration,
     uint count = 1
@@ -224,28 +265,50 @@ void dump_pulses(
     // Output the appropriate number of pulses, according to the command line options.
 
     if ( option_expand_pulses ) {
-        while ( count-- > 0 ) {
-            if ( option_annotate_pulses ) {
-              fprintf( output_file, "PULSE%u %u\n", uint( level ), duration ) ;
-            }
-            else {
-              fprintf( output_file, "PULSE %u\n", duration ) ;
+
+        // Format the line only once, and then just repeat it as many times as needed.
+        //
+        // Note that annotated lines just get their level digit updated for each pulse.
+
+        char line[ 32 ] = "PULSE" ;
+        uint size = 5 ;
+
+        const uint level_offset = size ;
+        if ( option_annotate_pulses ) {
+            size++ ;
+        }
+
+        line[ size++ ] = ' ' ;
+        size += TextOutput::format_number( line + size, duration ) ;
+        line[ size++ ] = '\n' ;
+
+        if ( ! option_annotate_pulses ) {
+            for ( uint i = 0 ; i < count ; i++ ) {
+                output.put( line, size ) ;
             }
+            level ^= ( count & 1 ) ;
+            return ;
+        }
+
+        while ( count-- > 0 ) {
+            line[ level_offset ] = char( '0' + level ) ;
+            output.put( line, size ) ;
             level = ! level ;
         }
         return ;
     }
 
+    output.put( "PULSE", 5 ) ;
     if ( option_annotate_pulses ) {
-      fprintf( output_file, "PULSE%u %u", uint( level ), duration ) ;
-    }
-    else {
-      fprintf( output_file, "PULSE %u", duration ) ;
+        output.put( char( '0' + level ) ) ;
     }
+    output.put( ' ' ) ;
+    output.put_number( duration ) ;
     if ( count > 1 ) {
-        fprintf( output_file, " %u", count ) ;
+        output.put( ' ' ) ;
+        output.put_number( count ) ;
     }
-    fprintf( output_file, "\n" ) ;
+    output.put( '\n' ) ;
     level ^= ( count & 1 ) ;
 }
 
@@ -253,7 +316,7 @@ void dump_pulses(
  * Dump bits from given byte using given (little endian) pulse sequences.
  */
 void dump_bits(
-    FILE * const output_file,
+    TextOutput & output,
     bool & level,
     uint bit_count,
     uint bits,
@@ -293,7 +356,7 @@ void dump_bits(
         while ( count-- > 0 ) {
             uint duration = *sequence++ ;
             duration += *sequence++ << 8 ;
-            dump_pulses( output_file, level, duration ) ;
+            dump_pulses( output, level, duration ) ;
         }
     }
 }
@@ -301,100 +364,193 @@ void dump_bits(
 /**
  * Dump given bit sequence to given output file.
  */
-void dump_bit_sequence( FILE * const output_file, const uint index, const byte * sequence, uint count )
+void dump_bit_sequence( TextOutput & output, const uint index, const byte * sequence, uint count )
 {
     hope( sequence ) ;
 
-    fprintf( output_file, "BIT%u", index ) ;
+    output.put( "BIT", 3 ) ;
+    output.put_number( index ) ;
 
     while ( count-- > 0 ) {
         uint duration = *sequence++ ;
         duration += *sequence++ << 8 ;
-        fprintf( output_file, " %u", duration ) ;
+        output.put( ' ' ) ;
+        output.put_number( duration ) ;
     }
 
-    fprintf( output_file, "\n" ) ;
+    output.put( '\n' ) ;
 }
 
 /**
- * Dump the DATA block to given file.
+ * Fields of DATA block.
  */
-void dump_data_block( FILE * const output_file, const byte * data, uint data_size )
+struct DataBlock {
+    bool level ;
+    uint bit_count ;
+    uint tail_cycles ;
+    uint pulse_count_0 ;
+    uint pulse_count_1 ;
+    const byte * sequence_0 ;
+    const byte * sequence_1 ;
+    const byte * data ;
+    uint data_size ;
+} ;
+
+/**
+ * Parse the DATA block fields from given block data.
+ */
+void parse_data_block( DataBlock & block, const byte * data, uint data_size )
 {
     hope( data ) ;
 
     // Fetch the numbers.
 
     uint bit_count = GET4() ;
-    const uint tail_cycles = GET2() ;
-    const uint pulse_count_0 = GET1() ;
-    const uint pulse_count_1 = GET1() ;
+    block.tail_cycles = GET2() ;
+    block.pulse_count_0 = GET1() ;
+    block.pulse_count_1 = GET1() ;
 
     // Extract initial pulse level.
 
-    bool level = ( ( bit_count >> 31 ) != 0 ) ;
+    block.level = ( ( bit_count >> 31 ) != 0 ) ;
 
     bit_count &= 0x7FFFFFFF ;
 
     // Fetch the sequences. Note that we keep them little endian here.
 
-    const byte * const sequence_0 = data ;
-    SKIP( 2 * pulse_count_0 ) ;
+    block.sequence_0 = data ;
+    SKIP( 2 * block.pulse_count_0 ) ;
 
-    const byte * const sequence_1 = data ;
-    SKIP( 2 * pulse_count_1 ) ;
+    block.sequence_1 = data ;
+    SKIP( 2 * block.pulse_count_1 ) ;
 
     // Make sure the bit count matches the block size.
 
     if ( data_size != ( ( bit_count + 7 ) / 8 ) ) {
-        fail( "bit count %u does not match the actual data size %u", bit_count, data_size ) ;
+        reject( "bit count %u does not match the actual data size %u", bit_count, data_size ) ;
     }
 
+    block.bit_count = bit_count ;
+    block.data = data ;
+    block.data_size = data_size ;
+}
+
+/**
+ * Dump the beginning of given DATA block, which precedes its data.
+ */
+void dump_data_head( TextOutput & output, const DataBlock & block )
+{
     // Dump everything as pulses if requested.
 
     if ( option_dump_pulses ) {
 
-        fprintf( output_file, "PULSES\n" ) ;
+        output.put( "PULSES\n", 7 ) ;
 
         // Make sure the level is high by using zero pulse if necessary.
 
-        if ( level ) {
-            level = false ;
-            dump_pulses( output_file, level, 0 ) ;
+        if ( block.level ) {
+            bool level = false ;
+            dump_pulses( output, level, 0 ) ;
         }
 
-        // Dump all the bits.
+        return ;
+    }
 
-        while ( bit_count > 8 ) {
-            dump_bits( output_file, level, 8, *data++, pulse_count_0, pulse_count_1, sequence_0, sequence_1 ) ;
-            bit_count -= 8 ;
-        }
-        dump_bits( output_file, level, bit_count, *data, pulse_count_0, pulse_count_1, sequence_0, sequence_1 ) ;
+    // Otherwise print the data normally, staring with all the header info.
 
-        // Include the tail pulse if necessary.
+    output.put( "DATA ", 5 ) ;
+    output.put_number( block.level ) ;
+    output.put( '\n' ) ;
 
-        if ( tail_cycles > 0 ) {
-            dump_pulses( output_file, level, tail_cycles ) ;
-        }
+    output.put( "SIZE ", 5 ) ;
+    output.put_number( block.bit_count / 8 ) ;
+    output.put( '\n' ) ;
 
-        return ;
+    if ( ( block.bit_count & 7 ) != 0 ) {
+        output.put( "BITS ", 5 ) ;
+        output.put_number( block.bit_count & 7 ) ;
+        output.put( '\n' ) ;
     }
 
-    // Otherwise print the data normally, staring with all the header info.
+    output.put( "TAIL ", 5 ) ;
+    output.put_number( block.tail_cycles ) ;
+    output.put( '\n' ) ;
+
+    // Now dump the bit sequences used.
 
-    fprintf( output_file, "DATA %u\n", level ) ;
+    dump_bit_sequence( output, 0, block.sequence_0, block.pulse_count_0 ) ;
+    dump_bit_sequence( output, 1, block.sequence_1, block.pulse_count_1 ) ;
+}
 
-    fprintf( output_file, "SIZE %u\n", ( bit_count / 8 ) ) ;
-    if ( ( bit_count & 7 ) != 0 ) {
-        fprintf( output_file, "BITS %u\n", ( bit_count & 7 ) ) ;
+/**
+ * Dump given amount of bits of given DATA block as pulses, starting with given data, toggling level as appropriate.
+ */
+void dump_data_bits( TextOutput & output, const DataBlock & block, bool & level, const byte * data, uint bit_count )
+{
+    hope( data ) ;
+
+    while ( bit_count > 8 ) {
+        dump_bits( output, level, 8, *data++, block.pulse_count_0, block.pulse_count_1, block.sequence_0, block.sequence_1 ) ;
+        bit_count -= 8 ;
     }
+    dump_bits( output, level, bit_count, *data, block.pulse_count_0, block.pulse_count_1, block.sequence_0, block.sequence_1 ) ;
+}
 
-    fprintf( output_file, "TAIL %u\n", tail_cycles ) ;
+/**
+ * Dump the tail of given DATA block, which follows its data.
+ */
+void dump_data_tail( TextOutput & output, const DataBlock & block, bool & level )
+{
+    // Include the tail pulse if necessary.
 
-    // Now dump the bit sequences used.
+    if ( option_dump_pulses && block.tail_cycles > 0 ) {
+        dump_pulses( output, level, block.tail_cycles ) ;
+    }
+}
+
+/**
+ * Get the level after dumping given data of given DATA block as pulses, starting with given level.
+ */
+bool advance_data_level( const DataBlock & block, bool level, const byte * data, const uint size )
+{
+    hope( data || size == 0 ) ;
+
+    uint ones = 0 ;
+    for ( uint i = 0 ; i < size ; i++ ) {
+        ones += __builtin_popcount( data[ i ] ) ;
+    }
+
+    const uint zeros = 8 * size - ones ;
+
+    return level ^ ( ( ones * block.pulse_count_1 + zeros * block.pulse_count_0 ) & 1 ) ;
+}
+
+/**
+ * Dump the DATA block to given file.
+ */
+void dump_data_block( TextOutput & output, const byte * data, uint data_size )
+{
+    hope( data ) ;
+
+    DataBlock block ;
+    parse_data_block( block, data, data_size ) ;
+
+    dump_data_head( output, block ) ;
+
+    // Dump all the bits as pulses if requested.
+
+    if ( option_dump_pulses ) {
 
-    dump_bit_sequence( output_file, 0, sequence_0, pulse_count_0 ) ;
-    dump_bit_sequence( output_file, 1, sequence_1, pulse_count_1 ) ;
+        bool level = block.level ;
+
+        dump_data_bits( output, block, level, block.data, block.bit_count ) ;
+
+        dump_data_tail( output, block, level ) ;
+        return ;
+    }
+
+    data = block.data ;
+    data_size = block.data_size ;
 
     // If header dumping is enabled, dump whatever looks like a header in a more readable form.
 
@@ -402,38 +558,46 @@ void dump_data_block( FILE * const output_file, const byte * data, uint data_siz
 
         const uint leader = GET1() ;
         const uint type = GET1() ;
-        fprintf( output_file, "BYTE %u %u\n", leader, type ) ;
+        output.put( "BYTE ", 5 ) ;
+        output.put_number( leader ) ;
+        output.put( ' ' ) ;
+        output.put_number( type ) ;
+        output.put( '\n' ) ;
 
-        dump_data_line( output_file, data, 10, true ) ;
+        dump_data_line( output, data, 10, true ) ;
         data += 10 ;
 
         const uint size = GET2() ;
         const uint start = GET2() ;
         const uint extra = GET2() ;
-        fprintf( output_file, "WORD %u %u %u\n", size, start, extra ) ;
+        output.put( "WORD ", 5 ) ;
+        output.put_number( size ) ;
+        output.put( ' ' ) ;
+        output.put_number( start ) ;
+        output.put( ' ' ) ;
+        output.put_number( extra ) ;
+        output.put( '\n' ) ;
 
         const uint checksum = GET1() ;
-        fprintf( output_file, "BYTE %u\n", checksum ) ;
+        output.put( "BYTE ", 5 ) ;
+        output.put_number( checksum ) ;
+        output.put( '\n' ) ;
         return ;
     }
 
     // Otherwise dump the data as they are.
 
-    dump_data( output_file, data, data_size, option_dump_ascii ) ;
+    dump_data( output, data, data_size, option_dump_ascii ) ;
 }
 
 /**
- * Dump the PULSE block to given file.
+ * Dump given pulses of PULSE block to given file, toggling level as appropriate.
  */
-void dump_pulse_block( FILE * const output_file, const byte * data, uint data_size )
+void dump_pulse_entries( TextOutput & output, bool & level, const byte * data, uint data_size )
 {
     hope( data ) ;
 
-    fprintf( output_file, "PULSES\n" ) ;
-
-    bool level = 0 ;
-
-    // Dump all pulses in the block.
+    // Dump all pulses given.
 
     while ( data_size > 0 ) {
 
@@ -453,14 +617,28 @@ void dump_pulse_block( FILE * const output_file, const byte * data, uint data_si
 
         // Output the appropriate number of pulses, according to the command line options.
 
-        dump_pulses( output_file, level, duration, count ) ;
+        dump_pulses( output, level, duration, count ) ;
     }
 }
 
+/**
+ * Dump the PULSE block to given file.
+ */
+void dump_pulse_block( TextOutput & output, const byte * data, uint data_size )
+{
+    hope( data ) ;
+
+    output.put( "PULSES\n", 7 ) ;
+
+    bool level = 0 ;
+
+    dump_pulse_entries( output, level, data, data_size ) ;
+}
+
 /**
  * Dump given PZX block to given file.
  */
-void dump_block( FILE * const output_file, const uint tag, const byte * data, uint data_size )
+void dump_block( TextOutput & output, const uint tag, const byte * data, uint data_size )
 {
     hope( data ) ;
 
@@ -469,43 +647,55 @@ void dump_block( FILE * const output_file, const uint tag, const byte * data, ui
             const uint major = GET1() ;
             const uint minor = GET1() ;
             if ( major != PZX_MAJOR ) {
-                fail( "unsupported PZX major version %u.%u - stopping", major, minor ) ;
+                reject( "unsupported PZX major version %u.%u - stopping", major, minor ) ;
             }
             if ( minor > PZX_MINOR ) {
                 warn( "unsupported PZX minor version %u.%u - proceeding", major, minor ) ;
             }
-            fprintf( output_file, "PZX %u.%u\n", major, minor ) ;
-            dump_strings( output_file, "INFO", data, data_size ) ;
+            output.put( "PZX ", 4 ) ;
+            output.put_number( major ) ;
+            output.put( '.' ) ;
+            output.put_number( minor ) ;
+            output.put( '\n' ) ;
+            dump_strings( output, "INFO", data, data_size ) ;
             return ;
         }
         case PZX_PULSES: {
-            dump_pulse_block( output_file, data, data_size ) ;
+            dump_pulse_block( output, data, data_size ) ;
             return ;
         }
         case PZX_DATA: {
-            dump_data_block( output_file, data, data_size ) ;
+            dump_data_block( output, data, data_size ) ;
             return ;
         }
         case PZX_PAUSE: {
             const uint duration = GET4() ;
-            fprintf( output_file, "PAUSE %u %u\n", ( duration & 0x7FFFFFFF ), ( duration >> 31 ) ) ;
+            output.put( "PAUSE ", 6 ) ;
+            output.put_number( duration & 0x7FFFFFFF ) ;
+            output.put( ' ' ) ;
+            output.put_number( duration >> 31 ) ;
+            output.put( '\n' ) ;
             break ;
         }
         case PZX_STOP: {
             const uint flags = GET2() ;
-            fprintf( output_file, "STOP %u\n", flags ) ;
+            output.put( "STOP ", 5 ) ;
+            output.put_number( flags ) ;
+            output.put( '\n' ) ;
             break ;
         }
         case PZX_BROWSE: {
-            dump_string( output_file, "BROWSE", data, data_size ) ;
+            dump_string( output, "BROWSE", data, data_size ) ;
             return ;
         }
         default: {
-            fprintf( output_file, "TAG " ) ;
-            fwrite( &tag, 4, 1, output_file ) ;
-            fprintf( output_file, "\n" ) ;
-            fprintf( output_file, "SIZE %u\n", data_size ) ;
-            dump_data( output_file, data, data_size, option_dump_ascii ) ;
+            output.put( "TAG ", 4 ) ;
+            output.put( reinterpret_cast< const char * >( &tag ), 4 ) ;
+            output.put( '\n' ) ;
+            output.put( "SIZE ", 5 ) ;
+            output.put_number( data_size ) ;
+            output.put( '\n' ) ;
+            dump_data( output, data, data_size, option_dump_ascii ) ;
             return ;
         }
     }
@@ -515,11 +705,665 @@ void dump_block( FILE * const output_file, const uint tag, const byte * data, ui
     }
 }
 
+/**
+ * Parallel dumping state.
+ */
+namespace {
+
+/**
+ * Amount of input data formatted by single task.
+ *
+ * Smaller blocks are batched together, larger PULS and DATA blocks are split
+ * to slices of about this size. It is a multiple of the number of bytes
+ * dumped on single data line, so the slices of data end at line boundaries.
+ */
+const uint task_size = 32 * 1024 ;
+
+/**
+ * Number of tasks per worker thread which may be in progress at once,
+ * limiting how far ahead the input is read.
+ */
+const uint tasks_per_thread = 4 ;
+
+/**
+ * Input data, shared by all the tasks which dump some part of it.
+ */
+typedef std::shared_ptr< Buffer > Input ;
+
+/**
+ * Task formatting part of the input to its private output buffer.
+ *
+ * The task either dumps all the complete blocks stored in its input, or
+ * single slice of PULS or DATA block stored in its input, starting at given
+ * offset of its pulses or data with given level.
+ */
+struct Task {
+
+    /**
+     * Input data dumped, and flag set when the output of the task begins new block, which needs to be separated.
+     */
+    //@{
+    Input input ;
+    bool separate ;
+    //@}
+
+    /**
+     * Slice to dump, if any. Otherwise the size tells how much of the input are complete blocks to dump.
+     */
+    //@{
+    bool slice ;
+    uint tag ;
+    uint offset ;
+    uint size ;
+    bool level ;
+    bool first ;
+    bool last ;
+    //@}
+
+    /**
+     * Formatted output, flag telling when it is complete, and the error which stopped the formatting, if any.
+     */
+    //@{
+    TextOutput output ;
+    bool done ;
+    std::exception_ptr failure ;
+    //@}
+
+    Task( const Input & task_input, const bool task_separate )
+        : input( task_input )
+        , separate( task_separate )
+        , slice( false )
+        , tag( 0 )
+        , offset( 0 )
+        , size( 0 )
+        , level( false )
+        , first( false )
+        , last( false )
+        , output( NULL, 4 * task_size )
+        , done( false )
+    {
+    }
+} ;
+
+/**
+ * Tasks in the order in which their output is written.
+ */
+typedef std::deque< std::unique_ptr< Task > > TaskQueue ;
+
+/**
+ * Dump given task to its output buffer.
+ */
+void dump_task( Task & task )
+{
+    const byte * data = task.input->get_data() ;
+    size_t data_size = task.input->get_data_size() ;
+
+    // Dump all the blocks, separating them with empty line, the same way the sequential dump does.
+
+    if ( ! task.slice ) {
+
+        data_size = task.size ;
+
+        bool first = true ;
+
+        while ( data_size > 0 ) {
+
+            const u32 * const header = reinterpret_cast< const u32 * >( data ) ;
+
+            const uint tag = native_endian( header[ 0 ] ) ;
+            const uint size = little_endian( header[ 1 ] ) ;
+
+            if ( ! first ) {
+                task.output.put( '\n' ) ;
+            }
+            first = false ;
+
+            dump_block( task.output, tag, data + 8, size ) ;
+
+            data += 8 + size ;
+            data_size -= 8 + size ;
+        }
+        return ;
+    }
+
+    // Dump the slice of the pulses.
+
+    bool level = task.level ;
+
+    if ( task.tag == PZX_PULSES ) {
+        if ( task.first ) {
+            task.output.put( "PULSES\n", 7 ) ;
+        }
+        dump_pulse_entries( task.output, level, data + task.offset, task.size ) ;
+        return ;
+    }
+
+    // Dump the slice of the data, including whatever precedes or follows them.
+
+    DataBlock block ;
+    parse_data_block( block, data, uint( data_size ) ) ;
+
+    if ( task.first ) {
+        dump_data_head( task.output, block ) ;
+    }
+
+    if ( option_dump_pulses ) {
+        const uint bit_count = ( task.last ? block.bit_count - 8 * task.offset : 8 * task.size ) ;
+        dump_data_bits( task.output, block, level, block.data + task.offset, bit_count ) ;
+        if ( task.last ) {
+            dump_data_tail( task.output, block, level ) ;
+        }
+        return ;
+    }
+
+    dump_data( task.output, block.data + task.offset, task.size, option_dump_ascii ) ;
+}
+
+/**
+ * Pool of worker threads dumping the tasks.
+ *
+ * The pool is meant to be local, so its synchronization objects are not
+ * destroyed while the threads use them in case the process exits due to
+ * an error.
+ */
+class Workers {
+
+    /**
+     * Worker threads, and tasks waiting for them.
+     */
+    //@{
+    std::vector< std::thread > threads ;
+    std::deque< Task * > pending_tasks ;
+    //@}
+
+    /**
+     * Flag set when no more tasks will come, and synchronization of the workers with the main thread.
+     */
+    //@{
+    bool finished ;
+    std::mutex mutex ;
+    std::condition_variable task_ready ;
+    std::condition_variable task_done ;
+    //@}
+
+public:
+
+    Workers( const uint count )
+        : finished( false )
+    {
+        for ( uint i = 0 ; i < count ; i++ ) {
+            threads.push_back( std::thread( &Workers::work, this ) ) ;
+        }
+    }
+
+    /**
+     * Let the workers finish the pending tasks and stop them.
+     */
+    ~Workers()
+    {
+        {
+            std::lock_guard< std::mutex > lock( mutex ) ;
+            finished = true ;
+        }
+
+        task_ready.notify_all() ;
+
+        for ( size_t i = 0 ; i < threads.size() ; i++ ) {
+            threads[ i ].join() ;
+        }
+    }
+
+private:
+
+    Workers( const Workers & ) ;
+    Workers & operator =( const Workers & ) ;
+
+public:
+
+    /**
+     * Hand given task over to the workers.
+     */
+    void submit( Task * const task )
+    {
+        {
+            std::lock_guard< std::mutex > lock( mutex ) ;
+            pending_tasks.push_back( task ) ;
+        }
+
+        task_ready.notify_one() ;
+    }
+
+    /**
+     * Wait until given task is done, unless told not to wait. Returns true if the task is done.
+     */
+    bool wait( Task & task, const bool block )
+    {
+        std::unique_lock< std::mutex > lock( mutex ) ;
+
+        while ( block && ! task.done ) {
+            task_done.wait( lock ) ;
+        }
+
+        return task.done ;
+    }
+
+private:
+
+    /**
+     * Keep dumping the pending tasks until there are no more.
+     */
+    void work( void )
+    {
+        for ( ; ; ) {
+
+            Task * task ;
+
+            {
+                std::unique_lock< std::mutex > lock( mutex ) ;
+
+                while ( pending_tasks.empty() && ! finished ) {
+                    task_ready.wait( lock ) ;
+                }
+
+                if ( pending_tasks.empty() ) {
+                    break ;
+                }
+
+                task = pending_tasks.front() ;
+                pending_tasks.pop_front() ;
+            }
+
+            // The errors are reported by the main thread when the output of the task is due.
+
+            try {
+                dump_task( *task ) ;
+            }
+            catch ( ... ) {
+                task->failure = std::current_exception() ;
+            }
+
+            {
+                std::lock_guard< std::mutex > lock( mutex ) ;
+                task->done = true ;
+            }
+
+            task_done.notify_one() ;
+        }
+
+        // Don't let the pool of the terminating thread leak its blocks.
+
+        buffer_pool_trim() ;
+    }
+} ;
+
+/**
+ * Append given task to given queue and hand it over to given workers.
+ */
+void submit_task( TaskQueue & tasks, Workers & workers, Task * const task )
+{
+    tasks.push_back( std::unique_ptr< Task >( task ) ) ;
+    workers.submit( task ) ;
+}
+
+/**
+ * Append task dumping given slice of given PULS or DATA block to given queue.
+ */
+void submit_slice( TaskQueue & tasks, Workers & workers, const Input & input, const bool separate, const uint tag, const uint offset, const uint size, const bool level, const bool last )
+{
+    Task * const task = new Task( input, separate && offset == 0 ) ;
+
+    task->slice = true ;
+    task->tag = tag ;
+    task->offset = offset ;
+    task->size = size ;
+    task->level = level ;
+    task->first = ( offset == 0 ) ;
+    task->last = last ;
+
+    submit_task( tasks, workers, task ) ;
+}
+
+/**
+ * Split given large PULS or DATA block to slices dumped by separate tasks.
+ *
+ * The level at the start of each slice is determined up front, which is
+ * much cheaper than formatting the pulses.
+ */
+void submit_slices( TaskQueue & tasks, Workers & workers, const Input & input, const uint tag, const bool separate )
+{
+    const byte * const data = input->get_data() ;
+    const uint data_size = uint( input->get_data_size() ) ;
+
+    if ( tag == PZX_PULSES ) {
+
+        // Split the pulses at the boundaries of the pulse entries. Anything
+        // incomplete at the end is left to the last slice, which reports it.
+
+        uint start = 0 ;
+        uint offset = 0 ;
+        bool start_level = false ;
+        bool level = false ;
+
+        while ( data_size - offset >= 2 ) {
+
+            if ( offset - start >= task_size ) {
+                submit_slice( tasks, workers, input, separate, tag, start, offset - start, start_level, false ) ;
+                start = offset ;
+                start_level = level ;
+            }
+
+            uint count = 1 ;
+            uint duration = little_endian( * reinterpret_cast< const u16 * >( data + offset ) ) ;
+            offset += 2 ;
+
+            if ( duration > 0x8000 ) {
+                if ( data_size - offset < 2 ) {
+                    break ;
+                }
+                count = duration & 0x7FFF ;
+                duration = little_endian( * reinterpret_cast< const u16 * >( data + offset ) ) ;
+                offset += 2 ;
+            }
+            if ( duration >= 0x8000 ) {
+                offset += 2 ;
+                if ( offset > data_size ) {
+                    break ;
+                }
+            }
+
+            level ^= ( count & 1 ) ;
+        }
+
+        submit_slice( tasks, workers, input, separate, tag, start, data_size - start, start_level, true ) ;
+        return ;
+    }
+
+    // Split the data at the line boundaries.
+
+    DataBlock block ;
+    parse_data_block( block, data, data_size ) ;
+
+    bool level = block.level ;
+
+    for ( uint offset = 0 ; offset < block.data_size ; offset += task_size ) {
+
+        const uint size = ( block.data_size - offset > task_size ? task_size : block.data_size - offset ) ;
+
+        submit_slice( tasks, workers, input, separate, tag, offset, size, level, offset + size == block.data_size ) ;
+
+        if ( option_dump_pulses ) {
+            level = advance_data_level( block, level, block.data + offset, size ) ;
+        }
+    }
+}
+
+/**
+ * Write the output of the finished tasks at the start of given queue to given output, in order.
+ *
+ * Waits for the tasks to finish while there are more than given amount of them.
+ * In case any of the tasks failed, whatever it managed to dump before the
+ * failure is written, as the sequential dump would, and its error is returned,
+ * so the caller can stop and report it. The failed task is removed from the
+ * queue like the others, so its output is never written twice.
+ */
+std::exception_ptr write_tasks( TaskQueue & tasks, Workers & workers, TextOutput & output, const size_t limit )
+{
+    while ( ! tasks.empty() ) {
+
+        Task & task = *tasks.front() ;
+
+        if ( ! workers.wait( task, tasks.size() > limit ) ) {
+            break ;
+        }
+
+        if ( task.separate ) {
+            output.put( '\n' ) ;
+        }
+
+        output.put( task.output.get_data(), task.output.get_data_size() ) ;
+
+        const std::exception_ptr failure = task.failure ;
+
+        tasks.pop_front() ;
+
+        if ( failure ) {
+            return failure ;
+        }
+    }
+
+    return std::exception_ptr() ;
+}
+
+/**
+ * Dump the blocks of given input file to given output using the worker threads, starting with the block with given header.
+ *
+ * The blocks are read ahead and batched to tasks, or split to several tasks
+ * if they are large, and the worker threads format each task to its own
+ * buffer. The buffers are written in the original order, so the output is
+ * the same as that of the sequential dump, including the case when the input
+ * turns out to be invalid.
+ */
+void dump_parallel( FILE * const input_file, TextOutput & output, const u32 * const first_header )
+{
+    TaskQueue tasks ;
+
+    const uint thread_count = option_thread_count ;
+
+    Workers workers( thread_count ) ;
+
+    u32 header[ 2 ] = { first_header[ 0 ], first_header[ 1 ] } ;
+
+    Task * batch = NULL ;
+    bool separate = false ;
+
+    // Note that the sequential dump separates the block from the previous
+    // one as soon as its header is read, before its data is.
+
+    bool separated = false ;
+
+    // Error of failed task, which stops the dump as soon as its output is written.
+
+    std::exception_ptr failure ;
+
+    try {
+        for ( ; ; ) {
+
+            // Extract the tag and size from the header.
+
+            const uint tag = native_endian( header[ 0 ] ) ;
+            const uint size = little_endian( header[ 1 ] ) ;
+
+            separated = separate ;
+
+            stats_enter( STATS_READ ) ;
+
+            if ( size > task_size && ( tag == PZX_PULSES || tag == PZX_DATA ) ) {
+
+                // Large blocks are read on their own and sliced.
+
+                if ( batch ) {
+                    submit_task( tasks, workers, batch ) ;
+                    batch = NULL ;
+                }
+
+                const Input input = std::make_shared< Buffer >() ;
+
+                if ( input->read( input_file, size ) != size ) {
+                    reject( "error reading block data" ) ;
+                }
+
+                submit_slices( tasks, workers, input, tag, separate ) ;
+            }
+            else {
+
+                // Other blocks are appended to the current batch, including their header.
+                // Only the blocks read completely count towards the batch size.
+
+                if ( batch == NULL ) {
+                    batch = new Task( std::make_shared< Buffer >(), separate ) ;
+                }
+
+                batch->input->write( header, sizeof( header ) ) ;
+
+                if ( batch->input->append( input_file, size ) != size ) {
+                    reject( "error reading block data" ) ;
+                }
+
+                batch->size = batch->input->get_data_size() ;
+
+                if ( batch->size >= task_size ) {
+                    submit_task( tasks, workers, batch ) ;
+                    batch = NULL ;
+                }
+            }
+
+            stats_add( STATS_BYTES_IN, 8 + size ) ;
+            stats_count_block( true, tag ) ;
+
+            separate = true ;
+            separated = false ;
+
+            // Write whatever is done already, waiting if too many tasks are in progress.
+
+            stats_enter( STATS_RENDER ) ;
+
+            failure = write_tasks( tasks, workers, output, tasks_per_thread * thread_count ) ;
+
+            if ( failure ) {
+                break ;
+            }
+
+            // Read in header of the next block, if there is any.
+
+            stats_enter( STATS_READ ) ;
+
+            const size_t bytes_read = std::fread( header, 1, sizeof( header ), input_file ) ;
+
+            // Stop if there is nothing more.
+
+            if ( bytes_read == 0 ) {
+                break ;
+            }
+
+            // Check for errors.
+
+            if ( bytes_read != sizeof( header ) ) {
+                reject( "error reading block header" ) ;
+            }
+        }
+    }
+    catch ( const InvalidInput & ) {
+
+        // Write the dump of all the blocks read so far before reporting the
+        // error, unless one of them turns out to be invalid, too, in which
+        // case its error takes precedence as it comes first.
+
+        if ( batch && batch->size > 0 ) {
+            submit_task( tasks, workers, batch ) ;
+        }
+        else {
+            delete batch ;
+        }
+
+        failure = write_tasks( tasks, workers, output, 0 ) ;
+
+        if ( failure ) {
+            std::rethrow_exception( failure ) ;
+        }
+
+        if ( separated ) {
+            output.put( '\n' ) ;
+        }
+
+        throw ;
+    }
+    catch ( ... ) {
+        delete batch ;
+        throw ;
+    }
+
+    // The blocks following the failed task are not dumped at all.
+
+    if ( failure ) {
+        delete batch ;
+        std::rethrow_exception( failure ) ;
+    }
+
+    if ( batch ) {
+        submit_task( tasks, workers, batch ) ;
+    }
+
+    // Now write everything what remains.
+
+    stats_enter( STATS_RENDER ) ;
+
+    failure = write_tasks( tasks, workers, output, 0 ) ;
+
+    if ( failure ) {
+        std::rethrow_exception( failure ) ;
+    }
+}
+
+/**
+ * Dump the blocks of given input file to given output one by one, starting with the block whose header is in given buffer.
+ */
+void dump_sequential( FILE * const input_file, TextOutput & output, Buffer & buffer )
+{
+    const u32 * header = buffer.get_typed_data< u32 >() ;
+
+    for ( ; ; ) {
+
+        // Extract the tag and size from the header.
+
+        const uint tag = native_endian( header[ 0 ] ) ;
+        const uint size = little_endian( header[ 1 ] ) ;
+
+        // Read in the block data.
+
+        if ( buffer.read( input_file, size ) != size ) {
+            reject( "error reading block data" ) ;
+        }
+
+        stats_add( STATS_BYTES_IN, 8 + size ) ;
+        stats_count_block( true, tag ) ;
+
+        // Dump the block.
+
+        stats_enter( STATS_RENDER ) ;
+
+        dump_block( output, tag, buffer.get_data(), size ) ;
+
+        // Read in header of the next block, if there is any.
+
+        stats_enter( STATS_READ ) ;
+
+        const uint bytes_read = buffer.read( input_file, 8 ) ;
+        header = buffer.get_typed_data< u32 >() ;
+
+        // Stop if there is nothing more.
+
+        if ( bytes_read == 0 ) {
+            break ;
+        }
+
+        // Check for errors.
+
+        if ( bytes_read != 8 ) {
+            reject( "error reading block header" ) ;
+        }
+
+        // Separate blocks with empty line.
+
+        output.put( '\n' ) ;
+    }
+}
+
+}
+
 /**
  * Convert given PZX file to PZX text dump.
  */
-extern "C"
-int main( int argc, char * * argv )
+int convert( int argc, char * * argv )
 {
     // Make sure the standard input is in binary mode.
 
@@ -538,6 +1382,9 @@ int main( int argc, char * * argv )
             input_name = argv[ i ] ;
             continue ;
         }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
         switch ( argv[ i ][ 1 ] ) {
             case 'o': {
                 if ( output_name ) {
@@ -570,13 +1417,27 @@ int main( int argc, char * * argv )
                 option_annotate_pulses = true ;
                 break ;
             }
+            case 'j': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing thread count" ) ;
+                }
+                option_thread_count = uint( atoi( arg ) ) ;
+                if ( option_thread_count == 0 ) {
+                    option_thread_count = std::thread::hardware_concurrency() ;
+                }
+                if ( option_thread_count == 0 ) {
+                    option_thread_count = 1 ;
+                }
+                break ;
+            }
             default: {
                 fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
 
                 // Fall through.
             }
             case 'h': {
-                fprintf( stderr, "usage: pzx2txt [-p|-a|-x|-d|-e] [-o output_file] [input_file]\n" ) ;
+                fprintf( stderr, "usage: pzx2txt [-p|-a|-x|-d|-e] [-j n] [-o output_file] [input_file]\n" ) ;
                 fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
                 fprintf( stderr, "-p     dump bytes in data blocks as pulses\n" ) ;
                 fprintf( stderr, "-a     dump bytes in data blocks as ASCII characters when possible\n" ) ;
@@ -584,6 +1445,8 @@ int main( int argc, char * * argv )
                 fprintf( stderr, "-d     don't dump content of data blocks\n" ) ;
                 fprintf( stderr, "-e     expand pulses, dumping each one on separate line\n" ) ;
                 fprintf( stderr, "-l     print initial level of each pulse dumped\n" ) ;
+                fprintf( stderr, "-j n   format the blocks using given number of threads, 0 for one per CPU\n" ) ;
+                stats_usage() ;
                 return EXIT_FAILURE ;
             }
         }
@@ -598,6 +1461,8 @@ int main( int argc, char * * argv )
 
     // Read in the header.
 
+    stats_enter( STATS_READ ) ;
+
     Buffer buffer ;
     if ( buffer.read( input_file, 8 ) != 8 ) {
         fail( "error reading input file" ) ;
@@ -618,46 +1483,34 @@ int main( int argc, char * * argv )
         fail( "unable to open output file" ) ;
     }
 
-    // Now keep reading the blocks and process each one in turn.
+    // Collect the output in a large buffer, so it can be written in bulk.
 
-    for ( ; ; ) {
+    TextOutput output( output_file ) ;
 
-        // Extract the tag and size from the header.
-
-        const uint tag = native_endian( header[ 0 ] ) ;
-        const uint size = little_endian( header[ 1 ] ) ;
+    // Either let the worker threads process the blocks, or process each one
+    // in turn. In case the input turns out to be invalid, make sure the dump
+    // of everything before the error is written before reporting it.
 
-        // Read in the block data.
-
-        if ( buffer.read( input_file, size ) != size ) {
-            fail( "error reading block data" ) ;
+    try {
+        if ( option_thread_count > 0 ) {
+            dump_parallel( input_file, output, header ) ;
         }
-
-        // Dump the block.
-
-        dump_block( output_file, tag, buffer.get_data(), size ) ;
-
-        // Read in header of the next block, if there is any.
-
-        const uint bytes_read = buffer.read( input_file, 8 ) ;
-        header = buffer.get_typed_data< u32 >() ;
-
-        // Stop if there is nothing more.
-
-        if ( bytes_read == 0 ) {
-            break ;
-        }
-
-        // Check for errors.
-
-        if ( bytes_read != 8 ) {
-            fail( "error reading block header" ) ;
+        else {
+            dump_sequential( input_file, output, buffer ) ;
         }
+    }
+    catch ( const InvalidInput & error ) {
+        output.flush() ;
+        fail( "%s", error.what() ) ;
+    }
+    catch ( ... ) {
+        output.flush() ;
+        throw ;
+    }
 
-        // Separate blocks with empty line.
+    stats_enter( STATS_OTHER ) ;
 
-        fprintf( output_file, "\n" ) ;
-    }
+    output.flush() ;
 
     // Close both input and output files and make sure there were no errors.
 
@@ -667,5 +1520,23 @@ int main( int argc, char * * argv )
         fail( "error while closing the output file" ) ;
     }
 
+    // Report the statistics, if requested.
+
+    stats_report( "pzx2txt" ) ;
+
     return EXIT_SUCCESS ;
 }
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
@@ -10,6 +10,13 @@
 
 #include "pzx.h"
 #include "wav.h"
+#include "libpzx.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
 
 /**
  * Global options.
@@ -26,227 +33,456 @@ const uint default_sample_rate = 44100 ;
  */
 uint option_sample_rate = 0 ;
 
+/**
+ * When set, the WAV is rendered in memory only and verified against the source pulses.
+ */
+bool option_verify = false ;
+
 } ;
 
 /**
- * Fetch value of specified type from given data block.
+ * Verifier state.
  */
-template< typename Type >
-Type fetch( const byte * & data, uint & data_size )
-{
-    hope( data ) ;
+namespace {
 
-    if ( sizeof( Type ) > data_size ) {
-        fail( "incomplete block detected" ) ;
-    }
+/**
+ * Duration of one sample, in units of T cycles multiplied by the sample rate.
+ * All times of the verifier use these units, so the sample boundaries are exact.
+ */
+const uquad SAMPLE_PERIOD = 3500000 ;
+
+/**
+ * Source edges closer than this many samples to another edge can't be
+ * reliably represented at given sample rate, so they are not checked.
+ */
+const uquad ISOLATION_SAMPLES = 2 ;
+
+/**
+ * Largest allowed deviation of the duration of pulse between two checked edges.
+ *
+ * The level of each sample is decided by the 128 of 255 threshold applied
+ * to its value rounded down, so each edge moves by less than 128/255 of
+ * a sample, and the duration of pulse by less than 256/255 of a sample.
+ */
+const uquad PULSE_DEVIATION_LIMIT = ( 2 * 128 * SAMPLE_PERIOD - 1 ) / 255 ;
 
-    const Type value = little_endian( * reinterpret_cast< const Type * >( data ) ) ;
+/**
+ * Results of the verification of single block.
+ */
+struct BlockCheck {
+    uint tag ;
+    uquad edge_count ;
+    uquad checked_count ;
+    uquad short_count ;
+    uquad error_count ;
+    uquad edge_deviation ;
+    uquad pulse_deviation ;
+} ;
+
+/**
+ * Results of all blocks, and tape positions where each block starts, in T cycles.
+ */
+//@{
+std::vector< BlockCheck > block_checks ;
+std::vector< uquad > block_positions ;
+//@}
 
-    data += sizeof( Type ) ;
-    data_size -= sizeof( Type ) ;
+/**
+ * Edge detector recovering the edges from the WAV samples.
+ */
+struct Samples {
+    const byte * data ;
+    uquad count ;
+    uquad index ;
+    bool level ;
+} ;
 
-    return value ;
+/**
+ * Read little endian value of specified type from given data.
+ */
+template< typename Type >
+Type peek( const byte * const data )
+{
+    Type value ;
+    std::memcpy( &value, data, sizeof( value ) ) ;
+    return little_endian( value ) ;
 }
 
 /**
- * Skip given amount of bytes in given data block.
+ * Locate the samples of given WAV file in memory, making sure its format is what we have rendered.
  */
-void skip( const uint amount, const byte * & data, uint & data_size )
+void parse_wav( const byte * data, size_t size, const uint sample_rate, Samples & samples )
 {
-    hope( data ) ;
+    if ( size < 12 || ( peek< u32 >( data ) != little_endian( WAV_HEADER ) && peek< u32 >( data ) != little_endian( WAV_HEADER64 ) ) ) {
+        fail( "rendered WAV has invalid header" ) ;
+    }
+
+    const bool rf64 = ( peek< u32 >( data ) == little_endian( WAV_HEADER64 ) ) ;
+
+    data += 12 ;
+    size -= 12 ;
+
+    uquad data_size64 = 0 ;
+    bool format_seen = false ;
+
+    while ( size >= 8 ) {
+
+        const uint tag = peek< u32 >( data ) ;
+        uquad chunk_size = peek< u32 >( data + 4 ) ;
+
+        data += 8 ;
+        size -= 8 ;
+
+        if ( tag == little_endian( WAV_DATA ) ) {
+            if ( rf64 && chunk_size == 0xFFFFFFFF ) {
+                chunk_size = data_size64 ;
+            }
+            if ( ! format_seen || chunk_size > size ) {
+                break ;
+            }
+            samples.data = data ;
+            samples.count = chunk_size ;
+            samples.index = 0 ;
+            samples.level = false ;
+            return ;
+        }
 
-    if ( amount > data_size ) {
-        fail( "incomplete block detected" ) ;
+        if ( chunk_size > size ) {
+            break ;
+        }
+
+        if ( tag == little_endian( WAV_SIZES64 ) && chunk_size >= 16 ) {
+            data_size64 = peek< u64 >( data + 8 ) ;
+        }
+
+        if ( tag == little_endian( WAV_FORMAT ) && chunk_size >= 16 ) {
+            if ( peek< u16 >( data ) != 1 || peek< u16 >( data + 2 ) != 1 || peek< u32 >( data + 4 ) != sample_rate || peek< u16 >( data + 14 ) != 8 ) {
+                fail( "rendered WAV has unexpected format" ) ;
+            }
+            format_seen = true ;
+        }
+
+        data += chunk_size ;
+        size -= chunk_size ;
     }
 
-    data += amount ;
-    data_size -= amount ;
+    fail( "rendered WAV has invalid chunks" ) ;
 }
 
 /**
- * Macros for convenient fetching of values from current block.
+ * Find the next edge of the sampled signal, returning its time and the new level.
+ *
+ * The level of each sample is decided by its value, as any WAV reader would.
  */
-//@{
-#define GET1()  fetch< u8 >( data, data_size )
-#define GET2()  fetch< u16 >( data, data_size )
-#define GET4()  fetch< u32 >( data, data_size )
-#define SKIP(n) skip( n, data, data_size )
-//@}
+bool next_recovered_edge( Samples & samples, uquad & time, bool & level )
+{
+    while ( samples.index < samples.count ) {
+        const bool sample_level = ( samples.data[ samples.index ] >= 128 ) ;
+        if ( sample_level != samples.level ) {
+            samples.level = sample_level ;
+            time = samples.index * SAMPLE_PERIOD ;
+            level = sample_level ;
+            return true ;
+        }
+        samples.index++ ;
+    }
+    return false ;
+}
 
 /**
- * Render bits from given byte using given (little endian) pulse sequences.
+ * Find the next edge of the source signal, returning its time and the new level.
+ *
+ * Adjacent pulses of the same level are merged, and the time is advanced past
+ * the pulse which starts at the edge.
  */
-void render_bits(
-    bool & level,
-    uint bit_count,
-    uint bits,
-    const uint pulse_count_0,
-    const uint pulse_count_1,
-    const byte * const sequence_0,
-    const byte * const sequence_1
-)
+bool next_source_edge( libpzx_pulses * const pulses, const uint sample_rate, uquad & source_time, bool & source_level, uquad & time, bool & level )
 {
-    hope( sequence_0 || pulse_count_0 == 0 ) ;
-    hope( sequence_1 || pulse_count_1 == 0 ) ;
-
-    // Output all bits.
-
-    while ( bit_count-- > 0 ) {
+    for ( ; ; ) {
 
-        // Choose the appropriate sequence for given bit.
+        uint32_t duration ;
+        int pulse_level ;
 
-        const byte * sequence ;
-        uint count ;
+        const int result = libpzx_pulses_next( pulses, &duration, &pulse_level ) ;
 
-        if ( ( bits & 0x80 ) == 0 ) {
-            sequence = sequence_0 ;
-            count = pulse_count_0 ;
+        if ( result == LIBPZX_END ) {
+            return false ;
         }
-        else {
-            sequence = sequence_1 ;
-            count = pulse_count_1 ;
+
+        if ( result == LIBPZX_ERROR ) {
+            fail( "%s", libpzx_error() ) ;
         }
 
-        // Use next bit next time.
+        if ( result == LIBPZX_STOP ) {
+            continue ;
+        }
 
-        bits <<= 1 ;
+        const uquad start = source_time ;
 
-        // Now output the appropriate amount of pulses.
+        source_time += uquad( duration ) * sample_rate ;
 
-        while ( count-- > 0 ) {
-            uint duration = *sequence++ ;
-            duration += *sequence++ << 8 ;
-            wav_out( duration, level ) ;
-            level = ! level ;
+        if ( bool( pulse_level ) != source_level ) {
+            source_level = ! source_level ;
+            time = start ;
+            level = source_level ;
+            return true ;
         }
     }
 }
 
 /**
- * Render given DATA block to WAV output file.
+ * Get the block which contains given time, in units of the verifier.
+ */
+BlockCheck & block_at( const uquad time, const uint sample_rate )
+{
+    const size_t index = std::upper_bound( block_positions.begin(), block_positions.end(), time / sample_rate ) - block_positions.begin() ;
+    return block_checks[ index > 0 ? index - 1 : 0 ] ;
+}
+
+/**
+ * Convert given deviation in units of the verifier to T cycles, rounding up.
+ */
+uint to_cycles( const uquad deviation, const uint sample_rate )
+{
+    return uint( ( deviation + sample_rate - 1 ) / sample_rate ) ;
+}
+
+/**
+ * Verify that the edges recovered from given WAV file in memory match the edges of given PZX file in memory.
+ *
+ * Each recovered edge is matched with the source edge of the same direction
+ * at most one sample away. The edges are rounded to the nearest sample
+ * boundary, so the durations of pulses between isolated edges may differ by
+ * slightly more than one sample, up to PULSE_DEVIATION_LIMIT. The edges of
+ * pulses too short for given sample rate are only counted, as they may vanish
+ * or move. Missing edges, extra edges, and pulses deviating more than that
+ * are reported as errors.
  */
-void render_data_block( const byte * data, uint data_size )
+uquad verify_wav( const byte * const tape, const size_t tape_size, const byte * const wav, const size_t wav_size, const uint sample_rate )
 {
-    hope( data ) ;
+    // Find where each block starts.
+
+    libpzx_player * const player = libpzx_player_open( tape, tape_size, 0 ) ;
+    libpzx_reader * const reader = libpzx_reader_open( tape, tape_size ) ;
+    if ( player == NULL || reader == NULL ) {
+        fail( "%s", libpzx_error() ) ;
+    }
 
-    // Fetch the numbers.
+    libpzx_block block ;
+    uint64_t position ;
 
-    uint bit_count = GET4() ;
-    const uint tail_cycles = GET2() ;
-    const uint pulse_count_0 = GET1() ;
-    const uint pulse_count_1 = GET1() ;
+    while ( libpzx_reader_next( reader, &block ) == LIBPZX_OK && libpzx_player_block_position( player, uint( block_checks.size() ), &position ) == LIBPZX_OK ) {
+        BlockCheck check = { block.tag, 0, 0, 0, 0, 0, 0 } ;
+        block_checks.push_back( check ) ;
+        block_positions.push_back( position ) ;
+    }
+
+    const uquad tape_length = libpzx_player_length( player ) * sample_rate ;
 
-    // Extract initial pulse level.
+    libpzx_reader_close( reader ) ;
+    libpzx_player_close( player ) ;
 
-    bool level = ( ( bit_count >> 31 ) != 0 ) ;
+    if ( block_checks.empty() ) {
+        fail( "input contains no blocks" ) ;
+    }
 
-    bit_count &= 0x7FFFFFFF ;
+    // Locate the samples, ignoring anything past the end of the tape, like the padding sample.
 
-    // Fetch the sequences. Note that we keep them little endian here.
+    Samples samples ;
 
-    const byte * const sequence_0 = data ;
-    SKIP( 2 * pulse_count_0 ) ;
+    parse_wav( wav, wav_size, sample_rate, samples ) ;
 
-    const byte * const sequence_1 = data ;
-    SKIP( 2 * pulse_count_1 ) ;
+    const uquad sample_count = ( tape_length + SAMPLE_PERIOD - 1 ) / SAMPLE_PERIOD ;
 
-    // Make sure the bit count matches the block size.
+    uquad error_count = 0 ;
 
-    if ( data_size != ( ( bit_count + 7 ) / 8 ) ) {
-        fail( "bit count %u does not match the actual data size %u", bit_count, data_size ) ;
+    if ( samples.count < sample_count ) {
+        warn( "rendered WAV has %llu samples instead of %llu", samples.count, sample_count ) ;
+        error_count++ ;
+    }
+    else {
+        samples.count = sample_count ;
     }
 
-    // Now output all the bits.
+    // Now walk the source edges, one edge ahead, as we need to know the length of the pulses on both sides.
 
-    while ( bit_count > 8 ) {
-        render_bits( level, 8, *data++, pulse_count_0, pulse_count_1, sequence_0, sequence_1 ) ;
-        bit_count -= 8 ;
+    libpzx_pulses * const pulses = libpzx_pulses_open( tape, tape_size ) ;
+    if ( pulses == NULL ) {
+        fail( "%s", libpzx_error() ) ;
     }
-    render_bits( level, bit_count, *data, pulse_count_0, pulse_count_1, sequence_0, sequence_1 ) ;
 
-    // And finally output the optional tail pulse.
+    const uquad window = SAMPLE_PERIOD ;
+    const uquad isolation = ISOLATION_SAMPLES * SAMPLE_PERIOD ;
 
-    wav_out( tail_cycles, level ) ;
-}
+    uquad source_time = 0 ;
+    bool source_level = false ;
 
-/**
- * Render given PULSE block to WAV output file.
- */
-void render_pulse_block( const byte * data, uint data_size )
-{
-    hope( data ) ;
+    uquad recovered_time = 0 ;
+    bool recovered_level = false ;
+    bool recovered = next_recovered_edge( samples, recovered_time, recovered_level ) ;
 
-    // Prepare initial level.
+    uquad edge_time = 0 ;
+    bool edge_level = false ;
+    bool edge = next_source_edge( pulses, sample_rate, source_time, source_level, edge_time, edge_level ) ;
 
-    bool level = false ;
+    // The tape starts at low level at time zero in both signals.
 
-    // Render all pulses in the block.
+    uquad previous_time = 0 ;
+    uquad previous_recovered_time = 0 ;
+    bool previous_checked = true ;
+    bool first = true ;
 
-    while ( data_size > 0 ) {
+    while ( edge ) {
 
-        // Fetch the pulse repeat count and duration.
+        uquad next_time = 0 ;
+        bool next_level = false ;
+        const bool next = next_source_edge( pulses, sample_rate, source_time, source_level, next_time, next_level ) ;
 
-        uint count = 1 ;
-        uint duration = GET2() ;
-        if ( duration > 0x8000 ) {
-            count = duration & 0x7FFF ;
-            duration = GET2() ;
+        BlockCheck & check = block_at( edge_time, sample_rate ) ;
+
+        check.edge_count++ ;
+
+        // Recovered edges well before this edge can't belong to it. Unless
+        // they are near the previous source edge, they shouldn't be there.
+
+        while ( recovered && recovered_time + window < edge_time ) {
+            if ( first || recovered_time > previous_time + window ) {
+                block_at( recovered_time, sample_rate ).error_count++ ;
+            }
+            recovered = next_recovered_edge( samples, recovered_time, recovered_level ) ;
+        }
+
+        // Only the edges far enough from both neighbors are checked.
+
+        const uquad following_length = ( next ? next_time : tape_length ) - edge_time ;
+
+        const bool isolated = ( ( first || edge_time - previous_time >= isolation ) && following_length >= isolation ) ;
+
+        bool checked = false ;
+
+        if ( isolated ) {
+
+            check.checked_count++ ;
+
+            while ( recovered && recovered_time <= edge_time + window && recovered_level != edge_level ) {
+                check.error_count++ ;
+                recovered = next_recovered_edge( samples, recovered_time, recovered_level ) ;
+            }
+
+            if ( recovered && recovered_time <= edge_time + window ) {
+
+                const uquad edge_deviation = ( recovered_time > edge_time ? recovered_time - edge_time : edge_time - recovered_time ) ;
+                check.edge_deviation = std::max( check.edge_deviation, edge_deviation ) ;
+
+                // The pulse ending at this edge may be checked if its start was checked as well.
+
+                if ( previous_checked ) {
+                    const uquad length = edge_time - previous_time ;
+                    const uquad recovered_length = recovered_time - previous_recovered_time ;
+                    const uquad pulse_deviation = ( recovered_length > length ? recovered_length - length : length - recovered_length ) ;
+                    check.pulse_deviation = std::max( check.pulse_deviation, pulse_deviation ) ;
+
+                    if ( pulse_deviation > PULSE_DEVIATION_LIMIT ) {
+                        check.error_count++ ;
+                    }
+                }
+
+                checked = true ;
+                previous_recovered_time = recovered_time ;
+                recovered = next_recovered_edge( samples, recovered_time, recovered_level ) ;
+            }
+            else {
+                check.error_count++ ;
+            }
         }
-        if ( duration >= 0x8000 ) {
-            duration &= 0x7FFF ;
-            duration <<= 16 ;
-            duration |= GET2() ;
+        else {
+            check.short_count++ ;
         }
 
-        // Output the appropriate number of pulses.
+        previous_time = edge_time ;
+        previous_checked = checked ;
+        first = false ;
+
+        edge = next ;
+        edge_time = next_time ;
+        edge_level = next_level ;
+    }
+
+    libpzx_pulses_close( pulses ) ;
+
+    // Any remaining recovered edges are errors, unless they belong to the last
+    // source edge, or to the end of the tape, where the last partial sample may
+    // end the last pulse.
 
-        while ( count-- > 0 ) {
-            wav_out( duration, level ) ;
-            level = ! level ;
+    while ( recovered ) {
+        if ( ( first || recovered_time > previous_time + window ) && recovered_time + window < tape_length ) {
+            block_at( recovered_time, sample_rate ).error_count++ ;
         }
+        recovered = next_recovered_edge( samples, recovered_time, recovered_level ) ;
     }
+
+    return error_count ;
 }
 
 /**
- * Render given PZX block to WAV output file.
+ * Report the results of the verification to given file, returning true if there were no errors.
  */
-void render_block( const uint tag, const byte * data, uint data_size )
+bool report_checks( FILE * const file, const uint sample_rate, uquad error_count )
 {
-    hope( data ) ;
-
-    switch ( tag ) {
-        case PZX_HEADER: {
-            const uint major = GET1() ;
-            const uint minor = GET1() ;
-            if ( major != PZX_MAJOR ) {
-                fail( "unsupported PZX major version %u.%u - stopping", major, minor ) ;
-            }
-            if ( minor > PZX_MINOR ) {
-                warn( "unsupported PZX minor version %u.%u - proceeding", major, minor ) ;
-            }
-            break ;
-        }
-        case PZX_PULSES: {
-            render_pulse_block( data, data_size ) ;
-            break ;
+    fprintf( file, "sample rate %u Hz, pulse deviation bound %u T\n", sample_rate, to_cycles( PULSE_DEVIATION_LIMIT, sample_rate ) ) ;
+
+    uquad checked_count = 0 ;
+    uquad short_count = 0 ;
+
+    for ( size_t i = 0 ; i < block_checks.size() ; i++ ) {
+
+        const BlockCheck & check = block_checks[ i ] ;
+
+        const char name[] = {
+            char( check.tag ),
+            char( check.tag >> 8 ),
+            char( check.tag >> 16 ),
+            char( check.tag >> 24 ),
+            0
+        } ;
+
+        fprintf( file, "block %u %s: ", uint( i ), name ) ;
+
+        if ( check.edge_count == 0 && check.error_count == 0 ) {
+            fprintf( file, "no edges\n" ) ;
+            continue ;
         }
-        case PZX_DATA: {
-            render_data_block( data, data_size ) ;
-            break ;
+
+        fprintf( file, "%llu edges, %llu checked, %llu too short, max edge deviation %u T, max pulse deviation %u T, ",
+            check.edge_count,
+            check.checked_count,
+            check.short_count,
+            to_cycles( check.edge_deviation, sample_rate ),
+            to_cycles( check.pulse_deviation, sample_rate )
+        ) ;
+
+        if ( check.error_count > 0 ) {
+            fprintf( file, "%llu errors\n", check.error_count ) ;
         }
-        case PZX_PAUSE: {
-            const uint duration = GET4() ;
-            wav_out( ( duration & 0x7FFFFFFF ), ( duration >> 31 ) ) ;
-            break ;
+        else {
+            fprintf( file, "ok\n" ) ;
         }
+
+        checked_count += check.checked_count ;
+        short_count += check.short_count ;
+        error_count += check.error_count ;
     }
+
+    fprintf( file, "%llu edges checked, %llu too short, %llu errors\n", checked_count, short_count, error_count ) ;
+
+    return ( error_count == 0 ) ;
+}
+
 }
 
 /**
  * Convert given PZX file to PZX text render.
  */
-extern "C"
-int main( int argc, char * * argv )
+int convert( int argc, char * * argv )
 {
     // Make sure the standard I/O is in binary mode.
 
@@ -266,6 +502,9 @@ int main( int argc, char * * argv )
             input_name = argv[ i ] ;
             continue ;
         }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
         switch ( argv[ i ][ 1 ] ) {
             case 'o': {
                 if ( output_name ) {
@@ -279,7 +518,16 @@ int main( int argc, char * * argv )
                 if ( arg == NULL ) {
                     fail( "missing sample rate" ) ;
                 }
-                option_sample_rate = uint( atoi( arg ) ) ;
+                char * end ;
+                const long value = std::strtol( arg, &end, 10 ) ;
+                if ( end == arg || *end != 0 || value <= 0 || value > 3500000 ) {
+                    fail( "invalid sample rate %s", arg ) ;
+                }
+                option_sample_rate = uint( value ) ;
+                break ;
+            }
+            case 'v': {
+                option_verify = true ;
                 break ;
             }
             default: {
@@ -288,9 +536,11 @@ int main( int argc, char * * argv )
                 // Fall through.
             }
             case 'h': {
-                fprintf( stderr, "usage: pzx2wav [-s n] [-o output_file] [input_file]\n" ) ;
+                fprintf( stderr, "usage: pzx2wav [-s n] [-v] [-o output_file] [input_file]\n" ) ;
                 fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
                 fprintf( stderr, "-s n   use given sample rate instead of default %uHz\n", default_sample_rate ) ;
+                fprintf( stderr, "-v     verify the WAV rendered in memory against the input and report the results\n" ) ;
+                stats_usage() ;
                 return EXIT_FAILURE ;
             }
         }
@@ -305,6 +555,8 @@ int main( int argc, char * * argv )
 
     // Read in the header.
 
+    stats_enter( STATS_READ ) ;
+
     Buffer buffer ;
     if ( buffer.read( input_file, 8 ) != 8 ) {
         fail( "error reading input file" ) ;
@@ -325,11 +577,20 @@ int main( int argc, char * * argv )
         fail( "unable to open output file" ) ;
     }
 
-    // Bind the WAV stream to the output file.
+    // Bind the WAV stream to the output file. When verifying, the WAV is
+    // rendered to memory instead, and the input is kept for comparison.
 
     const uint sample_rate = ( option_sample_rate > 0 ? option_sample_rate : default_sample_rate ) ;
 
-    wav_open( output_file, sample_rate, 3500000 ) ;
+    Buffer tape ;
+    Buffer wav ;
+
+    if ( option_verify ) {
+        wav_open( wav, sample_rate, 3500000 ) ;
+    }
+    else {
+        wav_open( output_file, sample_rate, 3500000 ) ;
+    }
 
     // Now keep reading the blocks and process each one in turn.
 
@@ -340,18 +601,33 @@ int main( int argc, char * * argv )
         const uint tag = native_endian( header[ 0 ] ) ;
         const uint size = little_endian( header[ 1 ] ) ;
 
+        if ( option_verify ) {
+            tape.write( header, 8 ) ;
+        }
+
         // Read in the block data.
 
         if ( buffer.read( input_file, size ) != size ) {
             fail( "error reading block data" ) ;
         }
 
+        if ( option_verify ) {
+            tape.write( buffer.get_data(), size ) ;
+        }
+
+        stats_add( STATS_BYTES_IN, 8 + size ) ;
+        stats_count_block( true, tag ) ;
+
         // Render the block.
 
-        render_block( tag, buffer.get_data(), size ) ;
+        stats_enter( STATS_RENDER ) ;
+
+        wav_render_block( tag, buffer.get_data(), size ) ;
 
         // Read in header of the next block, if there is any.
 
+        stats_enter( STATS_READ ) ;
+
         const uint bytes_read = buffer.read( input_file, 8 ) ;
         header = buffer.get_typed_data< u32 >() ;
 
@@ -368,6 +644,8 @@ int main( int argc, char * * argv )
         }
     }
 
+    stats_enter( STATS_OTHER ) ;
+
     // Close the input file.
 
     fclose( input_file ) ;
@@ -376,9 +654,42 @@ int main( int argc, char * * argv )
 
     wav_close() ;
 
+    bool verified = true ;
+
+    if ( option_verify ) {
+
+        stats_enter( STATS_PARSE ) ;
+
+        const uquad error_count = verify_wav( tape.get_data(), tape.get_data_size(), wav.get_data(), wav.get_data_size(), sample_rate ) ;
+
+        stats_enter( STATS_WRITE ) ;
+
+        verified = report_checks( output_file, sample_rate, error_count ) ;
+
+        stats_enter( STATS_OTHER ) ;
+    }
+
     if ( ferror( output_file ) != 0 || fclose( output_file ) != 0 ) {
         fail( "error while closing the output file" ) ;
     }
 
-    return EXIT_SUCCESS ;
+    // Report the statistics, if requested.
+
+    stats_report( "pzx2wav" ) ;
+
+    return ( verified ? EXIT_SUCCESS : EXIT_FAILURE ) ;
+}
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
 }
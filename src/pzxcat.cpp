@@ -0,0 +1,243 @@
+// $Id$
+
+/**
+ * @file PZX file concatenator.
+ *
+ * Joins several PZX files together, copying their blocks as they are,
+ * without decoding them in any way.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "pzx.h"
+#include "copy.h"
+#include "stats.h"
+
+#include <cstring>
+
+/**
+ * Global options.
+ */
+namespace {
+
+/**
+ * When set, header blocks of all but the first file are dropped.
+ */
+bool option_strip_headers = false ;
+
+} ;
+
+/**
+ * Concatenator state.
+ */
+namespace {
+
+/**
+ * Output file.
+ */
+FILE * output_file ;
+
+/**
+ * Content of the first header block written, including the block header.
+ */
+Buffer first_header ;
+
+/**
+ * Write given data to the output file.
+ */
+void write_data( const void * const data, const uint size )
+{
+    stats_enter( STATS_WRITE ) ;
+
+    if ( std::fwrite( data, 1, size, output_file ) != size ) {
+        fail( "error writing to file" ) ;
+    }
+
+    stats_add( STATS_BYTES_OUT, size ) ;
+}
+
+/**
+ * Append blocks of given PZX file to the output file.
+ */
+void append_file( const char * const input_name )
+{
+    FILE * const input_file = fopen( input_name, "rb" ) ;
+    if ( input_file == NULL ) {
+        fail( "unable to open input file %s", input_name ) ;
+    }
+
+    Buffer header_block ;
+
+    for ( bool first = true ; ; first = false ) {
+
+        // Read the block header.
+
+        stats_enter( STATS_READ ) ;
+
+        u32 block_header[ 2 ] ;
+
+        const uint bytes_read = fread( block_header, 1, sizeof( block_header ), input_file ) ;
+
+        if ( bytes_read == 0 && ! first ) {
+            break ;
+        }
+
+        if ( bytes_read != sizeof( block_header ) ) {
+            fail( "error reading block header of %s", input_name ) ;
+        }
+
+        const uint tag = native_endian( block_header[ 0 ] ) ;
+        const uint size = little_endian( block_header[ 1 ] ) ;
+
+        stats_add( STATS_BYTES_IN, sizeof( block_header ) ) ;
+        stats_count_block( true, tag ) ;
+
+        if ( first && tag != PZX_HEADER ) {
+            fail( "file %s is not a PZX file", input_name ) ;
+        }
+
+        // Copy all blocks other than headers directly.
+
+        if ( tag != PZX_HEADER ) {
+            write_data( block_header, sizeof( block_header ) ) ;
+            copy_data( output_file, input_file, size ) ;
+            continue ;
+        }
+
+        // Headers are small, so read them in to check their version first.
+
+        header_block.clear() ;
+        header_block.write( block_header, sizeof( block_header ) ) ;
+
+        if ( header_block.append( input_file, size ) != size ) {
+            fail( "error reading block data of %s", input_name ) ;
+        }
+
+        if ( size < 2 || header_block.get_data()[ 8 ] != PZX_MAJOR ) {
+            fail( "unsupported PZX version in %s", input_name ) ;
+        }
+
+        stats_add( STATS_BYTES_IN, size ) ;
+
+        // The first header of each file is dropped if it is the same as the
+        // header already written, or if we were asked to drop it. Any other
+        // headers are kept, as they were part of the file already.
+
+        if ( first ) {
+            if ( first_header.is_empty() ) {
+                first_header.write( header_block.get_data(), header_block.get_data_size() ) ;
+            }
+            else if ( option_strip_headers ) {
+                continue ;
+            }
+            else if ( header_block.get_data_size() == first_header.get_data_size() &&
+                std::memcmp( header_block.get_data(), first_header.get_data(), first_header.get_data_size() ) == 0 ) {
+                continue ;
+            }
+        }
+
+        write_data( header_block.get_data(), header_block.get_data_size() ) ;
+    }
+
+    fclose( input_file ) ;
+}
+
+}
+
+/**
+ * Concatenate given PZX files.
+ */
+int convert( int argc, char * * argv )
+{
+    // Make sure the standard I/O is in binary mode.
+
+    set_binary_mode( stdout ) ;
+
+    // Parse the command line.
+
+    const char * output_name = NULL ;
+
+    int input_count = 0 ;
+
+    for ( int i = 1 ; i < argc ; i++ ) {
+        if ( argv[ i ][ 0 ] != '-' ) {
+            argv[ input_count++ ] = argv[ i ] ;
+            continue ;
+        }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
+        switch ( argv[ i ][ 1 ] ) {
+            case 'o': {
+                if ( output_name ) {
+                    fail( "multiple output file names specified" ) ;
+                }
+                output_name = argv[ ++i ] ;
+                break ;
+            }
+            case 's': {
+                option_strip_headers = true ;
+                break ;
+            }
+            default: {
+                fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
+
+                // Fall through.
+            }
+            case 'h': {
+                fprintf( stderr, "usage: pzxcat [-s] [-o output_file] input_file...\n" ) ;
+                fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
+                fprintf( stderr, "-s     strip headers of all but the first file\n" ) ;
+                stats_usage() ;
+                return EXIT_FAILURE ;
+            }
+        }
+    }
+
+    if ( input_count == 0 ) {
+        fail( "no input files specified" ) ;
+    }
+
+    // Open the output file.
+
+    output_file = ( output_name ? fopen( output_name, "wb" ) : stdout ) ;
+    if ( output_file == NULL ) {
+        fail( "unable to open output file" ) ;
+    }
+
+    // Append all input files in turn.
+
+    for ( int i = 0 ; i < input_count ; i++ ) {
+        append_file( argv[ i ] ) ;
+    }
+
+    stats_enter( STATS_OTHER ) ;
+
+    // Close the output file.
+
+    if ( ferror( output_file ) != 0 || fclose( output_file ) != 0 ) {
+        fail( "error while closing the output file" ) ;
+    }
+
+    // Report the statistics, if requested.
+
+    stats_report( "pzxcat" ) ;
+
+    return EXIT_SUCCESS ;
+}
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
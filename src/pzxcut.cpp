@@ -0,0 +1,386 @@
+// $Id$
+
+/**
+ * @file PZX block cutter.
+ *
+ * Extracts selected blocks or parts of PZX file, copying the blocks as they
+ * are, without decoding them in any way.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "pzx.h"
+#include "copy.h"
+#include "stats.h"
+
+#include <cstring>
+
+/**
+ * Global options.
+ */
+namespace {
+
+/**
+ * Ways of dividing the input file to the units which may be selected.
+ */
+enum Unit {
+    UNIT_BLOCK,
+    UNIT_STOP_PART,
+    UNIT_BROWSE_PART
+} ;
+
+/**
+ * Unit used for the selection.
+ */
+Unit option_unit = UNIT_BLOCK ;
+
+/**
+ * First and last unit selected.
+ */
+//@{
+uint option_first = 0 ;
+uint option_last = 0xFFFFFFFF ;
+//@}
+
+} ;
+
+/**
+ * Cutter state.
+ */
+namespace {
+
+/**
+ * Name of the output file, possibly containing the part number placeholder.
+ */
+const char * output_name ;
+
+/**
+ * Current output file, if any.
+ */
+FILE * output_file ;
+
+/**
+ * Number of the part currently written to output file.
+ */
+uint output_part ;
+
+/**
+ * Content of the header block of the input file, including the block header.
+ */
+Buffer header_block ;
+
+/**
+ * Parse range of unit numbers from given string.
+ */
+void parse_range( const char * const string )
+{
+    if ( string == NULL ) {
+        fail( "missing range" ) ;
+    }
+
+    char * end ;
+
+    option_first = uint( std::strtoul( string, &end, 10 ) ) ;
+
+    if ( end == string ) {
+        fail( "invalid range %s", string ) ;
+    }
+
+    if ( *end == 0 ) {
+        option_last = option_first ;
+        return ;
+    }
+
+    if ( *end++ != '-' ) {
+        fail( "invalid range %s", string ) ;
+    }
+
+    if ( *end == 0 ) {
+        option_last = 0xFFFFFFFF ;
+        return ;
+    }
+
+    const char * const last = end ;
+
+    option_last = uint( std::strtoul( last, &end, 10 ) ) ;
+
+    if ( end == last || *end != 0 || option_last < option_first ) {
+        fail( "invalid range %s", string ) ;
+    }
+}
+
+/**
+ * Close the current output file, if any.
+ */
+void close_output( void )
+{
+    if ( output_file && ( ferror( output_file ) != 0 || fclose( output_file ) != 0 ) ) {
+        fail( "error while closing the output file" ) ;
+    }
+
+    output_file = NULL ;
+}
+
+/**
+ * Make sure the output file for given part is open.
+ *
+ * In case the output name contains the part number placeholder, each part
+ * is written to its own file, each starting with the header of the input file.
+ */
+void open_output( const uint part )
+{
+    const bool split = ( output_name && std::strstr( output_name, "%u" ) ) ;
+
+    if ( output_file && ( ! split || part == output_part ) ) {
+        return ;
+    }
+
+    close_output() ;
+
+    if ( split ) {
+        char name[ 1024 ] ;
+        std::snprintf( name, sizeof( name ), output_name, part ) ;
+        output_file = fopen( name, "wb" ) ;
+    }
+    else {
+        output_file = ( output_name ? fopen( output_name, "wb" ) : stdout ) ;
+    }
+
+    if ( output_file == NULL ) {
+        fail( "unable to open output file" ) ;
+    }
+
+    output_part = part ;
+
+    // Each file starts with the header, so it is a valid PZX file.
+
+    if ( std::fwrite( header_block.get_data(), 1, header_block.get_data_size(), output_file ) != header_block.get_data_size() ) {
+        fail( "error writing to file" ) ;
+    }
+
+    stats_add( STATS_BYTES_OUT, header_block.get_data_size() ) ;
+}
+
+}
+
+/**
+ * Cut given PZX file.
+ */
+int convert( int argc, char * * argv )
+{
+    // Make sure the standard I/O is in binary mode.
+
+    set_binary_mode( stdin ) ;
+    set_binary_mode( stdout ) ;
+
+    // Parse the command line.
+
+    const char * input_name = NULL ;
+
+    bool range_specified = false ;
+
+    for ( int i = 1 ; i < argc ; i++ ) {
+        if ( argv[ i ][ 0 ] != '-' ) {
+            if ( input_name ) {
+                fail( "multiple input file names specified" ) ;
+            }
+            input_name = argv[ i ] ;
+            continue ;
+        }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
+        switch ( argv[ i ][ 1 ] ) {
+            case 'o': {
+                if ( output_name ) {
+                    fail( "multiple output file names specified" ) ;
+                }
+                output_name = argv[ ++i ] ;
+                break ;
+            }
+            case 'b':
+            case 's':
+            case 'w': {
+                if ( range_specified ) {
+                    fail( "multiple ranges specified" ) ;
+                }
+                range_specified = true ;
+                option_unit = ( argv[ i ][ 1 ] == 'b' ? UNIT_BLOCK : argv[ i ][ 1 ] == 's' ? UNIT_STOP_PART : UNIT_BROWSE_PART ) ;
+                parse_range( argv[ ++i ] ) ;
+                break ;
+            }
+            default: {
+                fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
+
+                // Fall through.
+            }
+            case 'h': {
+                fprintf( stderr, "usage: pzxcut [-b range|-s range|-w range] [-o output_file] [input_file]\n" ) ;
+                fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
+                fprintf( stderr, "       with %%u in the name, each part is written to its own file\n" ) ;
+                fprintf( stderr, "-b r   extract given range of blocks, counted from 0\n" ) ;
+                fprintf( stderr, "-s r   extract given range of parts ending with STOP blocks, counted from 1\n" ) ;
+                fprintf( stderr, "-w r   extract given range of parts starting with BROWSE blocks, counted from 1\n" ) ;
+                fprintf( stderr, "       the range is either n, n-m, or n-\n" ) ;
+                stats_usage() ;
+                return EXIT_FAILURE ;
+            }
+        }
+    }
+
+    if ( ! range_specified ) {
+        fail( "no range specified" ) ;
+    }
+
+    if ( output_name && std::strstr( output_name, "%u" ) && option_unit == UNIT_BLOCK ) {
+        fail( "only parts may be written to separate files" ) ;
+    }
+
+    // Open the input file.
+
+    FILE * const input_file = ( input_name ? fopen( input_name, "rb" ) : stdin ) ;
+    if ( input_file == NULL ) {
+        fail( "unable to open input file" ) ;
+    }
+
+    // Read in the header block.
+
+    stats_enter( STATS_READ ) ;
+
+    if ( header_block.read( input_file, 8 ) != 8 ) {
+        fail( "error reading input file" ) ;
+    }
+
+    const u32 * header = header_block.get_typed_data< u32 >() ;
+
+    if ( header[ 0 ] != PZX_HEADER ) {
+        fail( "input is not a PZX file" ) ;
+    }
+
+    const uint header_size = little_endian( header[ 1 ] ) ;
+
+    if ( header_block.append( input_file, header_size ) != header_size ) {
+        fail( "error reading block data" ) ;
+    }
+
+    if ( header_size < 2 || header_block.get_data()[ 8 ] != PZX_MAJOR ) {
+        fail( "unsupported PZX version" ) ;
+    }
+
+    stats_add( STATS_BYTES_IN, 8 + header_size ) ;
+    stats_count_block( true, PZX_HEADER ) ;
+
+    // Unless we split the output, it always starts with the header, even if nothing is selected.
+
+    if ( ! output_name || ! std::strstr( output_name, "%u" ) ) {
+        open_output( 1 ) ;
+    }
+
+    // Now process the remaining blocks, copying the selected ones.
+
+    uint block_index = 0 ;
+    uint part = 1 ;
+    bool browse_seen = false ;
+
+    for ( ; ; ) {
+
+        u32 block_header[ 2 ] ;
+
+        const uint bytes_read = fread( block_header, 1, sizeof( block_header ), input_file ) ;
+
+        if ( bytes_read == 0 ) {
+            break ;
+        }
+
+        if ( bytes_read != sizeof( block_header ) ) {
+            fail( "error reading block header" ) ;
+        }
+
+        block_index++ ;
+
+        const uint tag = native_endian( block_header[ 0 ] ) ;
+        const uint size = little_endian( block_header[ 1 ] ) ;
+
+        stats_add( STATS_BYTES_IN, sizeof( block_header ) ) ;
+        stats_count_block( true, tag ) ;
+
+        // Each BROWSE block except the first one starts a new part.
+
+        if ( tag == PZX_BROWSE && option_unit == UNIT_BROWSE_PART ) {
+            if ( browse_seen ) {
+                part++ ;
+            }
+            browse_seen = true ;
+        }
+
+        const uint unit = ( option_unit == UNIT_BLOCK ? block_index : part ) ;
+
+        // Stop as soon as we are past the selected range.
+
+        if ( unit > option_last ) {
+            break ;
+        }
+
+        // Copy the block if it is selected, otherwise skip it.
+
+        if ( unit >= option_first ) {
+
+            open_output( part ) ;
+
+            stats_enter( STATS_WRITE ) ;
+
+            if ( std::fwrite( block_header, 1, sizeof( block_header ), output_file ) != sizeof( block_header ) ) {
+                fail( "error writing to file" ) ;
+            }
+
+            stats_add( STATS_BYTES_OUT, sizeof( block_header ) ) ;
+
+            copy_data( output_file, input_file, size ) ;
+        }
+        else {
+            stats_enter( STATS_READ ) ;
+
+            skip_data( input_file, size ) ;
+        }
+
+        // Each STOP block ends the current part.
+
+        if ( tag == PZX_STOP && option_unit == UNIT_STOP_PART ) {
+            part++ ;
+        }
+    }
+
+    stats_enter( STATS_OTHER ) ;
+
+    // Close the files.
+
+    fclose( input_file ) ;
+
+    if ( output_file == NULL ) {
+        warn( "nothing was selected" ) ;
+    }
+
+    close_output() ;
+
+    // Report the statistics, if requested.
+
+    stats_report( "pzxcut" ) ;
+
+    return EXIT_SUCCESS ;
+}
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
@@ -0,0 +1,814 @@
+// $Id$
+
+/**
+ * @file Conversion service daemon.
+ *
+ * Serves conversion requests over local Unix domain socket, so the clients
+ * don't have to start new process for each conversion.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "pzx.h"
+#include "tap.h"
+#include "tzx.h"
+#include "csw.h"
+#include "wav.h"
+
+#include <cerrno>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Global options.
+ */
+namespace {
+
+/**
+ * Default socket name, worker count, input size limit in megabytes, and sample rate for WAV generation.
+ */
+//@{
+const char * const default_socket_name = "pzxd.socket" ;
+const uint default_worker_count = 4 ;
+const uint default_input_limit = 64 ;
+const uint default_sample_rate = 44100 ;
+//@}
+
+/**
+ * Name of the socket to listen on.
+ */
+const char * option_socket_name = NULL ;
+
+/**
+ * Number of worker processes serving the requests.
+ */
+uint option_worker_count = 0 ;
+
+/**
+ * Largest input size in megabytes accepted from the clients.
+ */
+uint option_input_limit = 0 ;
+
+/**
+ * Resolved name of the directory the FILE requests may read from, or NULL
+ * if the FILE requests are not allowed at all.
+ */
+char * option_file_directory = NULL ;
+
+} ;
+
+/**
+ * Daemon state.
+ */
+namespace {
+
+/**
+ * Maximum number of worker processes.
+ */
+const uint worker_limit = 256 ;
+
+/**
+ * Process IDs of the worker processes.
+ */
+pid_t workers[ worker_limit ] ;
+
+/**
+ * Set when the daemon was asked to terminate.
+ */
+volatile sig_atomic_t termination_requested ;
+
+/**
+ * Socket of the client whose request is being processed, or -1 if there is none.
+ */
+int client_socket = -1 ;
+
+/**
+ * File collecting the warnings and errors printed while processing current request.
+ */
+FILE * message_file ;
+
+/**
+ * Original standard error output of the worker.
+ */
+int saved_stderr = -1 ;
+
+/**
+ * Supported input and output formats.
+ */
+enum Format {
+    FORMAT_NONE,
+    FORMAT_TZX,
+    FORMAT_TAP,
+    FORMAT_CSW,
+    FORMAT_PZX,
+    FORMAT_WAV
+} ;
+
+} ;
+
+/**
+ * Remember that the daemon should terminate.
+ */
+extern "C"
+void request_termination( int )
+{
+    termination_requested = 1 ;
+}
+
+/**
+ * Send given data to given socket, returning false in case of error.
+ */
+bool send_data( const int socket, const void * const data, const size_t size )
+{
+    hope( data || size == 0 ) ;
+
+    const char * p = static_cast< const char * >( data ) ;
+    size_t size_left = size ;
+
+    while ( size_left > 0 ) {
+        const ssize_t result = write( socket, p, size_left ) ;
+        if ( result < 0 ) {
+            if ( errno == EINTR ) {
+                continue ;
+            }
+            return false ;
+        }
+        p += result ;
+        size_left -= result ;
+    }
+
+    return true ;
+}
+
+/**
+ * Start collecting the messages of new request.
+ */
+void begin_messages( void )
+{
+    fflush( stderr ) ;
+
+    if ( ftruncate( fileno( message_file ), 0 ) != 0 || lseek( fileno( message_file ), 0, SEEK_SET ) != 0 ) {
+        fail( "unable to reset message file" ) ;
+    }
+
+    dup2( fileno( message_file ), STDERR_FILENO ) ;
+}
+
+/**
+ * Stop collecting the messages, storing them to given buffer.
+ */
+void end_messages( Buffer & messages )
+{
+    fflush( stderr ) ;
+
+    dup2( saved_stderr, STDERR_FILENO ) ;
+
+    const int file = fileno( message_file ) ;
+
+    if ( lseek( file, 0, SEEK_SET ) != 0 ) {
+        return ;
+    }
+
+    char chunk[ 4096 ] ;
+    ssize_t result ;
+    while ( ( result = read( file, chunk, sizeof( chunk ) ) ) > 0 ) {
+        messages.write( chunk, result ) ;
+    }
+}
+
+/**
+ * Send response with given status, the collected messages, and given output data to current client.
+ *
+ * The response consists of the status line, followed by the messages,
+ * one per line, followed by an empty line, followed by the output data, if any.
+ */
+void send_response( const char * const status, const void * const data, const size_t size )
+{
+    hope( status ) ;
+    hope( client_socket >= 0 ) ;
+
+    Buffer response( 4096 ) ;
+
+    // Status line goes first.
+
+    char line[ 64 ] ;
+    if ( data ) {
+        snprintf( line, sizeof( line ), "%s %llu\n", status, uquad( size ) ) ;
+    }
+    else {
+        snprintf( line, sizeof( line ), "%s\n", status ) ;
+    }
+    response.write( line, std::strlen( line ) ) ;
+
+    // Then the messages, making sure they end with newline, then empty line.
+
+    end_messages( response ) ;
+
+    const size_t response_size = response.get_data_size() ;
+    if ( response.get_data()[ response_size - 1 ] != '\n' ) {
+        response.write< u8 >( '\n' ) ;
+    }
+    response.write< u8 >( '\n' ) ;
+
+    // Now send it all, ignoring any errors, as there is not much we can do about them.
+
+    if ( send_data( client_socket, response.get_data(), response.get_data_size() ) && data ) {
+        send_data( client_socket, data, size ) ;
+    }
+
+    close( client_socket ) ;
+    client_socket = -1 ;
+}
+
+/**
+ * Reject the request of current client, reporting given error message.
+ */
+void reject( const char * const format, const char * const arg = "" )
+{
+    hope( format ) ;
+
+    fprintf( stderr, "error: " ) ;
+    fprintf( stderr, format, arg ) ;
+    fprintf( stderr, "\n" ) ;
+
+    send_response( "ERROR", NULL, 0 ) ;
+}
+
+/**
+ * Report failure of the request being processed, if there is any, to the client.
+ *
+ * Called in case the worker terminates unexpectedly while processing the request,
+ * for example due to a failed assertion. Ordinary conversion errors are
+ * reported by process_request() itself and don't terminate the worker.
+ */
+void report_failure( void )
+{
+    if ( client_socket >= 0 ) {
+        send_response( "ERROR", NULL, 0 ) ;
+    }
+}
+
+/**
+ * Get format of given name.
+ */
+Format get_format( const char * const name, const uint length )
+{
+    hope( name ) ;
+
+    static const struct {
+        const char * name ;
+        Format format ;
+    } formats[] = {
+        { "tzx", FORMAT_TZX },
+        { "tap", FORMAT_TAP },
+        { "csw", FORMAT_CSW },
+        { "pzx", FORMAT_PZX },
+        { "wav", FORMAT_WAV },
+    } ;
+
+    for ( uint i = 0 ; i < sizeof( formats ) / sizeof( formats[ 0 ] ) ; i++ ) {
+        if ( length == std::strlen( formats[ i ].name ) && std::strncmp( name, formats[ i ].name, length ) == 0 ) {
+            return formats[ i ].format ;
+        }
+    }
+
+    return FORMAT_NONE ;
+}
+
+/**
+ * Read line from given file to given buffer, stripping the line terminator.
+ */
+bool read_line( FILE * const file, char * const line, const uint size )
+{
+    hope( file ) ;
+    hope( line ) ;
+
+    if ( fgets( line, size, file ) == NULL ) {
+        return false ;
+    }
+
+    const uint length = std::strlen( line ) ;
+
+    if ( length == 0 || line[ length - 1 ] != '\n' ) {
+        return false ;
+    }
+
+    line[ length - 1 ] = 0 ;
+
+    if ( length > 1 && line[ length - 2 ] == '\r' ) {
+        line[ length - 2 ] = 0 ;
+    }
+
+    return true ;
+}
+
+/**
+ * Open input file of given name for reading, provided it is a regular file
+ * within the directory the clients may read from.
+ *
+ * Note that the resolved name is opened, so the symbolic links can't be
+ * used to escape the directory.
+ */
+FILE * open_input_file( const char * const name )
+{
+    hope( name ) ;
+
+    if ( option_file_directory == NULL ) {
+        return NULL ;
+    }
+
+    char * const resolved_name = realpath( name, NULL ) ;
+    if ( resolved_name == NULL ) {
+        return NULL ;
+    }
+
+    const size_t length = std::strlen( option_file_directory ) ;
+
+    FILE * file = NULL ;
+
+    if ( std::strncmp( resolved_name, option_file_directory, length ) == 0 && resolved_name[ length ] == '/' ) {
+        file = fopen( resolved_name, "rb" ) ;
+    }
+
+    std::free( resolved_name ) ;
+
+    struct stat info ;
+
+    if ( file && ( fstat( fileno( file ), &info ) != 0 || ! S_ISREG( info.st_mode ) ) ) {
+        fclose( file ) ;
+        file = NULL ;
+    }
+
+    return file ;
+}
+
+/**
+ * Render given PZX file to the WAV output stream.
+ */
+void render_pzx( const byte * data, size_t size )
+{
+    hope( data ) ;
+
+    u32 header[ 2 ] ;
+
+    if ( size < 8 || ( std::memcpy( header, data, 8 ), header[ 0 ] != PZX_HEADER ) ) {
+        fault( "input is not a PZX file" ) ;
+    }
+
+    while ( size > 0 ) {
+
+        if ( size < 8 ) {
+            fault( "error reading block header" ) ;
+        }
+
+        std::memcpy( header, data, 8 ) ;
+
+        const uint tag = native_endian( header[ 0 ] ) ;
+        const uint block_size = little_endian( header[ 1 ] ) ;
+
+        data += 8 ;
+        size -= 8 ;
+
+        if ( block_size > size ) {
+            fault( "error reading block data" ) ;
+        }
+
+        wav_render_block( tag, data, block_size ) ;
+
+        data += block_size ;
+        size -= block_size ;
+    }
+}
+
+/**
+ * Process request of current client, read from given file.
+ *
+ * The request consists of the command line, containing the conversion name
+ * like tzx2pzx or pzx2wav, optionally followed by -s or -p options, and of
+ * the input line, which is either FILE followed by name of the input file,
+ * or DATA followed by size of the input data, which then follow immediately.
+ * The FILE input is allowed only within the configured directory, and the
+ * size of either input is limited.
+ */
+void process_request( FILE * const file )
+{
+    hope( file ) ;
+
+    // Read the command line.
+
+    char line[ 4096 ] ;
+
+    if ( ! read_line( file, line, sizeof( line ) ) ) {
+        reject( "missing request" ) ;
+        return ;
+    }
+
+    // Parse the conversion name.
+
+    char * arg = std::strtok( line, " " ) ;
+
+    const char * const separator = ( arg ? std::strchr( arg, '2' ) : NULL ) ;
+
+    const Format input_format = ( separator ? get_format( arg, separator - arg ) : FORMAT_NONE ) ;
+    const Format output_format = ( separator ? get_format( separator + 1, std::strlen( separator + 1 ) ) : FORMAT_NONE ) ;
+
+    if (
+        input_format == FORMAT_NONE || input_format == FORMAT_WAV ||
+        ( output_format != FORMAT_PZX && output_format != FORMAT_WAV ) ||
+        input_format == output_format
+    ) {
+        reject( "unsupported conversion %s", arg ? arg : "" ) ;
+        return ;
+    }
+
+    // Parse the options.
+
+    uint sample_rate = default_sample_rate ;
+    uint pause_duration = 0 ;
+
+    while ( ( arg = std::strtok( NULL, " " ) ) != NULL ) {
+
+        const char * const value = std::strtok( NULL, " " ) ;
+
+        if ( std::strcmp( arg, "-s" ) == 0 && value && atoi( value ) > 0 ) {
+            sample_rate = uint( atoi( value ) ) ;
+        }
+        else if ( std::strcmp( arg, "-p" ) == 0 && value && uint( atoi( value ) ) <= 10 * 60 * 1000 ) {
+            pause_duration = uint( atoi( value ) ) * MILLISECOND_CYCLES ;
+        }
+        else {
+            reject( "invalid option %s", arg ) ;
+            return ;
+        }
+    }
+
+    // Read the input line and the input data.
+
+    if ( ! read_line( file, line, sizeof( line ) ) ) {
+        reject( "missing input" ) ;
+        return ;
+    }
+
+    const uquad input_limit = uquad( option_input_limit ) << 20 ;
+
+    Buffer input( 256 * 1024 ) ;
+
+    if ( std::strncmp( line, "FILE ", 5 ) == 0 ) {
+
+        FILE * const input_file = open_input_file( line + 5 ) ;
+        if ( input_file == NULL ) {
+            reject( "unable to open input file" ) ;
+            return ;
+        }
+
+        struct stat info ;
+
+        if ( fstat( fileno( input_file ), &info ) != 0 || uquad( info.st_size ) > input_limit ) {
+            fclose( input_file ) ;
+            reject( "input file is too large" ) ;
+            return ;
+        }
+
+        const bool result = input.read( input_file ) ;
+
+        fclose( input_file ) ;
+
+        if ( ! result ) {
+            reject( "error reading input file" ) ;
+            return ;
+        }
+    }
+    else if ( std::strncmp( line, "DATA ", 5 ) == 0 ) {
+
+        uquad size_left = std::strtoull( line + 5, NULL, 10 ) ;
+
+        if ( size_left > input_limit ) {
+            reject( "input data is too large" ) ;
+            return ;
+        }
+
+        while ( size_left > 0 ) {
+            const uint chunk_size = uint( size_left > 0x100000 ? 0x100000 : size_left ) ;
+            if ( input.append( file, chunk_size ) != chunk_size ) {
+                reject( "error reading input data" ) ;
+                return ;
+            }
+            size_left -= chunk_size ;
+        }
+    }
+    else {
+        reject( "invalid input specification" ) ;
+        return ;
+    }
+
+    const byte * const data = input.get_data() ;
+    const size_t size = input.get_data_size() ;
+
+    // Convert the input to PZX first, unless it already is PZX, then render
+    // it to WAV if requested. Should the conversion fail, abandon the outputs
+    // and reset the conversion state, so the worker can serve the next request.
+
+    Buffer pzx_output ;
+    Buffer wav_output ;
+
+    try {
+
+        if ( input_format != FORMAT_PZX ) {
+
+            pzx_open( pzx_output ) ;
+
+            switch ( input_format ) {
+                case FORMAT_TZX: {
+                    if ( size < 10 || std::memcmp( data, "ZXTape!\x1a", 8 ) != 0 ) {
+                        fault( "input is not a TZX file" ) ;
+                    }
+                    tzx_render( data, data + size ) ;
+                    break ;
+                }
+                case FORMAT_CSW: {
+                    if ( size < 32 || std::memcmp( data, "Compressed Square Wave\x1a", 23 ) != 0 ) {
+                        fault( "input is not a CSW file" ) ;
+                    }
+                    csw_render( data, size ) ;
+                    break ;
+                }
+                case FORMAT_TAP: {
+                    tap_render( data, size, pause_duration ) ;
+                    break ;
+                }
+                default: {
+                    hope( false ) ;
+                }
+            }
+
+            pzx_close() ;
+        }
+
+        // Render the PZX to WAV if requested.
+
+        if ( output_format == FORMAT_WAV ) {
+
+            wav_open( wav_output, sample_rate, 3500000 ) ;
+
+            if ( input_format != FORMAT_PZX ) {
+                render_pzx( pzx_output.get_data(), pzx_output.get_data_size() ) ;
+            }
+            else {
+                render_pzx( data, size ) ;
+            }
+
+            wav_close() ;
+        }
+    }
+    catch ( const Failure & ) {
+
+        pzx_abort() ;
+        wav_abort() ;
+        csw_clear_cache() ;
+
+        send_response( "ERROR", NULL, 0 ) ;
+        return ;
+    }
+
+    // Finally send the result.
+
+    const Buffer & output = ( output_format == FORMAT_WAV ? wav_output : pzx_output ) ;
+
+    send_response( "OK", output.get_data(), output.get_data_size() ) ;
+}
+
+/**
+ * Serve requests coming to given socket until terminated.
+ */
+void serve( const int listen_socket )
+{
+    // Let the signals terminate the worker again.
+
+    signal( SIGTERM, SIG_DFL ) ;
+    signal( SIGINT, SIG_DFL ) ;
+
+    // Prepare for collecting the messages.
+
+    message_file = tmpfile() ;
+    if ( message_file == NULL ) {
+        fail( "unable to create message file" ) ;
+    }
+
+    saved_stderr = dup( STDERR_FILENO ) ;
+
+    // In case the worker dies while processing a request, let the client know.
+
+    atexit( report_failure ) ;
+
+    // Now keep serving the requests.
+
+    for ( ; ; ) {
+
+        const int socket = accept( listen_socket, NULL, NULL ) ;
+
+        if ( socket < 0 ) {
+            if ( errno == EINTR || errno == ECONNABORTED ) {
+                continue ;
+            }
+            fail( "error accepting connection" ) ;
+        }
+
+        FILE * const file = fdopen( dup( socket ), "rb" ) ;
+        if ( file == NULL ) {
+            close( socket ) ;
+            continue ;
+        }
+
+        client_socket = socket ;
+
+        begin_messages() ;
+
+        process_request( file ) ;
+
+        fclose( file ) ;
+    }
+}
+
+/**
+ * Start new worker process serving given socket, returning its process ID.
+ */
+pid_t start_worker( const int listen_socket )
+{
+    const pid_t pid = fork() ;
+
+    if ( pid < 0 ) {
+        fail( "unable to start worker process" ) ;
+    }
+
+    if ( pid == 0 ) {
+        serve( listen_socket ) ;
+        exit( EXIT_SUCCESS ) ;
+    }
+
+    return pid ;
+}
+
+/**
+ * Run the conversion service daemon.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    // Parse the command line.
+
+    for ( int i = 1 ; i < argc ; i++ ) {
+        if ( argv[ i ][ 0 ] != '-' ) {
+            if ( option_socket_name ) {
+                fail( "multiple socket names specified" ) ;
+            }
+            option_socket_name = argv[ i ] ;
+            continue ;
+        }
+        switch ( argv[ i ][ 1 ] ) {
+            case 'j': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing worker count" ) ;
+                }
+                option_worker_count = uint( atoi( arg ) ) ;
+                if ( option_worker_count == 0 || option_worker_count > worker_limit ) {
+                    fail( "worker count %u is out of range", option_worker_count ) ;
+                }
+                break ;
+            }
+            case 'm': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing input size limit" ) ;
+                }
+                option_input_limit = uint( atoi( arg ) ) ;
+                if ( option_input_limit == 0 || option_input_limit > 4096 ) {
+                    fail( "input size limit %u is out of range", option_input_limit ) ;
+                }
+                break ;
+            }
+            case 'd': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing input directory" ) ;
+                }
+                if ( option_file_directory ) {
+                    fail( "multiple input directories specified" ) ;
+                }
+                option_file_directory = realpath( arg, NULL ) ;
+                if ( option_file_directory == NULL ) {
+                    fail( "unable to resolve input directory %s", arg ) ;
+                }
+
+                // Make sure the root directory doesn't end with the separator either.
+
+                if ( std::strcmp( option_file_directory, "/" ) == 0 ) {
+                    option_file_directory[ 0 ] = 0 ;
+                }
+                break ;
+            }
+            default: {
+                fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
+
+                // Fall through.
+            }
+            case 'h': {
+                fprintf( stderr, "usage: pzxd [-j n] [-m n] [-d dir] [socket_name]\n" ) ;
+                fprintf( stderr, "-j n   serve the requests with given number of workers instead of default %u\n", default_worker_count ) ;
+                fprintf( stderr, "-m n   reject inputs larger than given number of megabytes instead of default %u\n", default_input_limit ) ;
+                fprintf( stderr, "-d d   allow FILE requests to read the files within given directory\n" ) ;
+                return EXIT_FAILURE ;
+            }
+        }
+    }
+
+    const char * const socket_name = ( option_socket_name ? option_socket_name : default_socket_name ) ;
+    const uint worker_count = ( option_worker_count > 0 ? option_worker_count : default_worker_count ) ;
+
+    if ( option_input_limit == 0 ) {
+        option_input_limit = default_input_limit ;
+    }
+
+    // Create the socket.
+
+    sockaddr_un address ;
+    std::memset( &address, 0, sizeof( address ) ) ;
+    address.sun_family = AF_UNIX ;
+
+    if ( std::strlen( socket_name ) >= sizeof( address.sun_path ) ) {
+        fail( "socket name is too long" ) ;
+    }
+    std::strcpy( address.sun_path, socket_name ) ;
+
+    const int listen_socket = socket( AF_UNIX, SOCK_STREAM, 0 ) ;
+    if ( listen_socket < 0 ) {
+        fail( "unable to create socket" ) ;
+    }
+
+    unlink( socket_name ) ;
+
+    if ( bind( listen_socket, reinterpret_cast< sockaddr * >( &address ), sizeof( address ) ) != 0 ) {
+        fail( "unable to bind socket %s", socket_name ) ;
+    }
+
+    if ( listen( listen_socket, 64 ) != 0 ) {
+        fail( "unable to listen on socket %s", socket_name ) ;
+    }
+
+    // Don't let clients which go away kill us, and terminate cleanly when asked to.
+
+    signal( SIGPIPE, SIG_IGN ) ;
+
+    struct sigaction action ;
+    std::memset( &action, 0, sizeof( action ) ) ;
+    action.sa_handler = request_termination ;
+    sigaction( SIGTERM, &action, NULL ) ;
+    sigaction( SIGINT, &action, NULL ) ;
+
+    // Start the workers, and restart any which terminates, until asked to stop.
+
+    for ( uint i = 0 ; i < worker_count ; i++ ) {
+        workers[ i ] = start_worker( listen_socket ) ;
+    }
+
+    while ( ! termination_requested ) {
+
+        int status ;
+        const pid_t pid = waitpid( -1, &status, 0 ) ;
+
+        if ( pid < 0 ) {
+            if ( errno == EINTR ) {
+                continue ;
+            }
+            fail( "error waiting for workers" ) ;
+        }
+
+        for ( uint i = 0 ; i < worker_count ; i++ ) {
+            if ( workers[ i ] == pid && ! termination_requested ) {
+                workers[ i ] = start_worker( listen_socket ) ;
+            }
+        }
+    }
+
+    // Stop the workers and clean up.
+
+    for ( uint i = 0 ; i < worker_count ; i++ ) {
+        kill( workers[ i ], SIGTERM ) ;
+    }
+
+    for ( uint i = 0 ; i < worker_count ; i++ ) {
+        waitpid( workers[ i ], NULL, 0 ) ;
+    }
+
+    close( listen_socket ) ;
+    unlink( socket_name ) ;
+
+    return EXIT_SUCCESS ;
+}
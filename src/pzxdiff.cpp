@@ -0,0 +1,928 @@
+// $Id$
+
+/**
+ * @file PZX pulse comparator.
+ *
+ * Compares the signals described by two tape files, pulse by pulse, without
+ * dumping them to text first. The files may be PZX files, or TZX and CSW files,
+ * which are converted to PZX in memory first.
+ *
+ * The PULS blocks are compared run against run, using the repeat counts,
+ * and the DATA blocks are expanded only as the comparison proceeds.
+ * Adjacent pulses of the same level are merged, so the signal is compared
+ * regardless of how it is split to blocks.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "pzx.h"
+#include "tzx.h"
+#include "csw.h"
+#include "stats.h"
+
+#include <cstring>
+
+/**
+ * Global options.
+ */
+namespace {
+
+/**
+ * Tolerance of the pulse durations, in T cycles and in percent of the pulse duration.
+ */
+//@{
+uint option_tolerance = 0 ;
+uint option_relative_tolerance = 0 ;
+//@}
+
+/**
+ * When set, all differences are reported, not just the first one.
+ */
+bool option_all = false ;
+
+/**
+ * When set, the pulse levels are not compared, only their durations.
+ */
+bool option_ignore_levels = false ;
+
+/**
+ * When set, the differences are not reported, only the exit code is set.
+ */
+bool option_quiet = false ;
+
+} ;
+
+/**
+ * Comparator state.
+ */
+namespace {
+
+/**
+ * File where the differences are reported.
+ */
+FILE * output_file ;
+
+/**
+ * State of single tape being compared.
+ */
+struct Tape {
+
+    /**
+     * Name of the file, and its PZX data which remain to be processed.
+     */
+    //@{
+    const char * name ;
+    const byte * data ;
+    const byte * data_end ;
+    //@}
+
+    /**
+     * Number of blocks started so far, start of the current block including its
+     * header, tag of the current block, and its remaining data.
+     */
+    //@{
+    uint block_count ;
+    const byte * block_start ;
+    uint tag ;
+    const byte * block_data ;
+    const byte * block_end ;
+    //@}
+
+    /**
+     * Index of the next pulse within the current block, and its level.
+     */
+    //@{
+    uquad pulse_index ;
+    bool pulse_level ;
+    //@}
+
+    /**
+     * Remaining bits, pulse sequences and tail of current DATA block, as well
+     * as remaining pulses of the sequence of the current bit.
+     */
+    //@{
+    uint bit_count ;
+    uint bit_index ;
+    uint tail_cycles ;
+    uint pulse_count_0 ;
+    uint pulse_count_1 ;
+    const byte * sequence_0 ;
+    const byte * sequence_1 ;
+    const byte * sequence ;
+    uint sequence_count ;
+    //@}
+
+    /**
+     * Run of pulses of the same duration fetched from the blocks, but not
+     * merged with the adjacent pulses of the same level yet.
+     */
+    //@{
+    uint raw_count ;
+    uint raw_duration ;
+    bool raw_level ;
+    uint raw_block ;
+    uquad raw_pulse ;
+    //@}
+
+    /**
+     * Run of pulses being compared, its block and pulse index, and its starting time.
+     * The level is that of the first pulse, the levels of the others alternate.
+     */
+    //@{
+    uint count ;
+    uquad duration ;
+    bool level ;
+    uint block ;
+    uquad pulse ;
+    uquad time ;
+    bool end ;
+    //@}
+} ;
+
+/**
+ * Read little endian value of specified type from given data.
+ */
+template< typename Type >
+Type peek( const byte * const data )
+{
+    Type value ;
+    std::memcpy( &value, data, sizeof( value ) ) ;
+    return little_endian( value ) ;
+}
+
+/**
+ * Read in given file and turn it to PZX data of given tape.
+ */
+void open_tape( Tape & tape, const char * const name, Buffer & buffer, Buffer & pzx_buffer )
+{
+    std::memset( &tape, 0, sizeof( tape ) ) ;
+    tape.name = name ;
+
+    // Read in the entire file.
+
+    FILE * const input_file = fopen( name, "rb" ) ;
+    if ( input_file == NULL ) {
+        fail( "unable to open input file %s", name ) ;
+    }
+
+    const StatsPhase phase = stats_enter( STATS_READ ) ;
+
+    if ( ! buffer.read( input_file ) ) {
+        fail( "error reading input file %s", name ) ;
+    }
+
+    fclose( input_file ) ;
+
+    stats_leave( phase ) ;
+    stats_add( STATS_BYTES_IN, buffer.get_data_size() ) ;
+
+    const byte * const data = buffer.get_data() ;
+    const size_t size = buffer.get_data_size() ;
+
+    // PZX files are used directly, after checking their version.
+
+    if ( size >= 8 && native_endian( peek< u32 >( data ) ) == PZX_HEADER ) {
+        if ( size < 10 || data[ 8 ] != PZX_MAJOR ) {
+            fail( "unsupported PZX version of %s", name ) ;
+        }
+        tape.data = data ;
+        tape.data_end = data + size ;
+        return ;
+    }
+
+    // Anything else has to be converted to PZX first.
+
+    pzx_open( pzx_buffer ) ;
+
+    if ( size >= 10 && std::memcmp( data, "ZXTape!\x1a", 8 ) == 0 ) {
+        tzx_render( data, data + size ) ;
+    }
+    else if ( size >= 32 && std::memcmp( data, "Compressed Square Wave\x1a", 23 ) == 0 ) {
+        csw_render( data, size ) ;
+    }
+    else {
+        fail( "input %s is not a PZX, TZX, or CSW file", name ) ;
+    }
+
+    pzx_close() ;
+
+    tape.data = pzx_buffer.get_data() ;
+    tape.data_end = pzx_buffer.get_data_end() ;
+}
+
+/**
+ * Start processing next block of given tape.
+ *
+ * Returns false at the end of the tape.
+ */
+bool start_block( Tape & tape )
+{
+    if ( tape.data == tape.data_end ) {
+        return false ;
+    }
+
+    if ( tape.data_end - tape.data < 8 ) {
+        fail( "%s: incomplete block header detected", tape.name ) ;
+    }
+
+    const uint tag = native_endian( peek< u32 >( tape.data ) ) ;
+    const uint size = peek< u32 >( tape.data + 4 ) ;
+
+    tape.data += 8 ;
+
+    if ( uquad( tape.data_end - tape.data ) < size ) {
+        fail( "%s: incomplete block detected", tape.name ) ;
+    }
+
+    const byte * const data = tape.data ;
+
+    tape.block_start = data - 8 ;
+    tape.data += size ;
+
+    tape.block_count++ ;
+    tape.tag = tag ;
+    tape.block_data = data ;
+    tape.block_end = data + size ;
+    tape.pulse_index = 0 ;
+    tape.pulse_level = false ;
+
+    stats_count_block( true, tag ) ;
+
+    switch ( tag ) {
+        case PZX_PULSES: {
+            break ;
+        }
+        case PZX_DATA: {
+            if ( size < 8 ) {
+                fail( "%s: incomplete block detected", tape.name ) ;
+            }
+
+            const uint bits = peek< u32 >( data ) ;
+            const uint bit_count = ( bits & 0x7FFFFFFF ) ;
+            const uint pulse_count_0 = data[ 6 ] ;
+            const uint pulse_count_1 = data[ 7 ] ;
+            const uint sequence_size = 2 * ( pulse_count_0 + pulse_count_1 ) ;
+
+            if ( size < 8 + sequence_size || size - 8 - sequence_size != ( bit_count + 7 ) / 8 ) {
+                fail( "%s: bit count does not match the actual data size", tape.name ) ;
+            }
+
+            tape.block_data = data + 8 + sequence_size ;
+            tape.pulse_level = ( ( bits >> 31 ) != 0 ) ;
+            tape.bit_count = bit_count ;
+            tape.bit_index = 0 ;
+            tape.tail_cycles = peek< u16 >( data + 4 ) ;
+            tape.pulse_count_0 = pulse_count_0 ;
+            tape.pulse_count_1 = pulse_count_1 ;
+            tape.sequence_0 = data + 8 ;
+            tape.sequence_1 = data + 8 + 2 * pulse_count_0 ;
+            tape.sequence_count = 0 ;
+            break ;
+        }
+        case PZX_PAUSE: {
+            if ( size < 4 ) {
+                fail( "%s: incomplete block detected", tape.name ) ;
+            }
+            break ;
+        }
+        default: {
+
+            // Other blocks don't contain any pulses.
+
+            tape.tag = 0 ;
+            break ;
+        }
+    }
+
+    return true ;
+}
+
+/**
+ * Remember given run of pulses as the next raw run of given tape.
+ */
+inline void set_raw( Tape & tape, const uint count, const uint duration )
+{
+    tape.raw_count = count ;
+    tape.raw_duration = duration ;
+    tape.raw_level = tape.pulse_level ;
+    tape.raw_block = tape.block_count - 1 ;
+    tape.raw_pulse = tape.pulse_index ;
+
+    tape.pulse_index += count ;
+    tape.pulse_level ^= ( count & 1 ) ;
+}
+
+/**
+ * Fetch next run of pulses of the same duration from the blocks of given tape.
+ *
+ * Pulses of zero duration are skipped, only their effect on the level is retained.
+ * Returns false at the end of the tape.
+ */
+bool fetch_raw( Tape & tape )
+{
+    for ( ; ; ) {
+        switch ( tape.tag ) {
+            case PZX_PULSES: {
+
+                if ( tape.block_data == tape.block_end ) {
+                    break ;
+                }
+
+                // Decode the pulse repeat count and duration.
+
+                if ( tape.block_end - tape.block_data < 2 ) {
+                    fail( "%s: incomplete block detected", tape.name ) ;
+                }
+
+                uint count = 1 ;
+                uint duration = peek< u16 >( tape.block_data ) ;
+                tape.block_data += 2 ;
+
+                if ( duration > 0x8000 ) {
+                    if ( tape.block_end - tape.block_data < 2 ) {
+                        fail( "%s: incomplete block detected", tape.name ) ;
+                    }
+                    count = duration & 0x7FFF ;
+                    duration = peek< u16 >( tape.block_data ) ;
+                    tape.block_data += 2 ;
+                }
+                if ( duration >= 0x8000 ) {
+                    if ( tape.block_end - tape.block_data < 2 ) {
+                        fail( "%s: incomplete block detected", tape.name ) ;
+                    }
+                    duration &= 0x7FFF ;
+                    duration <<= 16 ;
+                    duration |= peek< u16 >( tape.block_data ) ;
+                    tape.block_data += 2 ;
+                }
+
+                if ( duration == 0 ) {
+                    tape.pulse_level ^= ( count & 1 ) ;
+                    continue ;
+                }
+
+                set_raw( tape, count, duration ) ;
+                return true ;
+            }
+            case PZX_DATA: {
+
+                // Choose the sequence for next bit if necessary.
+
+                if ( tape.sequence_count == 0 ) {
+
+                    // Once all bits are done, use the optional tail pulse.
+
+                    if ( tape.bit_index >= tape.bit_count ) {
+                        if ( tape.tail_cycles == 0 ) {
+                            break ;
+                        }
+                        set_raw( tape, 1, tape.tail_cycles ) ;
+                        tape.tail_cycles = 0 ;
+                        return true ;
+                    }
+
+                    const uint index = tape.bit_index++ ;
+                    const bool bit = ( ( tape.block_data[ index / 8 ] << ( index % 8 ) ) & 0x80 ) != 0 ;
+
+                    tape.sequence = ( bit ? tape.sequence_1 : tape.sequence_0 ) ;
+                    tape.sequence_count = ( bit ? tape.pulse_count_1 : tape.pulse_count_0 ) ;
+                    continue ;
+                }
+
+                const uint duration = peek< u16 >( tape.sequence ) ;
+                tape.sequence += 2 ;
+                tape.sequence_count-- ;
+
+                if ( duration == 0 ) {
+                    tape.pulse_level = ! tape.pulse_level ;
+                    continue ;
+                }
+
+                set_raw( tape, 1, duration ) ;
+                return true ;
+            }
+            case PZX_PAUSE: {
+
+                // The pause is a single pulse of given level.
+
+                const uint value = peek< u32 >( tape.block_data ) ;
+                const uint duration = ( value & 0x7FFFFFFF ) ;
+
+                tape.tag = 0 ;
+
+                if ( duration == 0 ) {
+                    continue ;
+                }
+
+                tape.pulse_level = ( ( value >> 31 ) != 0 ) ;
+                set_raw( tape, 1, duration ) ;
+                return true ;
+            }
+        }
+
+        // Proceed to next block.
+
+        tape.tag = 0 ;
+
+        if ( ! start_block( tape ) ) {
+            return false ;
+        }
+    }
+}
+
+/**
+ * Fetch next run of pulses to compare from given tape.
+ *
+ * All but the last pulse of each raw run are used as they are, while the last
+ * pulse is merged with all following pulses of the same level first.
+ */
+void fetch_run( Tape & tape )
+{
+    if ( tape.raw_count == 0 && ! fetch_raw( tape ) ) {
+        tape.count = 0 ;
+        tape.end = true ;
+        return ;
+    }
+
+    tape.duration = tape.raw_duration ;
+    tape.level = tape.raw_level ;
+    tape.block = tape.raw_block ;
+    tape.pulse = tape.raw_pulse ;
+
+    if ( tape.raw_count > 1 ) {
+        const uint count = tape.raw_count - 1 ;
+        tape.count = count ;
+        tape.raw_count = 1 ;
+        tape.raw_level ^= ( count & 1 ) ;
+        tape.raw_pulse += count ;
+        return ;
+    }
+
+    tape.count = 1 ;
+    tape.raw_count = 0 ;
+
+    while ( fetch_raw( tape ) && tape.raw_level == tape.level ) {
+        tape.duration += tape.raw_duration ;
+        tape.raw_count-- ;
+        tape.raw_level = ! tape.raw_level ;
+        tape.raw_pulse++ ;
+        if ( tape.raw_count > 0 ) {
+            break ;
+        }
+    }
+}
+
+/**
+ * Consume given number of pulses of the current run of given tape.
+ */
+void advance( Tape & tape, const uint count )
+{
+    hope( count <= tape.count ) ;
+
+    tape.time += count * tape.duration ;
+    tape.pulse += count ;
+    tape.level ^= ( count & 1 ) ;
+    tape.count -= count ;
+
+    if ( tape.count == 0 ) {
+        fetch_run( tape ) ;
+    }
+}
+
+/**
+ * Check if given durations are the same, within the tolerance.
+ */
+inline bool similar( const uquad a, const uquad b, const uquad limit )
+{
+    if ( a == b ) {
+        return true ;
+    }
+
+    const uquad difference = ( a > b ? a - b : b - a ) ;
+    const uquad relative_tolerance = limit * option_relative_tolerance / 100 ;
+    return ( difference <= option_tolerance || difference <= relative_tolerance ) ;
+}
+
+/**
+ * Compute the duration of given block, in T cycles.
+ */
+uquad block_duration( const byte * const block )
+{
+    const uint tag = native_endian( peek< u32 >( block ) ) ;
+    const uint size = peek< u32 >( block + 4 ) ;
+    const byte * data = block + 8 ;
+    const byte * const data_end = data + size ;
+
+    uquad duration = 0 ;
+
+    switch ( tag ) {
+        case PZX_PULSES: {
+            while ( data_end - data >= 2 ) {
+                uint count = 1 ;
+                uint value = peek< u16 >( data ) ;
+                data += 2 ;
+                if ( value > 0x8000 && data_end - data >= 2 ) {
+                    count = value & 0x7FFF ;
+                    value = peek< u16 >( data ) ;
+                    data += 2 ;
+                }
+                if ( value >= 0x8000 && data_end - data >= 2 ) {
+                    value = ( ( value & 0x7FFF ) << 16 ) | peek< u16 >( data ) ;
+                    data += 2 ;
+                }
+                duration += uquad( count ) * value ;
+            }
+            break ;
+        }
+        case PZX_DATA: {
+            if ( size < 8 ) {
+                break ;
+            }
+
+            const uint bit_count = ( peek< u32 >( data ) & 0x7FFFFFFF ) ;
+            const uint pulse_count_0 = data[ 6 ] ;
+            const uint pulse_count_1 = data[ 7 ] ;
+
+            duration = peek< u16 >( data + 4 ) ;
+
+            uquad sequence_0 = 0 ;
+            uquad sequence_1 = 0 ;
+
+            for ( uint i = 0 ; i < pulse_count_0 ; i++ ) {
+                sequence_0 += peek< u16 >( data + 8 + 2 * i ) ;
+            }
+            for ( uint i = 0 ; i < pulse_count_1 ; i++ ) {
+                sequence_1 += peek< u16 >( data + 8 + 2 * ( pulse_count_0 + i ) ) ;
+            }
+
+            // Count the bits set, ignoring the unused bits of the last byte.
+
+            const byte * const bits = data + 8 + 2 * ( pulse_count_0 + pulse_count_1 ) ;
+
+            uquad ones = 0 ;
+
+            for ( uint i = 0 ; i < bit_count / 8 ; i++ ) {
+                ones += __builtin_popcount( bits[ i ] ) ;
+            }
+            if ( bit_count % 8 != 0 ) {
+                ones += __builtin_popcount( bits[ bit_count / 8 ] >> ( 8 - bit_count % 8 ) ) ;
+            }
+
+            duration += ones * sequence_1 + ( bit_count - ones ) * sequence_0 ;
+            break ;
+        }
+        case PZX_PAUSE: {
+            if ( size >= 4 ) {
+                duration = ( peek< u32 >( data ) & 0x7FFFFFFF ) ;
+            }
+            break ;
+        }
+    }
+
+    return duration ;
+}
+
+/**
+ * Check if the current run of given tape starts at the first pulse of the current block.
+ */
+inline bool at_block_start( const Tape & tape )
+{
+    return ( ! tape.end && tape.pulse == 0 && tape.block + 1 == tape.block_count ) ;
+}
+
+/**
+ * Skip the blocks which are identical in both given tapes, starting at the current blocks.
+ *
+ * The last identical block is not skipped but processed normally, as its
+ * last pulse may merge with the first pulse of the following block, which
+ * may differ between the tapes.
+ */
+void skip_identical_blocks( Tape & a, Tape & b )
+{
+    const byte * block_a = a.block_start ;
+    const byte * block_b = b.block_start ;
+
+    uint skipped_count = 0 ;
+    uquad skipped_duration = 0 ;
+
+    for ( ; ; ) {
+        if ( a.data_end - block_a < 8 || b.data_end - block_b < 8 ) {
+            break ;
+        }
+
+        const uquad size = 8 + uquad( peek< u32 >( block_a + 4 ) ) ;
+
+        if ( uquad( a.data_end - block_a ) <= size || uquad( b.data_end - block_b ) <= size ) {
+            break ;
+        }
+        if ( std::memcmp( block_a, block_b, size ) != 0 ) {
+            break ;
+        }
+
+        // The next block is identical as well, so this one may be skipped.
+
+        const byte * const next_a = block_a + size ;
+        const byte * const next_b = block_b + size ;
+
+        if ( b.data_end - next_b < 8 || std::memcmp( next_a, next_b, 8 ) != 0 ) {
+            break ;
+        }
+
+        const uquad next_size = 8 + uquad( peek< u32 >( next_a + 4 ) ) ;
+
+        if ( uquad( a.data_end - next_a ) < next_size || uquad( b.data_end - next_b ) < next_size ||
+            std::memcmp( next_a, next_b, next_size ) != 0 ) {
+            break ;
+        }
+
+        skipped_count++ ;
+        skipped_duration += block_duration( block_a ) ;
+
+        block_a = next_a ;
+        block_b = next_b ;
+    }
+
+    if ( skipped_count == 0 ) {
+        return ;
+    }
+
+    // Restart both tapes at the last identical block.
+
+    Tape * const tapes[] = { &a, &b } ;
+    const byte * const blocks[] = { block_a, block_b } ;
+
+    for ( uint i = 0 ; i < 2 ; i++ ) {
+        Tape & tape = *tapes[ i ] ;
+        tape.data = blocks[ i ] ;
+        tape.block_count += skipped_count - 1 ;
+        tape.tag = 0 ;
+        tape.raw_count = 0 ;
+        tape.time += skipped_duration ;
+        fetch_run( tape ) ;
+    }
+}
+
+/**
+ * Report the current pulse of given tape.
+ */
+void report_pulse( const char * const prefix, const Tape & tape )
+{
+    if ( tape.end ) {
+        fprintf( output_file, "%s end of tape at %llu T\n", prefix, tape.time ) ;
+        return ;
+    }
+
+    fprintf( output_file, "%s block %u pulse %llu at %llu T: %llu T %s\n",
+        prefix,
+        tape.block,
+        tape.pulse,
+        tape.time,
+        tape.duration,
+        tape.level ? "high" : "low"
+    ) ;
+}
+
+/**
+ * Report difference of given number at current pulses of given tapes.
+ */
+void report_difference( const uint number, const Tape & a, const Tape & b )
+{
+    if ( option_quiet ) {
+        return ;
+    }
+
+    fprintf( output_file, "difference %u:\n", number ) ;
+    report_pulse( "<", a ) ;
+    report_pulse( ">", b ) ;
+}
+
+/**
+ * Compare given tapes, returning the number of differences found.
+ *
+ * After each difference, the tapes are advanced until their edges line up
+ * again, with the time measured from the start of the differing pulses.
+ * Once both tapes advance by the same number of pulses and the pulses match
+ * again, the tapes are considered in sync as well, so a pulse which merely
+ * got longer or shorter doesn't affect the comparison of the pulses after it.
+ */
+uint compare( Tape & a, Tape & b )
+{
+    fetch_run( a ) ;
+    fetch_run( b ) ;
+
+    uint differences = 0 ;
+    bool in_sync = true ;
+
+    uquad offset = 0 ;
+    uquad skipped_a = 0 ;
+    uquad skipped_b = 0 ;
+
+    for ( ; ; ) {
+
+        // Any tape ending sooner than the other one is a difference as well.
+
+        if ( a.end || b.end ) {
+            if ( in_sync && ! ( a.end && b.end ) ) {
+                report_difference( ++differences, a, b ) ;
+            }
+            break ;
+        }
+
+        // While the tapes are in sync, skip the identical blocks entirely,
+        // otherwise consume as many pulses as possible.
+
+        if ( in_sync && at_block_start( a ) && at_block_start( b ) ) {
+            skip_identical_blocks( a, b ) ;
+        }
+
+        const bool same_pulse = ( ( a.level == b.level || option_ignore_levels ) && similar( a.duration, b.duration, a.duration > b.duration ? a.duration : b.duration ) ) ;
+
+        if ( in_sync ) {
+            if ( same_pulse ) {
+                const uint count = ( a.count < b.count ? a.count : b.count ) ;
+                advance( a, count ) ;
+                advance( b, count ) ;
+                continue ;
+            }
+
+            report_difference( ++differences, a, b ) ;
+
+            if ( ! option_all ) {
+                break ;
+            }
+
+            in_sync = false ;
+
+            offset = b.time - a.time ;
+            skipped_a = 0 ;
+            skipped_b = 0 ;
+        }
+        else if ( skipped_a == skipped_b && same_pulse ) {
+            in_sync = true ;
+            continue ;
+        }
+
+        // Otherwise advance the tape whose pulse ends sooner, until the edges line up again.
+        // Note that the offset is added with wrap around, so it works even if it is negative.
+
+        const uquad end_a = a.time + a.duration + offset ;
+        const uquad end_b = b.time + b.duration ;
+
+        if ( similar( end_a, end_b, a.duration > b.duration ? a.duration : b.duration ) ) {
+            advance( a, 1 ) ;
+            advance( b, 1 ) ;
+            in_sync = true ;
+        }
+        else if ( end_a < end_b ) {
+            advance( a, 1 ) ;
+            skipped_a++ ;
+        }
+        else {
+            advance( b, 1 ) ;
+            skipped_b++ ;
+        }
+    }
+
+    return differences ;
+}
+
+}
+
+/**
+ * Compare given tape files.
+ */
+int convert( int argc, char * * argv )
+{
+    // Parse the command line.
+
+    const char * input_names[ 2 ] = { NULL, NULL } ;
+    const char * output_name = NULL ;
+
+    for ( int i = 1 ; i < argc ; i++ ) {
+        if ( argv[ i ][ 0 ] != '-' ) {
+            if ( input_names[ 1 ] ) {
+                fail( "too many input file names specified" ) ;
+            }
+            input_names[ input_names[ 0 ] ? 1 : 0 ] = argv[ i ] ;
+            continue ;
+        }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
+        switch ( argv[ i ][ 1 ] ) {
+            case 'o': {
+                if ( output_name ) {
+                    fail( "multiple output file names specified" ) ;
+                }
+                output_name = argv[ ++i ] ;
+                break ;
+            }
+            case 't': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing tolerance" ) ;
+                }
+                option_tolerance = uint( atoi( arg ) ) ;
+                break ;
+            }
+            case 'r': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing relative tolerance" ) ;
+                }
+                option_relative_tolerance = uint( atoi( arg ) ) ;
+                if ( option_relative_tolerance > 100 ) {
+                    fail( "relative tolerance %u%% is out of range", option_relative_tolerance ) ;
+                }
+                break ;
+            }
+            case 'a': {
+                option_all = true ;
+                break ;
+            }
+            case 'l': {
+                option_ignore_levels = true ;
+                break ;
+            }
+            case 'q': {
+                option_quiet = true ;
+                break ;
+            }
+            default: {
+                fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
+
+                // Fall through.
+            }
+            case 'h': {
+                fprintf( stderr, "usage: pzxdiff [-t n] [-r n] [-a] [-l] [-q] [-o output_file] file_1 file_2\n" ) ;
+                fprintf( stderr, "-o f   write the report to given file instead of standard output\n" ) ;
+                fprintf( stderr, "-t n   tolerate pulse duration differences of up to given number of T cycles\n" ) ;
+                fprintf( stderr, "-r n   tolerate pulse duration differences of up to given percentage\n" ) ;
+                fprintf( stderr, "-a     report all differences, not just the first one\n" ) ;
+                fprintf( stderr, "-l     ignore pulse levels, compare only pulse durations\n" ) ;
+                fprintf( stderr, "-q     don't report the differences, just set the exit code\n" ) ;
+                stats_usage() ;
+                return EXIT_FAILURE ;
+            }
+        }
+    }
+
+    if ( input_names[ 1 ] == NULL ) {
+        fail( "two input files must be specified" ) ;
+    }
+
+    // Read in both tapes.
+
+    Buffer buffers[ 2 ] ;
+    Buffer pzx_buffers[ 2 ] ;
+    Tape tapes[ 2 ] ;
+
+    for ( uint i = 0 ; i < 2 ; i++ ) {
+        open_tape( tapes[ i ], input_names[ i ], buffers[ i ], pzx_buffers[ i ] ) ;
+    }
+
+    // Open the output file.
+
+    output_file = ( output_name ? fopen( output_name, "w" ) : stdout ) ;
+    if ( output_file == NULL ) {
+        fail( "unable to open output file" ) ;
+    }
+
+    // Compare them.
+
+    stats_enter( STATS_PARSE ) ;
+
+    const uint differences = compare( tapes[ 0 ], tapes[ 1 ] ) ;
+
+    stats_enter( STATS_OTHER ) ;
+
+    if ( option_all && ! option_quiet && differences > 0 ) {
+        fprintf( output_file, "%u difference%s found\n", differences, differences == 1 ? "" : "s" ) ;
+    }
+
+    if ( ferror( output_file ) != 0 || fclose( output_file ) != 0 ) {
+        fail( "error while closing the output file" ) ;
+    }
+
+    // Report the statistics, if requested.
+
+    stats_report( "pzxdiff" ) ;
+
+    return ( differences > 0 ? EXIT_FAILURE : EXIT_SUCCESS ) ;
+}
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
@@ -0,0 +1,818 @@
+// $Id$
+
+/**
+ * @file PZX pulse filter.
+ *
+ * Native counterpart of the filter_pulses.pl, adjust_pulses.pl,
+ * sum_pulses.pl, average_pulses.pl and count_pulses.pl scripts, which
+ * processes the pulses of PZX files directly, without the round trip
+ * through the text form.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "pzx.h"
+#include "stats.h"
+
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <map>
+
+/**
+ * Global options.
+ */
+namespace {
+
+/**
+ * Kinds of reports which may be produced instead of the PZX output.
+ */
+enum Report {
+    REPORT_NONE,
+    REPORT_SUM,
+    REPORT_AVERAGE,
+    REPORT_COUNT
+} ;
+
+/**
+ * Report to produce, if any.
+ */
+Report option_report ;
+
+/**
+ * Flag set when DATA blocks should be processed as pulses as well.
+ */
+bool option_process_data ;
+
+/**
+ * Maximum number of filter ranges.
+ */
+const uint filter_limit = 256 ;
+
+/**
+ * Filter ranges, each mapping durations in <min,max> range to given duration.
+ */
+//@{
+uint filter_count ;
+uint filter_result[ filter_limit ] ;
+uint filter_min[ filter_limit ] ;
+uint filter_max[ filter_limit ] ;
+//@}
+
+/**
+ * Scale factors and biases for low and high pulses, respectively.
+ */
+//@{
+double scale[ 2 ] = { 1, 1 } ;
+double bias[ 2 ] = { 0, 0 } ;
+//@}
+
+/**
+ * Statistics gathered for the reports.
+ */
+//@{
+uquad pulse_sum ;
+uquad nonzero_pulse_sum ;
+uquad nonzero_pulse_count ;
+std::map< uint, uquad > pulse_histogram ;
+//@}
+
+} ;
+
+/**
+ * Fetch value of specified type from given data block.
+ */
+template< typename Type >
+Type fetch( const byte * & data, uint & data_size )
+{
+    hope( data ) ;
+
+    if ( sizeof( Type ) > data_size ) {
+        fail( "incomplete block detected" ) ;
+    }
+
+    const Type value = little_endian( * reinterpret_cast< const Type * >( data ) ) ;
+
+    data += sizeof( Type ) ;
+    data_size -= sizeof( Type ) ;
+
+    return value ;
+}
+
+/**
+ * Skip given amount of bytes in given data block.
+ */
+void skip( const uint amount, const byte * & data, uint & data_size )
+{
+    hope( data ) ;
+
+    if ( amount > data_size ) {
+        fail( "incomplete block detected" ) ;
+    }
+
+    data += amount ;
+    data_size -= amount ;
+}
+
+/**
+ * Macros for convenient fetching of values from current block.
+ */
+//@{
+#define GET1()  fetch< u8 >( data, data_size )
+#define GET2()  fetch< u16 >( data, data_size )
+#define GET4()  fetch< u32 >( data, data_size )
+#define SKIP(n) skip( n, data, data_size )
+//@}
+
+/**
+ * Parse number from given command string, returning false if there is none.
+ *
+ * Note that infinities and NaNs are not numbers in this sense, as they would
+ * slip through the range checks.
+ */
+bool parse_number( double & value, const char * & string )
+{
+    hope( string ) ;
+
+    char * end = NULL ;
+
+    const double result = std::strtod( string, &end ) ;
+
+    if ( end == string || ! std::isfinite( result ) ) {
+        return false ;
+    }
+
+    value = result ;
+    string = end ;
+    return true ;
+}
+
+/**
+ * Process single filter command.
+ */
+void process_command( const char * const command )
+{
+    hope( command ) ;
+
+    const char * s = command ;
+
+    // Skip leading whitespace, empty lines and comments.
+
+    s += std::strspn( s, " \t\r\n" ) ;
+
+    if ( *s == 0 || *s == '#' ) {
+        return ;
+    }
+
+    // Fetch the keyword.
+
+    const uint length = std::strcspn( s, " \t\r\n" ) ;
+
+    char keyword[ 8 ] = "" ;
+
+    if ( length < sizeof( keyword ) ) {
+        for ( uint i = 0 ; i < length ; i++ ) {
+            keyword[ i ] = std::toupper( s[ i ] ) ;
+        }
+        keyword[ length ] = 0 ;
+    }
+
+    s += length ;
+
+    // Fetch up to three numeric arguments.
+
+    double arguments[ 3 ] ;
+    uint argument_count = 0 ;
+
+    while ( argument_count < 3 && parse_number( arguments[ argument_count ], s ) ) {
+        argument_count++ ;
+    }
+
+    s += std::strspn( s, " \t\r\n" ) ;
+
+    if ( *s != 0 && *s != '#' ) {
+        fail( "invalid arguments in command %s", command ) ;
+    }
+
+    // Now process the command itself.
+
+    if ( std::strcmp( keyword, "FILTER" ) == 0 ) {
+
+        if ( argument_count == 0 ) {
+            filter_count = 0 ;
+            return ;
+        }
+
+        if ( argument_count == 1 ) {
+            fail( "missing filter range in command %s", command ) ;
+        }
+
+        if ( filter_count >= filter_limit ) {
+            fail( "too many filter ranges specified" ) ;
+        }
+
+        for ( uint i = 0 ; i < argument_count ; i++ ) {
+            if ( arguments[ i ] < 0 || arguments[ i ] > 0xFFFFFFFF ) {
+                fail( "filter duration out of range in command %s", command ) ;
+            }
+        }
+
+        const uint duration = uint( arguments[ 0 ] ) ;
+
+        filter_result[ filter_count ] = duration ;
+
+        if ( argument_count == 2 ) {
+            const uint range = uint( arguments[ 1 ] ) ;
+            filter_min[ filter_count ] = ( duration > range ? duration - range : 0 ) ;
+            filter_max[ filter_count ] = ( 0xFFFFFFFF - duration > range ? duration + range : 0xFFFFFFFF ) ;
+        }
+        else {
+            filter_min[ filter_count ] = uint( arguments[ 1 ] ) ;
+            filter_max[ filter_count ] = uint( arguments[ 2 ] ) ;
+        }
+
+        filter_count++ ;
+        return ;
+    }
+
+    if ( std::strcmp( keyword, "SCALE" ) == 0 || std::strcmp( keyword, "BIAS" ) == 0 ) {
+
+        if ( argument_count > 2 ) {
+            fail( "too many arguments in command %s", command ) ;
+        }
+
+        double * const values = ( keyword[ 0 ] == 'S' ? scale : bias ) ;
+
+        if ( argument_count == 0 ) {
+            arguments[ 0 ] = ( values == scale ? 1 : 0 ) ;
+        }
+        if ( argument_count < 2 ) {
+            arguments[ 1 ] = arguments[ 0 ] ;
+        }
+
+        if ( values == scale && ( arguments[ 0 ] < 0 || arguments[ 1 ] < 0 ) ) {
+            fail( "negative scale factor in command %s", command ) ;
+        }
+
+        values[ 0 ] = arguments[ 0 ] ;
+        values[ 1 ] = arguments[ 1 ] ;
+        return ;
+    }
+
+    fail( "invalid command %s", command ) ;
+}
+
+/**
+ * Process all commands in given script file.
+ */
+void process_script( const char * const name )
+{
+    hope( name ) ;
+
+    FILE * const file = fopen( name, "r" ) ;
+    if ( file == NULL ) {
+        fail( "unable to open script file %s", name ) ;
+    }
+
+    char line[ 1024 ] ;
+
+    while ( fgets( line, sizeof( line ), file ) ) {
+        process_command( line ) ;
+    }
+
+    if ( ferror( file ) != 0 ) {
+        fail( "error reading script file %s", name ) ;
+    }
+
+    fclose( file ) ;
+}
+
+/**
+ * Adjust given pulse duration of given level according to current settings.
+ */
+uint adjust_duration( const uint duration, const bool level )
+{
+    // Scale and bias the duration first, the same way adjust_pulses.pl does.
+
+    uint result = duration ;
+
+    if ( scale[ level ] != 1 || bias[ level ] != 0 ) {
+
+        const double value = duration * scale[ level ] + bias[ level ] ;
+
+        if ( value < 0 ) {
+            result = 0 ;
+        }
+        else if ( value > 0xFFFFFFFF ) {
+            result = 0xFFFFFFFF ;
+        }
+        else {
+            result = uint( value ) ;
+        }
+    }
+
+    // Then map it by the first matching filter range, the same way filter_pulses.pl does.
+
+    for ( uint i = 0 ; i < filter_count ; i++ ) {
+        if ( filter_min[ i ] <= result && result <= filter_max[ i ] ) {
+            return filter_result[ i ] ;
+        }
+    }
+
+    return result ;
+}
+
+/**
+ * Process given amount of pulses of given duration, starting at given level.
+ */
+void process_pulses( bool & level, const uint duration, const uint count = 1 )
+{
+    hope( count > 0 ) ;
+
+    // Adjust the duration for both levels, as the pulses alternate.
+
+    const uint durations[ 2 ] = {
+        adjust_duration( duration, false ),
+        adjust_duration( duration, true )
+    } ;
+
+    // Either gather the statistics, or send the pulses to the output.
+
+    if ( option_report != REPORT_NONE ) {
+
+        const uint count_0 = ( level ? count / 2 : ( count + 1 ) / 2 ) ;
+        const uint count_1 = ( count - count_0 ) ;
+
+        for ( uint l = 0 ; l < 2 ; l++ ) {
+
+            const uint d = durations[ l ] ;
+            const uint c = ( l ? count_1 : count_0 ) ;
+
+            if ( c == 0 ) {
+                continue ;
+            }
+
+            pulse_sum += uquad( d ) * c ;
+
+            if ( d > 0 ) {
+                nonzero_pulse_sum += uquad( d ) * c ;
+                nonzero_pulse_count += c ;
+            }
+
+            if ( option_report == REPORT_COUNT ) {
+                pulse_histogram[ d ] += c ;
+            }
+        }
+
+        level ^= ( count & 1 ) ;
+        return ;
+    }
+
+    // Send the pulses in batches. The batch size is even, so each batch
+    // starts with the same level and the same batch may be used repeatedly.
+
+    uquad batch[ 256 ] ;
+
+    const uint batch_size = ( count < 256 ? count : 256 ) ;
+
+    for ( uint i = 0 ; i < batch_size ; i++ ) {
+        batch[ i ] = durations[ level ^ ( i & 1 ) ] ;
+    }
+
+    for ( uint i = 0 ; i < count ; i += batch_size ) {
+        pzx_out( batch, ( count - i < batch_size ? count - i : batch_size ), level ) ;
+    }
+
+    level ^= ( count & 1 ) ;
+}
+
+/**
+ * Process bits from given byte using given (little endian) pulse sequences.
+ */
+void process_bits(
+    bool & level,
+    uint bit_count,
+    uint bits,
+    const uint pulse_count_0,
+    const uint pulse_count_1,
+    const byte * const sequence_0,
+    const byte * const sequence_1
+)
+{
+    hope( sequence_0 || pulse_count_0 == 0 ) ;
+    hope( sequence_1 || pulse_count_1 == 0 ) ;
+
+    // Process all bits.
+
+    while ( bit_count-- > 0 ) {
+
+        // Choose the appropriate sequence for given bit.
+
+        const byte * sequence ;
+        uint count ;
+
+        if ( ( bits & 0x80 ) == 0 ) {
+            sequence = sequence_0 ;
+            count = pulse_count_0 ;
+        }
+        else {
+            sequence = sequence_1 ;
+            count = pulse_count_1 ;
+        }
+
+        // Use next bit next time.
+
+        bits <<= 1 ;
+
+        // Now process the appropriate amount of pulses.
+
+        while ( count-- > 0 ) {
+            uint duration = *sequence++ ;
+            duration += *sequence++ << 8 ;
+            process_pulses( level, duration ) ;
+        }
+    }
+}
+
+/**
+ * Process given DATA block as pulses.
+ */
+void process_data_block( const byte * data, uint data_size )
+{
+    hope( data ) ;
+
+    // Fetch the numbers.
+
+    uint bit_count = GET4() ;
+    const uint tail_cycles = GET2() ;
+    const uint pulse_count_0 = GET1() ;
+    const uint pulse_count_1 = GET1() ;
+
+    // Extract initial pulse level.
+
+    bool level = ( ( bit_count >> 31 ) != 0 ) ;
+
+    bit_count &= 0x7FFFFFFF ;
+
+    // Fetch the sequences. Note that we keep them little endian here.
+
+    const byte * const sequence_0 = data ;
+    SKIP( 2 * pulse_count_0 ) ;
+
+    const byte * const sequence_1 = data ;
+    SKIP( 2 * pulse_count_1 ) ;
+
+    // Make sure the bit count matches the block size.
+
+    if ( data_size != ( ( bit_count + 7 ) / 8 ) ) {
+        fail( "bit count %u does not match the actual data size %u", bit_count, data_size ) ;
+    }
+
+    // Make sure the level is high by using zero pulse if necessary, the same way pzx2txt -p does.
+
+    if ( level ) {
+        level = false ;
+        process_pulses( level, 0 ) ;
+    }
+
+    // Now process all the bits.
+
+    while ( bit_count > 8 ) {
+        process_bits( level, 8, *data++, pulse_count_0, pulse_count_1, sequence_0, sequence_1 ) ;
+        bit_count -= 8 ;
+    }
+    process_bits( level, bit_count, *data, pulse_count_0, pulse_count_1, sequence_0, sequence_1 ) ;
+
+    // And finally the optional tail pulse.
+
+    if ( tail_cycles > 0 ) {
+        process_pulses( level, tail_cycles ) ;
+    }
+}
+
+/**
+ * Process given PULSE block.
+ */
+void process_pulse_block( const byte * data, uint data_size )
+{
+    hope( data ) ;
+
+    // Each block starts with low level.
+    //
+    // Note that the pulse output is continuous, so we have to make sure
+    // the level really goes low if the previous block ended high.
+
+    bool level = false ;
+
+    // Process all pulses in the block.
+
+    while ( data_size > 0 ) {
+
+        // Fetch the pulse repeat count and duration.
+
+        uint count = 1 ;
+        uint duration = GET2() ;
+        if ( duration > 0x8000 ) {
+            count = duration & 0x7FFF ;
+            duration = GET2() ;
+        }
+        if ( duration >= 0x8000 ) {
+            duration &= 0x7FFF ;
+            duration <<= 16 ;
+            duration |= GET2() ;
+        }
+
+        // Process the appropriate number of pulses.
+
+        if ( count > 0 ) {
+            process_pulses( level, duration, count ) ;
+        }
+    }
+}
+
+/**
+ * Process given PZX block.
+ */
+void process_block( const uint tag, const byte * data, uint data_size )
+{
+    hope( data ) ;
+
+    switch ( tag ) {
+        case PZX_HEADER: {
+            const uint major = GET1() ;
+            const uint minor = GET1() ;
+            if ( major != PZX_MAJOR ) {
+                fail( "unsupported PZX major version %u.%u - stopping", major, minor ) ;
+            }
+            if ( minor > PZX_MINOR ) {
+                warn( "unsupported PZX minor version %u.%u - proceeding", major, minor ) ;
+            }
+            if ( option_report == REPORT_NONE ) {
+                pzx_header( data, data_size ) ;
+            }
+            return ;
+        }
+        case PZX_PULSES: {
+            process_pulse_block( data, data_size ) ;
+            return ;
+        }
+        case PZX_DATA: {
+            if ( option_process_data ) {
+                process_data_block( data, data_size ) ;
+                return ;
+            }
+            break ;
+        }
+    }
+
+    // Any other block is copied verbatim.
+
+    if ( option_report == REPORT_NONE ) {
+        pzx_flush() ;
+        pzx_write_block( tag, data, data_size ) ;
+    }
+}
+
+/**
+ * Print the requested report to given file.
+ */
+void print_report( FILE * const output_file )
+{
+    switch ( option_report ) {
+        case REPORT_SUM: {
+            fprintf( output_file, "PULSE %llu\n", pulse_sum ) ;
+            break ;
+        }
+        case REPORT_AVERAGE: {
+            const uquad average = ( nonzero_pulse_count > 0 ? nonzero_pulse_sum / nonzero_pulse_count : 0 ) ;
+            fprintf( output_file, "PULSE %llu %llu\n", average, nonzero_pulse_count ) ;
+            break ;
+        }
+        case REPORT_COUNT: {
+            std::map< uint, uquad >::const_iterator it ;
+            for ( it = pulse_histogram.begin() ; it != pulse_histogram.end() ; ++it ) {
+                fprintf( output_file, "PULSE %u %llu\n", it->first, it->second ) ;
+            }
+            break ;
+        }
+        default: {
+            break ;
+        }
+    }
+}
+
+/**
+ * Filter pulses of given PZX file.
+ */
+int convert( int argc, char * * argv )
+{
+    // Make sure the standard I/O is in binary mode.
+
+    set_binary_mode( stdin ) ;
+    set_binary_mode( stdout ) ;
+
+    // Parse the command line.
+
+    const char * input_name = NULL ;
+    const char * output_name = NULL ;
+
+    for ( int i = 1 ; i < argc ; i++ ) {
+        if ( argv[ i ][ 0 ] != '-' ) {
+            if ( input_name ) {
+                fail( "multiple input file names specified" ) ;
+            }
+            input_name = argv[ i ] ;
+            continue ;
+        }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
+        switch ( argv[ i ][ 1 ] ) {
+            case 'o': {
+                if ( output_name ) {
+                    fail( "multiple output file names specified" ) ;
+                }
+                output_name = argv[ ++i ] ;
+                break ;
+            }
+            case 'c': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing command" ) ;
+                }
+                process_command( arg ) ;
+                break ;
+            }
+            case 'f': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing script file name" ) ;
+                }
+                process_script( arg ) ;
+                break ;
+            }
+            case 'p': {
+                option_process_data = true ;
+                break ;
+            }
+            case 'r': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing report type" ) ;
+                }
+                if ( std::strcmp( arg, "sum" ) == 0 ) {
+                    option_report = REPORT_SUM ;
+                }
+                else if ( std::strcmp( arg, "average" ) == 0 ) {
+                    option_report = REPORT_AVERAGE ;
+                }
+                else if ( std::strcmp( arg, "count" ) == 0 ) {
+                    option_report = REPORT_COUNT ;
+                }
+                else {
+                    fail( "invalid report type %s", arg ) ;
+                }
+                break ;
+            }
+            default: {
+                fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
+
+                // Fall through.
+            }
+            case 'h': {
+                fprintf( stderr, "usage: pzxfilter [-c command] [-f script_file] [-p] [-r report] [-o output_file] [input_file]\n" ) ;
+                fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
+                fprintf( stderr, "-c s   process given FILTER, SCALE or BIAS command\n" ) ;
+                fprintf( stderr, "-f f   process commands from given script file\n" ) ;
+                fprintf( stderr, "-p     process pulses of data blocks as well\n" ) ;
+                fprintf( stderr, "-r s   print sum, average or count report of the pulses instead of PZX output\n" ) ;
+                stats_usage() ;
+                return EXIT_FAILURE ;
+            }
+        }
+    }
+
+    // Open the input file.
+
+    FILE * const input_file = ( input_name ? fopen( input_name, "rb" ) : stdin ) ;
+    if ( input_file == NULL ) {
+        fail( "unable to open input file" ) ;
+    }
+
+    // Read in the header.
+
+    stats_enter( STATS_READ ) ;
+
+    Buffer buffer ;
+    if ( buffer.read( input_file, 8 ) != 8 ) {
+        fail( "error reading input file" ) ;
+    }
+
+    // Make sure it is really the PZX file.
+
+    const u32 * header = buffer.get_typed_data< u32 >() ;
+
+    if ( header[ 0 ] != PZX_HEADER ) {
+        fail( "input is not a PZX file" ) ;
+    }
+
+    // Only then open the output file.
+
+    const bool text_output = ( option_report != REPORT_NONE ) ;
+
+    FILE * const output_file = ( output_name ? fopen( output_name, text_output ? "w" : "wb" ) : stdout ) ;
+    if ( output_file == NULL ) {
+        fail( "unable to open output file" ) ;
+    }
+
+    // Bind the PZX stream to the output file unless we are just reporting.
+
+    if ( ! text_output ) {
+        pzx_open( output_file ) ;
+    }
+
+    // Now keep reading the blocks and process each one in turn.
+
+    for ( ; ; ) {
+
+        // Extract the tag and size from the header.
+
+        const uint tag = native_endian( header[ 0 ] ) ;
+        const uint size = little_endian( header[ 1 ] ) ;
+
+        // Read in the block data.
+
+        if ( buffer.read( input_file, size ) != size ) {
+            fail( "error reading block data" ) ;
+        }
+
+        stats_add( STATS_BYTES_IN, 8 + size ) ;
+        stats_count_block( true, tag ) ;
+
+        // Process the block.
+
+        stats_enter( STATS_RENDER ) ;
+
+        process_block( tag, buffer.get_data(), size ) ;
+
+        // Read in header of the next block, if there is any.
+
+        stats_enter( STATS_READ ) ;
+
+        const uint bytes_read = buffer.read( input_file, 8 ) ;
+        header = buffer.get_typed_data< u32 >() ;
+
+        // Stop if there is nothing more.
+
+        if ( bytes_read == 0 ) {
+            break ;
+        }
+
+        // Check for errors.
+
+        if ( bytes_read != 8 ) {
+            fail( "error reading block header" ) ;
+        }
+    }
+
+    stats_enter( STATS_OTHER ) ;
+
+    // Close the input file.
+
+    fclose( input_file ) ;
+
+    // Finish the output.
+
+    if ( text_output ) {
+        print_report( output_file ) ;
+    }
+    else {
+        pzx_close() ;
+    }
+
+    if ( ferror( output_file ) != 0 || fclose( output_file ) != 0 ) {
+        fail( "error while closing the output file" ) ;
+    }
+
+    // Report the statistics, if requested.
+
+    stats_report( "pzxfilter" ) ;
+
+    return EXIT_SUCCESS ;
+}
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
@@ -0,0 +1,550 @@
+// $Id$
+
+/**
+ * @file PZX optimizer.
+ *
+ * Rewrites given PZX file so it takes less space while it still describes
+ * exactly the same pulses. Adjacent PULS blocks are merged, the pulses are
+ * reencoded using the repeat counts whenever possible, and the pulses
+ * between the leader tones are packed to DATA blocks whenever possible.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "pzx.h"
+#include "stats.h"
+
+/**
+ * Global options.
+ */
+namespace {
+
+/**
+ * Default maximum number of pulses in the sequences used for packing.
+ */
+const uint default_sequence_limit = 2 ;
+
+/**
+ * Maximum number of pulses in the sequences used for packing.
+ */
+uint option_sequence_limit = default_sequence_limit ;
+
+} ;
+
+/**
+ * Optimizer state.
+ */
+namespace {
+
+/**
+ * Minimum number of pulses of the same duration considered to be a leader tone.
+ */
+const uint leader_pulse_limit = 256 ;
+
+/**
+ * Maximum number of pulses kept in the segment before it is processed anyway,
+ * so the memory use remains bounded even if there are no leader tones at all.
+ */
+const uint segment_pulse_limit = 16 * 1024 * 1024 ;
+
+/**
+ * Maximum number of pulses preceding and following the packed pulses which
+ * are stored in PULS block instead, like the sync pulses or the pause.
+ */
+const uint pack_margin = 2 ;
+
+/**
+ * Pulses following the last leader tone, not output yet. As the
+ * consecutive pulses of the same level are merged, their levels alternate.
+ */
+//@{
+Buffer segment_buffer ;
+bool segment_level ;
+//@}
+
+/**
+ * Number of pulses of the same duration at the end of the segment.
+ */
+uint run_count ;
+
+/**
+ * Duration and level of the pulse accumulated so far, not yet added to the segment.
+ */
+//@{
+uquad pending_duration ;
+bool pending_level ;
+//@}
+
+/**
+ * Fetch value of specified type from given data block.
+ */
+template< typename Type >
+Type fetch( const byte * & data, uint & data_size )
+{
+    hope( data ) ;
+
+    if ( sizeof( Type ) > data_size ) {
+        fail( "incomplete block detected" ) ;
+    }
+
+    const Type value = little_endian( * reinterpret_cast< const Type * >( data ) ) ;
+
+    data += sizeof( Type ) ;
+    data_size -= sizeof( Type ) ;
+
+    return value ;
+}
+
+/**
+ * Macros for convenient fetching of values from current block.
+ */
+//@{
+#define GET1()  fetch< u8 >( data, data_size )
+#define GET2()  fetch< u16 >( data, data_size )
+#define GET4()  fetch< u32 >( data, data_size )
+//@}
+
+/**
+ * Output given pulses starting with given level.
+ */
+void output_pulses( const word * const pulses, const uint pulse_count, bool level )
+{
+    for ( uint i = 0 ; i < pulse_count ; i++ ) {
+        pzx_out( pulses[ i ], level ) ;
+        level = ! level ;
+    }
+}
+
+/**
+ * Compute the size of given pulses when stored in PULS block.
+ */
+uquad pulse_block_size( const word * const pulses, const uint pulse_count )
+{
+    uquad size = 0 ;
+
+    for ( uint i = 0 ; i < pulse_count ; ) {
+        uint count = 1 ;
+        while ( i + count < pulse_count && pulses[ i + count ] == pulses[ i ] && count < 0x7FFF ) {
+            count++ ;
+        }
+        size += ( count > 1 ? 2 : 0 ) + ( pulses[ i ] < 0x8000 ? 2 : 4 ) ;
+        i += count ;
+    }
+
+    return size ;
+}
+
+/**
+ * Output given pulses starting with given level, packing them to DATA block if possible.
+ *
+ * The few pulses at the start and the end which don't fit the packing,
+ * like the sync pulses and the tail pulse, are output as they are.
+ */
+void pack_pulses( const word * const pulses, const uint pulse_count, const bool level )
+{
+    // Don't bother unless the DATA block would be smaller than the PULS block,
+    // even if each pulse would take entire bit.
+
+    const uint data_block_size = 8 + 8 + 4 * option_sequence_limit + ( pulse_count + 7 ) / 8 ;
+
+    if ( pulse_block_size( pulses, pulse_count ) <= data_block_size ) {
+        output_pulses( pulses, pulse_count, level ) ;
+        return ;
+    }
+
+    // Try skipping few pulses at the start, outputting them as we go.
+
+    uint lead = 0 ;
+
+    for ( ; ; ) {
+
+        const bool pack_level = level ^ ( lead & 1 ) ;
+
+        // Try excluding few pulses at the end, using the first of them as the tail pulse.
+
+        for ( uint trail = 0 ; trail <= pack_margin && lead + trail < pulse_count ; trail++ ) {
+
+            const uint pack_count = pulse_count - lead - trail ;
+
+            if ( trail == 0 ) {
+                if ( pzx_pack( pulses + lead, pack_count, pack_level, option_sequence_limit, 2, 0 ) ) {
+                    return ;
+                }
+                continue ;
+            }
+
+            const uint tail = lead + pack_count ;
+
+            if ( pzx_pack( pulses + lead, pack_count, pack_level, option_sequence_limit, 2, pulses[ tail ] ) ) {
+                output_pulses( pulses + tail + 1, trail - 1, level ^ ( ( tail + 1 ) & 1 ) ) ;
+                return ;
+            }
+        }
+
+        if ( lead >= pack_margin || lead + 1 >= pulse_count ) {
+            break ;
+        }
+
+        output_pulses( pulses + lead, 1, level ^ ( lead & 1 ) ) ;
+        lead++ ;
+    }
+
+    // Packing is not possible, so output the remaining pulses as they are.
+
+    output_pulses( pulses + lead, pulse_count - lead, level ^ ( lead & 1 ) ) ;
+}
+
+/**
+ * Output the pulses of current segment.
+ *
+ * The leader tone at the end of the segment, if there is any, is output
+ * separately, so it doesn't prevent packing of the pulses which precede it.
+ */
+void flush_segment( void )
+{
+    const word * const pulses = segment_buffer.get_typed_data< word >() ;
+    const uint pulse_count = segment_buffer.get_data_size() / 2 ;
+
+    const uint leader_count = ( run_count >= leader_pulse_limit ? run_count : 0 ) ;
+    const uint data_count = pulse_count - leader_count ;
+
+    if ( data_count > 0 ) {
+        pack_pulses( pulses, data_count, segment_level ) ;
+    }
+
+    output_pulses( pulses + data_count, leader_count, segment_level ^ ( data_count & 1 ) ) ;
+
+    segment_buffer.clear() ;
+    run_count = 0 ;
+}
+
+/**
+ * Add the pending pulse to current segment.
+ */
+void commit_pulse( void )
+{
+    const uquad duration = pending_duration ;
+    const bool level = pending_level ;
+
+    if ( duration == 0 ) {
+        return ;
+    }
+
+    pending_duration = 0 ;
+
+    // Pulses too long to be packed end the segment and are output right away.
+
+    if ( duration > 0xFFFF ) {
+        flush_segment() ;
+        for ( uquad left = duration ; left > 0 ; ) {
+            const uint part = uint( left > 0xFFFFFFFF ? 0xFFFFFFFF : left ) ;
+            pzx_out( part, level ) ;
+            left -= part ;
+        }
+        return ;
+    }
+
+    // The leader tone ends with pulse which is shorter, typically the sync
+    // pulse. Ending the segment only then avoids splitting data blocks at
+    // long runs of zero bits, which are followed by longer pulses instead.
+
+    if ( segment_buffer.is_not_empty() ) {
+        const word last_duration = segment_buffer.get_typed_data< word >()[ segment_buffer.get_data_size() / 2 - 1 ] ;
+        if ( duration == last_duration ) {
+            run_count++ ;
+        }
+        else if ( duration < last_duration && run_count >= leader_pulse_limit ) {
+            flush_segment() ;
+        }
+        else {
+            run_count = 1 ;
+        }
+    }
+
+    if ( segment_buffer.is_empty() ) {
+        segment_level = level ;
+        run_count = 1 ;
+    }
+
+    segment_buffer.write< word >( word( duration ) ) ;
+
+    // Make sure the segment doesn't grow indefinitely.
+
+    if ( segment_buffer.get_data_size() / 2 >= segment_pulse_limit ) {
+        flush_segment() ;
+    }
+}
+
+/**
+ * Add given pulse of given level, merging it with the preceding pulse of the same level.
+ */
+void add_pulse( const uint duration, const bool level )
+{
+    if ( duration == 0 ) {
+        return ;
+    }
+
+    if ( level != pending_level ) {
+        commit_pulse() ;
+        pending_level = level ;
+    }
+
+    pending_duration += duration ;
+}
+
+/**
+ * Output all pulses added so far.
+ */
+void flush_pulses( void )
+{
+    commit_pulse() ;
+    flush_segment() ;
+}
+
+/**
+ * Process given PULS block.
+ */
+void process_pulse_block( const byte * data, uint data_size )
+{
+    bool level = false ;
+
+    while ( data_size > 0 ) {
+
+        uint count = 1 ;
+        uint duration = GET2() ;
+        if ( duration > 0x8000 ) {
+            count = duration & 0x7FFF ;
+            duration = GET2() ;
+        }
+        if ( duration >= 0x8000 ) {
+            duration &= 0x7FFF ;
+            duration <<= 16 ;
+            duration |= GET2() ;
+        }
+
+        while ( count-- > 0 ) {
+            add_pulse( duration, level ) ;
+            level = ! level ;
+        }
+    }
+}
+
+/**
+ * Process given PZX block.
+ */
+void process_block( const uint tag, const byte * data, uint data_size )
+{
+    hope( data ) ;
+
+    // Collect the pulses of the PULS blocks.
+
+    if ( tag == PZX_PULSES ) {
+        process_pulse_block( data, data_size ) ;
+        return ;
+    }
+
+    // Anything else ends the pulses collected so far.
+
+    flush_pulses() ;
+
+    // The header is merged with the header of the output file, everything
+    // else is copied as it is.
+
+    if ( tag == PZX_HEADER ) {
+        const uint major = GET1() ;
+        const uint minor = GET1() ;
+        if ( major != PZX_MAJOR ) {
+            fail( "unsupported PZX major version %u.%u - stopping", major, minor ) ;
+        }
+        if ( minor > PZX_MINOR ) {
+            warn( "unsupported PZX minor version %u.%u - proceeding", major, minor ) ;
+        }
+        pzx_header( data, data_size ) ;
+        return ;
+    }
+
+    pzx_flush() ;
+    pzx_write_block( tag, data, data_size ) ;
+}
+
+}
+
+/**
+ * Optimize given PZX file.
+ */
+int convert( int argc, char * * argv )
+{
+    // Make sure the standard I/O is in binary mode.
+
+    set_binary_mode( stdin ) ;
+    set_binary_mode( stdout ) ;
+
+    // Parse the command line.
+
+    const char * input_name = NULL ;
+    const char * output_name = NULL ;
+
+    for ( int i = 1 ; i < argc ; i++ ) {
+        if ( argv[ i ][ 0 ] != '-' ) {
+            if ( input_name ) {
+                fail( "multiple input file names specified" ) ;
+            }
+            input_name = argv[ i ] ;
+            continue ;
+        }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
+        switch ( argv[ i ][ 1 ] ) {
+            case 'o': {
+                if ( output_name ) {
+                    fail( "multiple output file names specified" ) ;
+                }
+                output_name = argv[ ++i ] ;
+                break ;
+            }
+            case 'l': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing sequence limit" ) ;
+                }
+                option_sequence_limit = uint( atoi( arg ) ) ;
+                if ( option_sequence_limit < 1 || option_sequence_limit > 255 ) {
+                    fail( "sequence limit %u is out of range", option_sequence_limit ) ;
+                }
+                break ;
+            }
+            default: {
+                fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
+
+                // Fall through.
+            }
+            case 'h': {
+                fprintf( stderr, "usage: pzxopt [-l n] [-o output_file] [input_file]\n" ) ;
+                fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
+                fprintf( stderr, "-l n   use sequences of up to given number of pulses for packing (default %u)\n", default_sequence_limit ) ;
+                stats_usage() ;
+                return EXIT_FAILURE ;
+            }
+        }
+    }
+
+    // Open the input file.
+
+    FILE * const input_file = ( input_name ? fopen( input_name, "rb" ) : stdin ) ;
+    if ( input_file == NULL ) {
+        fail( "unable to open input file" ) ;
+    }
+
+    // Read in the header.
+
+    stats_enter( STATS_READ ) ;
+
+    Buffer buffer ;
+    if ( buffer.read( input_file, 8 ) != 8 ) {
+        fail( "error reading input file" ) ;
+    }
+
+    // Make sure it is really the PZX file.
+
+    const u32 * header = buffer.get_typed_data< u32 >() ;
+
+    if ( header[ 0 ] != PZX_HEADER ) {
+        fail( "input is not a PZX file" ) ;
+    }
+
+    // Only then open the output file.
+
+    FILE * const output_file = ( output_name ? fopen( output_name, "wb" ) : stdout ) ;
+    if ( output_file == NULL ) {
+        fail( "unable to open output file" ) ;
+    }
+
+    // Bind the PZX stream to the output file.
+
+    pzx_open( output_file ) ;
+
+    // Now keep reading the blocks and process each one in turn.
+
+    for ( ; ; ) {
+
+        // Extract the tag and size from the header.
+
+        const uint tag = native_endian( header[ 0 ] ) ;
+        const uint size = little_endian( header[ 1 ] ) ;
+
+        // Read in the block data.
+
+        if ( buffer.read( input_file, size ) != size ) {
+            fail( "error reading block data" ) ;
+        }
+
+        stats_add( STATS_BYTES_IN, 8 + size ) ;
+        stats_count_block( true, tag ) ;
+
+        // Process the block.
+
+        stats_enter( STATS_RENDER ) ;
+
+        process_block( tag, buffer.get_data(), size ) ;
+
+        // Read in header of the next block, if there is any.
+
+        stats_enter( STATS_READ ) ;
+
+        const uint bytes_read = buffer.read( input_file, 8 ) ;
+        header = buffer.get_typed_data< u32 >() ;
+
+        // Stop if there is nothing more.
+
+        if ( bytes_read == 0 ) {
+            break ;
+        }
+
+        // Check for errors.
+
+        if ( bytes_read != 8 ) {
+            fail( "error reading block header" ) ;
+        }
+    }
+
+    stats_enter( STATS_RENDER ) ;
+
+    flush_pulses() ;
+
+    stats_enter( STATS_OTHER ) ;
+
+    // Close the input file.
+
+    fclose( input_file ) ;
+
+    // Finally, close the PZX stream and make sure there were no errors.
+
+    pzx_close() ;
+
+    if ( ferror( output_file ) != 0 || fclose( output_file ) != 0 ) {
+        fail( "error while closing the output file" ) ;
+    }
+
+    // Report the statistics, if requested.
+
+    stats_report( "pzxopt" ) ;
+
+    return EXIT_SUCCESS ;
+}
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
@@ -0,0 +1,671 @@
+// $Id$
+
+/**
+ * @file Tape loadability verifier.
+ *
+ * Runs a cycle counted model of the ROM LD-BYTES loader over the signal of
+ * given tape file and reports which blocks would load correctly. Instead of
+ * stepping through each loader cycle, the model jumps straight from edge to
+ * edge, so even long tapes are verified in an instant.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "libpzx.h"
+#include "buffer.h"
+#include "stats.h"
+
+#include <cctype>
+#include <cstring>
+#include <vector>
+
+/**
+ * Global options.
+ */
+namespace {
+
+/**
+ * Counter of the delay loop of the loader edge detection routine.
+ */
+uint option_delay_count = 0x16 ;
+
+/**
+ * Value of the loader timing counter above which the bit is considered to be 1.
+ */
+uint option_bit_threshold = 0xCB ;
+
+} ;
+
+/**
+ * Loader timing, in T cycles.
+ */
+namespace {
+
+/**
+ * Duration of one iteration of the sampling loop.
+ */
+const uint SAMPLE_CYCLES = 59 ;
+
+/**
+ * Time from the start of the sampling loop iteration to the moment the port is read.
+ */
+const uint SAMPLE_OFFSET = 26 ;
+
+/**
+ * Time from the start of the sampling loop iteration where the edge was
+ * found to the return from the edge detection routine.
+ */
+const uint EDGE_CYCLES = 105 ;
+
+/**
+ * Time from the start of the sampling loop iteration where the timing
+ * counter overflows to the return from the edge detection routine.
+ */
+const uint TIMEOUT_CYCLES = 15 ;
+
+/**
+ * Duration of the call instruction.
+ */
+const uint CALL_CYCLES = 17 ;
+
+/**
+ * Duration of the loader code between the edge detection calls, while
+ * waiting for the leader, the sync, and between the bits and bytes.
+ */
+//@{
+const uint LEADER_CYCLES = 41 ;
+const uint SYNC_CYCLES = 30 ;
+const uint MARKER_CYCLES = 48 ;
+const uint BIT_CYCLES = 41 ;
+const uint BYTE_CYCLES = 156 ;
+//@}
+
+/**
+ * Duration of the delay loop the loader runs after the first edge is found.
+ */
+const uint WAIT_CYCLES = 0x415 * 3349 ;
+
+/**
+ * Number of leader pulse pairs the loader requires.
+ */
+const uint LEADER_PAIR_COUNT = 256 ;
+
+/**
+ * Size of the standard header block, including the flag and checksum bytes.
+ */
+const uint HEADER_SIZE = 19 ;
+
+}
+
+/**
+ * Verifier state.
+ */
+namespace {
+
+/**
+ * Player providing the tape signal.
+ */
+libpzx_player * player ;
+
+/**
+ * Current time of the loader, and the level of the signal it has seen last.
+ */
+//@{
+uquad current_time ;
+bool current_level ;
+//@}
+
+/**
+ * Duration of the delay before the edge detection starts sampling.
+ */
+uint delay_cycles ;
+
+/**
+ * Get the level of the tape signal at given time, as well as the time until
+ * which the level is guaranteed to stay the same. The tape is restarted
+ * immediately after each STOP block.
+ */
+bool tape_level( const uquad time, uquad & edge_time )
+{
+    int level ;
+    uint64_t edge ;
+
+    int result = libpzx_player_level( player, time, &level, &edge ) ;
+
+    if ( result == LIBPZX_STOP ) {
+        libpzx_player_continue( player, time ) ;
+        result = libpzx_player_level( player, time, &level, &edge ) ;
+    }
+
+    if ( result == LIBPZX_ERROR ) {
+        fail( "%s", libpzx_error() ) ;
+    }
+
+    edge_time = ( result == LIBPZX_OK ? edge : ~uquad( 0 ) ) ;
+
+    return ( level != 0 ) ;
+}
+
+/**
+ * Find the first of given number of samples taken since given time at which
+ * the tape level differs from the current level.
+ *
+ * Returns false in case no such sample exists.
+ */
+bool find_edge( const uquad first_sample, const uint sample_count, uint & sample_index )
+{
+    uquad time = first_sample ;
+
+    for ( ; ; ) {
+        uquad edge_time ;
+
+        if ( tape_level( time, edge_time ) != current_level ) {
+            sample_index = uint( ( time - first_sample ) / SAMPLE_CYCLES ) ;
+            return true ;
+        }
+
+        if ( edge_time == ~uquad( 0 ) ) {
+            return false ;
+        }
+
+        // Jump straight to the first sample taken after the level may change.
+
+        const uquad index = ( edge_time - first_sample + SAMPLE_CYCLES - 1 ) / SAMPLE_CYCLES ;
+
+        if ( index >= sample_count ) {
+            return false ;
+        }
+
+        time = first_sample + index * SAMPLE_CYCLES ;
+    }
+}
+
+/**
+ * Model of the LD-EDGE-1 routine, finding the next edge while advancing
+ * given timing counter, excluding the call itself.
+ *
+ * Returns false in case the counter overflows before the edge is found.
+ */
+bool edge_1( uint & counter )
+{
+    current_time += delay_cycles ;
+
+    // Each sample increments the counter, and the routine gives up once it overflows.
+
+    const uint sample_count = 255 - counter ;
+
+    uint index ;
+
+    if ( ! find_edge( current_time + SAMPLE_OFFSET, sample_count, index ) ) {
+        current_time += uquad( sample_count ) * SAMPLE_CYCLES + TIMEOUT_CYCLES ;
+        counter = 0 ;
+        return false ;
+    }
+
+    current_time += uquad( index ) * SAMPLE_CYCLES + EDGE_CYCLES ;
+    current_level = ! current_level ;
+    counter += index + 1 ;
+    return true ;
+}
+
+/**
+ * Model of the LD-EDGE-2 routine, finding the next two edges, including the call itself.
+ */
+bool edge_2( uint & counter )
+{
+    current_time += 2 * CALL_CYCLES ;
+
+    if ( ! edge_1( counter ) ) {
+        return false ;
+    }
+
+    current_time += 5 ;
+
+    return edge_1( counter ) ;
+}
+
+/**
+ * Wait until the tape level changes.
+ *
+ * Returns false in case it never does.
+ */
+bool wait_for_edge( void )
+{
+    for ( ; ; ) {
+        uquad edge_time ;
+
+        const bool level = tape_level( current_time, edge_time ) ;
+
+        if ( level != current_level ) {
+            current_level = level ;
+            current_time += EDGE_CYCLES ;
+            return true ;
+        }
+
+        if ( edge_time == ~uquad( 0 ) ) {
+            return false ;
+        }
+
+        current_time = edge_time ;
+    }
+}
+
+/**
+ * Model of the LD-BYTES routine, loading the next block from the tape.
+ *
+ * Stores the loaded bytes in given buffer, stopping either after given
+ * number of bytes, if known, or when the edges stop coming. The expected size
+ * is set to the header size when the flag byte indicates header. Returns the
+ * time when the data started, or zero when there are no more blocks.
+ */
+uquad load_block( Buffer & bytes, uint & expected_size )
+{
+    for ( ; ; ) {
+
+        // Wait for any edge, then wait for about a second for the tape to settle.
+
+        if ( ! wait_for_edge() ) {
+            return 0 ;
+        }
+
+        current_time += WAIT_CYCLES ;
+
+        uint counter = 0 ;
+
+        if ( ! edge_2( counter ) ) {
+            continue ;
+        }
+
+        // Now there has to be enough leader pulses, each pair long enough.
+
+        uint pair_count = 0 ;
+
+        while ( pair_count < LEADER_PAIR_COUNT ) {
+            counter = 0x9C ;
+            if ( ! edge_2( counter ) || counter <= 0xC6 ) {
+                break ;
+            }
+            current_time += LEADER_CYCLES ;
+            pair_count++ ;
+        }
+
+        if ( pair_count < LEADER_PAIR_COUNT ) {
+            continue ;
+        }
+
+        // Wait for the first sync pulse, which has to be short enough.
+
+        bool sync = false ;
+
+        for ( ; ; ) {
+            counter = 0xC9 ;
+            current_time += CALL_CYCLES ;
+            if ( ! edge_1( counter ) ) {
+                break ;
+            }
+            current_time += SYNC_CYCLES ;
+            if ( counter < 0xD4 ) {
+                sync = true ;
+                break ;
+            }
+        }
+
+        current_time += CALL_CYCLES ;
+
+        if ( ! sync || ! edge_1( counter ) ) {
+            continue ;
+        }
+
+        // Now read the bytes, until there are no more edges or enough bytes were read.
+
+        const uquad start_time = current_time ;
+
+        current_time += MARKER_CYCLES ;
+
+        bytes.clear() ;
+
+        for ( ; ; ) {
+
+            uint value = 0 ;
+
+            for ( uint bit = 0 ; bit < 8 ; bit++ ) {
+                counter = ( bit > 0 || bytes.is_empty() ? 0xB0 : 0xB2 ) ;
+                if ( ! edge_2( counter ) ) {
+                    return start_time ;
+                }
+                value = ( value << 1 ) | ( counter > option_bit_threshold ) ;
+                current_time += BIT_CYCLES ;
+            }
+
+            bytes.write( byte( value ) ) ;
+
+            current_time += BYTE_CYCLES - BIT_CYCLES ;
+
+            if ( bytes.get_data_size() == 1 && value == 0 ) {
+                expected_size = HEADER_SIZE ;
+            }
+
+            if ( bytes.get_data_size() == expected_size ) {
+                return start_time ;
+            }
+        }
+    }
+}
+
+/**
+ * Check if given file name ends with given lowercase extension, regardless of case.
+ */
+bool has_extension( const char * const name, const char * const extension )
+{
+    const size_t name_length = ( name ? std::strlen( name ) : 0 ) ;
+    const size_t extension_length = std::strlen( extension ) ;
+
+    if ( name_length <= extension_length ) {
+        return false ;
+    }
+
+    const char * const suffix = name + name_length - extension_length ;
+
+    for ( size_t i = 0 ; i < extension_length ; i++ ) {
+        if ( std::tolower( byte( suffix[ i ] ) ) != extension[ i ] ) {
+            return false ;
+        }
+    }
+
+    return true ;
+}
+
+}
+
+/**
+ * Verify given tape file.
+ */
+int convert( int argc, char * * argv )
+{
+    // Make sure the standard I/O is in binary mode.
+
+    set_binary_mode( stdin ) ;
+
+    // Parse the command line.
+
+    const char * input_name = NULL ;
+    const char * output_name = NULL ;
+
+    for ( int i = 1 ; i < argc ; i++ ) {
+        if ( argv[ i ][ 0 ] != '-' ) {
+            if ( input_name ) {
+                fail( "multiple input file names specified" ) ;
+            }
+            input_name = argv[ i ] ;
+            continue ;
+        }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
+        switch ( argv[ i ][ 1 ] ) {
+            case 'o': {
+                if ( output_name ) {
+                    fail( "multiple output file names specified" ) ;
+                }
+                output_name = argv[ ++i ] ;
+                break ;
+            }
+            case 'd': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing delay loop counter" ) ;
+                }
+                option_delay_count = uint( atoi( arg ) ) ;
+                if ( option_delay_count < 1 || option_delay_count > 256 ) {
+                    fail( "delay loop counter %u is out of range", option_delay_count ) ;
+                }
+                break ;
+            }
+            case 't': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing bit threshold" ) ;
+                }
+                option_bit_threshold = uint( atoi( arg ) ) ;
+                if ( option_bit_threshold < 0xB2 || option_bit_threshold > 0xFF ) {
+                    fail( "bit threshold %u is out of range", option_bit_threshold ) ;
+                }
+                break ;
+            }
+            default: {
+                fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
+
+                // Fall through.
+            }
+            case 'h': {
+                fprintf( stderr, "usage: pzxverify [-d n] [-t n] [-o output_file] [input_file]\n" ) ;
+                fprintf( stderr, "-o f   write the report to given file instead of standard output\n" ) ;
+                fprintf( stderr, "-d n   use given delay loop counter of the loader (default 22)\n" ) ;
+                fprintf( stderr, "-t n   use given bit threshold of the loader (default 203)\n" ) ;
+                stats_usage() ;
+                return EXIT_FAILURE ;
+            }
+        }
+    }
+
+    // Read in the input file.
+
+    FILE * const input_file = ( input_name ? fopen( input_name, "rb" ) : stdin ) ;
+    if ( input_file == NULL ) {
+        fail( "unable to open input file" ) ;
+    }
+
+    Buffer buffer( 256 * 1024 ) ;
+
+    const StatsPhase phase = stats_enter( STATS_READ ) ;
+
+    if ( ! buffer.read( input_file ) ) {
+        fail( "error reading input file" ) ;
+    }
+
+    fclose( input_file ) ;
+
+    stats_leave( phase ) ;
+    stats_add( STATS_BYTES_IN, buffer.get_data_size() ) ;
+
+    // Convert it to PZX, unless it already is PZX.
+
+    const byte * data = buffer.get_data() ;
+    size_t size = buffer.get_data_size() ;
+
+    void * pzx_data = NULL ;
+    size_t pzx_size = 0 ;
+
+    int result = LIBPZX_OK ;
+
+    if ( size >= 8 && std::memcmp( data, "PZXT", 4 ) == 0 ) {
+        result = LIBPZX_OK ;
+    }
+    else if ( size >= 8 && std::memcmp( data, "ZXTape!\x1a", 8 ) == 0 ) {
+        result = libpzx_import_tzx( data, size, &pzx_data, &pzx_size ) ;
+    }
+    else if ( size >= 23 && std::memcmp( data, "Compressed Square Wave\x1a", 23 ) == 0 ) {
+        result = libpzx_import_csw( data, size, &pzx_data, &pzx_size ) ;
+    }
+    else if ( has_extension( input_name, ".tap" ) ) {
+        result = libpzx_import_tap( data, size, 0, &pzx_data, &pzx_size ) ;
+    }
+    else {
+        fail( "input is not a PZX, TZX, CSW, or TAP file" ) ;
+    }
+
+    if ( result != LIBPZX_OK ) {
+        fail( "%s", libpzx_error() ) ;
+    }
+
+    if ( pzx_data ) {
+        data = static_cast< const byte * >( pzx_data ) ;
+        size = pzx_size ;
+    }
+
+    // Find out which blocks may contain data.
+
+    std::vector< uint > block_tags ;
+
+    libpzx_reader * const reader = libpzx_reader_open( data, size ) ;
+    if ( reader == NULL ) {
+        fail( "%s", libpzx_error() ) ;
+    }
+
+    libpzx_block block ;
+
+    while ( ( result = libpzx_reader_next( reader, &block ) ) == LIBPZX_OK ) {
+        block_tags.push_back( block.tag ) ;
+    }
+
+    libpzx_reader_close( reader ) ;
+
+    if ( result != LIBPZX_END ) {
+        fail( "%s", libpzx_error() ) ;
+    }
+
+    // Open the output file.
+
+    FILE * const output_file = ( output_name ? fopen( output_name, "w" ) : stdout ) ;
+    if ( output_file == NULL ) {
+        fail( "unable to open output file" ) ;
+    }
+
+    // Now let the loader load all it can.
+
+    stats_enter( STATS_PARSE ) ;
+
+    player = libpzx_player_open( data, size, 1 ) ;
+    if ( player == NULL ) {
+        fail( "%s", libpzx_error() ) ;
+    }
+
+    delay_cycles = 7 + 16 * option_delay_count - 5 + 4 ;
+
+    std::vector< bool > block_loaded( block_tags.size(), false ) ;
+
+    uint loaded_count = 0 ;
+    uint failed_count = 0 ;
+
+    uint expected_size = 0 ;
+    uint index = 0 ;
+
+    Buffer bytes ;
+
+    uquad start_time ;
+
+    while ( ( start_time = load_block( bytes, expected_size ) ) != 0 ) {
+
+        // Find the block where the data started. The blocks are loaded in order.
+
+        const uquad position = libpzx_player_position( player, start_time ) ;
+
+        uint64_t block_position ;
+
+        while ( libpzx_player_block_position( player, index + 1, &block_position ) == LIBPZX_OK && block_position <= position ) {
+            index++ ;
+        }
+
+        block_loaded[ index ] = true ;
+
+        // Verify the checksum over the expected size, if known.
+
+        const byte * const block_data = bytes.get_data() ;
+        const uint block_size = bytes.get_data_size() ;
+
+        uint checksum = 0 ;
+
+        for ( uint i = 0 ; i < block_size ; i++ ) {
+            checksum ^= block_data[ i ] ;
+        }
+
+        // Note that the loader may give up right after the sync pulses, in
+        // which case nothing was loaded at all, not even the flag byte.
+
+        const bool empty = ( block_size == 0 ) ;
+        const bool header = ( ! empty && block_data[ 0 ] == 0 && block_size == HEADER_SIZE ) ;
+        const bool complete = ( expected_size == 0 || block_size == expected_size ) ;
+        const bool valid = ( ! empty && complete && checksum == 0 ) ;
+
+        fprintf( output_file, "block %u at %llu T: ", index, position ) ;
+
+        if ( header ) {
+            char name[ 11 ] ;
+            for ( uint i = 0 ; i < 10 ; i++ ) {
+                const byte c = block_data[ 2 + i ] ;
+                name[ i ] = ( c >= 32 && c < 127 ? c : '?' ) ;
+            }
+            name[ 10 ] = 0 ;
+            fprintf( output_file, "header \"%s\", ", name ) ;
+        }
+        else if ( ! empty ) {
+            fprintf( output_file, "flag %u, ", block_data[ 0 ] ) ;
+        }
+
+        if ( empty && complete ) {
+            fprintf( output_file, "no data\n" ) ;
+        }
+        else if ( complete ) {
+            fprintf( output_file, "%u bytes, %s\n", block_size, valid ? "ok" : "checksum error" ) ;
+        }
+        else {
+            fprintf( output_file, "%u of %u bytes, truncated\n", block_size, expected_size ) ;
+        }
+
+        if ( valid ) {
+            loaded_count++ ;
+        }
+        else {
+            failed_count++ ;
+        }
+
+        // The header tells the size of the data block which follows it.
+
+        expected_size = ( header && valid ? 2 + ( block_data[ 12 ] | ( block_data[ 13 ] << 8 ) ) : 0 ) ;
+    }
+
+    libpzx_player_close( player ) ;
+
+    stats_enter( STATS_OTHER ) ;
+
+    // Report the DATA blocks which the loader has not loaded at all.
+
+    uint missed_count = 0 ;
+
+    for ( uint i = 0 ; i < block_tags.size() ; i++ ) {
+        if ( block_tags[ i ] == LIBPZX_BLOCK_DATA && ! block_loaded[ i ] ) {
+            fprintf( output_file, "block %u: not loaded\n", i ) ;
+            missed_count++ ;
+        }
+    }
+
+    fprintf( output_file, "%u blocks loaded, %u failed, %u not loaded\n", loaded_count, failed_count, missed_count ) ;
+
+    if ( ferror( output_file ) != 0 || fclose( output_file ) != 0 ) {
+        fail( "error while closing the output file" ) ;
+    }
+
+    libpzx_free( pzx_data ) ;
+
+    // Report the statistics, if requested.
+
+    stats_report( "pzxverify" ) ;
+
+    return ( failed_count > 0 || missed_count > 0 ? EXIT_FAILURE : EXIT_SUCCESS ) ;
+}
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
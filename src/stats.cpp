@@ -0,0 +1,387 @@
+// $Id$
+
+/**
+ * @file Processing statistics.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "stats.h"
+#include "debug.h"
+#include "endian.h"
+
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Publicly visible state.
+ */
+//@{
+bool stats_enabled = false ;
+std::atomic< uquad > stats_counters[ STATS_COUNTER_COUNT ] ;
+std::atomic< uquad > stats_memory_used ;
+std::atomic< uquad > stats_memory_peak ;
+//@}
+
+namespace {
+
+/**
+ * Names of the phases and counters, as used in the report.
+ */
+//@{
+const char * const phase_names[ STATS_PHASE_COUNT ] = {
+    "other", "read", "parse", "render", "pack", "write"
+} ;
+
+const char * const counter_names[ STATS_COUNTER_COUNT ] = {
+    "bytes_in", "bytes_out", "pulses_out", "pack_attempts", "pack_successes",
+    "buffer_allocations", "buffer_pool_hits", "buffer_growths", "buffer_bytes_copied"
+} ;
+//@}
+
+/**
+ * Set when the report should be made in JSON format.
+ */
+bool json_format = false ;
+
+/**
+ * Name of the file where to write the report, if any.
+ */
+const char * report_file_name = NULL ;
+
+/**
+ * Currently active phase.
+ */
+StatsPhase current_phase = STATS_OTHER ;
+
+/**
+ * Wall and CPU time when the current phase was entered, in seconds.
+ */
+//@{
+double phase_wall_start ;
+double phase_cpu_start ;
+//@}
+
+/**
+ * Accumulated wall and CPU time of each phase, in seconds.
+ */
+//@{
+double phase_wall_times[ STATS_PHASE_COUNT ] ;
+double phase_cpu_times[ STATS_PHASE_COUNT ] ;
+//@}
+
+/**
+ * Counts of input and output blocks of each kind.
+ */
+//@{
+std::map< std::string, uquad > input_blocks ;
+std::map< std::string, uquad > output_blocks ;
+//@}
+
+/**
+ * List of known Buffer call sites.
+ *
+ * Note that it is a plain pointer so it is already initialized when the
+ * global buffers get constructed. The same holds for the mutex which guards
+ * it against buffers created by the worker threads.
+ */
+StatsBufferSite * buffer_sites = NULL ;
+std::mutex buffer_sites_mutex ;
+
+/**
+ * Order Buffer call sites by their peak memory use, largest first.
+ */
+bool stats_compare_sites( const StatsBufferSite * const a, const StatsBufferSite * const b )
+{
+    if ( a->memory_peak != b->memory_peak ) {
+        return ( a->memory_peak > b->memory_peak ) ;
+    }
+    const int result = std::strcmp( a->file, b->file ) ;
+    return ( result != 0 ? result < 0 : a->line < b->line ) ;
+}
+
+} ;
+
+/**
+ * Get current wall time in seconds.
+ */
+double stats_wall_time( void )
+{
+#ifdef _MSC_VER
+    return double( std::clock() ) / CLOCKS_PER_SEC ;
+#else
+    timespec now ;
+    clock_gettime( CLOCK_MONOTONIC, &now ) ;
+    return now.tv_sec + now.tv_nsec * 1e-9 ;
+#endif
+}
+
+/**
+ * Get CPU time used by the process so far, in seconds.
+ */
+double stats_cpu_time( void )
+{
+#ifdef _MSC_VER
+    return double( std::clock() ) / CLOCKS_PER_SEC ;
+#else
+    timespec now ;
+    clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &now ) ;
+    return now.tv_sec + now.tv_nsec * 1e-9 ;
+#endif
+}
+
+/**
+ * Process given command line option, returning true if it was the statistics option.
+ *
+ * Recognized options are --stats, --stats=text, --stats=json and --stats-file=name.
+ */
+bool stats_option( const char * const option )
+{
+    hope( option ) ;
+
+    if ( std::strncmp( option, "--stats", 7 ) != 0 ) {
+        return false ;
+    }
+
+    const char * const arg = option + 7 ;
+
+    if ( *arg == 0 || std::strcmp( arg, "=text" ) == 0 ) {
+        json_format = false ;
+    }
+    else if ( std::strcmp( arg, "=json" ) == 0 ) {
+        json_format = true ;
+    }
+    else if ( std::strncmp( arg, "-file=", 6 ) == 0 && arg[ 6 ] != 0 ) {
+        report_file_name = arg + 6 ;
+    }
+    else {
+        return false ;
+    }
+
+    // Start measuring the time now.
+
+    if ( ! stats_enabled ) {
+        stats_enabled = true ;
+        phase_wall_start = stats_wall_time() ;
+        phase_cpu_start = stats_cpu_time() ;
+    }
+
+    return true ;
+}
+
+/**
+ * Print description of the statistics options.
+ */
+void stats_usage( void )
+{
+    fprintf( stderr, "--stats[=json]      report processing statistics to standard error when done\n" ) ;
+    fprintf( stderr, "--stats-file=f      write the statistics report to given file instead\n" ) ;
+}
+
+/**
+ * Switch the currently measured phase to given one, returning the previous one.
+ */
+StatsPhase stats_switch_phase( const StatsPhase phase )
+{
+    hope( phase < STATS_PHASE_COUNT ) ;
+
+    const double wall_time = stats_wall_time() ;
+    const double cpu_time = stats_cpu_time() ;
+
+    phase_wall_times[ current_phase ] += wall_time - phase_wall_start ;
+    phase_cpu_times[ current_phase ] += cpu_time - phase_cpu_start ;
+
+    phase_wall_start = wall_time ;
+    phase_cpu_start = cpu_time ;
+
+    const StatsPhase previous_phase = current_phase ;
+    current_phase = phase ;
+    return previous_phase ;
+}
+
+/**
+ * Count block of given name.
+ */
+void stats_count_block( const bool input, const char * const name )
+{
+    hope( name ) ;
+
+    if ( stats_enabled ) {
+        ( input ? input_blocks : output_blocks )[ name ]++ ;
+    }
+}
+
+/**
+ * Count PZX block with given tag.
+ */
+void stats_count_block( const bool input, const uint tag )
+{
+    if ( stats_enabled ) {
+        const u32 name[ 2 ] = { native_endian< u32 >( tag ), 0 } ;
+        stats_count_block( input, reinterpret_cast< const char * >( name ) ) ;
+    }
+}
+
+/**
+ * Get allocation record of Buffers created at given place in the source.
+ */
+StatsBufferSite * stats_buffer_site( const char * const file, const uint line )
+{
+    hope( file ) ;
+
+    std::lock_guard< std::mutex > lock( buffer_sites_mutex ) ;
+
+    for ( StatsBufferSite * site = buffer_sites ; site ; site = site->next ) {
+        if ( site->line == line && std::strcmp( site->file, file ) == 0 ) {
+            return site ;
+        }
+    }
+
+    StatsBufferSite * const site = new StatsBufferSite() ;
+    site->file = file ;
+    site->line = line ;
+    site->next = buffer_sites ;
+    buffer_sites = site ;
+    return site ;
+}
+
+/**
+ * Print given block counts to given file.
+ */
+void stats_print_blocks( FILE * const file, const char * const name, const std::map< std::string, uquad > & blocks )
+{
+    typedef std::map< std::string, uquad >::const_iterator Iterator ;
+
+    if ( json_format ) {
+        fprintf( file, "  \"%s\": {", name ) ;
+        for ( Iterator it = blocks.begin() ; it != blocks.end() ; ++it ) {
+            fprintf( file, "%s\"%s\": %llu", ( it == blocks.begin() ? " " : ", " ), it->first.c_str(), it->second ) ;
+        }
+        fprintf( file, "%s},\n", ( blocks.empty() ? "" : " " ) ) ;
+        return ;
+    }
+
+    fprintf( file, "%-20s", name ) ;
+    for ( Iterator it = blocks.begin() ; it != blocks.end() ; ++it ) {
+        fprintf( file, " %s:%llu", it->first.c_str(), it->second ) ;
+    }
+    fprintf( file, "\n" ) ;
+}
+
+/**
+ * Print allocation records of all Buffer call sites to given file.
+ */
+void stats_print_sites( FILE * const file )
+{
+    std::vector< const StatsBufferSite * > sites ;
+    for ( const StatsBufferSite * site = buffer_sites ; site ; site = site->next ) {
+        sites.push_back( site ) ;
+    }
+    std::sort( sites.begin(), sites.end(), stats_compare_sites ) ;
+
+    if ( json_format ) {
+        fprintf( file, ",\n  \"buffer_sites\": [" ) ;
+        for ( uint i = 0 ; i < sites.size() ; i++ ) {
+            const StatsBufferSite & site = *sites[ i ] ;
+            fprintf( file,
+                "%s\n    { \"file\": \"%s\", \"line\": %u, \"instances\": %llu, \"growths\": %llu,"
+                " \"bytes_copied\": %llu, \"live_memory\": %llu, \"peak_memory\": %llu }",
+                ( i > 0 ? "," : "" ), site.file, site.line, site.instances.load(), site.growths.load(),
+                site.bytes_copied.load(), site.memory_used.load(), site.memory_peak.load()
+            ) ;
+        }
+        fprintf( file, "%s]", ( sites.empty() ? "" : "\n  " ) ) ;
+        return ;
+    }
+
+    for ( uint i = 0 ; i < sites.size() ; i++ ) {
+        const StatsBufferSite & site = *sites[ i ] ;
+        fprintf( file, "%-20s %s:%u instances %llu, growths %llu, copied %llu, live %llu, peak %llu\n",
+            "buffer_site", site.file, site.line, site.instances.load(), site.growths.load(),
+            site.bytes_copied.load(), site.memory_used.load(), site.memory_peak.load()
+        ) ;
+    }
+}
+
+/**
+ * Report the statistics collected, if they were requested.
+ */
+void stats_report( const char * const tool_name )
+{
+    hope( tool_name ) ;
+
+    if ( ! stats_enabled ) {
+        return ;
+    }
+
+    // Account for the time of the phase still in progress.
+
+    stats_switch_phase( STATS_OTHER ) ;
+
+    double wall_time = 0 ;
+    double cpu_time = 0 ;
+    for ( uint i = 0 ; i < STATS_PHASE_COUNT ; i++ ) {
+        wall_time += phase_wall_times[ i ] ;
+        cpu_time += phase_cpu_times[ i ] ;
+    }
+
+    // Open the report file.
+
+    FILE * const file = ( report_file_name ? fopen( report_file_name, "w" ) : stderr ) ;
+    if ( file == NULL ) {
+        warn( "unable to open statistics file %s", report_file_name ) ;
+        return ;
+    }
+
+    // Print the report.
+
+    if ( json_format ) {
+        fprintf( file, "{\n" ) ;
+        fprintf( file, "  \"schema\": \"pzxtools-stats-1\",\n" ) ;
+        fprintf( file, "  \"tool\": \"%s\",\n", tool_name ) ;
+        fprintf( file, "  \"wall_time\": %.6f,\n", wall_time ) ;
+        fprintf( file, "  \"cpu_time\": %.6f,\n", cpu_time ) ;
+        fprintf( file, "  \"phases\": {\n" ) ;
+        for ( uint i = 0 ; i < STATS_PHASE_COUNT ; i++ ) {
+            fprintf( file, "    \"%s\": { \"wall_time\": %.6f, \"cpu_time\": %.6f }%s\n",
+                phase_names[ i ], phase_wall_times[ i ], phase_cpu_times[ i ], ( i + 1 < STATS_PHASE_COUNT ? "," : "" )
+            ) ;
+        }
+        fprintf( file, "  },\n" ) ;
+        stats_print_blocks( file, "blocks_in", input_blocks ) ;
+        stats_print_blocks( file, "blocks_out", output_blocks ) ;
+        for ( uint i = 0 ; i < STATS_COUNTER_COUNT ; i++ ) {
+            fprintf( file, "  \"%s\": %llu,\n", counter_names[ i ], stats_counters[ i ].load() ) ;
+        }
+        fprintf( file, "  \"peak_buffer_memory\": %llu", stats_memory_peak.load() ) ;
+        if ( buffer_sites ) {
+            stats_print_sites( file ) ;
+        }
+        fprintf( file, "\n}\n" ) ;
+    }
+    else {
+        fprintf( file, "%-20s %s\n", "tool", tool_name ) ;
+        fprintf( file, "%-20s wall %.6f s, cpu %.6f s\n", "time", wall_time, cpu_time ) ;
+        for ( uint i = 0 ; i < STATS_PHASE_COUNT ; i++ ) {
+            fprintf( file, "%-20s wall %.6f s, cpu %.6f s\n", phase_names[ i ], phase_wall_times[ i ], phase_cpu_times[ i ] ) ;
+        }
+        stats_print_blocks( file, "blocks_in", input_blocks ) ;
+        stats_print_blocks( file, "blocks_out", output_blocks ) ;
+        for ( uint i = 0 ; i < STATS_COUNTER_COUNT ; i++ ) {
+            fprintf( file, "%-20s %llu\n", counter_names[ i ], stats_counters[ i ].load() ) ;
+        }
+        fprintf( file, "%-20s %llu\n", "peak_buffer_memory", stats_memory_peak.load() ) ;
+        stats_print_sites( file ) ;
+    }
+
+    if ( file != stderr && ( ferror( file ) != 0 || fclose( file ) != 0 ) ) {
+        warn( "error writing statistics file %s", report_file_name ) ;
+    }
+}
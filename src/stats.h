@@ -0,0 +1,173 @@
+// $Id$
+
+/**
+ * @file Processing statistics.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#ifndef STATS_H
+#define STATS_H 1
+
+#include <atomic>
+
+#ifndef TYPES_H
+#include "types.h"
+#endif
+
+/**
+ * Processing phases, whose time is measured separately.
+ */
+enum StatsPhase {
+    STATS_OTHER,
+    STATS_READ,
+    STATS_PARSE,
+    STATS_RENDER,
+    STATS_PACK,
+    STATS_WRITE,
+    STATS_PHASE_COUNT
+} ;
+
+/**
+ * Simple event counters.
+ */
+enum StatsCounter {
+    STATS_BYTES_IN,
+    STATS_BYTES_OUT,
+    STATS_PULSES_OUT,
+    STATS_PACK_ATTEMPTS,
+    STATS_PACK_SUCCESSES,
+    STATS_BUFFER_ALLOCATIONS,
+    STATS_BUFFER_POOL_HITS,
+    STATS_BUFFER_GROWTHS,
+    STATS_BUFFER_COPIED,
+    STATS_COUNTER_COUNT
+} ;
+
+/**
+ * Set when the statistics were requested.
+ */
+extern bool stats_enabled ;
+
+/**
+ * Values of the event counters.
+ *
+ * The counters and the memory statistics are updated by the worker threads
+ * as well, so they are atomic. The counters are updated only when the
+ * statistics were requested, so they cost nothing otherwise.
+ */
+extern std::atomic< uquad > stats_counters[ STATS_COUNTER_COUNT ] ;
+
+/**
+ * Amount of Buffer memory currently allocated, and its peak value.
+ */
+//@{
+extern std::atomic< uquad > stats_memory_used ;
+extern std::atomic< uquad > stats_memory_peak ;
+//@}
+
+/**
+ * Allocation record of all Buffers created at the same place in the source.
+ *
+ * Buffers record their call sites only when built with BUFFER_TRACKING defined.
+ */
+struct StatsBufferSite {
+    const char * file ;
+    uint line ;
+    std::atomic< uquad > instances ;
+    std::atomic< uquad > growths ;
+    std::atomic< uquad > bytes_copied ;
+    std::atomic< uquad > memory_used ;
+    std::atomic< uquad > memory_peak ;
+    StatsBufferSite * next ;
+} ;
+
+StatsBufferSite * stats_buffer_site( const char * const file, const uint line ) ;
+
+bool stats_option( const char * const option ) ;
+void stats_usage( void ) ;
+void stats_report( const char * const tool_name ) ;
+
+StatsPhase stats_switch_phase( const StatsPhase phase ) ;
+
+void stats_count_block( const bool input, const char * const name ) ;
+void stats_count_block( const bool input, const uint tag ) ;
+
+/**
+ * Start measuring time of given phase, returning the phase which was active so far.
+ */
+inline StatsPhase stats_enter( const StatsPhase phase )
+{
+    return ( stats_enabled ? stats_switch_phase( phase ) : STATS_OTHER ) ;
+}
+
+/**
+ * Resume measuring time of given phase, previously returned by stats_enter().
+ */
+inline void stats_leave( const StatsPhase phase )
+{
+    if ( stats_enabled ) {
+        stats_switch_phase( phase ) ;
+    }
+}
+
+/**
+ * Increase given counter by given amount.
+ */
+inline void stats_add( const StatsCounter counter, const uquad amount = 1 )
+{
+    if ( stats_enabled ) {
+        stats_counters[ counter ].fetch_add( amount, std::memory_order_relaxed ) ;
+    }
+}
+
+/**
+ * Increase given memory amount by given size, updating given peak value as well.
+ */
+inline void stats_grow( std::atomic< uquad > & used, std::atomic< uquad > & peak, const uquad size )
+{
+    const uquad new_used = used.fetch_add( size, std::memory_order_relaxed ) + size ;
+
+    uquad old_peak = peak.load( std::memory_order_relaxed ) ;
+    while ( new_used > old_peak && ! peak.compare_exchange_weak( old_peak, new_used, std::memory_order_relaxed ) ) {
+    }
+}
+
+/**
+ * Account for Buffer memory being allocated or released.
+ *
+ * The amount of bytes copied is nonzero when growing the buffer moved its content.
+ *
+ * The memory is accounted for even when the statistics were not requested,
+ * so buffers allocated before that, like the global ones, are included in
+ * the peak, and releasing them can't make the amount in use wrap around.
+ * It happens only when the buffers are allocated or grown, so the relaxed
+ * atomic updates cost next to nothing.
+ */
+//@{
+inline void stats_allocate( const uquad size, const uquad bytes_copied )
+{
+    stats_grow( stats_memory_used, stats_memory_peak, size ) ;
+    stats_add( STATS_BUFFER_COPIED, bytes_copied ) ;
+}
+
+inline void stats_release( const uquad size )
+{
+    stats_memory_used.fetch_sub( size, std::memory_order_relaxed ) ;
+}
+
+inline void stats_allocate( StatsBufferSite * const site, const uquad size, const uquad bytes_copied )
+{
+    stats_grow( site->memory_used, site->memory_peak, size ) ;
+    site->bytes_copied.fetch_add( bytes_copied, std::memory_order_relaxed ) ;
+}
+
+inline void stats_release( StatsBufferSite * const site, const uquad size )
+{
+    site->memory_used.fetch_sub( size, std::memory_order_relaxed ) ;
+}
+//@}
+
+#endif // STATS_H
@@ -0,0 +1,69 @@
+// $Id$
+
+/**
+ * @file TAP rendering.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "tap.h"
+#include "pzx.h"
+
+/**
+ * Render given TAP block data to the PZX output stream, using the standard ROM loader timings.
+ */
+void tap_render_block( const byte * const data, const uint size )
+{
+    hope( data ) ;
+    hope( size > 0 ) ;
+
+    const uint leader_count = ( ( *data < 128 ) ? LONG_LEADER_COUNT : SHORT_LEADER_COUNT ) ;
+
+    pzx_store( leader_count, LEADER_CYCLES ) ;
+    pzx_store( 1, SYNC_1_CYCLES ) ;
+    pzx_store( 1, SYNC_2_CYCLES ) ;
+
+    static word sequence_0[] = { BIT_0_CYCLES, BIT_0_CYCLES } ;
+    static word sequence_1[] = { BIT_1_CYCLES, BIT_1_CYCLES } ;
+
+    pzx_data( data, 8 * size, true, 2, 2, sequence_0, sequence_1, TAIL_CYCLES ) ;
+}
+
+/**
+ * Render given TAP file to the PZX output stream, separating the blocks with pauses of given duration.
+ */
+void tap_render( const byte * data, size_t size, const uint pause_duration )
+{
+    hope( data ) ;
+
+    while ( size > 0 ) {
+
+        if ( size < 2 ) {
+            fault( "error reading block header" ) ;
+        }
+
+        const uint block_size = data[ 0 ] + ( data[ 1 ] << 8 ) ;
+
+        data += 2 ;
+        size -= 2 ;
+
+        if ( block_size == 0 ) {
+            continue ;
+        }
+
+        if ( block_size > size ) {
+            fault( "error reading block data" ) ;
+        }
+
+        tap_render_block( data, block_size ) ;
+
+        if ( pause_duration > 0 ) {
+            pzx_pause( pause_duration, false ) ;
+        }
+
+        data += block_size ;
+        size -= block_size ;
+    }
+}
@@ -1,7 +1,7 @@
 // $Id: tap.h 302 2007-06-15 07:37:58Z patrik $
 
 /**
- * @file TAP constants.
+ * @file TAP constants and rendering.
  *
  * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
  *
@@ -11,6 +11,8 @@
 #ifndef TAP_H
 #define TAP_H 1
 
+#include <cstddef>
+
 #ifndef TYPES_H
 #include "types.h"
 #endif
@@ -27,4 +29,9 @@ const uint BIT_1_CYCLES         = 1710 ;
 const uint TAIL_CYCLES          = 945 ;
 const uint MILLISECOND_CYCLES   = 3500 ;
 
+// Interface.
+
+void tap_render_block( const byte * const data, const uint size ) ;
+void tap_render( const byte * data, size_t size, const uint pause_duration ) ;
+
 #endif // TAP_H
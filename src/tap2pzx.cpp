@@ -10,6 +10,7 @@
 
 #include "pzx.h"
 #include "tap.h"
+#include "stats.h"
 
 /**
  * Global options.
@@ -26,8 +27,7 @@ uint option_pause_duration ;
 /**
  * Convert given TAP file to PZX file.
  */
-extern "C"
-int main( int argc, char * * argv )
+int convert( int argc, char * * argv )
 {
     // Make sure the standard I/O is in binary mode.
 
@@ -47,6 +47,9 @@ int main( int argc, char * * argv )
             input_name = argv[ i ] ;
             continue ;
         }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
         switch ( argv[ i ][ 1 ] ) {
             case 'o': {
                 if ( output_name ) {
@@ -76,6 +79,7 @@ int main( int argc, char * * argv )
                 fprintf( stderr, "usage: tap2pzx [-p n] [-o output_file] [input_file]\n" ) ;
                 fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
                 fprintf( stderr, "-p n   separate TAP blocks with pause of given duration (in ms)\n" ) ;
+                stats_usage() ;
                 return EXIT_FAILURE ;
             }
         }
@@ -107,8 +111,12 @@ int main( int argc, char * * argv )
 
         // Read in the block header, stop if there is nothing more.
 
+        StatsPhase phase = stats_enter( STATS_READ ) ;
+
         const uint bytes_read = buffer.read( input_file, 2 ) ;
 
+        stats_leave( phase ) ;
+
         if ( bytes_read == 0 ) {
             break ;
         }
@@ -130,25 +138,19 @@ int main( int argc, char * * argv )
 
         // Read in the block data.
 
+        phase = stats_enter( STATS_READ ) ;
+
         if ( buffer.read( input_file, size ) != size ) {
             fail( "error reading block data" ) ;
         }
 
-        // Store the block to the PZX stream.
-
-        const byte * const data = buffer.get_data() ;
-        hope( data ) ;
+        stats_leave( phase ) ;
+        stats_add( STATS_BYTES_IN, 2 + size ) ;
+        stats_count_block( true, "TAP" ) ;
 
-        const uint leader_count = ( ( *data < 128 ) ? LONG_LEADER_COUNT : SHORT_LEADER_COUNT ) ;
-
-        pzx_store( leader_count, LEADER_CYCLES ) ;
-        pzx_store( 1, SYNC_1_CYCLES ) ;
-        pzx_store( 1, SYNC_2_CYCLES ) ;
-
-        static word sequence_0[] = { BIT_0_CYCLES, BIT_0_CYCLES } ;
-        static word sequence_1[] = { BIT_1_CYCLES, BIT_1_CYCLES } ;
+        // Store the block to the PZX stream.
 
-        pzx_data( data, 8 * size, true, 2, 2, sequence_0, sequence_1, TAIL_CYCLES ) ;
+        tap_render_block( buffer.get_data(), size ) ;
 
         // Separate the blocks with specified pause if necessary.
 
@@ -169,5 +171,23 @@ int main( int argc, char * * argv )
         fail( "error while closing the output file" ) ;
     }
 
+    // Report the statistics, if requested.
+
+    stats_report( "tap2pzx" ) ;
+
     return EXIT_SUCCESS ;
 }
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
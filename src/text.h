@@ -0,0 +1,299 @@
+// $Id$
+
+/**
+ * @file Fast text output.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#ifndef TEXT_H
+#define TEXT_H 1
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#ifndef DEBUG_H
+#include "debug.h"
+#endif
+
+#ifndef TYPES_H
+#include "types.h"
+#endif
+
+#ifndef STATS_H
+#include "stats.h"
+#endif
+
+/**
+ * Class for fast formatting of text output.
+ *
+ * The text is collected in a large buffer, which is written to the output
+ * file in bulk whenever it fills up. Numbers are formatted by hand, as the
+ * format string parsing of printf is way too slow for dumps with hundreds
+ * of millions of lines.
+ *
+ * When no file is given, the buffer simply keeps growing, so the collected
+ * text may be written out later by the caller.
+ *
+ * The destructor only releases the buffer, as writing could fail and throw.
+ * Any text still pending has to be written with an explicit flush() call.
+ */
+class TextOutput {
+
+    char * buffer ;
+    size_t buffer_size ;
+    size_t bytes_used ;
+    FILE * file ;
+
+public:
+
+    TextOutput( FILE * const output_file = NULL, const size_t size = 1024 * 1024 )
+        : buffer( NULL )
+        , buffer_size( 0 )
+        , bytes_used( 0 )
+        , file( output_file )
+    {
+        reallocate( size ) ;
+    }
+
+    ~TextOutput()
+    {
+        std::free( buffer ) ;
+    }
+
+private:
+
+    TextOutput( const TextOutput & ) ;
+    TextOutput & operator =( const TextOutput & ) ;
+
+private:
+
+    void reallocate( const size_t new_size )
+    {
+        buffer = static_cast< char * >( std::realloc( buffer, new_size ) ) ;
+
+        if ( buffer == NULL || new_size <= buffer_size ) {
+            fault( "out of memory" ) ;
+        }
+
+        buffer_size = new_size ;
+    }
+
+    /**
+     * Make sure there is room for at least given amount of characters.
+     */
+    inline char * reserve( const size_t size )
+    {
+        if ( size > buffer_size - bytes_used ) {
+            make_room( size ) ;
+        }
+        return buffer + bytes_used ;
+    }
+
+    void make_room( const size_t size )
+    {
+        flush() ;
+
+        size_t new_size = buffer_size ;
+
+        while ( size > new_size - bytes_used ) {
+            if ( new_size > size_t( -1 ) / 2 ) {
+                fault( "out of memory" ) ;
+            }
+            new_size *= 2 ;
+        }
+
+        if ( new_size > buffer_size ) {
+            reallocate( new_size ) ;
+        }
+    }
+
+public:
+
+    /**
+     * Write the collected text to the output file, if there is any.
+     */
+    void flush( void )
+    {
+        if ( file == NULL || bytes_used == 0 ) {
+            return ;
+        }
+
+        const StatsPhase phase = stats_enter( STATS_WRITE ) ;
+
+        if ( std::fwrite( buffer, 1, bytes_used, file ) != bytes_used ) {
+            fault( "error writing to file" ) ;
+        }
+
+        stats_leave( phase ) ;
+        stats_add( STATS_BYTES_OUT, bytes_used ) ;
+
+        bytes_used = 0 ;
+    }
+
+    inline void clear( void )
+    {
+        bytes_used = 0 ;
+    }
+
+public:
+
+    inline void put( const char c )
+    {
+        *reserve( 1 ) = c ;
+        bytes_used++ ;
+    }
+
+    inline void put( const char * const data, const size_t size )
+    {
+        hope( data || size == 0 ) ;
+
+        std::memcpy( reserve( size ), data, size ) ;
+        bytes_used += size ;
+    }
+
+    inline void put( const char * const string )
+    {
+        hope( string ) ;
+        put( string, std::strlen( string ) ) ;
+    }
+
+    /**
+     * Output given number in decimal.
+     */
+    inline void put_number( const uquad value )
+    {
+        char digits[ 20 ] ;
+        const uint length = format_number( digits, value ) ;
+        put( digits, length ) ;
+    }
+
+    /**
+     * Output given byte as two digit uppercase hexadecimal number.
+     */
+    inline void put_hex( const byte value )
+    {
+        std::memcpy( reserve( 2 ), get_hex_pairs() + 2 * value, 2 ) ;
+        bytes_used += 2 ;
+    }
+
+    /**
+     * Output given bytes as uppercase hexadecimal numbers.
+     */
+    inline void put_hex( const byte * const data, const size_t size )
+    {
+        hope( data || size == 0 ) ;
+
+        char * p = reserve( 2 * size ) ;
+
+        const char * const pairs = get_hex_pairs() ;
+
+        for ( size_t i = 0 ; i < size ; i++ ) {
+            std::memcpy( p, pairs + 2 * data[ i ], 2 ) ;
+            p += 2 ;
+        }
+
+        bytes_used += 2 * size ;
+    }
+
+public:
+
+    /**
+     * Format given number in decimal to given buffer, returning number of characters used.
+     *
+     * @note The buffer has to have room for at least 20 characters.
+     */
+    static uint format_number( char * const output, uquad value )
+    {
+        hope( output ) ;
+
+        // Convert the number from the end, two digits at a time.
+
+        char digits[ 20 ] ;
+        char * const end = digits + sizeof( digits ) ;
+        char * p = end ;
+
+        while ( value >= 100 ) {
+            const uint pair = uint( value % 100 ) ;
+            value /= 100 ;
+            p -= 2 ;
+            std::memcpy( p, get_decimal_pairs() + 2 * pair, 2 ) ;
+        }
+
+        if ( value >= 10 ) {
+            p -= 2 ;
+            std::memcpy( p, get_decimal_pairs() + 2 * value, 2 ) ;
+        }
+        else {
+            *--p = char( '0' + value ) ;
+        }
+
+        const uint length = uint( end - p ) ;
+        std::memcpy( output, p, length ) ;
+        return length ;
+    }
+
+public:
+
+    inline const char * get_data( void ) const
+    {
+        return buffer ;
+    }
+
+    inline size_t get_data_size( void ) const
+    {
+        return bytes_used ;
+    }
+
+private:
+
+    /**
+     * Get table of all two digit decimal numbers.
+     */
+    static const char * get_decimal_pairs( void )
+    {
+        static const char pairs[] =
+            "00010203040506070809"
+            "10111213141516171819"
+            "20212223242526272829"
+            "30313233343536373839"
+            "40414243444546474849"
+            "50515253545556575859"
+            "60616263646566676869"
+            "70717273747576777879"
+            "80818283848586878889"
+            "90919293949596979899" ;
+        return pairs ;
+    }
+
+    /**
+     * Get table of all two digit uppercase hexadecimal numbers.
+     */
+    static const char * get_hex_pairs( void )
+    {
+        static const char pairs[] =
+            "000102030405060708090A0B0C0D0E0F"
+            "101112131415161718191A1B1C1D1E1F"
+            "202122232425262728292A2B2C2D2E2F"
+            "303132333435363738393A3B3C3D3E3F"
+            "404142434445464748494A4B4C4D4E4F"
+            "505152535455565758595A5B5C5D5E5F"
+            "606162636465666768696A6B6C6D6E6F"
+            "707172737475767778797A7B7C7D7E7F"
+            "808182838485868788898A8B8C8D8E8F"
+            "909192939495969798999A9B9C9D9E9F"
+            "A0A1A2A3A4A5A6A7A8A9AAABACADAEAF"
+            "B0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+            "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECF"
+            "D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+            "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEF"
+            "F0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF" ;
+        return pairs ;
+    }
+
+} ;
+
+#endif // TEXT_H
@@ -9,6 +9,7 @@
  */
 
 #include "pzx.h"
+#include "stats.h"
 
 #include <cstring>
 #include <cerrno>
@@ -106,11 +107,26 @@ bool parse_number( uint & value, const char * & string, const char * const what,
     }
 
     // Convert the number.
+    //
+    // Short decimal numbers are by far the most common, so convert those
+    // directly, and leave anything else to strtoul.
+
+    const char * end = string ;
+    unsigned long result = 0 ;
+
+    if ( base == 10 ) {
+        while ( end < string + 9 && uint( *end - '0' ) < 10 ) {
+            result = 10 * result + uint( *end++ - '0' ) ;
+        }
+    }
 
     errno = 0 ;
-    char * end = NULL ;
 
-    const unsigned long result = strtoul( string, &end, base ) ;
+    if ( end == string || uint( *end - '0' ) < 10 ) {
+        char * strtoul_end = NULL ;
+        result = strtoul( string, &strtoul_end, base ) ;
+        end = strtoul_end ;
+    }
 
     // Deal with errors.
 
@@ -148,6 +164,37 @@ bool parse_bool( bool & value, const char * & string, const char * const what, c
     return true ;
 }
 
+/**
+ * Table of hexadecimal digit values, with invalid digits marked by 0xFF.
+ */
+class HexDigitTable {
+
+    byte values[ 256 ] ;
+
+public:
+
+    HexDigitTable()
+    {
+        std::memset( values, 0xFF, sizeof( values ) ) ;
+
+        for ( uint i = 0 ; i < 10 ; i++ ) {
+            values[ '0' + i ] = i ;
+        }
+        for ( uint i = 0 ; i < 6 ; i++ ) {
+            values[ 'a' + i ] = 10 + i ;
+            values[ 'A' + i ] = 10 + i ;
+        }
+    }
+
+    inline uint operator []( const char c ) const
+    {
+        return values[ byte( c ) ] ;
+    }
+
+} ;
+
+const HexDigitTable hex_digit_values ;
+
 /**
  * Parse hexadecimal digit.
  */
@@ -155,14 +202,10 @@ uint parse_hex_digit( const char * & string )
 {
     const char c = *string++ ;
 
-    if ( c >= '0' && c <= '9' ) {
-        return c - '0' ;
-    }
-    if ( c >= 'a' && c <= 'f' ) {
-        return 10 + c - 'a' ;
-    }
-    if ( c >= 'A' && c <= 'F' ) {
-        return 10 + c - 'A' ;
+    const uint value = hex_digit_values[ c ] ;
+
+    if ( value < 16 ) {
+        return value ;
     }
 
     string-- ;
@@ -296,10 +339,19 @@ void parse_data_line( const char * const string )
             }
         }
 
-        // Otherwise fetch the hex encoded value.
+        // Otherwise fetch the hex encoded value, taking the fast path for valid digits.
 
         else {
-            c = parse_hex_number( s ) ;
+            const uint high = hex_digit_values[ s[ 0 ] ] ;
+            const uint low = ( high < 16 ? hex_digit_values[ s[ 1 ] ] : 0xFF ) ;
+
+            if ( low < 16 ) {
+                c = ( high << 4 ) | low ;
+                s += 2 ;
+            }
+            else {
+                c = parse_hex_number( s ) ;
+            }
         }
 
         // Now store it to the buffer.
@@ -456,17 +508,23 @@ void process_line( uint & last_block_tag, const char * const line )
         return ;
     }
 
-    // Fetch the tag at line start.
+    // Fetch the tag at line start, padding short lines with zeros.
 
-    uint tag = *s++ ;
-    tag <<= 8 ;
-    tag |= *s++ ;
-    tag <<= 8 ;
-    tag |= *s++ ;
-    tag <<= 8 ;
-    tag |= *s ;
+    uint tag = 0 ;
+    uint tag_length = 0 ;
+
+    while ( tag_length < 4 && s[ tag_length ] != 0 ) {
+        tag = ( tag << 8 ) | byte( s[ tag_length++ ] ) ;
+    }
+
+    tag <<= 8 * ( 4 - tag_length ) ;
+
+    s += ( tag_length < 4 ? tag_length : 3 ) ;
 
     // Make it uppercase, and convert space to zero as well.
+    //
+    // Note that the tags are matched by a switch on the whole 32 bit value,
+    // which the compiler turns into a fast decision tree.
 
     tag &= ~0x20202020 ;
 
@@ -740,36 +798,31 @@ void process_line( uint & last_block_tag, const char * const line )
 }
 
 /**
- * Process PZX text dump lines.
+ * Process PZX text dump lines in given memory block.
+ *
+ * @note The block has to end with line terminator.
  */
-void process_lines( Buffer & buffer )
+void process_lines( uint & last_block_tag, char * data, char * const end )
 {
-    // Terminate the input buffer first so we can check line tags easily and
-    // make it easy to detect the end at the same time.
-
-    buffer.write< u8 >( '\n' ) ;
-    buffer.write< u32 >( 0 ) ;
-
-    // Skip byte order marker, if present. Some brain-dead editors save
-    // those even to UTF-8 encoded files, sigh.
+    hope( data ) ;
+    hope( end ) ;
+    hope( data < end ) ;
+    hope( end[ -1 ] == '\n' || end[ -1 ] == '\r' ) ;
 
-    char * data = buffer.get_typed_data< char >() ;
+    // Replace the final line terminator with zero, so we can check line
+    // tags easily and detect the end at the same time.
 
-    if ( ( data[ 0 ] == '\xEF' ) && ( data[ 1 ] == '\xBB' ) && ( data[ 2 ] == '\xBF' ) ) {
-        data += 3 ;
-    }
+    end[ -1 ] = 0 ;
 
     // Now process line by line.
 
-    uint last_block_tag = 0 ;
-
     for ( ; ; ) {
 
         // Skip empty lines and leading whitespace.
 
         data += std::strspn( data, " \t\r\n" ) ;
 
-        // Stop if we have hit the end of file.
+        // Stop if we have hit the end of the block.
 
         if ( *data == 0 ) {
             break ;
@@ -777,28 +830,110 @@ void process_lines( Buffer & buffer )
 
         // Remember current line.
 
-        const char * const line = data ;
+        char * const line = data ;
 
-        // Find end of current line and terminate it.
+        // Find end of current line and terminate it. Both terminators are
+        // looked for in a single pass, so each byte is scanned only once.
 
-        data += std::strcspn( data, "\r\n" ) ;
-        *data++ = 0 ;
+        char * line_end = data ;
+
+        while ( line_end < end - 1 && *line_end != '\n' && *line_end != '\r' ) {
+            line_end++ ;
+        }
+
+        *line_end = 0 ;
+
+        data = ( line_end < end - 1 ? line_end + 1 : line_end ) ;
 
         // Now process it.
 
         process_line( last_block_tag, line ) ;
     }
+}
+
+/**
+ * Process PZX text dump lines read from given file.
+ *
+ * The file is read in large chunks, so the memory use remains bounded
+ * regardless of the input size.
+ */
+void process_file( FILE * const input_file )
+{
+    hope( input_file ) ;
+
+    const uint chunk_size = 1024 * 1024 ;
+
+    Buffer buffer( 2 * chunk_size ) ;
+
+    uint last_block_tag = 0 ;
+    bool first_chunk = true ;
+
+    for ( ; ; ) {
+
+        // Read in next chunk.
+
+        stats_enter( STATS_READ ) ;
+
+        const uint bytes_read = buffer.append( input_file, chunk_size ) ;
+
+        if ( bytes_read == ~0u ) {
+            fail( "error reading input file" ) ;
+        }
+
+        stats_add( STATS_BYTES_IN, bytes_read ) ;
+        stats_enter( STATS_PARSE ) ;
+
+        const bool last_chunk = ( bytes_read < chunk_size ) ;
+
+        // Skip byte order marker, if present. Some brain-dead editors save
+        // those even to UTF-8 encoded files, sigh.
+
+        if ( first_chunk ) {
+            const byte * const data = buffer.get_data() ;
+            if ( buffer.get_data_size() >= 3 && data[ 0 ] == 0xEF && data[ 1 ] == 0xBB && data[ 2 ] == 0xBF ) {
+                buffer.discard( 3 ) ;
+            }
+            first_chunk = false ;
+        }
+
+        // Make sure the last line is terminated.
+
+        if ( last_chunk ) {
+            buffer.write< u8 >( '\n' ) ;
+        }
+
+        // Find the end of the last complete line.
+
+        char * const data = buffer.get_typed_data< char >() ;
+        char * end = data + buffer.get_data_size() ;
+
+        while ( end > data && end[ -1 ] != '\n' && end[ -1 ] != '\r' ) {
+            end-- ;
+        }
+
+        // Process all complete lines, and keep the rest for the next round.
+
+        if ( end > data ) {
+            process_lines( last_block_tag, data, end ) ;
+            buffer.discard( end - data ) ;
+        }
+
+        if ( last_chunk ) {
+            break ;
+        }
+    }
 
     // Finish the last block.
 
     finish_block( last_block_tag, 0 ) ;
+
+    stats_enter( STATS_OTHER ) ;
 }
 
 /**
  * Convert given PZX text dump to PZX file.
  */
-extern "C"
-int main( int argc, char * * argv )
+int convert( int argc, char * * argv )
 {
     // Make sure the standard output is in binary mode.
 
@@ -817,6 +952,9 @@ int main( int argc, char * * argv )
             input_name = argv[ i ] ;
             continue ;
         }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
         switch ( argv[ i ][ 1 ] ) {
             case 'o': {
                 if ( output_name ) {
@@ -838,28 +976,19 @@ int main( int argc, char * * argv )
                 fprintf( stderr, "usage: txt2pzx [-p] [-o output_file] [input_file]\n" ) ;
                 fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
                 fprintf( stderr, "-p     store pulse sequences exactly as specified\n" ) ;
+                stats_usage() ;
                 return EXIT_FAILURE ;
             }
         }
     }
 
-    // Now read in the input file.
-    //
-    // Note that we could do that line by line, but why bother.
+    // Open the input file.
 
     FILE * const input_file = ( input_name ? fopen( input_name, "r" ) : stdin ) ;
     if ( input_file == NULL ) {
         fail( "unable to open input file" ) ;
     }
 
-    Buffer buffer( 256 * 1024 ) ;
-
-    if ( ! buffer.read( input_file ) ) {
-        fail( "error reading input file" ) ;
-    }
-
-    fclose( input_file ) ;
-
     // Open the output file.
 
     FILE * const output_file = ( output_name ? fopen( output_name, "wb" ) : stdout ) ;
@@ -871,9 +1000,11 @@ int main( int argc, char * * argv )
 
     pzx_open( output_file ) ;
 
-    // Now process line by line and pass the output to the PZX stream.
+    // Now process the input line by line and pass the output to the PZX stream.
 
-    process_lines( buffer ) ;
+    process_file( input_file ) ;
+
+    fclose( input_file ) ;
 
     // Finally, close the PZX stream and make sure there were no errors.
 
@@ -883,5 +1014,23 @@ int main( int argc, char * * argv )
         fail( "error while closing the output file" ) ;
     }
 
+    // Report the statistics, if requested.
+
+    stats_report( "txt2pzx" ) ;
+
     return EXIT_SUCCESS ;
 }
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
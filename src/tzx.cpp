@@ -13,6 +13,7 @@
 #include "csw.h"
 #include "pzx.h"
 #include "endian.h"
+#include "stats.h"
 
 /**
  * Macros for fetching little endian data from current block.
@@ -1000,6 +1001,8 @@ void tzx_render( const byte * const tape_start, const byte * const tape_end )
 
     // Create table of block starts.
 
+    const StatsPhase phase = stats_enter( STATS_PARSE ) ;
+
     Buffer block_buffer ;
     uint block_count = 0 ;
 
@@ -1009,6 +1012,14 @@ void tzx_render( const byte * const tape_start, const byte * const tape_end )
 
         block_buffer.write( block ) ;
 
+        // Count the blocks by their ID, except the header itself.
+
+        if ( stats_enabled && block_count > 0 ) {
+            char name[ 8 ] ;
+            sprintf( name, "0x%02X", block[ 0 ] ) ;
+            stats_count_block( true, name ) ;
+        }
+
         block = tzx_get_next_block( block, tape_end ) ;
 
         if ( block == NULL ) {
@@ -1022,7 +1033,15 @@ void tzx_render( const byte * const tape_start, const byte * const tape_end )
 
     // Now process process each block in turn.
 
+    stats_enter( STATS_RENDER ) ;
+
     bool level = false ;
     uint block_index = 0 ;
     tzx_process_blocks( level, block_index, blocks, block_count, 0, 0 ) ;
+
+    // Release any CSW data cached while rendering this tape.
+
+    csw_clear_cache() ;
+
+    stats_leave( phase ) ;
 }
@@ -10,12 +10,12 @@
 
 #include "pzx.h"
 #include "tzx.h"
+#include "stats.h"
 
 /**
  * Convert given TZX file to PZX file.
  */
-extern "C"
-int main( int argc, char * * argv )
+int convert( int argc, char * * argv )
 {
     // Make sure the standard I/O is in binary mode.
 
@@ -35,6 +35,9 @@ int main( int argc, char * * argv )
             input_name = argv[ i ] ;
             continue ;
         }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
         switch ( argv[ i ][ 1 ] ) {
             case 'o': {
                 if ( output_name ) {
@@ -51,6 +54,7 @@ int main( int argc, char * * argv )
             case 'h': {
                 fprintf( stderr, "usage: tzx2pzx [-o output_file] [input_file]\n" ) ;
                 fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
+                stats_usage() ;
                 return EXIT_FAILURE ;
             }
         }
@@ -65,12 +69,17 @@ int main( int argc, char * * argv )
 
     Buffer buffer( 256 * 1024 ) ;
 
+    const StatsPhase phase = stats_enter( STATS_READ ) ;
+
     if ( ! buffer.read( input_file ) ) {
         fail( "error reading input file" ) ;
     }
 
     fclose( input_file ) ;
 
+    stats_leave( phase ) ;
+    stats_add( STATS_BYTES_IN, buffer.get_data_size() ) ;
+
     // Make sure it is the TZX file.
 
     if ( buffer.get_data_size() < 10 || std::memcmp( buffer.get_data(), "ZXTape!\x1a", 8 ) != 0 ) {
@@ -100,5 +109,23 @@ int main( int argc, char * * argv )
         fail( "error while closing the output file" ) ;
     }
 
+    // Report the statistics, if requested.
+
+    stats_report( "tzx2pzx" ) ;
+
     return EXIT_SUCCESS ;
 }
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
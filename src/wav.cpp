@@ -1,28 +1,68 @@
 // $Id: wav.cpp 336 2007-07-30 19:50:57Z patrik $
 
 /**
- * @file Rendering to WAV files.
+ * @file Rendering to WAV and CSW files.
  *
  * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
  *
  * This source code is released under the MIT license, see included license.txt.
  */
 
+#ifndef NO_ZLIB
+#include <zlib.h>
+#endif
+
 #include "wav.h"
+#include "pzx.h"
 #include "buffer.h"
+#include "stats.h"
 
 namespace {
 
 /**
- * File currently used for output, if any.
+ * File or buffer currently used for output, if any.
  */
+//@{
 FILE * output_file ;
+Buffer * output_buffer ;
+//@}
 
 /**
- * Buffer used for holding the complete samples.
+ * Buffer used for holding the complete samples, or the pending CSW data when creating CSW file.
  */
 Buffer sample_buffer ;
 
+/**
+ * CSW output state.
+ *
+ * Unlike the WAV samples, the CSW data are written out as soon as enough of
+ * them is collected, so the memory use remains constant. The samples are
+ * turned into runs of the same level, each of which becomes one CSW pulse.
+ */
+//@{
+bool csw_output ;
+bool csw_compress ;
+bool csw_header_written ;
+bool csw_level ;
+uint csw_sample_rate ;
+uquad csw_run ;
+uquad csw_pulse_count ;
+//@}
+
+/**
+ * Amount of CSW data collected before they are written out.
+ */
+const uint csw_chunk_size = 65536 ;
+
+#ifndef NO_ZLIB
+
+/**
+ * Compressor used for CSW Z-RLE output.
+ */
+z_stream csw_stream ;
+
+#endif
+
 /**
  * Numerator and denominator for converting specified durations to number of samples.
  */
@@ -39,6 +79,233 @@ uint sample_value ;
 uint sample_duration ;
 //@}
 
+/**
+ * Fetch value of specified type from given data block.
+ */
+template< typename Type >
+Type fetch( const byte * & data, uint & data_size )
+{
+    hope( data ) ;
+
+    if ( sizeof( Type ) > data_size ) {
+        fault( "incomplete block detected" ) ;
+    }
+
+    const Type value = little_endian( * reinterpret_cast< const Type * >( data ) ) ;
+
+    data += sizeof( Type ) ;
+    data_size -= sizeof( Type ) ;
+
+    return value ;
+}
+
+/**
+ * Skip given amount of bytes in given data block.
+ */
+void skip( const uint amount, const byte * & data, uint & data_size )
+{
+    hope( data ) ;
+
+    if ( amount > data_size ) {
+        fault( "incomplete block detected" ) ;
+    }
+
+    data += amount ;
+    data_size -= amount ;
+}
+
+/**
+ * Macros for convenient fetching of values from current block.
+ */
+//@{
+#define GET1()  fetch< u8 >( data, data_size )
+#define GET2()  fetch< u16 >( data, data_size )
+#define GET4()  fetch< u32 >( data, data_size )
+#define SKIP(n) skip( n, data, data_size )
+//@}
+
+/**
+ * Write given memory block of given size to output file.
+ */
+void wav_write( const void * const data, const size_t size )
+{
+    hope( data || size == 0 ) ;
+    hope( output_file || output_buffer ) ;
+
+    // Just write everything, freaking out in case of problems.
+
+    const StatsPhase phase = stats_enter( STATS_WRITE ) ;
+
+    if ( output_buffer ) {
+        output_buffer->write( data, size ) ;
+    }
+    else if ( std::fwrite( data, 1, size, output_file ) != size ) {
+        fault( "error writing to file" ) ;
+    }
+
+    stats_leave( phase ) ;
+    stats_add( STATS_BYTES_OUT, size ) ;
+}
+
+/**
+ * Write content of given buffer to output file.
+ *
+ * @note The buffer content is cleared afterwards, making it ready for reuse.
+ */
+void wav_write( Buffer & buffer )
+{
+    // Write entire buffer to the file.
+
+    wav_write( buffer.get_data(), buffer.get_data_size() ) ;
+
+    // Clear the buffer so it can be reused right away.
+
+    buffer.clear() ;
+}
+
+/**
+ * Write the CSW data collected so far to output file, compressing them if requested.
+ *
+ * When finishing, the compressed stream is terminated as well.
+ */
+void csw_write( const bool finish )
+{
+    if ( ! csw_compress ) {
+        wav_write( sample_buffer ) ;
+        return ;
+    }
+
+#ifndef NO_ZLIB
+
+    csw_stream.next_in = sample_buffer.get_data() ;
+    csw_stream.avail_in = uint( sample_buffer.get_data_size() ) ;
+
+    int result ;
+
+    do {
+        const uint chunk_size = 16384 ;
+        byte chunk[ chunk_size ] ;
+
+        csw_stream.next_out = chunk ;
+        csw_stream.avail_out = chunk_size ;
+
+        result = deflate( &csw_stream, finish ? Z_FINISH : Z_NO_FLUSH ) ;
+
+        if ( result == Z_STREAM_ERROR ) {
+            fault( "error while compressing CSW data" ) ;
+        }
+
+        wav_write( chunk, chunk_size - csw_stream.avail_out ) ;
+
+    } while ( csw_stream.avail_out == 0 || ( finish && result != Z_STREAM_END ) ) ;
+
+    sample_buffer.clear() ;
+
+#endif // NO_ZLIB
+
+}
+
+/**
+ * Append CSW pulse of given duration, expressed in samples.
+ */
+void csw_pulse( const uint sample_count )
+{
+    if ( sample_count > 0 && sample_count < 256 ) {
+        sample_buffer.write< u8 >( sample_count ) ;
+    }
+    else {
+        sample_buffer.write< u8 >( 0 ) ;
+        sample_buffer.write_little< u32 >( sample_count ) ;
+    }
+
+    csw_pulse_count++ ;
+
+    if ( sample_buffer.get_data_size() >= csw_chunk_size ) {
+        csw_write( false ) ;
+    }
+}
+
+/**
+ * Write the CSW 2.0 header, using given initial signal level.
+ *
+ * The pulse count is not known until the end, so it is filled in when the
+ * file is closed.
+ */
+void csw_write_header( const bool initial_level )
+{
+    Buffer header ;
+
+    header.write( "Compressed Square Wave\x1A", 23 ) ;
+    header.write< u8 >( 2 ) ;                           // major version.
+    header.write< u8 >( 0 ) ;                           // minor version.
+    header.write_little< u32 >( csw_sample_rate ) ;     // sample rate.
+    header.write_little< u32 >( 0 ) ;                   // pulse count.
+    header.write< u8 >( csw_compress ? 2 : 1 ) ;        // compression.
+    header.write< u8 >( initial_level ? 1 : 0 ) ;       // flags, initial level.
+    header.write< u8 >( 0 ) ;                           // header extension length.
+    header.write( "pzx2csw\0\0\0\0\0\0\0\0\0", 16 ) ;  // encoding application.
+
+    wav_write( header ) ;
+
+    csw_header_written = true ;
+}
+
+/**
+ * Output the current run of samples of the same level as CSW pulse.
+ */
+void csw_flush_run( void )
+{
+    // Runs which don't fit in 32 bits are split by pulses of zero duration.
+
+    const uint limit = 0xFFFFFFFF ;
+
+    while ( csw_run > limit ) {
+        csw_pulse( limit ) ;
+        csw_pulse( 0 ) ;
+        csw_run -= limit ;
+    }
+
+    csw_pulse( uint( csw_run ) ) ;
+
+    csw_run = 0 ;
+    csw_level = ! csw_level ;
+}
+
+/**
+ * Output given amount of samples of given value, scaled by sample_denominator.
+ */
+void output_samples( const uint value, uquad count )
+{
+    if ( ! csw_output ) {
+        const u8 sample = u8( 255ull * value / sample_denominator ) ;
+        while ( count-- > 0 ) {
+            sample_buffer.write< u8 >( sample ) ;
+        }
+        return ;
+    }
+
+    // CSW has only two levels, so the partial samples become whichever level prevails.
+
+    const bool level = ( 2ull * value >= sample_denominator ) ;
+
+    // The first samples determine the initial level stored in the header,
+    // so the tape starting with high level doesn't start with empty pulse.
+
+    if ( ! csw_header_written ) {
+        if ( count == 0 ) {
+            return ;
+        }
+        csw_write_header( level ) ;
+        csw_level = level ;
+    }
+
+    if ( level != csw_level ) {
+        csw_flush_run() ;
+    }
+
+    csw_run += count ;
+}
+
 }
 
 /**
@@ -46,6 +313,8 @@ uint sample_duration ;
  */
 void wav_out( const uint duration, const bool level )
 {
+    stats_add( STATS_PULSES_OUT ) ;
+
     // Compute how much time has passed and how much is there left
     // until the next sample starts.
 
@@ -65,7 +334,7 @@ void wav_out( const uint duration, const bool level )
 
         // Output the sample.
 
-        sample_buffer.write< u8 >( 255ull * sample_value / sample_denominator ) ;
+        output_samples( sample_value, 1 ) ;
 
         // Prepare for next sample.
 
@@ -76,8 +345,9 @@ void wav_out( const uint duration, const bool level )
     // In case the time passed covered several more samples as well,
     // generate them now.
 
-    for ( ; time_passed >= sample_denominator ; time_passed -= sample_denominator ) {
-        sample_buffer.write< u8 >( level ? 255 : 0 ) ;
+    if ( time_passed >= sample_denominator ) {
+        output_samples( level ? sample_denominator : 0, time_passed / sample_denominator ) ;
+        time_passed %= sample_denominator ;
     }
 
     // Finally, accumulate the remainer for the next sample.
@@ -96,7 +366,7 @@ void wav_flush( void )
     // Store the remaining sample.
 
     if ( sample_duration > 0 ) {
-        sample_buffer.write< u8 >( 255ull * sample_value / sample_denominator ) ;
+        output_samples( sample_value, 1 ) ;
 
         sample_value = 0 ;
         sample_duration = 0 ;
@@ -104,54 +374,153 @@ void wav_flush( void )
 }
 
 /**
- * Write given memory block of given size to output file.
+ * Use given file for subsequent WAV output.
  */
-void wav_write( const void * const data, const uint size )
+void wav_open( FILE * file, const uint numerator, const uint denominator )
 {
-    hope( data || size == 0 ) ;
-    hope( output_file ) ;
+    hope( file ) ;
+    hope( numerator > 0 ) ;
+    hope( denominator > 0 ) ;
 
-    // Just write everything, freaking out in case of problems.
+    // Remember the file.
+
+    hope( output_file == NULL && output_buffer == NULL ) ;
+    output_file = file ;
+
+    // Remember the timing factors.
+
+    sample_numerator = numerator ;
+    sample_denominator = denominator ;
+}
+
+/**
+ * Use given buffer for subsequent WAV output, appending the WAV file to its content.
+ */
+void wav_open( Buffer & buffer, const uint numerator, const uint denominator )
+{
+    hope( numerator > 0 ) ;
+    hope( denominator > 0 ) ;
+
+    // Remember the buffer.
+
+    hope( output_file == NULL && output_buffer == NULL ) ;
+    output_buffer = &buffer ;
+
+    // Remember the timing factors.
+
+    sample_numerator = numerator ;
+    sample_denominator = denominator ;
+}
 
-    if ( std::fwrite( data, 1, size, output_file ) != size ) {
-        fail( "error writing to file" ) ;
+/**
+ * Use given file for subsequent CSW output, using given sample rate and optionally Z-RLE compression.
+ */
+void wav_open_csw( FILE * file, const uint sample_rate, const bool compress )
+{
+    wav_open( file, sample_rate, 3500000 ) ;
+
+#ifdef NO_ZLIB
+    if ( compress ) {
+        fault( "zlib support is not compiled in, so CSW Z-RLE compression is not supported" ) ;
     }
+#else
+    if ( compress ) {
+        csw_stream.zalloc = Z_NULL ;
+        csw_stream.zfree = Z_NULL ;
+        csw_stream.opaque = NULL ;
+        if ( deflateInit( &csw_stream, Z_BEST_COMPRESSION ) != Z_OK ) {
+            fault( "error initializing zlib compressor for CSW data" ) ;
+        }
+    }
+#endif
+
+    // The header is written once the initial level is known, that is,
+    // when the first samples are output.
+
+    csw_output = true ;
+    csw_compress = compress ;
+    csw_header_written = false ;
+    csw_level = false ;
+    csw_sample_rate = sample_rate ;
+    csw_run = 0 ;
+    csw_pulse_count = 0 ;
 }
 
 /**
- * Write content of given buffer to output file.
+ * Stop using the WAV output file, discarding any pending output.
  *
- * @note The buffer content is cleared afterwards, making it ready for reuse.
+ * Used to recover after the conversion was abandoned due to a failure,
+ * so the WAV stream may be used again.
  */
-void wav_write( Buffer & buffer )
+void wav_abort( void )
 {
-    // Write entire buffer to the file.
+    sample_buffer.clear() ;
 
-    wav_write( buffer.get_data(), buffer.get_data_size() ) ;
+#ifndef NO_ZLIB
+    if ( csw_output && csw_compress ) {
+        deflateEnd( &csw_stream ) ;
+    }
+#endif
 
-    // Clear the buffer so it can be reused right away.
+    csw_output = false ;
 
-    buffer.clear() ;
+    sample_value = 0 ;
+    sample_duration = 0 ;
+
+    output_file = NULL ;
+    output_buffer = NULL ;
 }
 
 /**
- * Use given file for subsequent WAV output.
+ * Write everything to CSW output file and stop using that file.
  */
-void wav_open( FILE * file, const uint numerator, const uint denominator )
+void csw_close( void )
 {
-    hope( file ) ;
-    hope( numerator > 0 ) ;
-    hope( denominator > 0 ) ;
+    // Output the last pulse, unless it was already flushed.
 
-    // Remember the file.
+    if ( csw_run > 0 ) {
+        csw_flush_run() ;
+    }
 
-    hope( output_file == NULL ) ;
-    output_file = file ;
+    // Make sure the header is there even if there were no samples at all.
 
-    // Remember the timing factors.
+    if ( ! csw_header_written ) {
+        csw_write_header( false ) ;
+    }
 
-    sample_numerator = numerator ;
-    sample_denominator = denominator ;
+    // Write the remaining data.
+
+    csw_write( true ) ;
+
+#ifndef NO_ZLIB
+    if ( csw_compress ) {
+        deflateEnd( &csw_stream ) ;
+    }
+#endif
+
+    csw_output = false ;
+
+    // Now store the pulse count in the header. Note that it has only 32 bits.
+    // In case the file is not seekable, the pulse count remains zero, which
+    // the CSW readers usually don't mind.
+
+    byte count[ 4 ] ;
+    for ( uint i = 0 ; i < 4 ; i++ ) {
+        count[ i ] = byte( csw_pulse_count >> ( 8 * i ) ) ;
+    }
+
+    if ( fseek( output_file, 0x1D, SEEK_SET ) == 0 ) {
+        if ( std::fwrite( count, 1, sizeof( count ), output_file ) != sizeof( count ) || fseek( output_file, 0, SEEK_END ) != 0 ) {
+            fault( "error writing to file" ) ;
+        }
+    }
+    else {
+        warn( "output is not seekable, so the CSW pulse count is not stored" ) ;
+    }
+
+    // Forget about the file.
+
+    output_file = NULL ;
 }
 
 /**
@@ -159,27 +528,52 @@ void wav_open( FILE * file, const uint numerator, const uint denominator )
  */
 void wav_close( void )
 {
-    hope( output_file ) ;
+    hope( output_file || output_buffer ) ;
 
     // Flush everything to the sample buffer.
 
     wav_flush() ;
 
+    if ( csw_output ) {
+        csw_close() ;
+        return ;
+    }
+
     // Make sure the buffer size is even.
 
-    uint size = sample_buffer.get_data_size() ;
+    const uquad sample_count = sample_buffer.get_data_size() ;
+
+    uquad size = sample_count ;
     if ( ( size & 1 ) != 0 ) {
         sample_buffer.write< u8 >( 0 ) ;
         size++ ;
     }
 
-    // Prepare the header.
+    // Prepare the header. In case the sizes don't fit in 32 bits, use the
+    // RF64 format, which stores the 64 bit sizes in extra ds64 chunk.
+
+    const uquad riff_size = 4 + ( 8 + 16 ) + ( 8 + size ) ;
+    const bool use_rf64 = ( riff_size > 0xFFFFFFFF ) ;
 
     Buffer header ;
 
-    header.write< u32 >( WAV_HEADER ) ;
-    header.write_little< u32 >( 4 + ( 8 + 16 ) + ( 8 + size ) ) ;
-    header.write< u32 >( WAV_WAVE ) ;
+    if ( use_rf64 ) {
+        header.write< u32 >( WAV_HEADER64 ) ;
+        header.write_little< u32 >( 0xFFFFFFFF ) ;
+        header.write< u32 >( WAV_WAVE ) ;
+
+        header.write< u32 >( WAV_SIZES64 ) ;
+        header.write_little< u32 >( 28 ) ;
+        header.write_little< u64 >( riff_size + ( 8 + 28 ) ) ;  // RIFF size.
+        header.write_little< u64 >( size ) ;                   // data size.
+        header.write_little< u64 >( sample_count ) ;           // sample count.
+        header.write_little< u32 >( 0 ) ;                      // table length.
+    }
+    else {
+        header.write< u32 >( WAV_HEADER ) ;
+        header.write_little< u32 >( riff_size ) ;
+        header.write< u32 >( WAV_WAVE ) ;
+    }
 
     // Continue with format chunk.
 
@@ -195,7 +589,7 @@ void wav_close( void )
     // Append the header of the data chunk.
 
     header.write< u32 >( WAV_DATA ) ;
-    header.write_little< u32 >( size ) ;
+    header.write_little< u32 >( use_rf64 ? 0xFFFFFFFF : size ) ;
 
     // Now write both the header and the data to the output file.
 
@@ -205,4 +599,174 @@ void wav_close( void )
     // Forget about the file.
 
     output_file = NULL ;
+    output_buffer = NULL ;
+}
+
+/**
+ * Render bits from given byte using given (little endian) pulse sequences.
+ */
+void wav_render_bits(
+    bool & level,
+    uint bit_count,
+    uint bits,
+    const uint pulse_count_0,
+    const uint pulse_count_1,
+    const byte * const sequence_0,
+    const byte * const sequence_1
+)
+{
+    hope( sequence_0 || pulse_count_0 == 0 ) ;
+    hope( sequence_1 || pulse_count_1 == 0 ) ;
+
+    // Output all bits.
+
+    while ( bit_count-- > 0 ) {
+
+        // Choose the appropriate sequence for given bit.
+
+        const byte * sequence ;
+        uint count ;
+
+        if ( ( bits & 0x80 ) == 0 ) {
+            sequence = sequence_0 ;
+            count = pulse_count_0 ;
+        }
+        else {
+            sequence = sequence_1 ;
+            count = pulse_count_1 ;
+        }
+
+        // Use next bit next time.
+
+        bits <<= 1 ;
+
+        // Now output the appropriate amount of pulses.
+
+        while ( count-- > 0 ) {
+            uint duration = *sequence++ ;
+            duration += *sequence++ << 8 ;
+            wav_out( duration, level ) ;
+            level = ! level ;
+        }
+    }
+}
+
+/**
+ * Render given DATA block to WAV output.
+ */
+void wav_render_data_block( const byte * data, uint data_size )
+{
+    hope( data ) ;
+
+    // Fetch the numbers.
+
+    uint bit_count = GET4() ;
+    const uint tail_cycles = GET2() ;
+    const uint pulse_count_0 = GET1() ;
+    const uint pulse_count_1 = GET1() ;
+
+    // Extract initial pulse level.
+
+    bool level = ( ( bit_count >> 31 ) != 0 ) ;
+
+    bit_count &= 0x7FFFFFFF ;
+
+    // Fetch the sequences. Note that we keep them little endian here.
+
+    const byte * const sequence_0 = data ;
+    SKIP( 2 * pulse_count_0 ) ;
+
+    const byte * const sequence_1 = data ;
+    SKIP( 2 * pulse_count_1 ) ;
+
+    // Make sure the bit count matches the block size.
+
+    if ( data_size != ( ( bit_count + 7 ) / 8 ) ) {
+        fault( "bit count %u does not match the actual data size %u", bit_count, data_size ) ;
+    }
+
+    // Now output all the bits.
+
+    while ( bit_count > 8 ) {
+        wav_render_bits( level, 8, *data++, pulse_count_0, pulse_count_1, sequence_0, sequence_1 ) ;
+        bit_count -= 8 ;
+    }
+    wav_render_bits( level, bit_count, *data, pulse_count_0, pulse_count_1, sequence_0, sequence_1 ) ;
+
+    // And finally output the optional tail pulse.
+
+    wav_out( tail_cycles, level ) ;
+}
+
+/**
+ * Render given PULSE block to WAV output.
+ */
+void wav_render_pulse_block( const byte * data, uint data_size )
+{
+    hope( data ) ;
+
+    // Prepare initial level.
+
+    bool level = false ;
+
+    // Render all pulses in the block.
+
+    while ( data_size > 0 ) {
+
+        // Fetch the pulse repeat count and duration.
+
+        uint count = 1 ;
+        uint duration = GET2() ;
+        if ( duration > 0x8000 ) {
+            count = duration & 0x7FFF ;
+            duration = GET2() ;
+        }
+        if ( duration >= 0x8000 ) {
+            duration &= 0x7FFF ;
+            duration <<= 16 ;
+            duration |= GET2() ;
+        }
+
+        // Output the appropriate number of pulses.
+
+        while ( count-- > 0 ) {
+            wav_out( duration, level ) ;
+            level = ! level ;
+        }
+    }
+}
+
+/**
+ * Render given PZX block to WAV output.
+ */
+void wav_render_block( const uint tag, const byte * data, uint data_size )
+{
+    hope( data ) ;
+
+    switch ( tag ) {
+        case PZX_HEADER: {
+            const uint major = GET1() ;
+            const uint minor = GET1() ;
+            if ( major != PZX_MAJOR ) {
+                fault( "unsupported PZX major version %u.%u - stopping", major, minor ) ;
+            }
+            if ( minor > PZX_MINOR ) {
+                warn( "unsupported PZX minor version %u.%u - proceeding", major, minor ) ;
+            }
+            break ;
+        }
+        case PZX_PULSES: {
+            wav_render_pulse_block( data, data_size ) ;
+            break ;
+        }
+        case PZX_DATA: {
+            wav_render_data_block( data, data_size ) ;
+            break ;
+        }
+        case PZX_PAUSE: {
+            const uint duration = GET4() ;
+            wav_out( ( duration & 0x7FFFFFFF ), ( duration >> 31 ) ) ;
+            break ;
+        }
+    }
 }
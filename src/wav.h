@@ -1,7 +1,7 @@
 // $Id: wav.h 302 2007-06-15 07:37:58Z patrik $
 
 /**
- * @file WAV stuff.
+ * @file WAV and CSW output stuff.
  *
  * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
  *
@@ -17,18 +17,28 @@
 #include "endian.h"
 #endif
 
+#ifndef BUFFER_H
+#include "buffer.h"
+#endif
+
 // WAV chunk tags.
 
 const uint WAV_HEADER   = TAG_NAME('R','I','F','F') ;
+const uint WAV_HEADER64 = TAG_NAME('R','F','6','4') ;
 const uint WAV_WAVE     = TAG_NAME('W','A','V','E') ;
+const uint WAV_SIZES64  = TAG_NAME('d','s','6','4') ;
 const uint WAV_FORMAT   = TAG_NAME('f','m','t',' ') ;
 const uint WAV_DATA     = TAG_NAME('d','a','t','a') ;
 
 // Interface.
 
 void wav_open( FILE * file, const uint numerator, const uint denominator ) ;
+void wav_open( Buffer & buffer, const uint numerator, const uint denominator ) ;
+void wav_open_csw( FILE * file, const uint sample_rate, const bool compress ) ;
 void wav_close( void ) ;
+void wav_abort( void ) ;
 
 void wav_out( const uint duration, const bool level ) ;
+void wav_render_block( const uint tag, const byte * data, uint data_size ) ;
 
 #endif // WAV_H
@@ -0,0 +1,547 @@
+// $Id$
+
+/**
+ * @file WAV->PZX convertor.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "pzx.h"
+#include "wav.h"
+#include "stats.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Global options.
+ */
+namespace {
+
+/**
+ * Default hysteresis of the edge detector, in percent of the full scale.
+ */
+const uint default_hysteresis = 5 ;
+
+/**
+ * Channel of the input to use.
+ */
+uint option_channel = 0 ;
+
+/**
+ * Hysteresis of the edge detector, in percent of the full scale.
+ */
+uint option_hysteresis = default_hysteresis ;
+
+} ;
+
+/**
+ * Input state.
+ */
+namespace {
+
+/**
+ * Format of the input samples.
+ */
+//@{
+uint sample_rate ;
+uint channel_count ;
+uint sample_size ;
+uint frame_size ;
+//@}
+
+/**
+ * Number of frames processed at once, and buffers for their raw and
+ * converted samples.
+ */
+//@{
+const uint chunk_frames = 64 * 1024 ;
+byte frame_chunk[ chunk_frames * 4 * 8 ] ;
+s16 sample_chunk[ chunk_frames ] ;
+//@}
+
+/**
+ * Number of edges after which the pending pulses are flushed to the PZX
+ * output, so the memory use remains bounded regardless of the input size.
+ */
+const uint flush_edge_count = 1024 * 1024 ;
+
+/**
+ * State of the edge detector.
+ */
+//@{
+bool level ;
+uquad sample_index ;
+uquad edge_time ;
+uint edge_count ;
+//@}
+
+/**
+ * Read given amount of bytes from given file.
+ */
+bool read_bytes( FILE * const file, void * const data, const size_t size )
+{
+    return ( std::fread( data, 1, size, file ) == size ) ;
+}
+
+/**
+ * Skip given amount of bytes in given file, which may not be seekable.
+ */
+bool skip_bytes( FILE * const file, uquad size )
+{
+    while ( size > 0 ) {
+        const uint amount = uint( size < sizeof( frame_chunk ) ? size : sizeof( frame_chunk ) ) ;
+        if ( ! read_bytes( file, frame_chunk, amount ) ) {
+            return false ;
+        }
+        size -= amount ;
+    }
+    return true ;
+}
+
+/**
+ * Read the WAV header from given file, returning the size of the sample data which follow.
+ */
+uquad read_header( FILE * const file )
+{
+    u32 header[ 3 ] ;
+
+    if ( ! read_bytes( file, header, sizeof( header ) ) ) {
+        fail( "error reading input file" ) ;
+    }
+
+    if ( ( header[ 0 ] != WAV_HEADER && header[ 0 ] != WAV_HEADER64 ) || header[ 2 ] != WAV_WAVE ) {
+        fail( "input is not a WAV file" ) ;
+    }
+
+    uquad data_size64 = 0 ;
+    bool format_seen = false ;
+
+    for ( ; ; ) {
+
+        u32 chunk[ 2 ] ;
+
+        if ( ! read_bytes( file, chunk, sizeof( chunk ) ) ) {
+            fail( "no sample data found in input file" ) ;
+        }
+
+        const uint tag = chunk[ 0 ] ;
+        uquad size = little_endian( chunk[ 1 ] ) ;
+
+        // The data chunk is the last one we are interested in.
+
+        if ( tag == WAV_DATA ) {
+            if ( ! format_seen ) {
+                fail( "sample data precede the format chunk" ) ;
+            }
+            if ( size == 0xFFFFFFFF && header[ 0 ] == WAV_HEADER64 ) {
+                size = data_size64 ;
+            }
+            return size ;
+        }
+
+        // Remember the 64 bit data size of RF64 files.
+
+        if ( tag == WAV_SIZES64 && size >= 16 ) {
+            u64 sizes[ 2 ] ;
+            if ( ! read_bytes( file, sizes, sizeof( sizes ) ) ) {
+                fail( "error reading input file" ) ;
+            }
+            data_size64 = little_endian( sizes[ 1 ] ) ;
+            size -= sizeof( sizes ) ;
+        }
+
+        // Parse the format.
+
+        if ( tag == WAV_FORMAT && size >= 16 ) {
+
+            byte format[ 16 ] ;
+            if ( ! read_bytes( file, format, sizeof( format ) ) ) {
+                fail( "error reading input file" ) ;
+            }
+            size -= sizeof( format ) ;
+
+            const uint type = format[ 0 ] | format[ 1 ] << 8 ;
+            channel_count = format[ 2 ] | format[ 3 ] << 8 ;
+            sample_rate = format[ 4 ] | format[ 5 ] << 8 | format[ 6 ] << 16 | format[ 7 ] << 24 ;
+            frame_size = format[ 12 ] | format[ 13 ] << 8 ;
+            const uint bits = format[ 14 ] | format[ 15 ] << 8 ;
+
+            // Accept the extensible format as well, as it is often used
+            // for PCM samples with more than 16 bits, provided its subformat
+            // GUID says the samples are PCM, too.
+
+            if ( type == 0xFFFE ) {
+
+                static const byte pcm_guid[ 16 ] = {
+                    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+                    0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+                } ;
+
+                byte extension[ 24 ] ;
+                if ( size < sizeof( extension ) ) {
+                    fail( "invalid WAV format" ) ;
+                }
+                if ( ! read_bytes( file, extension, sizeof( extension ) ) ) {
+                    fail( "error reading input file" ) ;
+                }
+                size -= sizeof( extension ) ;
+
+                const uint extension_size = extension[ 0 ] | extension[ 1 ] << 8 ;
+
+                if ( extension_size < 22 ) {
+                    fail( "invalid WAV format" ) ;
+                }
+                if ( std::memcmp( extension + 8, pcm_guid, sizeof( pcm_guid ) ) != 0 ) {
+                    fail( "only PCM WAV files are supported" ) ;
+                }
+            }
+            else if ( type != 1 ) {
+                fail( "only PCM WAV files are supported" ) ;
+            }
+            if ( bits != 8 && bits != 16 && bits != 24 ) {
+                fail( "unsupported sample size of %u bits", bits ) ;
+            }
+            if ( channel_count == 0 || channel_count > 8 || sample_rate == 0 ) {
+                fail( "invalid WAV format" ) ;
+            }
+
+            sample_size = bits / 8 ;
+
+            if ( frame_size != channel_count * sample_size ) {
+                fail( "invalid WAV block alignment %u", frame_size ) ;
+            }
+            if ( option_channel >= channel_count ) {
+                fail( "channel %u is not present in the input", option_channel ) ;
+            }
+
+            format_seen = true ;
+        }
+
+        // Skip the rest of the chunk, including the padding byte.
+
+        if ( ! skip_bytes( file, size + ( size & 1 ) ) ) {
+            fail( "error reading input file" ) ;
+        }
+    }
+}
+
+/**
+ * Extract samples of selected channel from given amount of frames in the frame
+ * chunk to the sample chunk, converting them to signed 16 bit values.
+ */
+void convert_samples( const uint frame_count )
+{
+    const byte * data = frame_chunk + option_channel * sample_size ;
+
+    switch ( sample_size ) {
+        case 1: {
+            for ( uint i = 0 ; i < frame_count ; i++, data += frame_size ) {
+                sample_chunk[ i ] = s16( ( data[ 0 ] - 128 ) * 256 ) ;
+            }
+            break ;
+        }
+        case 2: {
+            for ( uint i = 0 ; i < frame_count ; i++, data += frame_size ) {
+                sample_chunk[ i ] = s16( data[ 0 ] | data[ 1 ] << 8 ) ;
+            }
+            break ;
+        }
+        case 3: {
+            for ( uint i = 0 ; i < frame_count ; i++, data += frame_size ) {
+                sample_chunk[ i ] = s16( data[ 1 ] | data[ 2 ] << 8 ) ;
+            }
+            break ;
+        }
+    }
+}
+
+/**
+ * Find the first of given samples which is below given threshold, returning
+ * the sample count in case there is none.
+ */
+uint find_below( const s16 * const samples, const uint count, const s16 threshold )
+{
+    uint i = 0 ;
+
+#ifdef __SSE2__
+
+    // Compare eight samples at once, stopping at the first group where any
+    // of the samples passes.
+
+    const __m128i limit = _mm_set1_epi16( threshold ) ;
+
+    for ( ; i + 8 <= count ; i += 8 ) {
+        const __m128i values = _mm_loadu_si128( reinterpret_cast< const __m128i * >( samples + i ) ) ;
+        const uint mask = _mm_movemask_epi8( _mm_cmplt_epi16( values, limit ) ) ;
+        if ( mask != 0 ) {
+            return i + __builtin_ctz( mask ) / 2 ;
+        }
+    }
+
+#endif
+
+    for ( ; i < count ; i++ ) {
+        if ( samples[ i ] < threshold ) {
+            break ;
+        }
+    }
+
+    return i ;
+}
+
+/**
+ * Find the first of given samples which is above given threshold, returning
+ * the sample count in case there is none.
+ */
+uint find_above( const s16 * const samples, const uint count, const s16 threshold )
+{
+    uint i = 0 ;
+
+#ifdef __SSE2__
+
+    const __m128i limit = _mm_set1_epi16( threshold ) ;
+
+    for ( ; i + 8 <= count ; i += 8 ) {
+        const __m128i values = _mm_loadu_si128( reinterpret_cast< const __m128i * >( samples + i ) ) ;
+        const uint mask = _mm_movemask_epi8( _mm_cmpgt_epi16( values, limit ) ) ;
+        if ( mask != 0 ) {
+            return i + __builtin_ctz( mask ) / 2 ;
+        }
+    }
+
+#endif
+
+    for ( ; i < count ; i++ ) {
+        if ( samples[ i ] > threshold ) {
+            break ;
+        }
+    }
+
+    return i ;
+}
+
+/**
+ * Output pulse of current level lasting until given sample.
+ *
+ * The time is computed exactly from the sample index, so the rounding
+ * errors don't accumulate.
+ */
+void output_pulse( const uquad end_sample )
+{
+    const uquad end_time = ( end_sample * 3500000 + sample_rate / 2 ) / sample_rate ;
+
+    uquad duration = end_time - edge_time ;
+    const uint limit = 0xFFFFFFFF ;
+
+    while ( duration > limit ) {
+        pzx_out( limit, level ) ;
+        duration -= limit ;
+    }
+
+    pzx_out( uint( duration ), level ) ;
+
+    edge_time = end_time ;
+}
+
+/**
+ * Detect the edges in given amount of samples in the sample chunk and output the corresponding pulses.
+ *
+ * A Schmitt trigger is used, so the level changes only when the signal
+ * passes the threshold on the opposite side of the center.
+ */
+void render_samples( const uint count )
+{
+    const s16 high = s16( 32767 * option_hysteresis / 100 ) ;
+    const s16 low = s16( -high ) ;
+
+    uint i = 0 ;
+
+    for ( ; ; ) {
+
+        i += ( level ? find_below( sample_chunk + i, count - i, low ) : find_above( sample_chunk + i, count - i, high ) ) ;
+
+        if ( i >= count ) {
+            break ;
+        }
+
+        output_pulse( sample_index + i ) ;
+
+        level = ! level ;
+
+        if ( ++edge_count >= flush_edge_count ) {
+            pzx_flush() ;
+            edge_count = 0 ;
+        }
+    }
+
+    sample_index += count ;
+}
+
+}
+
+/**
+ * Convert given WAV file to PZX file.
+ */
+int convert( int argc, char * * argv )
+{
+    // Make sure the standard I/O is in binary mode.
+
+    set_binary_mode( stdin ) ;
+    set_binary_mode( stdout ) ;
+
+    // Parse the command line.
+
+    const char * input_name = NULL ;
+    const char * output_name = NULL ;
+
+    for ( int i = 1 ; i < argc ; i++ ) {
+        if ( argv[ i ][ 0 ] != '-' ) {
+            if ( input_name ) {
+                fail( "multiple input file names specified" ) ;
+            }
+            input_name = argv[ i ] ;
+            continue ;
+        }
+        if ( stats_option( argv[ i ] ) ) {
+            continue ;
+        }
+        switch ( argv[ i ][ 1 ] ) {
+            case 'o': {
+                if ( output_name ) {
+                    fail( "multiple output file names specified" ) ;
+                }
+                output_name = argv[ ++i ] ;
+                break ;
+            }
+            case 'c': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing channel number" ) ;
+                }
+                option_channel = uint( atoi( arg ) ) ;
+                break ;
+            }
+            case 't': {
+                const char * const arg = argv[ ++i ] ;
+                if ( arg == NULL ) {
+                    fail( "missing hysteresis" ) ;
+                }
+                option_hysteresis = uint( atoi( arg ) ) ;
+                if ( option_hysteresis > 99 ) {
+                    fail( "hysteresis %u%% is out of range", option_hysteresis ) ;
+                }
+                break ;
+            }
+            default: {
+                fprintf( stderr, "error: invalid option %s\n", argv[ i ] ) ;
+
+                // Fall through.
+            }
+            case 'h': {
+                fprintf( stderr, "usage: wav2pzx [-c n] [-t n] [-o output_file] [input_file]\n" ) ;
+                fprintf( stderr, "-o f   write output to given file instead of standard output\n" ) ;
+                fprintf( stderr, "-c n   use given channel of multichannel input (default 0, the left one)\n" ) ;
+                fprintf( stderr, "-t n   use given hysteresis in percent of full scale (default %u)\n", default_hysteresis ) ;
+                stats_usage() ;
+                return EXIT_FAILURE ;
+            }
+        }
+    }
+
+    // Open the input file and read in the header.
+
+    FILE * const input_file = ( input_name ? fopen( input_name, "rb" ) : stdin ) ;
+    if ( input_file == NULL ) {
+        fail( "unable to open input file" ) ;
+    }
+
+    StatsPhase phase = stats_enter( STATS_READ ) ;
+
+    uquad data_left = read_header( input_file ) ;
+
+    stats_leave( phase ) ;
+
+    // Open the output file.
+
+    FILE * const output_file = ( output_name ? fopen( output_name, "wb" ) : stdout ) ;
+    if ( output_file == NULL ) {
+        fail( "unable to open output file" ) ;
+    }
+
+    // Bind the PZX stream to output file.
+
+    pzx_open( output_file ) ;
+
+    // Now process the samples chunk by chunk, so the memory use remains constant.
+
+    const uint chunk_size = chunk_frames * frame_size ;
+
+    while ( data_left > 0 ) {
+
+        phase = stats_enter( STATS_READ ) ;
+
+        const uint size = std::fread( frame_chunk, 1, uint( data_left < chunk_size ? data_left : chunk_size ), input_file ) ;
+
+        stats_leave( phase ) ;
+        stats_add( STATS_BYTES_IN, size ) ;
+
+        const uint frame_count = size / frame_size ;
+
+        if ( frame_count == 0 ) {
+            if ( ferror( input_file ) != 0 ) {
+                fail( "error reading input file" ) ;
+            }
+            if ( data_left != 0xFFFFFFFF ) {
+                warn( "premature end of sample data detected" ) ;
+            }
+            break ;
+        }
+
+        phase = stats_enter( STATS_PARSE ) ;
+
+        convert_samples( frame_count ) ;
+        render_samples( frame_count ) ;
+
+        stats_leave( phase ) ;
+
+        data_left -= size ;
+    }
+
+    fclose( input_file ) ;
+
+    // Output the last pulse up to the end of the samples.
+
+    output_pulse( sample_index ) ;
+
+    // Finally, close the PZX stream and make sure there were no errors.
+
+    pzx_close() ;
+
+    if ( ferror( output_file ) != 0 || fclose( output_file ) != 0 ) {
+        fail( "error while closing the output file" ) ;
+    }
+
+    // Report the statistics, if requested.
+
+    stats_report( "wav2pzx" ) ;
+
+    return EXIT_SUCCESS ;
+}
+
+/**
+ * Run the conversion, turning errors reported by the conversion core into failure exit code.
+ */
+extern "C"
+int main( int argc, char * * argv )
+{
+    try {
+        return convert( argc, argv ) ;
+    }
+    catch ( const Failure & ) {
+        return EXIT_FAILURE ;
+    }
+}
@@ -0,0 +1,332 @@
+/* $Id$ */
+
+/**
+ * @file Exercise the PZX library C interface for the regression test.
+ *
+ * Usage: libcheck tzx|tap|csw|blocks|pulses|play|stop input_file output_file [pause_ms]
+ *
+ * The tzx, tap and csw commands import given file, the blocks command copies
+ * given PZX file block by block using the block reader, the pulses command
+ * rebuilds given PZX file from the pulses returned by the pulse iterator,
+ * and the play command rebuilds it from the levels reported by the player,
+ * occasionally looking back to exercise the seeking as well, and checks
+ * the block positions it reports. The stop command checks that the player
+ * stops at each STOP block even when asked for the level far past it, and
+ * then copies given PZX file like the blocks command does.
+ *
+ * Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+ *
+ * This source code is released under the MIT license, see included license.txt.
+ */
+
+#include "../src/libpzx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Report given error and terminate.
+ */
+static void fail( const char * const message )
+{
+    fprintf( stderr, "error: %s\n", message ) ;
+    exit( EXIT_FAILURE ) ;
+}
+
+/**
+ * Read entire given file to newly allocated memory.
+ */
+static void * read_file( const char * const name, size_t * const size )
+{
+    FILE * const file = fopen( name, "rb" ) ;
+    if ( file == NULL ) {
+        fail( "unable to open input file" ) ;
+    }
+
+    fseek( file, 0, SEEK_END ) ;
+    *size = ftell( file ) ;
+    fseek( file, 0, SEEK_SET ) ;
+
+    void * const data = malloc( *size + 1 ) ;
+    if ( data == NULL || fread( data, 1, *size, file ) != *size ) {
+        fail( "error reading input file" ) ;
+    }
+
+    fclose( file ) ;
+    return data ;
+}
+
+/**
+ * Rebuild PZX file from pulses of given PZX file.
+ */
+static int copy_pulses( const void * const data, const size_t size, void * * const pzx_data, size_t * const pzx_size )
+{
+    libpzx_pulses * const pulses = libpzx_pulses_open( data, size ) ;
+    libpzx_writer * const writer = libpzx_writer_open() ;
+
+    if ( pulses == NULL || writer == NULL ) {
+        return LIBPZX_ERROR ;
+    }
+
+    uint32_t duration ;
+    int level ;
+    int result ;
+
+    while ( ( result = libpzx_pulses_next( pulses, &duration, &level ) ) != LIBPZX_END ) {
+        if ( result == LIBPZX_STOP ) {
+            result = libpzx_writer_stop( writer, level ) ;
+        }
+        else if ( result == LIBPZX_OK ) {
+            result = libpzx_writer_out( writer, duration, level ) ;
+        }
+        if ( result != LIBPZX_OK ) {
+            return LIBPZX_ERROR ;
+        }
+    }
+
+    libpzx_pulses_close( pulses ) ;
+
+    return libpzx_writer_close( writer, pzx_data, pzx_size ) ;
+}
+
+/**
+ * Rebuild PZX file from levels of given PZX file reported by the player.
+ */
+static int copy_levels( const void * const data, const size_t size, void * * const pzx_data, size_t * const pzx_size )
+{
+    libpzx_player * const player = libpzx_player_open( data, size, 1 ) ;
+    libpzx_writer * const writer = libpzx_writer_open() ;
+
+    if ( player == NULL || writer == NULL ) {
+        return LIBPZX_ERROR ;
+    }
+
+    uint64_t time = 0 ;
+    uint64_t edge_time ;
+    uint32_t step = 0 ;
+    int level ;
+    int result ;
+
+    while ( ( result = libpzx_player_level( player, time, &level, &edge_time ) ) != LIBPZX_END ) {
+        if ( result == LIBPZX_STOP ) {
+            result = libpzx_writer_stop( writer, 0 ) ;
+            libpzx_player_continue( player, time ) ;
+        }
+        else if ( result == LIBPZX_OK ) {
+            result = libpzx_writer_out( writer, edge_time - time, level ) ;
+            time = edge_time ;
+        }
+        if ( result != LIBPZX_OK ) {
+            return LIBPZX_ERROR ;
+        }
+        if ( ++step % 1024 == 0 && libpzx_player_level( player, time / 2, &level, NULL ) == LIBPZX_ERROR ) {
+            return LIBPZX_ERROR ;
+        }
+    }
+
+    if ( libpzx_player_length( player ) != time ) {
+        return LIBPZX_ERROR ;
+    }
+
+    uint64_t previous_position = 0 ;
+    uint64_t position ;
+    uint32_t index = 0 ;
+
+    while ( ( result = libpzx_player_block_position( player, index++, &position ) ) == LIBPZX_OK ) {
+        if ( position < previous_position || position > time ) {
+            return LIBPZX_ERROR ;
+        }
+        previous_position = position ;
+    }
+
+    if ( result != LIBPZX_END ) {
+        return LIBPZX_ERROR ;
+    }
+
+    libpzx_player_close( player ) ;
+
+    return libpzx_writer_close( writer, pzx_data, pzx_size ) ;
+}
+
+/**
+ * Check that the player of given PZX file started at the block preceding
+ * the STOP block with given index and position stops there when asked for
+ * the level at given time, possibly after asking for it at given earlier time.
+ */
+static int check_stop( const void * const data, const size_t size, const uint32_t index, const uint64_t position, const uint64_t time, const uint64_t earlier_time )
+{
+    libpzx_player * const player = libpzx_player_open( data, size, 1 ) ;
+
+    uint64_t start ;
+
+    if (
+        player == NULL ||
+        libpzx_player_block_position( player, index - 1, &start ) != LIBPZX_OK ||
+        libpzx_player_seek_block( player, index - 1, start ) != LIBPZX_OK
+    ) {
+        return LIBPZX_ERROR ;
+    }
+
+    int level ;
+    uint64_t edge_time ;
+    int result = LIBPZX_OK ;
+
+    if ( earlier_time >= start && earlier_time < position ) {
+        result = libpzx_player_level( player, earlier_time, &level, &edge_time ) ;
+    }
+
+    if ( result == LIBPZX_OK ) {
+        result = libpzx_player_level( player, time, &level, &edge_time ) ;
+    }
+
+    libpzx_player_close( player ) ;
+
+    return ( result == LIBPZX_STOP ? LIBPZX_OK : LIBPZX_ERROR ) ;
+}
+
+/**
+ * Check that the player of given PZX file stops at each of its STOP blocks.
+ */
+static int check_stops( const void * const data, const size_t size )
+{
+    libpzx_reader * const reader = libpzx_reader_open( data, size ) ;
+    libpzx_player * const player = libpzx_player_open( data, size, 1 ) ;
+
+    if ( reader == NULL || player == NULL ) {
+        return LIBPZX_ERROR ;
+    }
+
+    static const uint64_t offsets[] = { 0, 1, 10, 100000 } ;
+
+    libpzx_block block ;
+    uint32_t index = 0 ;
+    int result ;
+
+    while ( ( result = libpzx_reader_next( reader, &block ) ) == LIBPZX_OK ) {
+
+        uint64_t position ;
+
+        if ( libpzx_player_block_position( player, index, &position ) != LIBPZX_OK ) {
+            return LIBPZX_ERROR ;
+        }
+
+        // Note that the first block is always the header, never STOP block.
+
+        if ( block.tag == LIBPZX_BLOCK_STOP && index > 0 ) {
+            for ( size_t i = 0 ; i < sizeof( offsets ) / sizeof( offsets[ 0 ] ) ; i++ ) {
+                if (
+                    check_stop( data, size, index, position, position + offsets[ i ], position ) != LIBPZX_OK ||
+                    check_stop( data, size, index, position, position + offsets[ i ], position - 1 ) != LIBPZX_OK
+                ) {
+                    return LIBPZX_ERROR ;
+                }
+            }
+        }
+
+        index++ ;
+    }
+
+    libpzx_player_close( player ) ;
+    libpzx_reader_close( reader ) ;
+
+    return ( result == LIBPZX_END ? LIBPZX_OK : LIBPZX_ERROR ) ;
+}
+
+/**
+ * Copy given PZX file block by block to given output file.
+ */
+static int copy_blocks( const void * const data, const size_t size, FILE * const file )
+{
+    libpzx_reader * const reader = libpzx_reader_open( data, size ) ;
+
+    if ( reader == NULL ) {
+        return LIBPZX_ERROR ;
+    }
+
+    libpzx_block block ;
+    int result ;
+
+    while ( ( result = libpzx_reader_next( reader, &block ) ) == LIBPZX_OK ) {
+        const uint8_t header[ 8 ] = {
+            block.tag, block.tag >> 8, block.tag >> 16, block.tag >> 24,
+            block.size, block.size >> 8, block.size >> 16, block.size >> 24,
+        } ;
+        fwrite( header, 1, sizeof( header ), file ) ;
+        fwrite( block.data, 1, block.size, file ) ;
+    }
+
+    libpzx_reader_close( reader ) ;
+
+    return ( result == LIBPZX_END ? LIBPZX_OK : LIBPZX_ERROR ) ;
+}
+
+int main( int argc, char * * argv )
+{
+    if ( argc < 4 ) {
+        fail( "usage: libcheck tzx|tap|csw|blocks|pulses|play|stop input_file output_file [pause_ms]" ) ;
+    }
+
+    if ( libpzx_version() != LIBPZX_VERSION ) {
+        fail( "library version mismatch" ) ;
+    }
+
+    const char * const command = argv[ 1 ] ;
+
+    size_t size ;
+    void * const data = read_file( argv[ 2 ], &size ) ;
+
+    FILE * const file = fopen( argv[ 3 ], "wb" ) ;
+    if ( file == NULL ) {
+        fail( "unable to open output file" ) ;
+    }
+
+    void * pzx_data = NULL ;
+    size_t pzx_size = 0 ;
+    int result ;
+
+    if ( strcmp( command, "tzx" ) == 0 ) {
+        result = libpzx_import_tzx( data, size, &pzx_data, &pzx_size ) ;
+    }
+    else if ( strcmp( command, "tap" ) == 0 ) {
+        result = libpzx_import_tap( data, size, ( argc > 4 ? atoi( argv[ 4 ] ) : 0 ), &pzx_data, &pzx_size ) ;
+    }
+    else if ( strcmp( command, "csw" ) == 0 ) {
+        result = libpzx_import_csw( data, size, &pzx_data, &pzx_size ) ;
+    }
+    else if ( strcmp( command, "pulses" ) == 0 ) {
+        result = copy_pulses( data, size, &pzx_data, &pzx_size ) ;
+    }
+    else if ( strcmp( command, "play" ) == 0 ) {
+        result = copy_levels( data, size, &pzx_data, &pzx_size ) ;
+    }
+    else if ( strcmp( command, "blocks" ) == 0 ) {
+        result = copy_blocks( data, size, file ) ;
+    }
+    else if ( strcmp( command, "stop" ) == 0 ) {
+        result = check_stops( data, size ) ;
+        if ( result == LIBPZX_OK ) {
+            result = copy_blocks( data, size, file ) ;
+        }
+    }
+    else {
+        fail( "invalid command" ) ;
+    }
+
+    if ( result != LIBPZX_OK ) {
+        fail( libpzx_error() ) ;
+    }
+
+    if ( pzx_data ) {
+        fwrite( pzx_data, 1, pzx_size, file ) ;
+        libpzx_free( pzx_data ) ;
+    }
+
+    if ( ferror( file ) != 0 || fclose( file ) != 0 ) {
+        fail( "error while closing the output file" ) ;
+    }
+
+    free( data ) ;
+
+    return EXIT_SUCCESS ;
+}
@@ -0,0 +1,778 @@
+#! /usr/bin/perl -w
+#
+# Regression test of the PZX tools.
+#
+# Converts synthetic tape corpus through all the tools, compares the results
+# against the stored golden hashes and checks the pzx->txt->pzx round trips.
+# Use -u to regenerate the golden file after an intentional output change.
+# Use -r with directory of known good tools to locate the exact pulse where
+# the mismatching PZX files differ.
+# Also checks that pzxd daemon and libpzx library give the same results as the tools.
+#
+# Copyright (C) 2007 Patrik Rak (patrik@raxoft.cz)
+#
+# This source code is released under the MIT license, see included license.txt.
+
+use strict ;
+use Digest::MD5 qw( md5_hex ) ;
+use File::Copy ;
+use File::Spec ;
+use IO::Socket::UNIX ;
+use Getopt::Std ;
+
+my %opts ;
+getopts( 'ub:r:g:w:k:', \%opts ) or die "usage: regress.pl [-u] [-b bin_dir] [-r reference_bin_dir] [-g golden_file] [-w work_dir] [-k size]\n" ;
+
+my $update = $opts{u} ;
+my $bin_dir = File::Spec->rel2abs( $opts{b} || "../src" ) ;
+my $reference_dir = ( $opts{r} ? File::Spec->rel2abs( $opts{r} ) : undef ) ;
+my $golden_file = $opts{g} || "golden.txt" ;
+my $work_dir = $opts{w} || "work" ;
+my $size = $opts{k} || 4 ;
+my $tapegen = "../bench/tapegen" ;
+
+# Number of pulses hashed together when locating differences in PZX files.
+my $pulse_chunk = 4096 ;
+
+# Number of bytes hashed together when locating differences in other files.
+my $byte_chunk = 262144 ;
+
+# The conversions to run, as pairs of output file name and command to run.
+# Note that commands may use outputs of preceding commands as their inputs.
+my @conversions = (
+    [ "tzx.pzx",        "tzx2pzx -o %o corpus.tzx" ],
+    [ "tap.pzx",        "tap2pzx -o %o corpus.tap" ],
+    [ "tap500.pzx",     "tap2pzx -p 500 -o %o corpus.tap" ],
+    [ "csw1.pzx",       "csw2pzx -o %o corpus1.csw" ],
+    [ "csw2.pzx",       "csw2pzx -o %o corpus2.csw" ],
+    [ "txt.pzx",        "txt2pzx -o %o corpus_txt.txt" ],
+    [ "txtp.pzx",       "txt2pzx -p -o %o corpus_txt.txt" ],
+) ;
+
+my @pzx_files = qw( tzx.pzx tap.pzx csw1.pzx csw2.pzx txt.pzx corpus.pzx ) ;
+
+for my $name ( @pzx_files ) {
+    ( my $base = $name ) =~ s/\.pzx$// ;
+    push @conversions,
+        [ "$base.wav",      "pzx2wav -o %o $name" ],
+        [ "$base.22050.wav","pzx2wav -s 22050 -o %o $name" ],
+        [ "$base.wv.txt",   "pzx2wav -v -s 22050 -o %o $name" ],
+        [ "$base.txt",      "pzx2txt -o %o $name" ],
+        [ "$base.e.txt",    "pzx2txt -e -l -o %o $name" ],
+        [ "$base.p.txt",    "pzx2txt -p -e -o %o $name" ],
+        [ "$base.a.txt",    "pzx2txt -a -o %o $name" ],
+        [ "$base.x.txt",    "pzx2txt -x -o %o $name" ],
+        [ "$base.d.txt",    "pzx2txt -d -o %o $name" ],
+        [ "$base.j.txt",    "pzx2txt -j 3 -o %o $name" ],
+        [ "$base.je.txt",   "pzx2txt -e -l -j 3 -o %o $name" ],
+        [ "$base.jp.txt",   "pzx2txt -p -e -j 3 -o %o $name" ],
+        [ "$base.rt.pzx",   "txt2pzx -o %o $base.txt" ],
+        [ "$base.rtp.pzx",  "txt2pzx -p -o %o $base.p.txt" ],
+        [ "$base.opt.pzx",  "pzxopt -o %o $base.rtp.pzx" ] ;
+}
+
+# The WAV inputs, as generated by pzx2wav, are converted back as well. The same
+# signal resampled to other sample sizes and stereo has to give the same result.
+push @conversions,
+    [ "wav.pzx",        "wav2pzx -o %o corpus.wav" ],
+    [ "wav22050.pzx",   "wav2pzx -o %o corpus.22050.wav" ],
+    [ "wav16s.wav",     sub { widen_wav( "corpus.wav", 2, 2, @_ ) } ],
+    [ "wav24.wav",      sub { widen_wav( "corpus.wav", 3, 1, @_ ) } ],
+    [ "wav24x.wav",     sub { widen_wav( "corpus.wav", 3, -2, @_ ) } ],
+    [ "wav16s.pzx",     "wav2pzx -c 1 -o %o wav16s.wav" ],
+    [ "wav24.pzx",      "wav2pzx -t 5 -o %o wav24.wav" ],
+    [ "wav24x.pzx",     "wav2pzx -c 1 -t 5 -o %o wav24x.wav" ] ;
+
+# The CSW outputs are converted back, and the compressed ones have to give the same result.
+push @conversions,
+    [ "pzx.csw",        "pzx2csw -o %o corpus.pzx" ],
+    [ "pzxz.csw",       "pzx2csw -z -s 22050 -o %o corpus.pzx" ],
+    [ "pzx22050.csw",   "pzx2csw -s 22050 -o %o corpus.pzx" ],
+    [ "csw.pzx",        "csw2pzx -o %o pzx.csw" ],
+    [ "cswz.pzx",       "csw2pzx -o %o pzxz.csw" ],
+    [ "csw22050.pzx",   "csw2pzx -o %o pzx22050.csw" ],
+    [ "csw.j.pzx",      "csw2pzx -j 3 -o %o pzx.csw" ],
+    [ "cswz.j.pzx",     "csw2pzx -j 3 -o %o pzxz.csw" ],
+    [ "csw1.j.pzx",     "csw2pzx -j 5 -o %o corpus1.csw" ] ;
+
+# The standard blocks are extracted to TAP, which has to give the original TAP file.
+push @conversions,
+    [ "tap.tap",        "pzx2tap -o %o tap500.pzx" ],
+    [ "tzx.tap",        "pzx2tap -o %o tzx.pzx" ] ;
+
+# The blocks are cut to parts and joined back, which has to give the original PZX file.
+push @conversions,
+    [ "cut.s1.pzx",     "pzxcut -s 1 -o %o tzx.pzx" ],
+    [ "cut.s2.pzx",     "pzxcut -s 2- -o %o tzx.pzx" ],
+    [ "cut.w2.pzx",     "pzxcut -w 2 -o %o tzx.pzx" ],
+    [ "cut.b1.pzx",     "pzxcut -b 0-20 -o %o tzx.pzx" ],
+    [ "cut.b2.pzx",     "pzxcut -b 21- -o %o tzx.pzx" ],
+    [ "cat.s.pzx",      "pzxcat -o %o cut.s1.pzx cut.s2.pzx" ],
+    [ "cat.b.pzx",      "pzxcat -o %o cut.b1.pzx cut.b2.pzx" ],
+    [ "cat.pzx",        "pzxcat -o %o tzx.pzx corpus.pzx" ] ;
+
+# The consistent TAP file has to load correctly, even after the round trip through WAV.
+push @conversions,
+    [ "verify.tap",     sub { make_tap( [ "verify", 3000 ], [ "short", 1 ], @_ ) } ],
+    [ "verify.pzx",     "tap2pzx -p 1000 -o %o verify.tap" ],
+    [ "verify.wav",     "pzx2wav -s 22050 -o %o verify.pzx" ],
+    [ "verify.wav.pzx", "wav2pzx -o %o verify.wav" ],
+    [ "verify.txt",     "pzxverify -o %o verify.pzx" ],
+    [ "verify.wav.txt", "pzxverify -o %o verify.wav.pzx" ] ;
+
+# The leader and sync followed by no data at all has to be reported as failed load.
+push @conversions,
+    [ "empty.txt",      sub { make_pulses( [ 2168, 3000 ], [ 667, 1 ], [ 735, 1 ], [ 3500000, 1 ], @_ ) } ],
+    [ "empty.pzx",      "txt2pzx -o %o empty.txt" ] ;
+
+# The WAV rendering has to reproduce the pulses within about one sample even at unusual sample rates.
+push @conversions,
+    [ "corpus.wv11025.txt", "pzx2wav -v -s 11025 -o %o corpus.pzx" ],
+    [ "corpus.wv12345.txt", "pzx2wav -v -s 12345 -o %o corpus.pzx" ],
+    [ "corpus.wv96000.txt", "pzx2wav -v -s 96000 -o %o corpus.pzx" ] ;
+
+# The leader with a single lengthened pulse and longer sync pulse has to differ just in those pulses, even though the edges in between are shifted.
+push @conversions,
+    [ "leader.txt",     sub { make_pulses( [ 2168, 3000 ], [ 667, 1 ], [ 735, 1 ], @_ ) } ],
+    [ "leader1.txt",    sub { make_pulses( [ 2168, 1499 ], [ 2218, 1 ], [ 2168, 1500 ], [ 720, 1 ], [ 735, 1 ], @_ ) } ],
+    [ "leader.pzx",     "txt2pzx -o %o leader.txt" ],
+    [ "leader1.pzx",    "txt2pzx -o %o leader1.txt" ] ;
+
+# The player has to stop at the STOP block between the pulses, even when asked for the level far past it.
+push @conversions,
+    [ "stop.txt",       sub { make_text( "PULSES\nPULSE 1000 3\n\nSTOP 0\n\nPULSES\nPULSE 1000 3\n", @_ ) } ],
+    [ "stop.pzx",       "txt2pzx -o %o stop.txt" ] ;
+
+# The parallel dump of invalid file has to stop at the same place as the sequential one.
+push @conversions,
+    [ "invalid.pzx",    sub { make_invalid_pzx( "corpus.pzx", @_ ) } ] ;
+
+# The daemon requests to run, as triplets of request, input and the file which must match the result.
+# The input is either name of file to send inline, or @name of file to be read by the daemon.
+# The daemon may read only the files copied to its directory, not those outside of it nor the links to them.
+my @daemon_files = qw( corpus.tzx corpus1.csw ) ;
+my @daemon_requests = (
+    [ "tzx2pzx",            "\@corpus.tzx",     "tzx.pzx" ],
+    [ "tap2pzx -p 500",     "corpus.tap",       "tap500.pzx" ],
+    [ "csw2pzx",            "corpus2.csw",      "csw2.pzx" ],
+    [ "pzx2wav -s 22050",   "corpus.pzx",       "corpus.22050.wav" ],
+    [ "tzx2pzx",            "corpus.tap",       undef ],
+    [ "pzx2wav",            "corpus.tap",       undef ],
+    [ "csw2wav",            "\@corpus1.csw",    "csw1.wav" ],
+    [ "tzx2pzx",            "\@../corpus.tzx",  undef ],
+    [ "tzx2pzx",            "\@link.tzx",       undef ],
+) ;
+
+# The library checks to run, as triplets of output file name, libcheck arguments, and the file
+# which must have identical content, or identical pulses in case it is prefixed with ~.
+my @library_checks = (
+    [ "lib.tzx.pzx",        "tzx corpus.tzx",           "tzx.pzx" ],
+    [ "lib.tap.pzx",        "tap corpus.tap",           "tap.pzx" ],
+    [ "lib.tap500.pzx",     "tap corpus.tap 500",       "tap500.pzx" ],
+    [ "lib.csw1.pzx",       "csw corpus1.csw",          "csw1.pzx" ],
+    [ "lib.csw2.pzx",       "csw corpus2.csw",          "csw2.pzx" ],
+    [ "lib.blocks.pzx",     "blocks corpus.pzx",        "corpus.pzx" ],
+    [ "lib.pulses.pzx",     "pulses corpus.pzx",        "~corpus.pzx" ],
+    [ "lib.tzx.pulses.pzx", "pulses tzx.pzx",           "~tzx.pzx" ],
+    [ "lib.play.pzx",       "play corpus.pzx",          "~corpus.pzx" ],
+    [ "lib.tzx.play.pzx",   "play tzx.pzx",             "~tzx.pzx" ],
+    [ "lib.stop.pzx",       "stop stop.pzx",            "stop.pzx" ],
+    [ "lib.tzx.stop.pzx",   "stop tzx.pzx",             "tzx.pzx" ],
+) ;
+
+# The round trips which have to give identical files, and those which have to give identical pulses.
+my @identical_files = map { ( my $base = $_ ) =~ s/\.pzx$// ; [ $_, "$base.rt.pzx" ] } @pzx_files ;
+push @identical_files, map { ( my $base = $_ ) =~ s/\.pzx$// ; ( [ "$base.txt", "$base.j.txt" ], [ "$base.e.txt", "$base.je.txt" ], [ "$base.p.txt", "$base.jp.txt" ] ) } @pzx_files ;
+push @identical_files, [ "wav.pzx", "wav16s.pzx" ], [ "wav.pzx", "wav24.pzx" ], [ "wav.pzx", "wav24x.pzx" ], [ "csw22050.pzx", "cswz.pzx" ],
+    [ "csw.pzx", "csw.j.pzx" ], [ "cswz.pzx", "cswz.j.pzx" ], [ "csw1.pzx", "csw1.j.pzx" ],
+    [ "corpus.tap", "tap.tap" ], [ "tzx.pzx", "cat.s.pzx" ], [ "tzx.pzx", "cat.b.pzx" ] ;
+my @identical_pulses = map { ( my $base = $_ ) =~ s/\.pzx$// ; ( [ $_, "$base.rtp.pzx" ], [ $_, "$base.opt.pzx" ] ) } @pzx_files ;
+
+# The files which pzxdiff has to consider the same signal, in addition to the above, and those it has to tell apart.
+my @same_signals = ( @identical_pulses, [ "tzx.pzx", "corpus.tzx" ], [ "csw1.pzx", "corpus1.csw" ], [ "csw2.pzx", "corpus2.csw" ] ) ;
+my @different_signals = ( [ "corpus.pzx", "wav.pzx" ], [ "tzx.pzx", "tap.pzx" ], [ "tzx.pzx", "cut.b1.pzx" ] ) ;
+
+# The pairs of files which pzxdiff has to find given number of differences in, with given options.
+my @difference_counts = ( [ "leader.pzx", "leader1.pzx", "-a -t 49", 2 ], [ "leader.pzx", "leader1.pzx", "-a", 2 ] ) ;
+
+# The files which pzxverify has to load with given number of blocks loaded and failed.
+my @load_counts = ( [ "verify.pzx", 4, 0 ], [ "empty.pzx", 0, 1 ] ) ;
+
+# The invalid files which the parallel pzx2txt has to dump exactly like the sequential one, with given options.
+my @invalid_dumps = ( [ "invalid.pzx", "" ], [ "invalid.pzx", "-e -l" ], [ "invalid.pzx", "-p -e" ] ) ;
+
+# Read the entire file.
+sub read_file {
+    my( $name ) = @_ ;
+    open( my $file, "<", $name ) or die "unable to open $name: $!\n" ;
+    binmode( $file ) ;
+    local $/ ;
+    my $data = <$file> ;
+    close( $file ) ;
+    return defined( $data ) ? $data : "" ;
+}
+
+# Split given PZX file content into blocks, each being pair of tag and raw block data.
+sub pzx_blocks {
+    my( $data ) = @_ ;
+    my @blocks ;
+    my $offset = 0 ;
+    while ( $offset + 8 <= length( $data ) ) {
+        my( $tag, $size ) = unpack( "a4 V", substr( $data, $offset, 8 ) ) ;
+        push @blocks, [ $tag, substr( $data, $offset, 8 + $size ) ] ;
+        $offset += 8 + $size ;
+    }
+    push @blocks, [ "????", substr( $data, $offset ) ] if $offset < length( $data ) ;
+    return @blocks ;
+}
+
+# Get pulses of given PZX block, as list of pairs of level and duration.
+sub block_pulses {
+    my( $tag, $block ) = @_ ;
+    my $body = substr( $block, 8 ) ;
+    my @pulses ;
+
+    if ( $tag eq "PULS" ) {
+        my @words = unpack( "v*", $body ) ;
+        my $level = 0 ;
+        while ( @words ) {
+            my $count = 1 ;
+            my $duration = shift @words ;
+            if ( $duration > 0x8000 ) {
+                $count = $duration & 0x7FFF ;
+                $duration = shift @words ;
+            }
+            if ( $duration >= 0x8000 ) {
+                $duration = ( ( $duration & 0x7FFF ) << 16 ) | shift @words ;
+            }
+            for ( 1 .. $count ) {
+                push @pulses, [ $level, $duration ] ;
+                $level ^= 1 ;
+            }
+        }
+    }
+    elsif ( $tag eq "DATA" ) {
+        my( $bits, $tail, $count_0, $count_1 ) = unpack( "V v C C", $body ) ;
+        my $level = $bits >> 31 ;
+        $bits &= 0x7FFFFFFF ;
+        my @sequence_0 = unpack( "x8 v$count_0", $body ) ;
+        my @sequence_1 = unpack( "x8 x" . ( 2 * $count_0 ) . " v$count_1", $body ) ;
+        my $data = unpack( "B$bits", substr( $body, 8 + 2 * ( $count_0 + $count_1 ) ) ) ;
+        for my $bit ( split( //, $data ) ) {
+            for my $duration ( $bit ? @sequence_1 : @sequence_0 ) {
+                push @pulses, [ $level, $duration ] ;
+                $level ^= 1 ;
+            }
+        }
+        push @pulses, [ $level, $tail ] if $tail > 0 ;
+    }
+    elsif ( $tag eq "PAUS" ) {
+        my $duration = unpack( "V", $body ) ;
+        push @pulses, [ $duration >> 31, $duration & 0x7FFFFFFF ] ;
+    }
+
+    return @pulses ;
+}
+
+# Get the signal of given PZX file as list of triplets of level, duration and block index,
+# with adjacent pulses of the same level merged together, as that's what really matters.
+sub pzx_signal {
+    my( @blocks ) = @_ ;
+    my @signal ;
+    for my $index ( 0 .. $#blocks ) {
+        for my $pulse ( block_pulses( @{ $blocks[ $index ] } ) ) {
+            my( $level, $duration ) = @$pulse ;
+            next if $duration == 0 ;
+            if ( @signal && $signal[ -1 ][ 0 ] == $level ) {
+                $signal[ -1 ][ 1 ] += $duration ;
+            }
+            else {
+                push @signal, [ $level, $duration, $index ] ;
+            }
+        }
+    }
+    return @signal ;
+}
+
+# Format given pulses as text used for hashing.
+sub pulse_text {
+    return join( "", map { "$_->[0] $_->[1]\n" } @_ ) ;
+}
+
+# Compute the records describing given output file.
+sub describe_file {
+    my( $name ) = @_ ;
+    my $data = read_file( "$work_dir/$name" ) ;
+    my @records = ( [ "file", $name, length( $data ), md5_hex( $data ) ] ) ;
+
+    if ( $name =~ /\.pzx$/ ) {
+        my @blocks = pzx_blocks( $data ) ;
+        for my $index ( 0 .. $#blocks ) {
+            my( $tag, $block ) = @{ $blocks[ $index ] } ;
+            my @pulses = block_pulses( $tag, $block ) ;
+            push @records, [ "block", $name, $index, $tag, scalar( @pulses ), md5_hex( $block ) ] ;
+            for ( my $offset = 0 ; $offset < @pulses ; $offset += $pulse_chunk ) {
+                my $end = $offset + $pulse_chunk - 1 ;
+                $end = $#pulses if $end > $#pulses ;
+                push @records, [ "pulses", $name, $index, $offset, md5_hex( pulse_text( @pulses[ $offset .. $end ] ) ) ] ;
+            }
+        }
+    }
+    else {
+        for ( my $offset = 0 ; $offset < length( $data ) ; $offset += $byte_chunk ) {
+            push @records, [ "chunk", $name, $offset, md5_hex( substr( $data, $offset, $byte_chunk ) ) ] ;
+        }
+    }
+
+    return @records ;
+}
+
+# Explain where given file differs from its golden records.
+sub explain_difference {
+    my( $name, $expected, $actual ) = @_ ;
+
+    my( @expected_file ) = grep { $_->[ 0 ] eq "file" } @$expected ;
+    my( @actual_file ) = grep { $_->[ 0 ] eq "file" } @$actual ;
+    my $message = "$name: expected size $expected_file[0][2], got $actual_file[0][2]" ;
+
+    if ( $name =~ /\.pzx$/ ) {
+        my @expected_blocks = grep { $_->[ 0 ] eq "block" } @$expected ;
+        my @actual_blocks = grep { $_->[ 0 ] eq "block" } @$actual ;
+        for my $index ( 0 .. ( @expected_blocks > @actual_blocks ? $#expected_blocks : $#actual_blocks ) ) {
+            my $e = $expected_blocks[ $index ] ;
+            my $a = $actual_blocks[ $index ] ;
+            next if $e && $a && $e->[ 5 ] eq $a->[ 5 ] ;
+            return "$message; block $index missing" unless $a ;
+            return "$message; extra block $index ($a->[3])" unless $e ;
+            $message .= "; first difference in block $index (expected $e->[3] with $e->[4] pulses, got $a->[3] with $a->[4] pulses)" ;
+            my @expected_chunks = grep { $_->[ 0 ] eq "pulses" && $_->[ 2 ] == $index } @$expected ;
+            my @actual_chunks = grep { $_->[ 0 ] eq "pulses" && $_->[ 2 ] == $index } @$actual ;
+            for my $chunk ( 0 .. $#expected_chunks ) {
+                my $offset = $expected_chunks[ $chunk ][ 3 ] ;
+                if ( ! $actual_chunks[ $chunk ] || $actual_chunks[ $chunk ][ 4 ] ne $expected_chunks[ $chunk ][ 4 ] ) {
+                    return "$message, first differing pulse within pulses $offset-" . ( $offset + $pulse_chunk - 1 ) . " of the block" ;
+                }
+            }
+            return "$message, pulses match but block encoding differs" if @actual_chunks == @expected_chunks ;
+            return "$message, pulses differ after pulse " . ( $pulse_chunk * @expected_chunks ) ;
+        }
+        return $message ;
+    }
+
+    my @expected_chunks = grep { $_->[ 0 ] eq "chunk" } @$expected ;
+    my @actual_chunks = grep { $_->[ 0 ] eq "chunk" } @$actual ;
+    for my $chunk ( 0 .. $#expected_chunks ) {
+        my $offset = $expected_chunks[ $chunk ][ 2 ] ;
+        if ( ! $actual_chunks[ $chunk ] || $actual_chunks[ $chunk ][ 3 ] ne $expected_chunks[ $chunk ][ 3 ] ) {
+            return "$message; first difference within bytes $offset-" . ( $offset + $byte_chunk - 1 ) ;
+        }
+    }
+    return $message ;
+}
+
+# Compare pulses of two PZX files, returning description of the first difference, if any.
+sub compare_pulses {
+    my( $name_a, $name_b ) = @_ ;
+    my @blocks_a = pzx_blocks( read_file( $name_a ) ) ;
+    my @blocks_b = pzx_blocks( read_file( $name_b ) ) ;
+    my @signal_a = pzx_signal( @blocks_a ) ;
+    my @signal_b = pzx_signal( @blocks_b ) ;
+    my $count = ( @signal_a < @signal_b ? @signal_a : @signal_b ) ;
+    for my $i ( 0 .. $count - 1 ) {
+        my( $level_a, $duration_a, $block_a ) = @{ $signal_a[ $i ] } ;
+        my( $level_b, $duration_b, $block_b ) = @{ $signal_b[ $i ] } ;
+        next if $level_a == $level_b && $duration_a == $duration_b ;
+        return "pulse $i differs: $name_a block $block_a ($blocks_a[$block_a][0]) has $level_a/$duration_a, " .
+            "$name_b block $block_b ($blocks_b[$block_b][0]) has $level_b/$duration_b" ;
+    }
+    return "$name_a has " . scalar( @signal_a ) . " pulses, $name_b has " . scalar( @signal_b ) if @signal_a != @signal_b ;
+    return undef ;
+}
+
+# Compare two PZX files byte by byte, returning description of the first difference, if any.
+sub compare_files {
+    my( $name_a, $name_b ) = @_ ;
+    my @blocks_a = pzx_blocks( read_file( $name_a ) ) ;
+    my @blocks_b = pzx_blocks( read_file( $name_b ) ) ;
+    my $count = ( @blocks_a > @blocks_b ? @blocks_a : @blocks_b ) ;
+    for my $index ( 0 .. $count - 1 ) {
+        my $a = $blocks_a[ $index ] ;
+        my $b = $blocks_b[ $index ] ;
+        next if $a && $b && $a->[ 1 ] eq $b->[ 1 ] ;
+        return "block $index missing in $name_b" unless $b ;
+        return "extra block $index in $name_b" unless $a ;
+        my $message = "block $index differs ($a->[0] in $name_a, $b->[0] in $name_b)" ;
+        my @pulses_a = block_pulses( @$a ) ;
+        my @pulses_b = block_pulses( @$b ) ;
+        for my $i ( 0 .. ( @pulses_a < @pulses_b ? $#pulses_a : $#pulses_b ) ) {
+            next if "@{ $pulses_a[ $i ] }" eq "@{ $pulses_b[ $i ] }" ;
+            return "$message, first at pulse $i: @{ $pulses_a[ $i ] } vs @{ $pulses_b[ $i ] }" ;
+        }
+        return $message ;
+    }
+    return undef ;
+}
+
+# Convert given 8 bit mono WAV file in given directory to given sample size in bytes
+# and channel count, with the signal in the last channel and the other channels silent.
+# Negative channel count makes it use the extensible PCM format instead of the plain one.
+sub widen_wav {
+    my( $input, $sample_size, $channels, $dir, $output ) = @_ ;
+    my $extensible = ( $channels < 0 ) ;
+    $channels = abs( $channels ) ;
+    my $data = read_file( "$dir/$input" ) ;
+    my $offset = index( $data, "data" ) ;
+    die "no sample data in $input\n" if $offset < 0 ;
+    my $samples = substr( $data, $offset + 8, unpack( "V", substr( $data, $offset + 4, 4 ) ) ) ;
+    my $rate = unpack( "V", substr( $data, 24, 4 ) ) ;
+    my $frame_size = $sample_size * $channels ;
+    my $silence = "\0" x ( $frame_size - $sample_size ) ;
+    my $padding = "\0" x ( $sample_size - 1 ) ;
+    my $body = join( "", map { $silence . $padding . pack( "c", $_ - 128 ) } unpack( "C*", $samples ) ) ;
+    open( my $file, ">", "$dir/$output" ) or die "unable to create $output: $!\n" ;
+    binmode( $file ) ;
+    my $format = pack( "v v V V v v", $extensible ? 0xFFFE : 1, $channels, $rate, $rate * $frame_size, $frame_size, 8 * $sample_size ) ;
+    $format .= pack( "v v V H32", 22, 8 * $sample_size, 0, "0100000000001000800000aa00389b71" ) if $extensible ;
+    print $file pack( "a4 V a4 a4 V", "RIFF", 20 + length( $format ) + length( $body ), "WAVE", "fmt ", length( $format ) ),
+        $format, pack( "a4 V", "data", length( $body ) ), $body ;
+    close( $file ) or die "error writing $output: $!\n" ;
+}
+
+# Create TAP file with header and data block pair of given name and size for each given pair.
+sub make_tap {
+    my $output = pop ;
+    my $dir = pop ;
+    my $tap = "" ;
+    for my $pair ( @_ ) {
+        my( $name, $size ) = @$pair ;
+        for my $block ( [ 0x00, pack( "C A10 v v v", 3, $name, $size, 32768, 32768 ) ],
+            [ 0xFF, pack( "C*", map { ( $_ * 7 + 3 ) & 255 } 0 .. $size - 1 ) ] ) {
+            my $data = pack( "C", $block->[ 0 ] ) . $block->[ 1 ] ;
+            my $checksum = 0 ;
+            $checksum ^= $_ for unpack( "C*", $data ) ;
+            $data .= pack( "C", $checksum ) ;
+            $tap .= pack( "v", length( $data ) ) . $data ;
+        }
+    }
+    open( my $file, ">", "$dir/$output" ) or die "unable to create $output: $!\n" ;
+    binmode( $file ) ;
+    print $file $tap ;
+    close( $file ) or die "error writing $output: $!\n" ;
+}
+
+# Create PZX text file with PULSES block made of given pairs of pulse duration and count.
+sub make_pulses {
+    my $output = pop ;
+    my $dir = pop ;
+    my $text = "PULSES\n" ;
+    $text .= "PULSE $_->[ 0 ] $_->[ 1 ]\n" for @_ ;
+    make_text( $text, $dir, $output ) ;
+}
+
+# Create PZX text file with given blocks in given directory.
+sub make_text {
+    my( $text, $dir, $output ) = @_ ;
+    open( my $file, ">", "$dir/$output" ) or die "unable to create $output: $!\n" ;
+    print $file "PZX 1.0\n\n$text" ;
+    close( $file ) or die "error writing $output: $!\n" ;
+}
+
+# Create PZX file with large PULS block ending with incomplete pulse, followed by the blocks of given PZX file.
+sub make_invalid_pzx {
+    my( $input, $dir, $output ) = @_ ;
+    my $data = read_file( "$dir/$input" ) ;
+    my $pulses = pack( "v*", ( 1000 ) x 20000 ) . pack( "v", 0x8001 ) ;
+    open( my $file, ">", "$dir/$output" ) or die "unable to create $output: $!\n" ;
+    binmode( $file ) ;
+    my $header_size = 8 + unpack( "V", substr( $data, 4, 4 ) ) ;
+    print $file substr( $data, 0, $header_size ), pack( "a4 V", "PULS", length( $pulses ) ), $pulses, substr( $data, $header_size ) ;
+    close( $file ) or die "error writing $output: $!\n" ;
+}
+
+# Generate the corpus in given directory and run all conversions there using tools from given directory.
+sub run_conversions {
+    my( $dir, $bin ) = @_ ;
+
+    mkdir( $dir ) unless -d $dir ;
+
+    my %corpus = (
+        "corpus.tzx"    => "tzx",
+        "corpus.tap"    => "tap",
+        "corpus1.csw"   => "csw1",
+        "corpus2.csw"   => "csw2",
+        "corpus.pzx"    => "pzx",
+        "corpus_txt.txt" => "txt",
+    ) ;
+
+    for my $name ( sort keys %corpus ) {
+        system( "$tapegen -t $corpus{$name} -k $size -o $dir/$name" ) == 0 or die "unable to generate $name\n" ;
+    }
+
+    my @outputs = ( "corpus.pzx" ) ;
+
+    for my $conversion ( @conversions ) {
+        my( $output, $command ) = @$conversion ;
+        if ( ref( $command ) ) {
+            $command->( $dir, $output ) ;
+            next ;
+        }
+        $command =~ s/%o/$output/ ;
+        system( "cd $dir && $bin/$command 2>/dev/null" ) == 0 or die "command failed: $command\n" ;
+        push @outputs, $output ;
+    }
+
+    return @outputs ;
+}
+
+# Run all the conversions.
+
+my @outputs = run_conversions( $work_dir, $bin_dir ) ;
+
+# Describe the results.
+
+my %actual ;
+for my $name ( @outputs ) {
+    $actual{ $name } = [ describe_file( $name ) ] ;
+}
+
+# Either store the golden records, or compare them.
+
+if ( $update ) {
+    open( my $file, ">", $golden_file ) or die "unable to create $golden_file: $!\n" ;
+    print $file "# Golden output of regress.pl, regenerate with regress.pl -u after intentional output changes.\n" ;
+    print $file "# Generated from tapegen corpus of size $size.\n" ;
+    for my $name ( @outputs ) {
+        print $file join( " ", @$_ ), "\n" for @{ $actual{ $name } } ;
+    }
+    close( $file ) or die "error writing $golden_file: $!\n" ;
+    print "updated $golden_file with ", scalar( @outputs ), " files\n" ;
+    exit 0 ;
+}
+
+my %expected ;
+open( my $file, "<", $golden_file ) or die "unable to open $golden_file: $!\n" ;
+while ( <$file> ) {
+    next if /^#/ || /^\s*$/ ;
+    my @record = split ;
+    push @{ $expected{ $record[ 1 ] } }, \@record ;
+}
+close( $file ) ;
+
+my $failures = 0 ;
+my @mismatches ;
+
+for my $name ( @outputs ) {
+    my $expected = $expected{ $name } ;
+    if ( ! $expected ) {
+        print "FAIL $name: no golden record\n" ;
+        $failures++ ;
+        next ;
+    }
+    if ( $expected->[ 0 ][ 3 ] eq $actual{ $name }[ 0 ][ 3 ] ) {
+        print "ok   $name\n" ;
+        next ;
+    }
+    print "FAIL ", explain_difference( $name, $expected, $actual{ $name } ), "\n" ;
+    push @mismatches, $name ;
+    $failures++ ;
+}
+
+# Locate the exact differences using the reference tools, if available.
+
+if ( $reference_dir && @mismatches ) {
+    run_conversions( "$work_dir/reference", $reference_dir ) ;
+    for my $name ( grep { /\.pzx$/ } @mismatches ) {
+        my $difference = compare_files( "$work_dir/reference/$name", "$work_dir/$name" ) ;
+        print "     $name: ", ( defined( $difference ) ? $difference : "reference tools give the same output" ), "\n" ;
+    }
+}
+
+# Check the round trips.
+
+for my $pair ( @identical_files ) {
+    my $difference = compare_files( map { "$work_dir/$_" } @$pair ) ;
+    if ( defined( $difference ) ) {
+        print "FAIL round trip $pair->[0] -> $pair->[1]: $difference\n" ;
+        $failures++ ;
+    }
+    else {
+        print "ok   round trip $pair->[0] -> $pair->[1]\n" ;
+    }
+}
+
+for my $pair ( @identical_pulses ) {
+    my $difference = compare_pulses( map { "$work_dir/$_" } @$pair ) ;
+    if ( defined( $difference ) ) {
+        print "FAIL pulse round trip $pair->[0] -> $pair->[1]: $difference\n" ;
+        $failures++ ;
+    }
+    else {
+        print "ok   pulse round trip $pair->[0] -> $pair->[1]\n" ;
+    }
+}
+
+for my $pair ( @same_signals ) {
+    if ( system( "$bin_dir/pzxdiff -q " . join( " ", map { "$work_dir/$_" } @$pair ) . " 2>/dev/null" ) != 0 ) {
+        print "FAIL pzxdiff $pair->[0] $pair->[1]: signals differ\n" ;
+        $failures++ ;
+    }
+    else {
+        print "ok   pzxdiff $pair->[0] $pair->[1]\n" ;
+    }
+}
+
+for my $pair ( @different_signals ) {
+    if ( system( "$bin_dir/pzxdiff -q " . join( " ", map { "$work_dir/$_" } @$pair ) . " 2>/dev/null" ) == 0 ) {
+        print "FAIL pzxdiff $pair->[0] $pair->[1]: signals don't differ\n" ;
+        $failures++ ;
+    }
+    else {
+        print "ok   pzxdiff $pair->[0] $pair->[1] differ\n" ;
+    }
+}
+
+for my $check ( @difference_counts ) {
+    my( $name_a, $name_b, $options, $count ) = @$check ;
+    my $report = `$bin_dir/pzxdiff $options $work_dir/$name_a $work_dir/$name_b 2>/dev/null` ;
+    my( $found ) = ( $report =~ /^(\d+) differences? found$/m ) ;
+    $found = 0 unless defined( $found ) ;
+    if ( $found != $count ) {
+        print "FAIL pzxdiff $options $name_a $name_b: $found differences found instead of $count\n" ;
+        $failures++ ;
+    }
+    else {
+        print "ok   pzxdiff $options $name_a $name_b\n" ;
+    }
+}
+
+for my $check ( @load_counts ) {
+    my( $name, $loaded, $failed ) = @$check ;
+    my $report = `$bin_dir/pzxverify $work_dir/$name 2>/dev/null` ;
+    my( $found_loaded, $found_failed ) = ( $report =~ /^(\d+) blocks loaded, (\d+) failed/m ) ;
+    if ( ! defined( $found_loaded ) || $found_loaded != $loaded || $found_failed != $failed ) {
+        print "FAIL pzxverify $name: expected $loaded blocks loaded and $failed failed\n" ;
+        $failures++ ;
+    }
+    else {
+        print "ok   pzxverify $name\n" ;
+    }
+}
+
+for my $check ( @invalid_dumps ) {
+    my( $name, $options ) = @$check ;
+    my $command = join( " ", "pzx2txt", $options || (), "-j 2" ) ;
+    my $sequential = `$bin_dir/pzx2txt $options $work_dir/$name 2>&1` ;
+    my $sequential_status = $? ;
+    my $parallel = `$bin_dir/pzx2txt $options -j 2 $work_dir/$name 2>&1` ;
+    my $parallel_status = $? ;
+    if ( $sequential_status == 0 ) {
+        print "FAIL $command $name: invalid input was not detected\n" ;
+        $failures++ ;
+    }
+    elsif ( $parallel ne $sequential || $parallel_status != $sequential_status ) {
+        print "FAIL $command $name: output differs from sequential dump\n" ;
+        $failures++ ;
+    }
+    else {
+        print "ok   $command $name\n" ;
+    }
+}
+
+# Send given request with given input to daemon listening on given socket, returning the result, if any.
+sub daemon_request {
+    my( $socket_name, $request, $input ) = @_ ;
+
+    my $socket = IO::Socket::UNIX->new( Peer => $socket_name, Type => SOCK_STREAM ) or return ;
+    binmode( $socket ) ;
+
+    if ( $input =~ /^@(.*)/ ) {
+        print $socket "$request\nFILE ", File::Spec->rel2abs( "$work_dir/daemon/$1" ), "\n" ;
+    }
+    else {
+        my $data = read_file( "$work_dir/$input" ) ;
+        print $socket "$request\nDATA ", length( $data ), "\n", $data ;
+    }
+
+    local $/ ;
+    my $response = <$socket> ;
+    my( $head, $data ) = split( /\n\n/, $response, 2 ) ;
+    return ( $head =~ /^OK / ? $data : undef ) ;
+}
+
+# Check the daemon, unless it is not available.
+
+if ( -x "$bin_dir/pzxd" ) {
+    my $socket_name = File::Spec->rel2abs( "$work_dir/pzxd.socket" ) ;
+    my $daemon_dir = "$work_dir/daemon" ;
+    mkdir( $daemon_dir ) unless -d $daemon_dir ;
+    for my $name ( @daemon_files ) {
+        copy( "$work_dir/$name", "$daemon_dir/$name" ) or die "unable to copy $name: $!\n" ;
+    }
+    unlink( "$daemon_dir/link.tzx" ) ;
+    symlink( "../corpus.tzx", "$daemon_dir/link.tzx" ) or die "unable to create link.tzx: $!\n" ;
+    # Remove socket left behind by interrupted run, so the wait below waits for the new one.
+    unlink( $socket_name ) ;
+    my $pid = fork() ;
+    die "unable to start pzxd\n" unless defined( $pid ) ;
+    if ( $pid == 0 ) {
+        exec( "$bin_dir/pzxd", "-j", "2", "-d", $daemon_dir, $socket_name ) or exit 1 ;
+    }
+    for ( my $i = 0 ; $i < 100 && ! -S $socket_name ; $i++ ) {
+        select( undef, undef, undef, 0.1 ) ;
+    }
+
+    for my $request ( @daemon_requests ) {
+        my( $command, $input, $expected ) = @$request ;
+        my $result = daemon_request( $socket_name, $command, $input ) ;
+        my $description = "pzxd $command $input" ;
+        if ( ! defined( $expected ) ) {
+            print( defined( $result ) ? "FAIL $description: request should have failed\n" : "ok   $description fails\n" ) ;
+            $failures++ if defined( $result ) ;
+        }
+        elsif ( ! defined( $result ) || $result ne read_file( "$work_dir/$expected" ) ) {
+            print "FAIL $description: result differs from $expected\n" ;
+            $failures++ ;
+        }
+        else {
+            print "ok   $description\n" ;
+        }
+    }
+
+    kill( "TERM", $pid ) ;
+    waitpid( $pid, 0 ) ;
+}
+
+# Check the library, unless the test program is not available.
+
+if ( -x "libcheck" ) {
+    my $libcheck = File::Spec->rel2abs( "libcheck" ) ;
+    for my $check ( @library_checks ) {
+        my( $output, $arguments, $expected ) = @$check ;
+        ( my $command = $arguments ) =~ s/^(\S+) (\S+)/$1 $2 $output/ ;
+        my $description = "libpzx $arguments" ;
+        if ( system( "cd $work_dir && $libcheck $command 2>/dev/null" ) != 0 ) {
+            print "FAIL $description: command failed\n" ;
+            $failures++ ;
+            next ;
+        }
+        my $difference = ( $expected =~ s/^~// ?
+            compare_pulses( "$work_dir/$expected", "$work_dir/$output" ) :
+            compare_files( "$work_dir/$expected", "$work_dir/$output" )
+        ) ;
+        if ( defined( $difference ) ) {
+            print "FAIL $description: result differs from $expected: $difference\n" ;
+            $failures++ ;
+        }
+        else {
+            print "ok   $description\n" ;
+        }
+    }
+}
+
+if ( $failures > 0 ) {
+    print "$failures test(s) failed\n" ;
+    exit 1 ;
+}
+
+print "all tests passed\n" ;
+exit 0 ;